@@ -2,13 +2,29 @@
 #
 # URING_INCLUDE_DIR - Where to find liburing.h
 # URING_LIBRARIES - List of libraries when using uring.
+# URING_VERSION_STRING - Version of liburing, empty before 2.4 which
+#                        started to install liburing/io_uring_version.h
 # uring_FOUND - True if uring found.
 
 find_path(URING_INCLUDE_DIR liburing.h)
 find_library(URING_LIBRARIES uring)
 
+set(URING_VERSION_HEADER "${URING_INCLUDE_DIR}/liburing/io_uring_version.h")
+if(URING_INCLUDE_DIR AND EXISTS "${URING_VERSION_HEADER}")
+  foreach(ver "MAJOR" "MINOR")
+    file(STRINGS "${URING_VERSION_HEADER}" URING_VER_${ver}_LINE
+      REGEX "^#define[ \t]+IO_URING_VERSION_${ver}[ \t]+[0-9]+$")
+    string(REGEX REPLACE "^#define[ \t]+IO_URING_VERSION_${ver}[ \t]+([0-9]+)$"
+      "\\1" URING_VERSION_${ver} "${URING_VER_${ver}_LINE}")
+    unset(URING_VER_${ver}_LINE)
+  endforeach()
+  set(URING_VERSION_STRING "${URING_VERSION_MAJOR}.${URING_VERSION_MINOR}")
+endif()
+
 include(FindPackageHandleStandardArgs)
-find_package_handle_standard_args(uring DEFAULT_MSG URING_LIBRARIES URING_INCLUDE_DIR)
+find_package_handle_standard_args(uring
+  REQUIRED_VARS URING_LIBRARIES URING_INCLUDE_DIR
+  VERSION_VAR URING_VERSION_STRING)
 
 if(uring_FOUND AND NOT TARGET uring::uring)
   add_library(uring::uring UNKNOWN IMPORTED)
@@ -249,6 +249,30 @@ function TEST_rados_put_get_shec() {
     ceph osd erasure-code-profile rm $profile
 }
 
+function TEST_allow_ec_optimizations() {
+    local dir=$1
+    local poolname=pool-ec-optimizations
+
+    # not without overwrites
+    create_pool $poolname 12 12 erasure myprofile || return 1
+    ! ceph osd pool set $poolname allow_ec_optimizations true || return 1
+    ceph osd pool set $poolname allow_ec_overwrites true || return 1
+    ceph osd pool set $poolname allow_ec_optimizations true || return 1
+    ceph osd pool get $poolname allow_ec_optimizations | grep true || return 1
+    delete_pool $poolname
+
+    # nor with plugins which don't support them
+    ceph osd erasure-code-profile set profile-lrc-opt \
+        plugin=lrc \
+        k=4 m=2 l=3 \
+        crush-failure-domain=osd || return 1
+    create_pool $poolname 12 12 erasure profile-lrc-opt || return 1
+    ceph osd pool set $poolname allow_ec_overwrites true || return 1
+    ! ceph osd pool set $poolname allow_ec_optimizations true || return 1
+    delete_pool $poolname
+    ceph osd erasure-code-profile rm profile-lrc-opt
+}
+
 function TEST_alignment_constraints() {
     local payload=ABC
     echo "$payload" > $dir/ORIGINAL
@@ -0,0 +1,53 @@
+#!/usr/bin/env bash
+
+source $CEPH_ROOT/qa/standalone/ceph-helpers.sh
+
+function run() {
+    local dir=$1
+    shift
+
+    export CEPH_MON="127.0.0.1:7149" # git grep '\<7149\>' : there must be only one
+    export CEPH_ARGS
+    CEPH_ARGS+="--fsid=$(uuidgen) --auth-supported=none "
+    CEPH_ARGS+="--mon-host=$CEPH_MON "
+
+    local funcs=${@:-$(set | sed -n -e 's/^\(TEST_[0-9a-z_]*\) .*/\1/p')}
+    for func in $funcs ; do
+        setup $dir || return 1
+        $func $dir || return 1
+        teardown $dir || return 1
+    done
+}
+
+function TEST_steal_keeps_pg_order() {
+    local dir=$1
+
+    run_mon $dir a || return 1
+    run_mgr $dir x || return 1
+    run_osd $dir 0 --osd_op_num_shards=8 --osd_op_num_threads_per_shard=1 \
+        --osd_op_queue=wpq \
+        --osd_op_queue_steal_min_depth=1 \
+        --osd_op_queue_steal_interval_ms=1 || return 1
+
+    create_pool hot 1 1 || return 1
+    ceph osd pool set hot size 1 --yes-i-really-mean-it || return 1
+    wait_for_clean || return 1
+
+    # all ops go to the shard of the pool's only PG and the threads of
+    # the 7 other shards take them from there. ceph_test_rados aborts if
+    # the writes to an object complete out of order.
+    ceph_test_rados --pool hot --max-ops 4000 --objects 4 \
+        --max-in-flight 64 --size 65536 \
+        --min-stride-size 4096 --max-stride-size 16384 \
+        --op read 50 --op write 100 --op write_excl 20 || return 1
+
+    local stolen=$(ceph tell osd.0 perf dump osd | jq '.osd.op_wq_steal')
+    echo "op_wq_steal $stolen"
+    test "$stolen" -gt 0 || return 1
+}
+
+main osd-op-queue-steal "$@"
+
+# Local Variables:
+# compile-command: "cd ../.. ; make -j4 && test/osd/osd-op-queue-steal.sh"
+# End:
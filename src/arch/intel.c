@@ -23,6 +23,8 @@ int ceph_arch_intel_ssse3 = 0;
 int ceph_arch_intel_sse3 = 0;
 int ceph_arch_intel_sse2 = 0;
 int ceph_arch_intel_aesni = 0;
+int ceph_arch_intel_avx2 = 0;
+int ceph_arch_intel_avx512f = 0;
 
 #ifdef __x86_64__
 #include <cpuid.h>
@@ -36,6 +38,24 @@ int ceph_arch_intel_aesni = 0;
 #define CPUID_SSE3	(1)
 #define CPUID_SSE2	(1 << 26)
 #define CPUID_AESNI (1 << 25)
+#define CPUID_OSXSAVE	(1 << 27)
+#define CPUID_AVX	(1 << 28)
+
+/* http://en.wikipedia.org/wiki/CPUID#EAX.3D7.2C_ECX.3D0:_Extended_Features */
+
+#define CPUID7_AVX2	(1 << 5)
+#define CPUID7_AVX512F	(1 << 16)
+
+/* XCR0 state the OS must preserve: SSE|AVX, plus opmask|ZMM for AVX-512 */
+#define XCR0_AVX	0x06
+#define XCR0_AVX512	0xe6
+
+static unsigned long long ceph_arch_intel_xgetbv(void)
+{
+	unsigned int eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+}
 
 int ceph_arch_intel_probe(void)
 {
@@ -65,6 +85,20 @@ int ceph_arch_intel_probe(void)
   if ((ecx & CPUID_AESNI) != 0) {
           ceph_arch_intel_aesni = 1;
   }
+	/* AVX state must be enabled by the OS before the extended features are usable */
+	if ((ecx & CPUID_OSXSAVE) != 0 && (ecx & CPUID_AVX) != 0) {
+		unsigned long long xcr0 = ceph_arch_intel_xgetbv();
+		if ((xcr0 & XCR0_AVX) == XCR0_AVX &&
+		    __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+			if ((ebx & CPUID7_AVX2) != 0) {
+				ceph_arch_intel_avx2 = 1;
+			}
+			if ((xcr0 & XCR0_AVX512) == XCR0_AVX512 &&
+			    (ebx & CPUID7_AVX512F) != 0) {
+				ceph_arch_intel_avx512f = 1;
+			}
+		}
+	}
 
 	return 0;
 }
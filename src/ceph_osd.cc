@@ -598,6 +598,11 @@ flushjournal_out:
   ms_cluster->set_policy(entity_name_t::TYPE_CLIENT,
 			 Messenger::Policy::stateless_server(0));
 
+  // the OSD, MonClient and MgrClient dispatchers serialize on their own
+  // locks, so their messages may come from several dispatch threads
+  ms_public->set_concurrent_dispatch();
+  ms_cluster->set_concurrent_dispatch();
+
   ms_hb_front_client->set_policy(entity_name_t::TYPE_OSD,
 			  Messenger::Policy::lossy_client(0));
   ms_hb_back_client->set_policy(entity_name_t::TYPE_OSD,
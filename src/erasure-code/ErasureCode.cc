@@ -17,6 +17,7 @@
 
 #include <algorithm>
 #include <cerrno>
+#include <cstring>
 
 #include "ErasureCode.h"
 
@@ -40,6 +41,7 @@ using ceph::bufferlist;
 
 namespace ceph {
 const unsigned ErasureCode::SIMD_ALIGN = 32;
+const unsigned ErasureCode::ENCODE_CACHE_BLOCK = 256 * 1024;
 
 int ErasureCode::init(
   ErasureCodeProfile &profile,
@@ -179,6 +181,10 @@ int ErasureCode::encode_prepare(const bufferlist &raw,
   for (unsigned int i = 0; i < k - padded_chunks; i++) {
     bufferlist &chunk = encoded[chunk_index(i)];
     chunk.substr_of(prepared, i * blocksize, blocksize);
+    if (!chunk.is_contiguous() ||
+	!chunk.is_aligned_size_and_memory(blocksize, SIMD_ALIGN)) {
+      count_copied(blocksize);
+    }
     chunk.rebuild_aligned_size_and_memory(blocksize, SIMD_ALIGN);
     ceph_assert(chunk.is_contiguous());
   }
@@ -187,6 +193,7 @@ int ErasureCode::encode_prepare(const bufferlist &raw,
     bufferptr buf(buffer::create_aligned(blocksize, SIMD_ALIGN));
 
     raw.begin((k - padded_chunks) * blocksize).copy(remainder, buf.c_str());
+    count_copied(remainder);
     buf.zero(remainder, blocksize - remainder);
     encoded[chunk_index(k-padded_chunks)].push_back(std::move(buf));
 
@@ -204,6 +211,119 @@ int ErasureCode::encode_prepare(const bufferlist &raw,
   return 0;
 }
 
+bool ErasureCode::wants_encode_sg(const bufferlist &in) const
+{
+  if (!encode_sg_enabled ||
+      !(get_supported_optimizations() &
+	FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION) ||
+      !chunk_mapping.empty()) {
+    return false;
+  }
+  if (in.get_num_buffers() <= 1 && in.is_aligned(SIMD_ALIGN)) {
+    // encode_prepare won't copy anything
+    return false;
+  }
+  return true;
+}
+
+int ErasureCode::encode_sg(const bufferlist &raw,
+			   map<int, bufferlist> &encoded)
+{
+  unsigned int k = get_data_chunk_count();
+  unsigned int m = get_chunk_count() - k;
+  unsigned blocksize = get_chunk_size(raw.length());
+  unsigned padded_chunks = k - raw.length() / blocksize;
+
+  for (unsigned int i = 0; i < k - padded_chunks; i++) {
+    encoded[chunk_index(i)].substr_of(raw, i * blocksize, blocksize);
+  }
+  if (padded_chunks) {
+    unsigned remainder = raw.length() - (k - padded_chunks) * blocksize;
+    bufferptr buf(buffer::create_aligned(blocksize, SIMD_ALIGN));
+
+    raw.begin((k - padded_chunks) * blocksize).copy(remainder, buf.c_str());
+    count_copied(remainder);
+    buf.zero(remainder, blocksize - remainder);
+    encoded[chunk_index(k-padded_chunks)].push_back(std::move(buf));
+
+    for (unsigned int i = k - padded_chunks + 1; i < k; i++) {
+      bufferptr buf(buffer::create_aligned(blocksize, SIMD_ALIGN));
+      buf.zero();
+      encoded[chunk_index(i)].push_back(std::move(buf));
+    }
+  }
+  map<int, bufferptr> coding;
+  for (unsigned int i = k; i < k + m; i++) {
+    bufferptr buf(buffer::create_aligned(blocksize, SIMD_ALIGN));
+    buf.zero();
+    coding[chunk_index(i)] = buf;
+    encoded[chunk_index(i)].push_back(std::move(buf));
+  }
+
+  unsigned window = std::max(
+    SIMD_ALIGN, ENCODE_CACHE_BLOCK / m / SIMD_ALIGN * SIMD_ALIGN);
+  bufferptr bounce(buffer::create_aligned(window, SIMD_ALIGN));
+  map<int, bufferptr> in;
+  map<int, bufferptr> out;
+  auto apply = [&](int shard, const bufferptr &from, unsigned off) {
+    in.clear();
+    in[shard] = from;
+    for (auto &&[c, buf] : coding) {
+      out[c] = bufferptr(buf, off, from.length());
+    }
+    apply_delta(in, out);
+  };
+
+  // where each data chunk stands: current segment and its chunk offset
+  vector<pair<bufferlist::buffers_t::const_iterator, unsigned>> cursor;
+  for (unsigned int i = 0; i < k; i++) {
+    auto &chunk = encoded[chunk_index(i)];
+    cursor.emplace_back(chunk.buffers().begin(), 0);
+  }
+  for (unsigned off = 0; off < blocksize; off += window) {
+    unsigned end = std::min(blocksize, off + window);
+    for (unsigned int i = 0; i < k; i++) {
+      int shard = chunk_index(i);
+      auto &[seg, seg_off] = cursor[i];
+      unsigned pos = off;
+      unsigned run = end;  // start of the bytes copied to bounce, if any
+      while (pos < end) {
+	unsigned n = std::min<unsigned>(seg_off + seg->length(), end) - pos;
+	if (n == 0) {
+	  ++seg;
+	  continue;
+	}
+	const char *p = seg->c_str() + (pos - seg_off);
+	// the kernels want the input at the same alignment as the output
+	// and don't split words
+	if ((uintptr_t)p % SIMD_ALIGN == pos % SIMD_ALIGN &&
+	    pos % sizeof(uint64_t) == 0 && n % sizeof(uint64_t) == 0) {
+	  if (run < pos) {
+	    apply(shard, bufferptr(bounce, run - off, pos - run), run);
+	    run = end;
+	  }
+	  apply(shard, bufferptr(*seg, pos - seg_off, n), pos);
+	} else {
+	  if (run == end) {
+	    run = pos;
+	  }
+	  memcpy(bounce.c_str() + (pos - off), p, n);
+	  count_copied(n);
+	}
+	pos += n;
+	if (pos == seg_off + seg->length()) {
+	  seg_off += seg->length();
+	  ++seg;
+	}
+      }
+      if (run < end) {
+	apply(shard, bufferptr(bounce, run - off, end - run), run);
+      }
+    }
+  }
+  return 0;
+}
+
 int ErasureCode::encode(const set<int> &want_to_encode,
                         const bufferlist &in,
                         map<int, bufferlist> *encoded)
@@ -211,10 +331,16 @@ int ErasureCode::encode(const set<int> &want_to_encode,
   unsigned int k = get_data_chunk_count();
   unsigned int m = get_chunk_count() - k;
   bufferlist out;
-  int err = encode_prepare(in, *encoded);
-  if (err)
-    return err;
-  encode_chunks(want_to_encode, encoded);
+  if (wants_encode_sg(in)) {
+    int err = encode_sg(in, *encoded);
+    if (err)
+      return err;
+  } else {
+    int err = encode_prepare(in, *encoded);
+    if (err)
+      return err;
+    encode_chunks(want_to_encode, encoded);
+  }
   for (unsigned int i = 0; i < k + m; i++) {
     if (want_to_encode.count(i) == 0)
       encoded->erase(i);
@@ -254,6 +380,10 @@ int ErasureCode::_decode(const set<int> &want_to_read,
       (*decoded)[i].swap(tmp);
     } else {
       (*decoded)[i] = chunks.find(i)->second;
+      if (!(*decoded)[i].is_contiguous() ||
+	  !(*decoded)[i].is_aligned(SIMD_ALIGN)) {
+	count_copied(blocksize);
+      }
       (*decoded)[i].rebuild_aligned(SIMD_ALIGN);
     }
   }
@@ -365,4 +495,27 @@ int ErasureCode::decode_concat(const map<int, bufferlist> &chunks,
   }
   return r;
 }
+
+void ErasureCode::encode_delta(const bufferptr &old_data,
+			       const bufferptr &new_data,
+			       bufferptr *delta)
+{
+  ceph_assert(old_data.length() == new_data.length());
+  if (delta->length() == 0) {
+    *delta = buffer::create_aligned(old_data.length(), SIMD_ALIGN);
+  }
+  ceph_assert(delta->length() == old_data.length());
+  const char *o = old_data.c_str();
+  const char *n = new_data.c_str();
+  char *d = delta->c_str();
+  for (unsigned i = 0; i < old_data.length(); ++i) {
+    d[i] = o[i] ^ n[i];
+  }
+}
+
+void ErasureCode::apply_delta(const map<int, bufferptr> &in,
+			      map<int, bufferptr> &out)
+{
+  ceph_abort_msg("parity delta is not supported by this plugin");
+}
 }
@@ -22,6 +22,8 @@
 
  */ 
 
+#include <atomic>
+
 #include "ErasureCodeInterface.h"
 
 namespace ceph {
@@ -29,6 +31,9 @@ namespace ceph {
   class ErasureCode : public ErasureCodeInterface {
   public:
     static const unsigned SIMD_ALIGN;
+    /// bytes of coding chunks kept hot in the cache while encoding
+    /// scatter-gather input, @see encode_sg
+    static const unsigned ENCODE_CACHE_BLOCK;
 
     std::vector<int> chunk_mapping;
     ErasureCodeProfile _profile;
@@ -77,6 +82,35 @@ namespace ceph {
     int encode_prepare(const bufferlist &raw,
                        std::map<int, bufferlist> &encoded) const;
 
+    /**
+     * Encode **raw** without making its data chunks contiguous first.
+     * The data chunks reference the segments of **raw** and the coding
+     * chunks are accumulated with **apply_delta**, one cache sized block
+     * at a time. Only the segments the plugin kernels can't process in
+     * place (misaligned or split words) are copied.
+     */
+    int encode_sg(const bufferlist &raw,
+                  std::map<int, bufferlist> &encoded);
+
+    /// true if encode_sg is enabled, **in** would be copied by
+    /// encode_prepare and encode_sg can encode it instead
+    bool wants_encode_sg(const bufferlist &in) const;
+
+    void set_encode_sg(bool enable) override {
+      encode_sg_enabled = enable;
+    }
+
+    /// count the bytes copied to align or linearize buffers, which the
+    /// benchmark reports against the bytes encoded. Off by default: the
+    /// OSD shards of a pool share the plugin, the counter would be a
+    /// contended cache line on every encode and decode.
+    void set_count_copies(bool count) {
+      count_copies = count;
+    }
+    uint64_t get_bytes_copied() const {
+      return bytes_copied;
+    }
+
     int encode(const std::set<int> &want_to_encode,
                        const bufferlist &in,
                        std::map<int, bufferlist> *encoded) override;
@@ -115,12 +149,34 @@ namespace ceph {
     int decode_concat(const std::map<int, bufferlist> &chunks,
 			      bufferlist *decoded) override;
 
+    // none, plugins opt in to what their layout and code allow
+    uint64_t get_supported_optimizations() const override {
+      return 0;
+    }
+
+    void encode_delta(const bufferptr &old_data,
+		      const bufferptr &new_data,
+		      bufferptr *delta) override;
+
+    void apply_delta(const std::map<int, bufferptr> &in,
+		     std::map<int, bufferptr> &out) override;
+
   protected:
     int parse(const ErasureCodeProfile &profile,
 	      std::ostream *ss);
 
-  private:
     int chunk_index(unsigned int i) const;
+
+    void count_copied(uint64_t n) const {
+      if (count_copies) {
+	bytes_copied += n;
+      }
+    }
+
+  private:
+    bool count_copies = false;
+    bool encode_sg_enabled = false;
+    mutable std::atomic<uint64_t> bytes_copied = {0};
   };
 }
 
@@ -459,6 +459,66 @@ namespace ceph {
      */
     virtual int decode_concat(const std::map<int, bufferlist> &chunks,
 			      bufferlist *decoded) = 0;
+
+    /**
+     * Optional optimizations the plugin supports, a combination of
+     * FLAG_EC_PLUGIN_* bits.
+     *
+     * FLAG_EC_PLUGIN_PARTIAL_READ_OPTIMIZATION means the data chunks
+     * are laid out so that any byte range of an object can be read
+     * directly from the data chunks holding it, without reading or
+     * decoding whole stripes.
+     *
+     * FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION means the code is linear
+     * and **encode_delta** / **apply_delta** can be used to update the
+     * coding chunks after a partial overwrite of the data chunks.
+     *
+     * @return a combination of FLAG_EC_PLUGIN_* bits
+     */
+    enum {
+      FLAG_EC_PLUGIN_PARTIAL_READ_OPTIMIZATION = 1<<0,
+      FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION = 1<<1,
+    };
+    virtual uint64_t get_supported_optimizations() const = 0;
+
+    /**
+     * Compute the delta between **old_data** and **new_data**, two
+     * versions of the same range of a data chunk. **delta** is
+     * allocated if it is empty, otherwise it must be as long as the
+     * inputs.
+     *
+     * @param [in] old_data the range before the overwrite
+     * @param [in] new_data the range after the overwrite
+     * @param [out] delta to be fed to **apply_delta**
+     */
+    virtual void encode_delta(const bufferptr &old_data,
+			      const bufferptr &new_data,
+			      bufferptr *delta) = 0;
+
+    /**
+     * Update coding chunks in place with the deltas of some data
+     * chunks, as computed by **encode_delta**. All buffers cover the
+     * same range of their respective chunks. Only available if
+     * FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION is supported.
+     *
+     * @param [in] in map data chunk indexes to their delta
+     * @param [in,out] out map coding chunk indexes to their content,
+     *                 not all coding chunks need to be present
+     */
+    virtual void apply_delta(const std::map<int, bufferptr> &in,
+			     std::map<int, bufferptr> &out) = 0;
+
+    /**
+     * Let **encode** process fragmented or misaligned input one
+     * segment at a time, updating the coding chunks with
+     * **apply_delta**, rather than copying it into contiguous data
+     * chunks first. Only has an effect if
+     * FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION is supported. Off
+     * by default.
+     *
+     * @param [in] enable true to allow it
+     */
+    virtual void set_encode_sg(bool enable) = 0;
   };
 
   typedef std::shared_ptr<ErasureCodeInterface> ErasureCodeInterfaceRef;
@@ -15,6 +15,7 @@
 // -----------------------------------------------------------------------------
 #include <algorithm>
 #include <cerrno>
+#include <vector>
 // -----------------------------------------------------------------------------
 #include "common/debug.h"
 #include "ErasureCodeIsa.h"
@@ -95,10 +96,10 @@ int ErasureCodeIsa::decode_chunks(const set<int> &want_to_read,
                                   map<int, bufferlist> *decoded)
 {
   unsigned blocksize = (*chunks.begin()).second.length();
-  int erasures[k + m + 1];
+  std::vector<int> erasures(k + m + 1);
   int erasures_count = 0;
-  char *data[k];
-  char *coding[m];
+  std::vector<char*> data(k);
+  std::vector<char*> coding(m);
   for (int i = 0; i < k + m; i++) {
     if (chunks.find(i) == chunks.end()) {
       erasures[erasures_count] = i;
@@ -111,7 +112,7 @@ int ErasureCodeIsa::decode_chunks(const set<int> &want_to_read,
   }
   erasures[erasures_count] = -1;
   ceph_assert(erasures_count > 0);
-  return isa_decode(erasures, data, coding, blocksize);
+  return isa_decode(erasures.data(), data.data(), coding.data(), blocksize);
 }
 
 // -----------------------------------------------------------------------------
@@ -132,6 +133,52 @@ ErasureCodeIsaDefault::isa_encode(char **data,
 
 // -----------------------------------------------------------------------------
 
+void
+ErasureCodeIsaDefault::apply_delta(const map<int, bufferptr> &in,
+                                   map<int, bufferptr> &out)
+{
+  std::vector<unsigned char*> coding(m);
+  int rows = 0;
+  unsigned length = 0;
+  for (int j = 0; j < m; j++) {
+    auto p = out.find(chunk_index(k + j));
+    coding[j] = p == out.end() ? nullptr : (unsigned char*) p->second.c_str();
+    if (coding[j]) {
+      rows++;
+      length = p->second.length();
+    }
+  }
+  for (int i = 0; i < k; i++) {
+    auto d = in.find(chunk_index(i));
+    if (d == in.end())
+      continue;
+    ceph_assert(!rows || d->second.length() == length);
+    unsigned char *delta = (unsigned char*) d->second.c_str();
+    int blocksize = d->second.length();
+    if (m == 1) {
+      // single parity stripe is a plain xor, @see isa_encode
+      if (coding[0]) {
+        unsigned char *src[2] = { coding[0], delta };
+        region_xor(src, coding[0], 2, blocksize);
+      }
+    } else if (rows == m) {
+      // update all coding rows with data vector i in a single pass
+      ec_encode_data_update(blocksize, k, m, i, encode_tbls, delta,
+                            coding.data());
+    } else {
+      for (int j = 0; j < m; j++) {
+        if (!coding[j])
+          continue;
+        // update coding row j with data vector i
+        ec_encode_data_update(blocksize, k, 1, i, &encode_tbls[j * k * 32],
+                              delta, &coding[j]);
+      }
+    }
+  }
+}
+
+// -----------------------------------------------------------------------------
+
 bool
 ErasureCodeIsaDefault::erasure_contains(int *erasures, int i)
 {
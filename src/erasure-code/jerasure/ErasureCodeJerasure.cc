@@ -39,6 +39,7 @@ using std::map;
 using std::set;
 
 using ceph::bufferlist;
+using ceph::bufferptr;
 using ceph::ErasureCodeProfile;
 
 static ostream& _prefix(std::ostream* _dout)
@@ -152,6 +153,42 @@ bool ErasureCodeJerasure::is_prime(int value)
   return false;
 }
 
+void ErasureCodeJerasure::matrix_apply_delta(const int *matrix,
+					     const map<int, bufferptr> &in,
+					     map<int, bufferptr> &out)
+{
+  for (int j = 0; j < m; j++) {
+    auto p = out.find(chunk_index(k + j));
+    if (p == out.end())
+      continue;
+    char *coding = p->second.c_str();
+    for (int i = 0; i < k; i++) {
+      auto d = in.find(chunk_index(i));
+      if (d == in.end())
+	continue;
+      ceph_assert(d->second.length() == p->second.length());
+      char *delta = const_cast<char*>(d->second.c_str());
+      int size = d->second.length();
+      int coeff = matrix[j * k + i];
+      if (coeff == 1) {
+	galois_region_xor(delta, coding, size);
+	continue;
+      }
+      switch (w) {
+      case 8:
+	galois_w08_region_multiply(delta, coeff, size, coding, 1);
+	break;
+      case 16:
+	galois_w16_region_multiply(delta, coeff, size, coding, 1);
+	break;
+      case 32:
+	galois_w32_region_multiply(delta, coeff, size, coding, 1);
+	break;
+      }
+    }
+  }
+}
+
 // 
 // ErasureCodeJerasureReedSolomonVandermonde
 //
@@ -56,6 +56,11 @@ public:
 
   unsigned int get_chunk_size(unsigned int stripe_width) const override;
 
+  // every technique keeps the data chunks as they are
+  uint64_t get_supported_optimizations() const override {
+    return FLAG_EC_PLUGIN_PARTIAL_READ_OPTIMIZATION;
+  }
+
   int encode_chunks(const std::set<int> &want_to_encode,
 		    std::map<int, ceph::buffer::list> *encoded) override;
 
@@ -77,6 +82,10 @@ public:
   static bool is_prime(int value);
 protected:
   virtual int parse(ceph::ErasureCodeProfile &profile, std::ostream *ss);
+  // coding chunk j is the sum of matrix[j*k+i] * data chunk i over GF(2^w)
+  void matrix_apply_delta(const int *matrix,
+			  const std::map<int, ceph::bufferptr> &in,
+			  std::map<int, ceph::bufferptr> &out);
 };
 class ErasureCodeJerasureReedSolomonVandermonde : public ErasureCodeJerasure {
 public:
@@ -104,6 +113,14 @@ public:
                                int blocksize) override;
   unsigned get_alignment() const override;
   void prepare() override;
+  uint64_t get_supported_optimizations() const override {
+    return FLAG_EC_PLUGIN_PARTIAL_READ_OPTIMIZATION |
+      FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION;
+  }
+  void apply_delta(const std::map<int, ceph::bufferptr> &in,
+		   std::map<int, ceph::bufferptr> &out) override {
+    matrix_apply_delta(matrix, in, out);
+  }
 private:
   int parse(ceph::ErasureCodeProfile& profile, std::ostream *ss) override;
 };
@@ -134,6 +151,14 @@ public:
                                int blocksize) override;
   unsigned get_alignment() const override;
   void prepare() override;
+  uint64_t get_supported_optimizations() const override {
+    return FLAG_EC_PLUGIN_PARTIAL_READ_OPTIMIZATION |
+      FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION;
+  }
+  void apply_delta(const std::map<int, ceph::bufferptr> &in,
+		   std::map<int, ceph::bufferptr> &out) override {
+    matrix_apply_delta(matrix, in, out);
+  }
 private:
   int parse(ceph::ErasureCodeProfile& profile, std::ostream *ss) override;
 };
@@ -2,6 +2,7 @@
 
 #include <boost/asio/io_context.hpp>
 #include <boost/json/src.hpp>
+#include <cctype>
 #include <chrono>
 #include <filesystem>
 #include <iostream>
@@ -38,7 +39,9 @@ void DaemonMetricCollector::request_loop(boost::asio::steady_timer &timer) {
     auto prio_limit = g_conf().get_val<int64_t>("exporter_prio_limit");
     std::string dump_response;
     std::string schema_response;
-    dump_asok_metrics(sort_metrics, prio_limit, true, dump_response, schema_response, true);
+    std::string histogram_response;
+    dump_asok_metrics(sort_metrics, prio_limit, true, dump_response, schema_response,
+                      histogram_response, true);
     auto stats_period = g_conf().get_val<int64_t>("exporter_stats_period");
     // time to wait before sending requests again
     timer.expires_from_now(std::chrono::seconds(stats_period));
@@ -146,10 +149,84 @@ void DaemonMetricCollector::parse_asok_metrics(
   }
 }
 
+// Collapse each 2D perf histogram onto every one of its axes, exporting the
+// per axis bucket counts as cumulative <histogram>_<axis>_bucket{le=...}
+// series next to a <histogram>_count. Bucket bounds are the raw axis values,
+// as shown by 'perf histogram dump'.
+void DaemonMetricCollector::parse_asok_histograms(
+    std::string &histogram_dump_response, const std::string &daemon_name) {
+  json_object histogram_dump =
+      boost::json::parse(histogram_dump_response).as_object();
+  auto extra_labels = get_extra_labels(daemon_name);
+  if (extra_labels.empty()) {
+    dout(1) << "Unable to parse instance_id from daemon_name: "
+            << daemon_name << dendl;
+    return;
+  }
+  for (auto &perf_group_item : histogram_dump) {
+    std::string perf_group = {perf_group_item.key().begin(),
+                              perf_group_item.key().end()};
+    if (!perf_group_item.value().is_object()) {
+      // labeled counters come as arrays, none of them are histograms yet
+      continue;
+    }
+    for (auto &histogram : perf_group_item.value().as_object()) {
+      std::string histogram_name = perf_group + "_" +
+        std::string(histogram.key().begin(), histogram.key().end());
+      promethize(histogram_name);
+      auto &axes = histogram.value().at("axes").as_array();
+      auto &values = histogram.value().at("values").as_array();
+      if (axes.size() != 2) {
+        continue;
+      }
+      // marginal counts for each axis
+      std::vector<std::vector<uint64_t>> counts(2);
+      uint64_t total = 0;
+      for (size_t i = 0; i < 2; ++i) {
+        counts[i].resize(axes[i].at("ranges").as_array().size());
+      }
+      for (size_t x = 0; x < values.size() && x < counts[0].size(); ++x) {
+        auto &row = values[x].as_array();
+        for (size_t y = 0; y < row.size() && y < counts[1].size(); ++y) {
+          uint64_t v = row[y].as_int64();
+          counts[0][x] += v;
+          counts[1][y] += v;
+          total += v;
+        }
+      }
+      labels_t labels(extra_labels);
+      add_metric(builder, total, histogram_name + "_count",
+                 "Number of samples in " + histogram_name, "counter", labels);
+      for (size_t i = 0; i < 2; ++i) {
+        std::string axis_name =
+          boost_string_to_std(axes[i].at("name").as_string());
+        std::string name = histogram_name + "_" + promethize_axis(axis_name) +
+          "_bucket";
+        std::string description = histogram_name + " by " + axis_name;
+        auto &ranges = axes[i].at("ranges").as_array();
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b < counts[i].size(); ++b) {
+          cumulative += counts[i][b];
+          auto &range = ranges[b].as_object();
+          labels_t bucket_labels(labels);
+          if (auto max = range.if_contains("max"); max) {
+            bucket_labels["le"] =
+              quote(std::to_string(max->as_int64()));
+          } else {
+            bucket_labels["le"] = quote("+Inf");
+          }
+          add_metric(builder, cumulative, name, description, "counter",
+                     bucket_labels);
+        }
+      }
+    }
+  }
+}
 
 void DaemonMetricCollector::dump_asok_metrics(bool sort_metrics, int64_t counter_prio,
                                               bool sockClientsPing, std::string &dump_response,
                                               std::string &schema_response,
+                                              std::string &histogram_response,
                                               bool config_show_response) {
   BlockTimer timer(__FILE__, __FUNCTION__);
 
@@ -189,6 +266,15 @@ void DaemonMetricCollector::dump_asok_metrics(bool sort_metrics, int64_t counter
     try {
       parse_asok_metrics(counter_dump_response, counter_schema_response,
                          prio_limit, daemon_name);
+      if (g_conf().get_val<bool>("exporter_histograms")) {
+        // daemons without histograms, or not answering, just don't get any
+        std::string histogram_dump_response = histogram_response.size() > 0 ?
+          histogram_response :
+          asok_request(sock_client, "perf histogram dump", daemon_name);
+        if (histogram_dump_response.size() > 0) {
+          parse_asok_histograms(histogram_dump_response, daemon_name);
+        }
+      }
 
       std::string config_show = !config_show_response ? "" :
         asok_request(sock_client, "config show", daemon_name);
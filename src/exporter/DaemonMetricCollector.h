@@ -38,6 +38,7 @@ public:
   void dump_asok_metrics(bool sort_metrics, int64_t counter_prio,
                          bool sockClientsPing, std::string &dump_response,
                          std::string &schema_response,
+                         std::string &histogram_response,
                          bool config_show_response);
   std::map<std::string, AdminSocketClient> clients;
   std::string metrics;
@@ -55,6 +56,8 @@ private:
   void parse_asok_metrics(std::string &counter_dump_response,
                           std::string &counter_schema_response,
                           int64_t prio_limit, const std::string &daemon_name);
+  void parse_asok_histograms(std::string &histogram_dump_response,
+                             const std::string &daemon_name);
   void get_process_metrics(std::vector<std::pair<std::string, int>> daemon_pids);
   std::string asok_request(AdminSocketClient &asok, std::string command, std::string daemon_name);
 };
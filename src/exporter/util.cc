@@ -60,3 +60,19 @@ void promethize(std::string &name) {
 
   name = "ceph_" + name;
 }
+
+// "Queue wait (usec)" -> "queue_wait_usec"
+std::string promethize_axis(const std::string &axis_name) {
+  std::string res;
+  for (char ch : axis_name) {
+    if (std::isalnum(static_cast<unsigned char>(ch))) {
+      res += std::tolower(static_cast<unsigned char>(ch));
+    } else if (!res.empty() && res.back() != '_') {
+      res += '_';
+    }
+  }
+  while (!res.empty() && res.back() == '_') {
+    res.pop_back();
+  }
+  return res;
+}
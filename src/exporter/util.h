@@ -20,3 +20,4 @@ class BlockTimer {
 std::string read_file_to_string(std::string path);
 
 void promethize(std::string &name);
+std::string promethize_axis(const std::string &axis_name);
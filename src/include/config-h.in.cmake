@@ -90,6 +90,9 @@
 /* Defined if you have liburing */
 #cmakedefine HAVE_LIBURING
 
+/* Defined if the async+io_uring messenger is built */
+#cmakedefine HAVE_URING_STACK
+
 /* Defind if you have POSIX AIO */
 #cmakedefine HAVE_POSIXAIO
 
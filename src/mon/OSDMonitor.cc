@@ -5387,7 +5387,7 @@ void OSDMonitor::dump_info(Formatter *f)
 namespace {
   enum osd_pool_get_choices {
     SIZE, MIN_SIZE,
-    PG_NUM, PGP_NUM, CRUSH_RULE, HASHPSPOOL, EC_OVERWRITES,
+    PG_NUM, PGP_NUM, CRUSH_RULE, HASHPSPOOL, EC_OVERWRITES, EC_OPTIMIZATIONS,
     NODELETE, NOPGCHANGE, NOSIZECHANGE,
     WRITE_FADVISE_DONTNEED, NOSCRUB, NODEEP_SCRUB,
     HIT_SET_TYPE, HIT_SET_PERIOD, HIT_SET_COUNT, HIT_SET_FPP,
@@ -6111,7 +6111,8 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
       {"crush_rule", CRUSH_RULE},
       {"hashpspool", HASHPSPOOL},
       {"eio", POOL_EIO},
-      {"allow_ec_overwrites", EC_OVERWRITES}, {"nodelete", NODELETE},
+      {"allow_ec_overwrites", EC_OVERWRITES},
+      {"allow_ec_optimizations", EC_OPTIMIZATIONS}, {"nodelete", NODELETE},
       {"nopgchange", NOPGCHANGE}, {"nosizechange", NOSIZECHANGE},
       {"noscrub", NOSCRUB}, {"nodeep-scrub", NODEEP_SCRUB},
       {"write_fadvise_dontneed", WRITE_FADVISE_DONTNEED},
@@ -6171,7 +6172,7 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
       HIT_SET_GRADE_DECAY_RATE, HIT_SET_SEARCH_LAST_N
     };
     const choices_set_t ONLY_ERASURE_CHOICES = {
-      EC_OVERWRITES, ERASURE_CODE_PROFILE
+      EC_OVERWRITES, EC_OPTIMIZATIONS, ERASURE_CODE_PROFILE
     };
     const choices_set_t ONLY_REPLICA_CHOICES = {
       READ_RATIO
@@ -6282,6 +6283,10 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	    f->dump_bool("allow_ec_overwrites",
                          p->has_flag(pg_pool_t::FLAG_EC_OVERWRITES));
 	    break;
+	  case EC_OPTIMIZATIONS:
+	    f->dump_bool("allow_ec_optimizations",
+                         p->has_flag(pg_pool_t::FLAG_EC_OPTIMIZATIONS));
+	    break;
 	  case PG_AUTOSCALE_MODE:
 	    f->dump_string("pg_autoscale_mode",
 			   pg_pool_t::get_pg_autoscale_mode_name(
@@ -6518,6 +6523,11 @@ bool OSDMonitor::preprocess_command(MonOpRequestRef op)
 	      (p->has_flag(pg_pool_t::FLAG_EC_OVERWRITES) ? "true" : "false") <<
 	      "\n";
 	    break;
+	  case EC_OPTIMIZATIONS:
+	    ss << "allow_ec_optimizations: " <<
+	      (p->has_flag(pg_pool_t::FLAG_EC_OPTIMIZATIONS) ? "true" : "false") <<
+	      "\n";
+	    break;
 	  case HASHPSPOOL:
 	  case POOL_EIO:
 	  case NODELETE:
@@ -8738,6 +8748,40 @@ int OSDMonitor::prepare_command_pool_set(const cmdmap_t& cmdmap,
       ss << "expecting value 'true', 'false', '0', or '1'";
       return -EINVAL;
     }
+  } else if (var == "allow_ec_optimizations") {
+    if (!p.is_erasure()) {
+      ss << "ec optimizations can only be enabled for an erasure coded pool";
+      return -EINVAL;
+    }
+    if (val == "true" || (interr.empty() && n == 1)) {
+      if (!p.allows_ecoverwrites()) {
+	ss << "ec optimizations require allow_ec_overwrites to be enabled";
+	return -EINVAL;
+      }
+      ErasureCodeInterfaceRef erasure_code;
+      stringstream tmp;
+      int err = get_erasure_code(p.erasure_code_profile, &erasure_code, &tmp);
+      if (err < 0) {
+	ss << __func__ << " get_erasure_code failed: " << tmp.str();
+	return err;
+      }
+      const uint64_t required =
+	ceph::ErasureCodeInterface::FLAG_EC_PLUGIN_PARTIAL_READ_OPTIMIZATION |
+	ceph::ErasureCodeInterface::FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION;
+      if ((erasure_code->get_supported_optimizations() & required) !=
+	  required) {
+	ss << "the erasure code profile " << p.erasure_code_profile
+	   << " uses a plugin or technique which doesn't support"
+	   << " ec optimizations";
+	return -EINVAL;
+      }
+      p.flags |= pg_pool_t::FLAG_EC_OPTIMIZATIONS;
+    } else if (val == "false" || (interr.empty() && n == 0)) {
+      p.flags &= ~pg_pool_t::FLAG_EC_OPTIMIZATIONS;
+    } else {
+      ss << "expecting value 'true', 'false', '0', or '1'";
+      return -EINVAL;
+    }
   } else if (var == "target_max_objects") {
     if (interr.length()) {
       ss << "error parsing int '" << val << "': " << interr;
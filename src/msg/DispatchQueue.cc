@@ -30,12 +30,65 @@ using ceph::ref_t;
 #undef dout_prefix
 #define dout_prefix *_dout << "-- " << msgr->get_myaddrs() << " "
 
+DispatchQueue::DispatchQueue(CephContext *cct, Messenger *msgr,
+			     std::string &name)
+  : cct(cct), msgr(msgr),
+    name(name),
+    next_id(1),
+    local_delivery_lock(ceph::make_mutex("Messenger::DispatchQueue::local_delivery_lock" + name)),
+    stop_local_delivery(false),
+    local_delivery_thread(this),
+    dispatch_throttler(cct, std::string("msgr_dispatch_throttler-") + name,
+		       cct->_conf->ms_dispatch_throttle_bytes),
+    stop(false)
+{
+  shards.emplace_back(std::make_unique<Shard>(
+    this, "Messenger::DispatchQueue::lock" + name));
+}
+
+void DispatchQueue::set_concurrent()
+{
+  ceph_assert(!is_started());
+  ceph_assert(shards.size() == 1 && shards[0]->mqueue.empty());
+  auto num_shards = std::max<uint64_t>(
+    1, cct->_conf.get_val<uint64_t>("ms_dispatch_threads"));
+  for (uint64_t i = 1; i < num_shards; ++i) {
+    shards.emplace_back(std::make_unique<Shard>(
+      this, "Messenger::DispatchQueue::lock" + name + "-" + std::to_string(i)));
+  }
+}
+
 double DispatchQueue::get_max_age(utime_t now) const {
-  std::lock_guard l{lock};
-  if (marrival.empty())
-    return 0;
-  else
-    return (now - marrival.begin()->first);
+  double max_age = 0;
+  for (auto& shard : shards) {
+    std::lock_guard l{shard->lock};
+    if (!shard->marrival.empty())
+      max_age = std::max<double>(max_age,
+				 now - shard->marrival.begin()->first);
+  }
+  return max_age;
+}
+
+int DispatchQueue::get_queue_len() const {
+  int len = 0;
+  for (auto& shard : shards) {
+    std::lock_guard l{shard->lock};
+    len += shard->mqueue.length();
+  }
+  return len;
+}
+
+void DispatchQueue::queue_code(int code, Connection *con)
+{
+  Shard& shard = get_shard(con);
+  std::lock_guard l{shard.lock};
+  if (stop)
+    return;
+  shard.mqueue.enqueue_strict(
+    0,
+    CEPH_MSG_PRIO_HIGHEST,
+    QueueItem(code, con));
+  shard.cond.notify_all();
 }
 
 uint64_t DispatchQueue::pre_dispatch(const ref_t<Message>& m)
@@ -82,18 +135,19 @@ void DispatchQueue::fast_preprocess(const ref_t<Message>& m)
 
 void DispatchQueue::enqueue(const ref_t<Message>& m, int priority, uint64_t id)
 {
-  std::lock_guard l{lock};
+  Shard& shard = get_shard(m->get_connection().get());
+  std::lock_guard l{shard.lock};
   if (stop) {
     return;
   }
   ldout(cct,20) << "queue " << m << " prio " << priority << dendl;
-  add_arrival(m);
+  shard.add_arrival(m);
   if (priority >= CEPH_MSG_PRIO_LOW) {
-    mqueue.enqueue_strict(id, priority, QueueItem(m));
+    shard.mqueue.enqueue_strict(id, priority, QueueItem(m));
   } else {
-    mqueue.enqueue(id, priority, m->get_cost(), QueueItem(m));
+    shard.mqueue.enqueue(id, priority, m->get_cost(), QueueItem(m));
   }
-  cond.notify_all();
+  shard.cond.notify_all();
 }
 
 void DispatchQueue::local_delivery(const ref_t<Message>& m, int priority)
@@ -152,15 +206,16 @@ void DispatchQueue::dispatch_throttle_release(uint64_t msize)
  * has remaining messages at that priority level, it is re-placed on to the
  * end of the queue. If the queue is empty; it's removed.
  * The message is then delivered and the process starts again.
+ * Each shard has its own queues and thread running this.
  */
-void DispatchQueue::entry()
+void DispatchQueue::entry(Shard &shard)
 {
-  std::unique_lock l{lock};
+  std::unique_lock l{shard.lock};
   while (true) {
-    while (!mqueue.empty()) {
-      QueueItem qitem = mqueue.dequeue();
+    while (!shard.mqueue.empty()) {
+      QueueItem qitem = shard.mqueue.dequeue();
       if (!qitem.is_code())
-	remove_arrival(qitem.get_message());
+	shard.remove_arrival(qitem.get_message());
       l.unlock();
 
       if (qitem.is_code()) {
@@ -209,34 +264,48 @@ void DispatchQueue::entry()
       break;
 
     // wait for something to be put on queue
-    cond.wait(l);
+    shard.cond.wait(l);
   }
 }
 
 void DispatchQueue::discard_queue(uint64_t id) {
-  std::lock_guard l{lock};
-  std::list<QueueItem> removed;
-  mqueue.remove_by_class(id, &removed);
-  for (auto i = removed.begin(); i != removed.end(); ++i) {
-    ceph_assert(!(i->is_code())); // We don't discard id 0, ever!
-    const ref_t<Message>& m = i->get_message();
-    remove_arrival(m);
-    dispatch_throttle_release(m->get_dispatch_throttle_size());
+  // the queues are sharded by connection rather than by id; this is only
+  // called on resets, so just look for the id in all of them
+  for (auto& shard : shards) {
+    std::lock_guard l{shard->lock};
+    std::list<QueueItem> removed;
+    shard->mqueue.remove_by_class(id, &removed);
+    for (auto i = removed.begin(); i != removed.end(); ++i) {
+      ceph_assert(!(i->is_code())); // We don't discard id 0, ever!
+      const ref_t<Message>& m = i->get_message();
+      shard->remove_arrival(m);
+      dispatch_throttle_release(m->get_dispatch_throttle_size());
+    }
   }
 }
 
 void DispatchQueue::start()
 {
   ceph_assert(!stop);
-  ceph_assert(!dispatch_thread.is_started());
-  dispatch_thread.create("ms_dispatch");
+  for (size_t i = 0; i < shards.size(); ++i) {
+    auto& shard = shards[i];
+    ceph_assert(!shard->dispatch_thread.is_started());
+    if (shards.size() == 1) {
+      shard->dispatch_thread.create("ms_dispatch");
+    } else {
+      std::string thread_name = "ms_dispatch-" + std::to_string(i);
+      shard->dispatch_thread.create(thread_name.c_str());
+    }
+  }
   local_delivery_thread.create("ms_local");
 }
 
 void DispatchQueue::wait()
 {
   local_delivery_thread.join();
-  dispatch_thread.join();
+  for (auto& shard : shards) {
+    shard->dispatch_thread.join();
+  }
 }
 
 void DispatchQueue::discard_local()
@@ -252,10 +321,10 @@ void DispatchQueue::shutdown()
     stop_local_delivery = true;
     local_delivery_cond.notify_all();
   }
-  // stop my dispatch thread
-  {
-    std::scoped_lock l{lock};
-    stop = true;
-    cond.notify_all();
+  // stop my dispatch threads
+  stop = true;
+  for (auto& shard : shards) {
+    std::scoped_lock l{shard->lock};
+    shard->cond.notify_all();
   }
 }
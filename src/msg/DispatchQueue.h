@@ -17,10 +17,13 @@
 
 #include <atomic>
 #include <map>
+#include <memory>
 #include <queue>
+#include <vector>
 #include <boost/intrusive_ptr.hpp>
 #include "include/ceph_assert.h"
 #include "include/common_fwd.h"
+#include "include/hash.h"
 #include "common/Throttle.h"
 #include "common/ceph_mutex.h"
 #include "common/Thread.h"
@@ -34,7 +37,9 @@ struct Connection;
 /**
  * The DispatchQueue contains all the connections which have Messages
  * they want to be dispatched, carefully organized by Message priority
- * and permitted to deliver in a round-robin fashion.
+ * and permitted to deliver in a round-robin fashion. If the Messenger
+ * allows it, the connections are sharded over ms_dispatch_threads
+ * dispatch threads.
  * See Messenger::dispatch_entry for details.
  */
 class DispatchQueue {
@@ -64,44 +69,72 @@ class DispatchQueue {
 
   CephContext *cct;
   Messenger *msgr;
-  mutable ceph::mutex lock;
-  ceph::condition_variable cond;
-
-  PrioritizedQueue<QueueItem, uint64_t> mqueue;
-
-  std::set<std::pair<double, ceph::ref_t<Message>>> marrival;
-  std::map<ceph::ref_t<Message>, decltype(marrival)::iterator> marrival_map;
-  void add_arrival(const ceph::ref_t<Message>& m) {
-    marrival_map.insert(
-      make_pair(
-	m,
-	marrival.insert(std::make_pair(m->get_recv_stamp(), m)).first
-	)
-      );
-  }
-  void remove_arrival(const ceph::ref_t<Message>& m) {
-    auto it = marrival_map.find(m);
-    ceph_assert(it != marrival_map.end());
-    marrival.erase(it->second);
-    marrival_map.erase(it);
-  }
-
-  std::atomic<uint64_t> next_id;
 
   enum { D_CONNECT = 1, D_ACCEPT, D_BAD_REMOTE_RESET, D_BAD_RESET, D_CONN_REFUSED, D_NUM_CODES };
 
+  struct Shard;
+
   /**
-   * The DispatchThread runs dispatch_entry to empty out the dispatch_queue.
+   * The DispatchThread runs dispatch_entry to empty out the queue of its
+   * shard.
    */
   class DispatchThread : public Thread {
     DispatchQueue *dq;
+    Shard *shard;
   public:
-    explicit DispatchThread(DispatchQueue *dq) : dq(dq) {}
+    DispatchThread(DispatchQueue *dq, Shard *shard) : dq(dq), shard(shard) {}
     void *entry() override {
-      dq->entry();
+      dq->entry(*shard);
       return 0;
     }
-  } dispatch_thread;
+  };
+
+  /**
+   * The connections are spread over ms_dispatch_threads shards, each with
+   * its own queue and dispatch thread. All the messages and events of a
+   * connection go through the same shard, in order.
+   */
+  struct Shard {
+    mutable ceph::mutex lock;
+    ceph::condition_variable cond;
+
+    PrioritizedQueue<QueueItem, uint64_t> mqueue;
+
+    std::set<std::pair<double, ceph::ref_t<Message>>> marrival;
+    std::map<ceph::ref_t<Message>, decltype(marrival)::iterator> marrival_map;
+    void add_arrival(const ceph::ref_t<Message>& m) {
+      marrival_map.insert(
+	make_pair(
+	  m,
+	  marrival.insert(std::make_pair(m->get_recv_stamp(), m)).first
+	  )
+	);
+    }
+    void remove_arrival(const ceph::ref_t<Message>& m) {
+      auto it = marrival_map.find(m);
+      ceph_assert(it != marrival_map.end());
+      marrival.erase(it->second);
+      marrival_map.erase(it);
+    }
+
+    DispatchThread dispatch_thread;
+
+    Shard(DispatchQueue *dq, const std::string &lock_name)
+      : lock(ceph::make_mutex(lock_name)),
+	mqueue(dq->cct->_conf->ms_pq_max_tokens_per_priority,
+	       dq->cct->_conf->ms_pq_min_cost),
+	dispatch_thread(dq, this) {}
+  };
+  std::vector<std::unique_ptr<Shard>> shards;
+
+  Shard& get_shard(const Connection *con) {
+    if (shards.size() == 1)
+      return *shards[0];
+    return *shards[rjhash64(reinterpret_cast<uintptr_t>(con)) % shards.size()];
+  }
+
+  std::string name;
+  std::atomic<uint64_t> next_id;
 
   ceph::mutex local_delivery_lock;
   ceph::condition_variable local_delivery_cond;
@@ -117,6 +150,7 @@ class DispatchQueue {
     }
   } local_delivery_thread;
 
+  void queue_code(int code, Connection *con);
   uint64_t pre_dispatch(const ceph::ref_t<Message>& m);
   void post_dispatch(const ceph::ref_t<Message>& m, uint64_t msize);
 
@@ -125,7 +159,7 @@ class DispatchQueue {
   /// Throttle preventing us from building up a big backlog waiting for dispatch
   Throttle dispatch_throttler;
 
-  bool stop;
+  std::atomic<bool> stop;
   void local_delivery(const ceph::ref_t<Message>& m, int priority);
   void local_delivery(Message* m, int priority) {
     return local_delivery(ceph::ref_t<Message>(m, false), priority); /* consume ref */
@@ -134,10 +168,7 @@ class DispatchQueue {
 
   double get_max_age(utime_t now) const;
 
-  int get_queue_len() const {
-    std::lock_guard l{lock};
-    return mqueue.length();
-  }
+  int get_queue_len() const;
 
   /**
    * Release memory accounting back to the dispatch throttler.
@@ -147,54 +178,19 @@ class DispatchQueue {
   void dispatch_throttle_release(uint64_t msize);
 
   void queue_connect(Connection *con) {
-    std::lock_guard l{lock};
-    if (stop)
-      return;
-    mqueue.enqueue_strict(
-      0,
-      CEPH_MSG_PRIO_HIGHEST,
-      QueueItem(D_CONNECT, con));
-    cond.notify_all();
+    queue_code(D_CONNECT, con);
   }
   void queue_accept(Connection *con) {
-    std::lock_guard l{lock};
-    if (stop)
-      return;
-    mqueue.enqueue_strict(
-      0,
-      CEPH_MSG_PRIO_HIGHEST,
-      QueueItem(D_ACCEPT, con));
-    cond.notify_all();
+    queue_code(D_ACCEPT, con);
   }
   void queue_remote_reset(Connection *con) {
-    std::lock_guard l{lock};
-    if (stop)
-      return;
-    mqueue.enqueue_strict(
-      0,
-      CEPH_MSG_PRIO_HIGHEST,
-      QueueItem(D_BAD_REMOTE_RESET, con));
-    cond.notify_all();
+    queue_code(D_BAD_REMOTE_RESET, con);
   }
   void queue_reset(Connection *con) {
-    std::lock_guard l{lock};
-    if (stop)
-      return;
-    mqueue.enqueue_strict(
-      0,
-      CEPH_MSG_PRIO_HIGHEST,
-      QueueItem(D_BAD_RESET, con));
-    cond.notify_all();
+    queue_code(D_BAD_RESET, con);
   }
   void queue_refused(Connection *con) {
-    std::lock_guard l{lock};
-    if (stop)
-      return;
-    mqueue.enqueue_strict(
-      0,
-      CEPH_MSG_PRIO_HIGHEST,
-      QueueItem(D_CONN_REFUSED, con));
-    cond.notify_all();
+    queue_code(D_CONN_REFUSED, con);
   }
 
   bool can_fast_dispatch(const ceph::cref_t<Message> &m) const;
@@ -212,29 +208,24 @@ class DispatchQueue {
   uint64_t get_id() {
     return next_id++;
   }
+  /**
+   * Spread the connections over ms_dispatch_threads shards. Only for
+   * Dispatchers which can handle messages of different connections
+   * concurrently, and only before start().
+   */
+  void set_concurrent();
   void start();
-  void entry();
+  void entry(Shard &shard);
   void wait();
   void shutdown();
-  bool is_started() const {return dispatch_thread.is_started();}
-
-  DispatchQueue(CephContext *cct, Messenger *msgr, std::string &name)
-    : cct(cct), msgr(msgr),
-      lock(ceph::make_mutex("Messenger::DispatchQueue::lock" + name)),
-      mqueue(cct->_conf->ms_pq_max_tokens_per_priority,
-	     cct->_conf->ms_pq_min_cost),
-      next_id(1),
-      dispatch_thread(this),
-      local_delivery_lock(ceph::make_mutex("Messenger::DispatchQueue::local_delivery_lock" + name)),
-      stop_local_delivery(false),
-      local_delivery_thread(this),
-      dispatch_throttler(cct, std::string("msgr_dispatch_throttler-") + name,
-                         cct->_conf->ms_dispatch_throttle_bytes),
-      stop(false)
-    {}
+  bool is_started() const {return shards[0]->dispatch_thread.is_started();}
+
+  DispatchQueue(CephContext *cct, Messenger *msgr, std::string &name);
   ~DispatchQueue() {
-    ceph_assert(mqueue.empty());
-    ceph_assert(marrival.empty());
+    for (auto& shard : shards) {
+      ceph_assert(shard->mqueue.empty());
+      ceph_assert(shard->marrival.empty());
+    }
     ceph_assert(local_messages.empty());
   }
 };
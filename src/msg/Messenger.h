@@ -371,6 +371,15 @@ public:
     ceph_assert(!started);
     default_send_priority = p;
   }
+  /**
+   * let the Messages which are not fast dispatched be dispatched from up
+   * to ms_dispatch_threads threads, those of one Connection still in order
+   *
+   * This is an init-time function and must be called *before* the first
+   * Dispatcher is added. Only call it if all the Dispatchers can handle
+   * Messages of different Connections concurrently.
+   */
+  virtual void set_concurrent_dispatch() {}
   /**
    * set the priority(SO_PRIORITY) for all packets to be sent on this socket.
    *
@@ -118,8 +118,9 @@ AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, DispatchQu
     logger(w->get_perf_counter()),
     labeled_logger(w->get_labeled_perf_counter()),
     state(STATE_NONE), port(-1),
-    dispatch_queue(q), recv_buf(NULL),
+    dispatch_queue(q),
     recv_max_prefetch(std::max<int64_t>(msgr->cct->_conf->ms_tcp_prefetch_max_size, TCP_PREFETCH_MIN_SIZE)),
+    recv_arena_size(msgr->cct->_conf.get_val<Option::size_t>("ms_async_rx_arena_size")),
     recv_start(0), recv_end(0),
     last_active(ceph::coarse_mono_clock::now()),
     connect_timeout_us(cct->_conf->ms_connection_ready_timeout*1000*1000),
@@ -135,8 +136,6 @@ AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, DispatchQu
   write_callback_handler = new C_handle_write_callback(this);
   wakeup_handler = new C_time_wakeup(this);
   tick_handler = new C_tick_wakeup(this);
-  // double recv_max_prefetch see "read_until"
-  recv_buf = new char[2*recv_max_prefetch];
   if (local) {
     protocol = std::unique_ptr<Protocol>(new LoopbackProtocolV1(this));
   } else if (m2) {
@@ -149,8 +148,6 @@ AsyncConnection::AsyncConnection(CephContext *cct, AsyncMessenger *m, DispatchQu
 
 AsyncConnection::~AsyncConnection()
 {
-  if (recv_buf)
-    delete[] recv_buf;
   ceph_assert(!delay_state);
 }
 
@@ -200,7 +197,11 @@ ssize_t AsyncConnection::read(unsigned len, char *buffer,
 // Normally, only "read_message" will pass existing bufferptr in
 //
 // And it will uses readahead method to reduce small read overhead,
-// "recv_buf" is used to store read buffer
+// "recv_buf" is used to store read buffer. With ms_async_rx_arena_size
+// set, a busy connection reads as much as the socket has into it, so that
+// a single read may bring in several small frames, and "read_slice" hands
+// parts of it out without copying. The bytes before "recv_end" are never
+// written over while such a slice may point at them, see "prepare_recv_buf".
 //
 // return the remaining bytes, 0 means this buffer is finished
 // else return < 0 means error
@@ -216,11 +217,15 @@ ssize_t AsyncConnection::read_until(unsigned len, char *p)
     }
   }
 
+  if (cs && cs.support_zero_copy_read()) {
+    return read_until_zero_copy(len, p);
+  }
+
   ssize_t r = 0;
   uint64_t left = len - state_offset;
   if (recv_end > recv_start) {
     uint64_t to_read = std::min<uint64_t>(recv_end - recv_start, left);
-    memcpy(p, recv_buf+recv_start, to_read);
+    memcpy(p, recv_buf.c_str()+recv_start, to_read);
     recv_start += to_read;
     left -= to_read;
     ldout(async_msgr->cct, 25) << __func__ << " got " << to_read << " in buffer "
@@ -233,7 +238,6 @@ ssize_t AsyncConnection::read_until(unsigned len, char *p)
     state_offset += to_read;
   }
 
-  recv_end = recv_start = 0;
   /* nothing left in the prefetch buffer */
   if (left > (uint64_t)recv_max_prefetch) {
     /* this was a large read, we don't prefetch for these */
@@ -251,29 +255,139 @@ ssize_t AsyncConnection::read_until(unsigned len, char *p)
       left -= r;
     } while (r > 0);
   } else {
+    prepare_recv_buf();
     do {
-      r = read_bulk(recv_buf+recv_end, recv_max_prefetch);
+      // at least recv_max_prefetch of room to begin with, see "prepare_recv_buf"
+      uint32_t room = recv_arena_size ? recv_buf.length() - recv_end : recv_max_prefetch;
+      r = read_bulk(recv_buf.c_str()+recv_end, room);
       ldout(async_msgr->cct, 25) << __func__ << " read_bulk recv_end is " << recv_end
                                  << " left is " << left << " got " << r << dendl;
       if (r < 0) {
         ldout(async_msgr->cct, 1) << __func__ << " read failed" << dendl;
         return -1;
       }
+      if (recv_arena_size && r == static_cast<int>(room)) {
+        // the socket may well have had more, use full size segments
+        recv_grow = true;
+      }
       recv_end += r;
-      if (r >= static_cast<int>(left)) {
-        recv_start = len - state_offset;
-        memcpy(p+state_offset, recv_buf, recv_start);
+      if (recv_end - recv_start >= left) {
+        memcpy(p+state_offset, recv_buf.c_str()+recv_start, left);
+        recv_start += left;
         state_offset = 0;
         return 0;
       }
-      left -= r;
     } while (r > 0);
-    memcpy(p+state_offset, recv_buf, recv_end-recv_start);
+    memcpy(p+state_offset, recv_buf.c_str()+recv_start, recv_end-recv_start);
     state_offset += (recv_end - recv_start);
-    recv_end = recv_start = 0;
+    recv_start = recv_end;
+  }
+  ldout(async_msgr->cct, 25) << __func__ << " need len " << len << " remaining "
+                             << len - state_offset << " bytes" << dendl;
+  return len - state_offset;
+}
+
+// make sure "recv_buf" has room for a prefetching read at "recv_end".
+//
+// The arena is a ring of segments: slices handed out by "read_slice" each
+// hold a reference to the segment they point into, so a segment with no
+// other reference than "recv_buf" is rewound and reused as is. When the
+// current one is still referenced and full, the previous one is taken back
+// if it has been released meanwhile, and only if both are still in use
+// (say, a message is being held by its dispatcher) is a new one allocated.
+// A pinned segment is then only kept alive by the slices into it.
+//
+// Segments are 2 * recv_max_prefetch as the plain prefetch buffer was, and
+// ms_async_rx_arena_size once a read has filled all the room it was given,
+// so connections which never have more than a frame or two queued don't
+// carry a large arena.
+void AsyncConnection::prepare_recv_buf()
+{
+  ceph_assert(recv_start == recv_end);
+  uint32_t size = 2 * recv_max_prefetch;
+  if (recv_grow) {
+    size = std::max(size, recv_arena_size);
+  }
+  if (recv_buf.have_raw() && recv_buf.length() >= size) {
+    if (recv_buf.raw_nref() == 1) {
+      recv_start = recv_end = 0;
+      return;
+    }
+    if (recv_buf.length() - recv_end >= recv_max_prefetch) {
+      return;
+    }
+  }
+  if (recv_spare.have_raw() && recv_spare.raw_nref() == 1 &&
+      recv_spare.length() >= size) {
+    std::swap(recv_buf, recv_spare);
+  } else {
+    if (recv_buf.have_raw() && recv_buf.raw_nref() > 1) {
+      recv_spare = std::move(recv_buf);
+    }
+    recv_buf = ceph::buffer::ptr(ceph::buffer::create(size));
+    logger->inc(l_msgr_recv_arena_segments);
+  }
+  recv_start = recv_end = 0;
+}
+
+// hand out the next "len" bytes as a slice of "recv_buf" if they have all
+// been received already, rather than copying them out with "read_until".
+// The slice pins just the segment it points into, not the arena. Alignments
+// up to a pointer's don't matter to the decoders, larger ones have to be met.
+bool AsyncConnection::read_slice(unsigned len, unsigned align,
+                                 ceph::buffer::ptr *out)
+{
+  if (!recv_arena_size || state_offset || recv_end - recv_start < len) {
+    return false;
+  }
+  if (align > sizeof(void*) &&
+      (reinterpret_cast<uintptr_t>(recv_buf.c_str() + recv_start) & (align - 1))) {
+    return false;
+  }
+  *out = ceph::buffer::ptr(recv_buf, recv_start, len);
+  recv_start += len;
+  logger->inc(l_msgr_recv_slice_bytes, len);
+  return true;
+}
+
+// read_until() for stacks which hand out the buffers they received into:
+// the data is copied from those straight into p rather than through
+// recv_buf, and what is left of the last one is kept in recv_ptr
+ssize_t AsyncConnection::read_until_zero_copy(unsigned len, char *p)
+{
+  while (state_offset < len) {
+    if (!recv_ptr.have_raw()) {
+      ssize_t r = cs.zero_copy_read(recv_ptr);
+      if (r == -EAGAIN) {
+        break;
+      } else if (r < 0) {
+        ldout(async_msgr->cct, 1) << __func__ << " reading from fd=" << cs.fd()
+                                  << " : " << r << " " << cpp_strerror(r) << dendl;
+        return -1;
+      } else if (r == 0) {
+        ldout(async_msgr->cct, 1) << __func__ << " peer close file descriptor "
+                                  << cs.fd() << dendl;
+        return -1;
+      }
+      logger->inc(l_msgr_recv_reads);
+    }
+    unsigned n = std::min<unsigned>(len - state_offset, recv_ptr.length());
+    memcpy(p + state_offset, recv_ptr.c_str(), n);
+    state_offset += n;
+    if (n == recv_ptr.length()) {
+      // give the buffer back to the stack
+      recv_ptr = ceph::buffer::ptr();
+    } else {
+      recv_ptr.set_offset(recv_ptr.offset() + n);
+      recv_ptr.set_length(recv_ptr.length() - n);
+    }
   }
   ldout(async_msgr->cct, 25) << __func__ << " need len " << len << " remaining "
                              << len - state_offset << " bytes" << dendl;
+  if (state_offset == len) {
+    state_offset = 0;
+    return 0;
+  }
   return len - state_offset;
 }
 
@@ -298,6 +412,8 @@ ssize_t AsyncConnection::read_bulk(char *buf, unsigned len)
     ldout(async_msgr->cct, 1) << __func__ << " peer close file descriptor "
                               << cs.fd() << dendl;
     return -1;
+  } else {
+    logger->inc(l_msgr_recv_reads);
   }
   return nread;
 }
@@ -615,7 +731,9 @@ void AsyncConnection::fault()
   if (delay_state)
     delay_state->flush();
 
-  recv_start = recv_end = 0;
+  // drop what was prefetched, but don't rewind: slices may point at it
+  recv_start = recv_end;
+  recv_ptr = ceph::buffer::ptr();
   state_offset = 0;
   outgoing_bl.clear();
 }
@@ -55,6 +55,9 @@ class AsyncConnection : public Connection {
                std::function<void(char *, ssize_t)> callback);
   ssize_t read_until(unsigned needed, char *p);
   ssize_t read_bulk(char *buf, unsigned len);
+  bool read_slice(unsigned len, unsigned align, ceph::buffer::ptr *out);
+  ssize_t read_until_zero_copy(unsigned needed, char *p);
+  void prepare_recv_buf();
 
   ssize_t write(ceph::buffer::list &bl, std::function<void(ssize_t)> callback,
                 bool more=false);
@@ -195,10 +198,17 @@ private:
   EventCallbackRef write_callback_handler;
   EventCallbackRef wakeup_handler;
   EventCallbackRef tick_handler;
-  char *recv_buf;
+  // the receive arena, see "read_until" and "read_slice"
+  ceph::buffer::ptr recv_buf;   ///< segment prefetching reads go into
+  ceph::buffer::ptr recv_spare; ///< previous segment, reused once unpinned
   uint32_t recv_max_prefetch;
+  uint32_t recv_arena_size;     ///< 0 if slicing is disabled
+  bool recv_grow = false;       ///< a prefetch took all the room it was given
   uint32_t recv_start;
   uint32_t recv_end;
+  // what is left of the buffer last handed out by zero_copy_read(), for
+  // stacks which support it, in place of recv_buf
+  ceph::buffer::ptr recv_ptr;
   std::set<uint64_t> register_time_events; // need to delete it if stop
   ceph::coarse_mono_clock::time_point last_connect_started;
   ceph::coarse_mono_clock::time_point last_active;
@@ -114,6 +114,10 @@ public:
     cluster_protocol = p;
   }
 
+  void set_concurrent_dispatch() override {
+    dispatch_queue.set_concurrent();
+  }
+
   int bind(const entity_addr_t& bind_addr,
 	   std::optional<entity_addrvec_t> public_addrs=std::nullopt) override;
   int rebind(const std::set<int>& avoid_ports) override;
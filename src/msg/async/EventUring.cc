@@ -0,0 +1,729 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <poll.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+
+#include "common/deleter.h"
+#include "common/errno.h"
+#include "include/intarith.h"
+#include "include/compat.h"
+#include "EventUring.h"
+
+#define dout_subsys ceph_subsys_ms
+
+#undef dout_prefix
+#define dout_prefix *_dout << "UringDriver."
+
+UringDriver::~UringDriver()
+{
+  // unregistering the buffer ring would be refused outside of the center's
+  // thread, it goes along with the ring instead
+  if (ring_inited) {
+    io_uring_queue_exit(&ring);
+  }
+  if (buf_ring) {
+    munmap(buf_ring, nbufs * sizeof(struct io_uring_buf));
+  }
+  for (auto& [id, s] : sockets) {
+    ::close(s->fd);
+  }
+  for (auto& s : adopted) {
+    ::close(s->fd);
+  }
+  free(bufs);
+}
+
+int UringDriver::init(EventCenter *c, int nevent)
+{
+  center = c;
+  unsigned entries = cct->_conf.get_val<uint64_t>("ms_async_uring_queue_depth");
+  struct io_uring_params params = {};
+  // the ring is set up here but only ever entered by the center's thread,
+  // which enables it, see event_wait()
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN |
+    IORING_SETUP_R_DISABLED;
+  int r = io_uring_queue_init_params(entries, &ring, &params);
+  if (r < 0) {
+    lderr(cct) << __func__ << " unable to set up io_uring"
+	       << " (requires Linux 6.0): " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  ring_inited = true;
+
+  // the ring of provided buffers takes a power of two of them
+  nbufs = 1u << std::min<unsigned>(15, cbits(
+    cct->_conf.get_val<uint64_t>("ms_async_uring_recv_buffers")) - 1);
+  buf_size = cct->_conf.get_val<Option::size_t>("ms_async_uring_recv_buffer_size");
+  socket_bufs_max = std::min<uint64_t>(
+    nbufs,
+    cct->_conf.get_val<uint64_t>("ms_async_uring_recv_buffers_per_socket"));
+  send_inflight_max =
+    cct->_conf.get_val<Option::size_t>("ms_async_uring_send_inflight_max");
+  if (posix_memalign((void**)&bufs, CEPH_PAGE_SIZE, (size_t)nbufs * buf_size)) {
+    lderr(cct) << __func__ << " unable to allocate receive buffers" << dendl;
+    return -ENOMEM;
+  }
+  buf_ring = io_uring_setup_buf_ring(&ring, nbufs, BGID, 0, &r);
+  if (!buf_ring) {
+    lderr(cct) << __func__ << " unable to set up provided buffers"
+	       << " (requires Linux 6.0): " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  for (unsigned i = 0; i < nbufs; ++i) {
+    io_uring_buf_ring_add(buf_ring, bufs + (size_t)i * buf_size, buf_size, i,
+			  io_uring_buf_ring_mask(nbufs), i);
+  }
+  io_uring_buf_ring_advance(buf_ring, nbufs);
+
+  ldout(cct, 10) << __func__ << " entries " << params.sq_entries
+		 << " recv buffers " << nbufs << "x" << buf_size << dendl;
+  return 0;
+}
+
+struct io_uring_sqe *UringDriver::get_sqe()
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+  while (!sqe) {
+    // the submission queue is full, make room
+    int r = io_uring_submit(&ring);
+    if (r < 0 && r != -EINTR && r != -EAGAIN && r != -EBUSY) {
+      lderr(cct) << __func__ << " io_uring_submit failed: "
+		 << cpp_strerror(r) << dendl;
+      ceph_abort_msg("io_uring_submit failed");
+    }
+    sqe = io_uring_get_sqe(&ring);
+  }
+  return sqe;
+}
+
+static unsigned to_poll_mask(int mask)
+{
+  unsigned m = 0;
+  if (mask & EVENT_READABLE)
+    m |= POLLIN;
+  if (mask & EVENT_WRITABLE)
+    m |= POLLOUT;
+  return m;
+}
+
+static int from_poll_mask(unsigned m)
+{
+  int mask = 0;
+  if (m & POLLIN)
+    mask |= EVENT_READABLE;
+  if (m & POLLOUT)
+    mask |= EVENT_WRITABLE;
+  if (m & (POLLERR | POLLHUP))
+    mask |= EVENT_READABLE | EVENT_WRITABLE;
+  return mask;
+}
+
+void UringDriver::arm_poll(int fd, int mask)
+{
+  uint32_t id = next_id++;
+  polls[fd] = Poll{id, mask};
+  poll_fds[id] = fd;
+  struct io_uring_sqe *sqe = get_sqe();
+  io_uring_prep_poll_multishot(sqe, fd, to_poll_mask(mask));
+  io_uring_sqe_set_data64(sqe, make_user_data(OP_POLL, id));
+}
+
+void UringDriver::disarm_poll(int fd)
+{
+  auto p = polls.find(fd);
+  if (p == polls.end()) {
+    return;
+  }
+  struct io_uring_sqe *sqe = get_sqe();
+  io_uring_prep_poll_remove(sqe, make_user_data(OP_POLL, p->second.id));
+  io_uring_sqe_set_data64(sqe, 0);
+  // completions still coming for the old poll are ignored
+  poll_fds.erase(p->second.id);
+  polls.erase(p);
+}
+
+void UringDriver::arm_recv(Socket *s)
+{
+  if (s->recv_armed || s->eof || s->error || s->closed) {
+    return;
+  }
+  struct io_uring_sqe *sqe = get_sqe();
+  io_uring_prep_recv_multishot(sqe, s->fd, nullptr, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BGID;
+  io_uring_sqe_set_data64(sqe, make_user_data(OP_RECV, s->id));
+  s->recv_armed = true;
+  s->recv_starved = false;
+  ++s->ops;
+}
+
+void UringDriver::cancel_recv(Socket *s)
+{
+  if (!s->recv_armed || s->recv_cancelling) {
+    return;
+  }
+  struct io_uring_sqe *sqe = get_sqe();
+  io_uring_prep_cancel64(sqe, make_user_data(OP_RECV, s->id), 0);
+  io_uring_sqe_set_data64(sqe, 0);
+  s->recv_cancelling = true;
+}
+
+void UringDriver::arm_send(Socket *s)
+{
+  if (s->sending || s->out.length() == 0 || s->error) {
+    return;
+  }
+  s->iov.clear();
+  for (auto& p : s->out.buffers()) {
+    if (s->iov.size() == IOV_MAX) {
+      break;
+    }
+    if (p.length()) {
+      s->iov.push_back({(void*)p.c_str(), p.length()});
+    }
+  }
+  // FIPS zeroization audit 20191115: this memset is not security related.
+  memset(&s->msg, 0, sizeof(s->msg));
+  s->msg.msg_iov = s->iov.data();
+  s->msg.msg_iovlen = s->iov.size();
+  struct io_uring_sqe *sqe = get_sqe();
+  io_uring_prep_sendmsg(sqe, s->fd, &s->msg, MSG_NOSIGNAL);
+  io_uring_sqe_set_data64(sqe, make_user_data(OP_SEND, s->id));
+  s->sending = true;
+  ++s->ops;
+}
+
+void UringDriver::arm_connect_poll(Socket *s)
+{
+  if (s->connect_poll || s->closed) {
+    return;
+  }
+  struct io_uring_sqe *sqe = get_sqe();
+  io_uring_prep_poll_add(sqe, s->fd, POLLOUT);
+  io_uring_sqe_set_data64(sqe, make_user_data(OP_CONNECT, s->id));
+  s->connect_poll = true;
+  ++s->ops;
+}
+
+void UringDriver::recycle(uint16_t bid)
+{
+  io_uring_buf_ring_add(buf_ring, bufs + (size_t)bid * buf_size, buf_size, bid,
+			io_uring_buf_ring_mask(nbufs), recycled++);
+}
+
+void UringDriver::resume_recv(Socket *s)
+{
+  if (s->recv_capped && s->rx.size() + s->lent < socket_bufs_max) {
+    s->recv_capped = false;
+    arm_recv(s);
+  }
+}
+
+void UringDriver::take_returned()
+{
+  std::vector<std::pair<uint32_t, uint16_t>> taken;
+  {
+    std::lock_guard l{returned->lock};
+    if (returned->bufs.empty()) {
+      return;
+    }
+    taken.swap(returned->bufs);
+  }
+  for (auto [id, bid] : taken) {
+    recycle(bid);
+    auto p = sockets.find(id);
+    if (p != sockets.end()) {
+      Socket *s = p->second.get();
+      ceph_assert(s->lent > 0);
+      --s->lent;
+      resume_recv(s);
+    }
+  }
+}
+
+void UringDriver::publish_recycled()
+{
+  if (!recycled) {
+    return;
+  }
+  io_uring_buf_ring_advance(buf_ring, recycled);
+  recycled = 0;
+  if (starved) {
+    starved = false;
+    for (auto& [id, s] : sockets) {
+      if (s->recv_starved && !s->recv_capped) {
+	arm_recv(s.get());
+      }
+    }
+  }
+}
+
+uint32_t UringDriver::adopt(int fd, bool connected)
+{
+  uint32_t id = next_id++;
+  std::lock_guard l{adopt_lock};
+  adopted.push_back(std::make_unique<Socket>(fd, id, connected));
+  return id;
+}
+
+void UringDriver::take_adopted()
+{
+  std::vector<std::unique_ptr<Socket>> taken;
+  {
+    std::lock_guard l{adopt_lock};
+    if (adopted.empty()) {
+      return;
+    }
+    taken.swap(adopted);
+  }
+  for (auto& s : taken) {
+    ldout(cct, 20) << __func__ << " fd " << s->fd << " id " << s->id
+		   << " connected " << s->connected << dendl;
+    disarm_poll(s->fd);
+    socket_fds[s->fd] = s.get();
+    if (s->connected) {
+      arm_recv(s.get());
+    }
+    sockets[s->id] = std::move(s);
+  }
+}
+
+UringDriver::Socket *UringDriver::get_socket(uint32_t id)
+{
+  auto p = sockets.find(id);
+  if (p == sockets.end()) {
+    take_adopted();
+    p = sockets.find(id);
+    if (p == sockets.end()) {
+      return nullptr;
+    }
+  }
+  return p->second.get();
+}
+
+void UringDriver::fire(Socket *s, int mask)
+{
+  if (!s->closed && (s->mask & mask)) {
+    ready[s->fd] |= s->mask & mask;
+  }
+}
+
+int UringDriver::add_event(int fd, int cur_mask, int add_mask)
+{
+  ldout(cct, 20) << __func__ << " add event fd=" << fd << " cur_mask=" << cur_mask
+		 << " add_mask=" << add_mask << dendl;
+  take_adopted();
+  auto p = socket_fds.find(fd);
+  if (p == socket_fds.end()) {
+    disarm_poll(fd);
+    arm_poll(fd, cur_mask | add_mask);
+    return 0;
+  }
+  Socket *s = p->second;
+  s->mask = cur_mask | add_mask;
+  if (add_mask & EVENT_READABLE) {
+    if (!s->rx.empty() || s->eof || s->error) {
+      ready[fd] |= EVENT_READABLE;
+    }
+  }
+  if (add_mask & EVENT_WRITABLE) {
+    if (!s->connected) {
+      arm_connect_poll(s);
+    } else if (s->error || s->out.length() < send_inflight_max) {
+      ready[fd] |= EVENT_WRITABLE;
+    }
+  }
+  return 0;
+}
+
+int UringDriver::del_event(int fd, int cur_mask, int del_mask)
+{
+  ldout(cct, 20) << __func__ << " del event fd=" << fd << " cur_mask=" << cur_mask
+		 << " del_mask=" << del_mask << dendl;
+  int mask = cur_mask & ~del_mask;
+  auto p = socket_fds.find(fd);
+  if (p == socket_fds.end()) {
+    disarm_poll(fd);
+    if (mask != EVENT_NONE) {
+      arm_poll(fd, mask);
+    }
+    return 0;
+  }
+  p->second->mask = mask;
+  return 0;
+}
+
+int UringDriver::resize_events(int newsize)
+{
+  return 0;
+}
+
+void UringDriver::put_op(Socket *s)
+{
+  ceph_assert(s->ops > 0);
+  if (--s->ops == 0 && s->closed) {
+    release(s);
+  }
+}
+
+// no op refers to the closed socket anymore, its fd can go
+void UringDriver::release(Socket *s)
+{
+  ldout(cct, 20) << __func__ << " fd " << s->fd << " id " << s->id << dendl;
+  ::close(s->fd);
+  sockets.erase(s->id);
+}
+
+void UringDriver::handle_recv(Socket *s, struct io_uring_cqe *cqe)
+{
+  bool more = cqe->flags & IORING_CQE_F_MORE;
+  if (cqe->res > 0) {
+    ceph_assert(cqe->flags & IORING_CQE_F_BUFFER);
+    uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (s->closed) {
+      recycle(bid);
+    } else {
+      s->rx.push_back({bid, 0, (uint32_t)cqe->res});
+      fire(s, EVENT_READABLE);
+      if (s->rx.size() + s->lent >= socket_bufs_max && !s->recv_capped) {
+	// leave the other sockets their share of the buffers, receiving
+	// resumes once some come back
+	ldout(cct, 20) << __func__ << " fd " << s->fd << " holds "
+		       << s->rx.size() + s->lent << " receive buffers, pausing"
+		       << dendl;
+	s->recv_capped = true;
+	if (more) {
+	  cancel_recv(s);
+	}
+      }
+    }
+  } else if (cqe->res == 0) {
+    s->eof = true;
+    fire(s, EVENT_READABLE);
+  } else if (cqe->res == -ENOBUFS) {
+    // all the buffers are held by sockets not read yet, this one resumes
+    // once some come back
+    ldout(cct, 10) << __func__ << " fd " << s->fd << " out of receive buffers"
+		   << dendl;
+    s->recv_starved = true;
+    starved = true;
+  } else if (cqe->res != -ECANCELED ||
+	     !(s->closed || s->recv_cancelling)) {
+    s->error = -cqe->res;
+    fire(s, EVENT_READABLE | EVENT_WRITABLE);
+  }
+  if (!more) {
+    s->recv_armed = false;
+    s->recv_cancelling = false;
+    if (!s->recv_starved && !s->recv_capped) {
+      arm_recv(s);
+    }
+    put_op(s);
+  }
+}
+
+void UringDriver::handle_send(Socket *s, int res)
+{
+  s->sending = false;
+  if (res == -EINTR || res == -EAGAIN) {
+    arm_send(s);
+  } else if (res < 0) {
+    s->error = -res;
+    fire(s, EVENT_READABLE | EVENT_WRITABLE);
+  } else {
+    // the kernel is done with the front of 'out', which may be shorter than
+    // what was queued
+    s->out.splice(0, res);
+    if (s->out.length()) {
+      arm_send(s);
+    }
+    if (s->out.length() < send_inflight_max) {
+      fire(s, EVENT_WRITABLE);
+    }
+  }
+  if (!s->sending) {
+    flushed(s);
+  }
+  put_op(s);
+}
+
+// 'out' is sent, or can't be: carry out a shutdown or close put off
+// until then
+void UringDriver::flushed(Socket *s)
+{
+  if (s->out.length()) {
+    ldout(cct, 10) << __func__ << " fd " << s->fd << " dropping "
+		   << s->out.length() << " unsent bytes: "
+		   << cpp_strerror(s->error) << dendl;
+    s->out.clear();
+  }
+  if (s->closed) {
+    ::shutdown(s->fd, SHUT_RDWR);
+  } else if (s->shut_wr) {
+    ::shutdown(s->fd, SHUT_WR);
+  }
+}
+
+void UringDriver::handle_cqe(struct io_uring_cqe *cqe)
+{
+  uint64_t data = io_uring_cqe_get_data64(cqe);
+  auto op = op_t(data >> 32);
+  uint32_t id = data & 0xffffffff;
+  if (op == OP_POLL) {
+    auto p = poll_fds.find(id);
+    if (p == poll_fds.end()) {
+      return;
+    }
+    int fd = p->second;
+    if (cqe->res < 0) {
+      ldout(cct, 1) << __func__ << " poll on fd " << fd << " failed: "
+		    << cpp_strerror(cqe->res) << dendl;
+      ready[fd] |= EVENT_READABLE | EVENT_WRITABLE;
+    } else {
+      ready[fd] |= from_poll_mask(cqe->res);
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      // the kernel ended the multishot poll, e.g. on overflow
+      int mask = polls[fd].mask;
+      poll_fds.erase(p);
+      arm_poll(fd, mask);
+    }
+    return;
+  }
+  if (op != OP_RECV && op != OP_SEND && op != OP_CONNECT) {
+    // poll removals
+    return;
+  }
+  auto p = sockets.find(id);
+  if (p == sockets.end()) {
+    ldout(cct, 0) << __func__ << " completion for unknown socket id " << id
+		  << dendl;
+    if (op == OP_RECV && (cqe->flags & IORING_CQE_F_BUFFER)) {
+      recycle(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+    return;
+  }
+  Socket *s = p->second.get();
+  switch (op) {
+  case OP_RECV:
+    handle_recv(s, cqe);
+    break;
+  case OP_SEND:
+    handle_send(s, cqe->res);
+    break;
+  case OP_CONNECT:
+    s->connect_poll = false;
+    // AsyncConnection checks the connect with is_connected()
+    fire(s, EVENT_READABLE | EVENT_WRITABLE);
+    put_op(s);
+    break;
+  default:
+    break;
+  }
+}
+
+int UringDriver::event_wait(std::vector<FiredFileEvent> &fired_events,
+			    struct timeval *tvp)
+{
+  if (!ring_enabled) {
+    // makes this thread the only one allowed to submit
+    int r = io_uring_enable_rings(&ring);
+    if (r < 0) {
+      lderr(cct) << __func__ << " unable to enable io_uring: "
+		 << cpp_strerror(r) << dendl;
+      ceph_abort_msg("io_uring_enable_rings failed");
+    }
+    ring_enabled = true;
+  }
+  take_adopted();
+  take_returned();
+  publish_recycled();
+
+  struct io_uring_cqe *cqe = nullptr;
+  int r;
+  if (!ready.empty()) {
+    r = io_uring_submit(&ring);
+  } else if (tvp) {
+    struct __kernel_timespec ts;
+    ts.tv_sec = tvp->tv_sec;
+    ts.tv_nsec = tvp->tv_usec * 1000;
+    r = io_uring_submit_and_wait_timeout(&ring, &cqe, 1, &ts, nullptr);
+  } else {
+    r = io_uring_submit_and_wait(&ring, 1);
+  }
+  if (r < 0 && r != -ETIME && r != -EINTR) {
+    ldout(cct, 1) << __func__ << " io_uring wait failed: " << cpp_strerror(r)
+		  << dendl;
+  }
+
+  unsigned head;
+  unsigned n = 0;
+  io_uring_for_each_cqe(&ring, head, cqe) {
+    handle_cqe(cqe);
+    ++n;
+  }
+  io_uring_cq_advance(&ring, n);
+  publish_recycled();
+
+  int numevents = ready.size();
+  fired_events.resize(numevents);
+  int i = 0;
+  for (auto& [fd, mask] : ready) {
+    fired_events[i].fd = fd;
+    fired_events[i].mask = mask;
+    ++i;
+  }
+  ready.clear();
+  return numevents;
+}
+
+ssize_t UringDriver::read(uint32_t id, char *buf, size_t len)
+{
+  Socket *s = get_socket(id);
+  ceph_assert(s);
+  size_t copied = 0;
+  while (copied < len && !s->rx.empty()) {
+    auto& b = s->rx.front();
+    size_t n = std::min<size_t>(len - copied, b.len);
+    memcpy(buf + copied, bufs + (size_t)b.bid * buf_size + b.off, n);
+    copied += n;
+    b.off += n;
+    b.len -= n;
+    if (b.len == 0) {
+      recycle(b.bid);
+      s->rx.pop_front();
+    }
+  }
+  resume_recv(s);
+  publish_recycled();
+  if (copied) {
+    return copied;
+  }
+  if (s->error) {
+    return -s->error;
+  }
+  if (s->eof) {
+    return 0;
+  }
+  return -EAGAIN;
+}
+
+ssize_t UringDriver::zero_copy_read(uint32_t id, ceph::buffer::ptr &data)
+{
+  Socket *s = get_socket(id);
+  ceph_assert(s);
+  // the connection usually released its previous buffer just now
+  take_returned();
+  publish_recycled();
+  if (s->rx.empty()) {
+    if (s->error) {
+      return -s->error;
+    }
+    if (s->eof) {
+      return 0;
+    }
+    return -EAGAIN;
+  }
+  auto b = s->rx.front();
+  s->rx.pop_front();
+  ++s->lent;
+  data = ceph::buffer::ptr(ceph::buffer::claim_buffer(
+    b.len, bufs + (size_t)b.bid * buf_size + b.off,
+    make_deleter([returned = returned, id, bid = b.bid] {
+      std::lock_guard l{returned->lock};
+      returned->bufs.emplace_back(id, bid);
+    })));
+  return b.len;
+}
+
+ssize_t UringDriver::send(uint32_t id, ceph::buffer::list &bl)
+{
+  Socket *s = get_socket(id);
+  ceph_assert(s);
+  if (s->error) {
+    return -s->error;
+  }
+  if (s->shut_wr) {
+    return -EPIPE;
+  }
+  if (s->out.length() >= send_inflight_max) {
+    return 0;
+  }
+  ssize_t len = bl.length();
+  s->out.claim_append(bl);
+  arm_send(s);
+  return len;
+}
+
+void UringDriver::set_connected(uint32_t id)
+{
+  Socket *s = get_socket(id);
+  ceph_assert(s);
+  if (!s->connected) {
+    s->connected = true;
+    arm_recv(s);
+  }
+}
+
+void UringDriver::shutdown(uint32_t id)
+{
+  Socket *s = get_socket(id);
+  if (!s || s->closed) {
+    return;
+  }
+  if (s->sending) {
+    // as with a posix socket, what was accepted goes out before the FIN
+    ::shutdown(s->fd, SHUT_RD);
+    s->shut_wr = true;
+  } else {
+    ::shutdown(s->fd, SHUT_RDWR);
+  }
+}
+
+void UringDriver::close(uint32_t id)
+{
+  Socket *s = get_socket(id);
+  if (!s || s->closed) {
+    return;
+  }
+  ldout(cct, 20) << __func__ << " fd " << s->fd << " id " << id
+		 << " ops " << s->ops << " unsent " << s->out.length() << dendl;
+  for (auto& b : s->rx) {
+    recycle(b.bid);
+  }
+  s->rx.clear();
+  publish_recycled();
+  socket_fds.erase(s->fd);
+  ready.erase(s->fd);
+  s->closed = true;
+  cancel_recv(s);
+  if (s->sending) {
+    // what was queued still goes out, see flushed(). The peer may not be
+    // reading though, and unlike a posix socket closed with data unsent
+    // this one isn't orphaned for the kernel to drop it eventually: bound
+    // the wait by the idle timeout.
+    ::shutdown(s->fd, SHUT_RD);
+    unsigned timeout_ms = cct->_conf->ms_connection_idle_timeout * 1000;
+    ::setsockopt(s->fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout_ms,
+		 sizeof(timeout_ms));
+  } else {
+    ::shutdown(s->fd, SHUT_RDWR);
+  }
+  if (s->ops == 0) {
+    release(s);
+  }
+}
@@ -0,0 +1,212 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MSG_EVENTURING_H
+#define CEPH_MSG_EVENTURING_H
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <liburing.h>
+
+#include "include/buffer.h"
+#include "Event.h"
+
+/**
+ * io_uring based event driver, used by the "io_uring" network stack
+ * (UringStack.h).
+ *
+ * Plain fds, i.e. the notify pipe and listening sockets, are watched with
+ * multishot polls, which is what epoll would do for them.
+ *
+ * The connected sockets of the stack are adopted by the driver, which does
+ * their io itself:
+ * - a multishot recv per socket fills buffers picked by the kernel from a
+ *   ring of provided buffers. zero_copy_read() hands them out as they are,
+ *   and they go back to the ring once the connection releases them; read()
+ *   copies out of them for the callers which want a copy. A socket holding
+ *   ms_async_uring_recv_buffers_per_socket of them, handed out or not,
+ *   stops receiving until some come back, so that a connection which is
+ *   not read can't take the buffers of all the others.
+ * - send() queues the data and returns at once. One sendmsg at a time is
+ *   in flight per socket, carrying everything queued meanwhile. What was
+ *   queued is still sent after shutdown() or close(), as the kernel would
+ *   for a posix socket.
+ * A closed socket keeps its fd until the last op referring to it completes,
+ * so that the number can't be reused under an op still in the ring.
+ * The socket's fd is reported readable when a recv completes, and writable
+ * when a send completes and leaves room for more, so that AsyncConnection
+ * keeps driving it as it would drive a posix socket with epoll.
+ *
+ * Everything is submitted at once when the center waits for events: a
+ * single io_uring_enter() per loop, rather than a read or sendmsg syscall
+ * per socket and event. As only the center's thread submits, the ring is
+ * set up with IORING_SETUP_SINGLE_ISSUER and IORING_SETUP_COOP_TASKRUN,
+ * disabled until that thread first waits on it (Linux 6.0, which multishot
+ * recv requires anyway).
+ */
+class UringDriver : public EventDriver {
+ public:
+  /// a connected (or connecting) socket whose io goes through the ring
+  struct Socket {
+    struct rx_buf {
+      uint16_t bid;
+      uint32_t off;
+      uint32_t len;
+    };
+
+    int fd;
+    uint32_t id;
+    bool connected;
+    bool closed = false;	///< by the connection, the fd stays open until
+				///< the last op completes
+    int mask = EVENT_NONE;	///< the events the center waits for
+
+    // receive side
+    bool recv_armed = false;
+    bool recv_starved = false;	///< stopped for lack of provided buffers
+    bool recv_capped = false;	///< stopped as it holds its share of buffers
+    bool recv_cancelling = false;	///< the recv is being cancelled
+    bool eof = false;
+    int error = 0;
+    std::deque<rx_buf> rx;
+    unsigned lent = 0;		///< buffers handed out by zero_copy_read()
+
+    // send side
+    ceph::buffer::list out;	///< accepted by send(), not yet sent
+    bool sending = false;	///< a sendmsg of the front of 'out' is queued
+    bool shut_wr = false;	///< shut the write side once 'out' is sent
+    std::vector<struct iovec> iov;
+    struct msghdr msg;
+
+    bool connect_poll = false;	///< waiting for a connect to complete
+    unsigned ops = 0;		///< queued ops referring to the socket
+
+    Socket(int fd, uint32_t id, bool connected)
+      : fd(fd), id(id), connected(connected) {}
+  };
+
+ private:
+  enum op_t : uint32_t {
+    OP_POLL = 1,	///< multishot poll of a plain fd
+    OP_RECV,
+    OP_SEND,
+    OP_CONNECT,		///< oneshot POLLOUT of a connecting socket
+  };
+  static uint64_t make_user_data(op_t op, uint32_t id) {
+    return (uint64_t(op) << 32) | id;
+  }
+
+  static constexpr uint16_t BGID = 0;
+
+  CephContext *cct;
+  EventCenter *center = nullptr;
+  struct io_uring ring;
+  bool ring_inited = false;
+  bool ring_enabled = false;	///< by the center's thread, see event_wait()
+
+  // provided receive buffers
+  struct io_uring_buf_ring *buf_ring = nullptr;
+  char *bufs = nullptr;
+  unsigned nbufs = 0;
+  unsigned buf_size = 0;
+  unsigned socket_bufs_max = 0;	///< buffers a socket may hold
+  unsigned recycled = 0;	///< returned to the ring, not published yet
+  bool starved = false;		///< some recvs wait for buffers
+
+  /// buffers handed out by zero_copy_read() and released since, by socket
+  /// id. They may be released in any thread, and after the driver is gone.
+  struct returned_bufs {
+    std::mutex lock;
+    std::vector<std::pair<uint32_t, uint16_t>> bufs;
+  };
+  std::shared_ptr<returned_bufs> returned =
+    std::make_shared<returned_bufs>();
+
+  uint64_t send_inflight_max = 0;
+
+  std::atomic<uint32_t> next_id{1};
+
+  /// plain fds
+  struct Poll {
+    uint32_t id;
+    int mask;
+  };
+  std::map<int, Poll> polls;		///< by fd
+  std::map<uint32_t, int> poll_fds;	///< by poll id
+
+  std::map<uint32_t, std::unique_ptr<Socket>> sockets;	///< by id
+  std::map<int, Socket*> socket_fds;			///< open ones, by fd
+
+  /// sockets adopted from other threads (accepted ones), not yet in 'sockets'
+  std::mutex adopt_lock;
+  std::vector<std::unique_ptr<Socket>> adopted;
+
+  /// events to report on the next event_wait()
+  std::map<int, int> ready;
+
+  struct io_uring_sqe *get_sqe();
+  void arm_poll(int fd, int mask);
+  void disarm_poll(int fd);
+  void arm_recv(Socket *s);
+  void cancel_recv(Socket *s);
+  void arm_send(Socket *s);
+  void arm_connect_poll(Socket *s);
+  void recycle(uint16_t bid);
+  void publish_recycled();
+  void take_returned();
+  void resume_recv(Socket *s);
+  void take_adopted();
+  void fire(Socket *s, int mask);
+  void handle_cqe(struct io_uring_cqe *cqe);
+  void handle_recv(Socket *s, struct io_uring_cqe *cqe);
+  void handle_send(Socket *s, int res);
+  void flushed(Socket *s);
+  void put_op(Socket *s);
+  void release(Socket *s);
+  Socket *get_socket(uint32_t id);
+
+ public:
+  explicit UringDriver(CephContext *c): cct(c) {}
+  ~UringDriver() override;
+
+  int init(EventCenter *c, int nevent) override;
+  int add_event(int fd, int cur_mask, int add_mask) override;
+  int del_event(int fd, int cur_mask, int del_mask) override;
+  int resize_events(int newsize) override;
+  int event_wait(std::vector<FiredFileEvent> &fired_events,
+		 struct timeval *tp) override;
+
+  EventCenter *get_center() { return center; }
+
+  // socket interface, see UringStack.cc. All but adopt() are called in the
+  // center's thread.
+
+  /// hand a socket over to the driver, from any thread
+  uint32_t adopt(int fd, bool connected);
+  ssize_t read(uint32_t id, char *buf, size_t len);
+  ssize_t zero_copy_read(uint32_t id, ceph::buffer::ptr &data);
+  ssize_t send(uint32_t id, ceph::buffer::list &bl);
+  void set_connected(uint32_t id);
+  void shutdown(uint32_t id);
+  void close(uint32_t id);
+};
+
+#endif
@@ -19,8 +19,12 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#ifdef MSG_ZEROCOPY
+#include <linux/errqueue.h>
+#endif
 
 #include <algorithm>
+#include <deque>
 
 #include "PosixStack.h"
 
@@ -37,16 +41,65 @@
 #undef dout_prefix
 #define dout_prefix *_dout << "PosixStack "
 
+void ZeroCopySendTracker::hold(const ceph::buffer::list &bl, unsigned calls)
+{
+  pending.push_back({next, calls, 0, bl});
+  next += calls;
+}
+
+void ZeroCopySendTracker::complete(uint32_t lo32, uint32_t hi32)
+{
+  if (pending.empty()) {
+    return;
+  }
+  // the kernel's ids are the low 32 bits of ours
+  uint64_t base = pending.front().first;
+  uint64_t lo = base + (uint32_t)(lo32 - (uint32_t)base);
+  uint64_t hi = lo + (uint32_t)(hi32 - lo32);
+  for (auto& p : pending) {
+    if (p.first > hi) {
+      break;
+    }
+    uint64_t from = std::max(p.first, lo);
+    uint64_t to = std::min(p.first + p.count - 1, hi);
+    if (from <= to) {
+      p.done += to - from + 1;
+    }
+  }
+  while (!pending.empty() && pending.front().done == pending.front().count) {
+    pending.pop_front();
+  }
+}
+
 class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   ceph::NetHandler &handler;
   int _fd;
   entity_addr_t sa;
   bool connected;
+  PerfCounters *logger;
+
+  /// sendmsg() calls sending at least this much use MSG_ZEROCOPY, 0 if none
+  uint64_t zerocopy_min;
+  ZeroCopySendTracker zerocopy_pending;
 
  public:
   explicit PosixConnectedSocketImpl(ceph::NetHandler &h, const entity_addr_t &sa,
-				    int f, bool connected)
-      : handler(h), _fd(f), sa(sa), connected(connected) {}
+				    int f, bool connected, PerfCounters *logger,
+				    uint64_t zerocopy_min)
+      : handler(h), _fd(f), sa(sa), connected(connected), logger(logger),
+	zerocopy_min(zerocopy_min) {
+#ifdef MSG_ZEROCOPY
+    if (zerocopy_min) {
+      int on = 1;
+      if (::setsockopt(_fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+	// not supported by this kernel
+	this->zerocopy_min = 0;
+      }
+    }
+#else
+    this->zerocopy_min = 0;
+#endif
+  }
 
   int is_connected() override {
     if (connected)
@@ -63,7 +116,46 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
     }
   }
 
+  // release what the kernel is done with, according to the notifications
+  // queued on the socket's error queue
+  void reap_zerocopy() {
+#ifdef MSG_ZEROCOPY
+    while (!zerocopy_pending.empty()) {
+      char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+      struct msghdr msg;
+      // FIPS zeroization audit 20191115: this memset is not security related.
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (::recvmsg(_fd, &msg, MSG_ERRQUEUE) < 0) {
+        // EAGAIN: none left
+        break;
+      }
+      for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+              (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+          continue;
+        }
+        auto serr = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cm));
+        if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+          continue;
+        }
+        if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+          // e.g. over loopback, where zero copy only adds overhead
+          logger->inc(l_msgr_send_zerocopy_copied);
+          zerocopy_min = 0;
+        }
+        zerocopy_pending.complete(serr->ee_info, serr->ee_data);
+      }
+    }
+#endif
+  }
+
   ssize_t read(char *buf, size_t len) override {
+    if (!zerocopy_pending.empty()) {
+      // notifications raise POLLERR, which wakes the reader up
+      reap_zerocopy();
+    }
     #ifdef _WIN32
     ssize_t r = ::recv(_fd, buf, len, 0);
     #else
@@ -77,13 +169,15 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   // return the sent length
   // < 0 means error occurred
   #ifndef _WIN32
-  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more)
+  // *zerocopy_calls is incremented for each successful MSG_ZEROCOPY call
+  static ssize_t do_sendmsg(int fd, struct msghdr &msg, unsigned len, bool more,
+			    int flags, unsigned *zerocopy_calls)
   {
     size_t sent = 0;
     while (1) {
       MSGR_SIGPIPE_STOPPER;
       ssize_t r;
-      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      r = ::sendmsg(fd, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0) | flags);
       if (r < 0) {
         int err = ceph_sock_errno();
         if (err == EINTR) {
@@ -91,9 +185,21 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
         } else if (err == EAGAIN) {
           break;
         }
+#ifdef MSG_ZEROCOPY
+        if (err == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+          // over the limit of pinned pages (optmem_max), copy this one
+          flags &= ~MSG_ZEROCOPY;
+          continue;
+        }
+#endif
         return -err;
       }
 
+#ifdef MSG_ZEROCOPY
+      if (flags & MSG_ZEROCOPY) {
+        ++*zerocopy_calls;
+      }
+#endif
       sent += r;
       if (len == sent) break;
 
@@ -114,7 +220,11 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
   }
 
   ssize_t send(ceph::buffer::list &bl, bool more) override {
+    if (!zerocopy_pending.empty()) {
+      reap_zerocopy();
+    }
     size_t sent_bytes = 0;
+    unsigned zerocopy_calls = 0;
     auto pb = std::cbegin(bl.buffers());
     uint64_t left_pbrs = bl.get_num_buffers();
     while (left_pbrs) {
@@ -133,9 +243,25 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
 	msglen += pb->length();
 	++pb;
       }
-      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more);
-      if (r < 0)
+      int flags = 0;
+#ifdef MSG_ZEROCOPY
+      if (zerocopy_min && msglen >= zerocopy_min) {
+        flags |= MSG_ZEROCOPY;
+      }
+#endif
+      unsigned calls = zerocopy_calls;
+      ssize_t r = do_sendmsg(_fd, msg, msglen, left_pbrs || more, flags,
+                             &zerocopy_calls);
+      if (r < 0) {
+        if (zerocopy_calls) {
+          // some went out before the error, their pages must stay around
+          zerocopy_pending.hold(bl, zerocopy_calls);
+        }
         return r;
+      }
+      if (zerocopy_calls != calls) {
+        logger->inc(l_msgr_send_zerocopy_bytes, r);
+      }
 
       // "r" is the remaining length
       sent_bytes += r;
@@ -150,7 +276,11 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
         bl.splice(sent_bytes, bl.length()-sent_bytes, &swapped);
         bl.swap(swapped);
       } else {
-        bl.clear();
+        swapped.swap(bl);
+      }
+      if (zerocopy_calls) {
+        // 'swapped' is what was sent
+        zerocopy_pending.hold(swapped, zerocopy_calls);
       }
     }
 
@@ -204,6 +334,18 @@ class PosixConnectedSocketImpl final : public ConnectedSocketImpl {
     ::shutdown(_fd, SHUT_RDWR);
   }
   void close() override {
+#ifndef _WIN32
+    if (!zerocopy_pending.empty()) {
+      reap_zerocopy();
+    }
+    if (!zerocopy_pending.empty()) {
+      // the kernel would keep sending from buffers released below, reset
+      // the connection instead
+      struct linger l = {1, 0};
+      ::setsockopt(_fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+      zerocopy_pending.clear();
+    }
+#endif
     compat_closesocket(_fd);
   }
   void set_priority(int sd, int prio, int domain) override {
@@ -262,7 +404,9 @@ int PosixServerSocketImpl::accept(ConnectedSocket *sock, const SocketOptions &op
   out->set_sockaddr((sockaddr*)&ss);
   handler.set_priority(sd, opt.priority, out->get_family());
 
-  std::unique_ptr<PosixConnectedSocketImpl> csi(new PosixConnectedSocketImpl(handler, *out, sd, true));
+  std::unique_ptr<PosixConnectedSocketImpl> csi(new PosixConnectedSocketImpl(
+    handler, *out, sd, true, w->perf_logger,
+    w->cct->_conf.get_val<Option::size_t>("ms_tcp_zerocopy_min_size")));
   *sock = ConnectedSocket(std::move(csi));
   return 0;
 }
@@ -331,7 +475,9 @@ int PosixWorker::connect(const entity_addr_t &addr, const SocketOptions &opts, C
 
   net.set_priority(sd, opts.priority, addr.get_family());
   *socket = ConnectedSocket(
-      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(net, addr, sd, !opts.nonblock)));
+      std::unique_ptr<PosixConnectedSocketImpl>(new PosixConnectedSocketImpl(
+        net, addr, sd, !opts.nonblock, perf_logger,
+        cct->_conf.get_val<Option::size_t>("ms_tcp_zerocopy_min_size"))));
   return 0;
 }
 
@@ -17,13 +17,47 @@
 #ifndef CEPH_MSG_ASYNC_POSIXSTACK_H
 #define CEPH_MSG_ASYNC_POSIXSTACK_H
 
+#include <deque>
 #include <thread>
 
+#include "include/buffer.h"
 #include "msg/msg_types.h"
 #include "msg/async/net_handler.h"
 
 #include "Stack.h"
 
+/**
+ * Holds the data sent with MSG_ZEROCOPY until the kernel reports on the
+ * socket's error queue that it is done with it. The kernel numbers the
+ * zero copy sendmsg() calls of a socket with a 32 bit counter, which is
+ * allowed to wrap.
+ */
+class ZeroCopySendTracker {
+  struct send_t {
+    uint64_t first;	///< id of the first sendmsg() call
+    unsigned count;	///< number of zero copy sendmsg() calls
+    unsigned done = 0;	///< completed ones
+    ceph::buffer::list bl;
+  };
+  std::deque<send_t> pending;
+  uint64_t next;	///< id of the next zero copy sendmsg()
+
+ public:
+  explicit ZeroCopySendTracker(uint64_t next = 0) : next(next) {}
+
+  bool empty() const {
+    return pending.empty();
+  }
+  /// @p calls zero copy sendmsg() calls went out of @p bl
+  void hold(const ceph::buffer::list &bl, unsigned calls);
+  /// the kernel is done with the calls numbered @p lo to @p hi
+  void complete(uint32_t lo, uint32_t hi);
+  /// drop everything, the kernel must not be using any of it anymore
+  void clear() {
+    pending.clear();
+  }
+};
+
 class PosixWorker : public Worker {
   ceph::NetHandler net;
   void initialize() override;
@@ -2396,8 +2396,10 @@ CtPtr ProtocolV1::replace(const AsyncConnectionRef& existing,
     existing->state = AsyncConnection::STATE_NONE;
     // Discard existing prefetch buffer in `recv_buf`
     existing->recv_start = existing->recv_end = 0;
+    existing->recv_ptr = ceph::buffer::ptr();
     // there shouldn't exist any buffer
     ceph_assert(connection->recv_start == connection->recv_end);
+    ceph_assert(!connection->recv_ptr.have_raw());
 
     auto deactivate_existing = std::bind(
         [existing, new_worker, new_center, exproto, reply,
@@ -61,9 +61,7 @@ void ProtocolV2::run_continuation(CtRef continuation) {
 
 #define WRITE(B, D, C) write(D, CONTINUATION(C), B)
 
-#define READ(L, C) read(CONTINUATION(C), ceph::buffer::ptr_node::create(ceph::buffer::create(L)))
-
-#define READ_RXBUF(B, C) read(CONTINUATION(C), B)
+#define READ(L, C) read(CONTINUATION(C), L, segment_t::DEFAULT_ALIGNMENT, true)
 
 #ifdef UNIT_TESTS_BUILT
 
@@ -795,6 +793,36 @@ CtPtr ProtocolV2::read(CONTINUATION_RXBPTR_TYPE<ProtocolV2> &next,
   return nullptr;
 }
 
+CtPtr ProtocolV2::read(CONTINUATION_RXBPTR_TYPE<ProtocolV2> &next,
+                       unsigned len, unsigned align, bool transient) {
+  ceph::buffer::ptr slice;
+  if (transient && connection->read_slice(len, align, &slice)) {
+    // already received, take it from the receive arena as is
+    next.node = ceph::buffer::ptr_node::create(std::move(slice));
+    if (unlikely(pre_auth.enabled)) {
+      pre_auth.rxbuf.append(*next.node);
+      ceph_assert(!cct->_conf->ms_die_on_bug ||
+		  pre_auth.rxbuf.length() < 20000000);
+    }
+    next.r = 0;
+    return &next;
+  }
+
+  rx_buffer_t buffer;
+  try {
+    buffer = ceph::buffer::ptr_node::create(ceph::buffer::create_aligned(
+        len, align));
+  } catch (const ceph::buffer::bad_alloc&) {
+    // Catching because of potential issues with satisfying alignment.
+    ldout(cct, 1) << __func__ << " can't allocate aligned rx_buffer"
+                  << " len=" << len
+                  << " align=" << align
+                  << dendl;
+    return _fault();
+  }
+  return read(next, std::move(buffer));
+}
+
 template <class F>
 CtPtr ProtocolV2::write(const std::string &desc,
                         CONTINUATION_TYPE<ProtocolV2> &next,
@@ -1101,6 +1129,7 @@ CtPtr ProtocolV2::handle_read_frame_preamble_main(rx_buffer_t &&buffer, int r) {
   }
 
   rx_preamble.push_back(std::move(buffer));
+  connection->logger->inc(l_msgr_recv_frames);
 
   ldout(cct, 30) << __func__ << " preamble\n";
   rx_preamble.hexdump(*_dout);
@@ -1189,21 +1218,16 @@ CtPtr ProtocolV2::read_frame_segment() {
     return _handle_read_frame_segment();
   }
 
-  rx_buffer_t rx_buffer;
   uint16_t align = rx_frame_asm.get_segment_align(seg_idx);
-  try {
-    rx_buffer = ceph::buffer::ptr_node::create(ceph::buffer::create_aligned(
-        onwire_len, align));
-  } catch (const ceph::buffer::bad_alloc&) {
-    // Catching because of potential issues with satisfying alignment.
-    ldout(cct, 1) << __func__ << " can't allocate aligned rx_buffer"
-                  << " len=" << onwire_len
-                  << " align=" << align
-                  << dendl;
-    return _fault();
-  }
-
-  return READ_RXBUF(std::move(rx_buffer), handle_read_frame_segment);
+  // front, middle and data of a message end up in the Message (decryption
+  // is done in place), and from there in whatever the dispatcher decodes
+  // them into: pg log entries, cached object data... A slice would pin its
+  // arena segment for as long as those live, so they get a buffer of their
+  // own. The message header is decoded into a struct and dropped.
+  bool transient = next_tag != Tag::MESSAGE ||
+                   seg_idx == SegmentIndex::Msg::HEADER;
+  return read(CONTINUATION(handle_read_frame_segment), onwire_len, align,
+              transient);
 }
 
 CtPtr ProtocolV2::handle_read_frame_segment(rx_buffer_t &&rx_buffer, int r) {
@@ -2771,10 +2795,13 @@ CtPtr ProtocolV2::reuse_connection(const AsyncConnectionRef& existing,
   // avoid previous thread modify event
   exproto->state = NONE;
   existing->state = AsyncConnection::STATE_NONE;
-  // Discard existing prefetch buffer in `recv_buf`
-  existing->recv_start = existing->recv_end = 0;
+  // Discard existing prefetch buffer in `recv_buf`, without rewinding it
+  // as slices of it may still be in use
+  existing->recv_start = existing->recv_end;
+  existing->recv_ptr = ceph::buffer::ptr();
   // there shouldn't exist any buffer
   ceph_assert(connection->recv_start == connection->recv_end);
+  ceph_assert(!connection->recv_ptr.have_raw());
 
   auto deactivate_existing = std::bind(
       [ existing,
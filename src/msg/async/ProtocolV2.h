@@ -129,6 +129,10 @@ private:
 
   Ct<ProtocolV2> *read(CONTINUATION_RXBPTR_TYPE<ProtocolV2> &next,
                        rx_buffer_t&& buffer);
+  /// take len bytes out of the receive arena without copying if they are
+  /// already there and transient, i.e. done with once the frame is handled
+  Ct<ProtocolV2> *read(CONTINUATION_RXBPTR_TYPE<ProtocolV2> &next,
+                       unsigned len, unsigned align, bool transient);
   template <class F>
   Ct<ProtocolV2> *write(const std::string &desc,
                         CONTINUATION_TYPE<ProtocolV2> &next,
@@ -30,6 +30,14 @@ class ConnectedSocketImpl {
   virtual ~ConnectedSocketImpl() {}
   virtual int is_connected() = 0;
   virtual ssize_t read(char*, size_t) = 0;
+  /// stacks that receive into buffers of their own may hand them out
+  /// instead of copying from them, the buffer goes back once released
+  virtual bool support_zero_copy_read() const {
+    return false;
+  }
+  virtual ssize_t zero_copy_read(ceph::buffer::ptr &) {
+    return -EOPNOTSUPP;
+  }
   virtual ssize_t send(ceph::buffer::list &bl, bool more) = 0;
   virtual void shutdown() = 0;
   virtual void close() = 0;
@@ -96,6 +104,16 @@ class ConnectedSocket {
   ssize_t read(char* buf, size_t len) {
     return _csi->read(buf, len);
   }
+  bool support_zero_copy_read() const {
+    return _csi->support_zero_copy_read();
+  }
+  /// Read the input stream without copy.
+  ///
+  /// Hands out a buffer of the stack holding data sent from the remote
+  /// endpoint, it returns to the stack when the last reference goes.
+  ssize_t zero_copy_read(ceph::buffer::ptr &data) {
+    return _csi->zero_copy_read(data);
+  }
   /// Gets the output stream.
   ///
   /// Gets an object that sends data to the remote endpoint.
@@ -213,6 +231,14 @@ enum {
   l_msgr_recv_encrypted_bytes,
   l_msgr_send_encrypted_bytes,
 
+  l_msgr_send_zerocopy_bytes,
+  l_msgr_send_zerocopy_copied,
+
+  l_msgr_recv_reads,
+  l_msgr_recv_frames,
+  l_msgr_recv_slice_bytes,
+  l_msgr_recv_arena_segments,
+
   l_msgr_last,
 };
 
@@ -271,6 +297,14 @@ class Worker {
     plb.add_u64_counter(l_msgr_recv_encrypted_bytes, "msgr_recv_encrypted_bytes", "Network received encrypted bytes", NULL, 0, unit_t(UNIT_BYTES));
     plb.add_u64_counter(l_msgr_send_encrypted_bytes, "msgr_send_encrypted_bytes", "Network sent encrypted bytes", NULL, 0, unit_t(UNIT_BYTES));
 
+    plb.add_u64_counter(l_msgr_send_zerocopy_bytes, "msgr_send_zerocopy_bytes", "Network bytes sent with MSG_ZEROCOPY", NULL, 0, unit_t(UNIT_BYTES));
+    plb.add_u64_counter(l_msgr_send_zerocopy_copied, "msgr_send_zerocopy_copied", "MSG_ZEROCOPY sends the kernel copied anyway");
+
+    plb.add_u64_counter(l_msgr_recv_reads, "msgr_recv_reads", "Socket reads returning data");
+    plb.add_u64_counter(l_msgr_recv_frames, "msgr_recv_frames", "Network received msgr2 frames");
+    plb.add_u64_counter(l_msgr_recv_slice_bytes, "msgr_recv_slice_bytes", "Network received bytes handed out of the receive arena without copying", NULL, 0, unit_t(UNIT_BYTES));
+    plb.add_u64_counter(l_msgr_recv_arena_segments, "msgr_recv_arena_segments", "Receive arena segments allocated");
+
     perf_logger = plb.create_perf_counters();
     cct->get_perfcounters_collection()->add(perf_logger);
 
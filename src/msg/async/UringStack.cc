@@ -0,0 +1,232 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <sys/socket.h>
+#include <errno.h>
+
+#include "UringStack.h"
+#include "EventUring.h"
+
+#include "include/buffer.h"
+#include "common/errno.h"
+#include "common/dout.h"
+#include "include/compat.h"
+#include "include/sock_compat.h"
+
+#define dout_subsys ceph_subsys_ms
+#undef dout_prefix
+#define dout_prefix *_dout << "UringStack "
+
+class UringConnectedSocketImpl final : public ConnectedSocketImpl {
+  ceph::NetHandler &handler;
+  UringDriver *driver;
+  int _fd;
+  uint32_t id;
+  entity_addr_t sa;
+  bool connected;
+
+ public:
+  UringConnectedSocketImpl(ceph::NetHandler &h, UringDriver *d,
+			   const entity_addr_t &sa, int f, bool connected)
+    : handler(h), driver(d), _fd(f), id(d->adopt(f, connected)), sa(sa),
+      connected(connected) {}
+
+  int is_connected() override {
+    if (connected)
+      return 1;
+
+    int r = handler.reconnect(sa, _fd);
+    if (r == 0) {
+      connected = true;
+      driver->set_connected(id);
+      return 1;
+    } else if (r < 0) {
+      return r;
+    } else {
+      return 0;
+    }
+  }
+
+  ssize_t read(char *buf, size_t len) override {
+    return driver->read(id, buf, len);
+  }
+  bool support_zero_copy_read() const override {
+    return true;
+  }
+  ssize_t zero_copy_read(ceph::buffer::ptr &data) override {
+    return driver->zero_copy_read(id, data);
+  }
+
+  // the driver takes the whole of 'bl' unless too much is in flight
+  // already, and sends it in the background
+  ssize_t send(ceph::buffer::list &bl, bool more) override {
+    return driver->send(id, bl);
+  }
+  void shutdown() override {
+    driver->shutdown(id);
+  }
+  void close() override {
+    driver->close(id);
+  }
+  void set_priority(int sd, int prio, int domain) override {
+    handler.set_priority(sd, prio, domain);
+  }
+  int fd() const override {
+    return _fd;
+  }
+};
+
+class UringServerSocketImpl : public ServerSocketImpl {
+  ceph::NetHandler &handler;
+  int _fd;
+
+ public:
+  explicit UringServerSocketImpl(ceph::NetHandler &h, int f,
+				 const entity_addr_t& listen_addr, unsigned slot)
+    : ServerSocketImpl(listen_addr.get_type(), slot),
+      handler(h), _fd(f) {}
+  int accept(ConnectedSocket *sock, const SocketOptions &opts, entity_addr_t *out, Worker *w) override;
+  void abort_accept() override {
+    ::close(_fd);
+    _fd = -1;
+  }
+  int fd() const override {
+    return _fd;
+  }
+};
+
+int UringServerSocketImpl::accept(ConnectedSocket *sock, const SocketOptions &opt, entity_addr_t *out, Worker *w) {
+  ceph_assert(sock);
+  sockaddr_storage ss;
+  socklen_t slen = sizeof(ss);
+  int sd = accept_cloexec(_fd, (sockaddr*)&ss, &slen);
+  if (sd < 0) {
+    return -ceph_sock_errno();
+  }
+
+  int r = handler.set_nonblock(sd);
+  if (r < 0) {
+    ::close(sd);
+    return -ceph_sock_errno();
+  }
+
+  r = handler.set_socket_options(sd, opt.nodelay, opt.rcbuf_size);
+  if (r < 0) {
+    ::close(sd);
+    return -ceph_sock_errno();
+  }
+
+  ceph_assert(NULL != out); //out should not be NULL in accept connection
+
+  out->set_type(addr_type);
+  out->set_sockaddr((sockaddr*)&ss);
+  handler.set_priority(sd, opt.priority, out->get_family());
+
+  // the connection is served by 'w', not by the listening worker
+  auto driver = static_cast<UringDriver*>(w->center.get_driver());
+  std::unique_ptr<UringConnectedSocketImpl> csi(
+    new UringConnectedSocketImpl(handler, driver, *out, sd, true));
+  *sock = ConnectedSocket(std::move(csi));
+  return 0;
+}
+
+void UringWorker::initialize()
+{
+}
+
+int UringWorker::listen(entity_addr_t &sa,
+			unsigned addr_slot,
+			const SocketOptions &opt,
+			ServerSocket *sock)
+{
+  int listen_sd = net.create_socket(sa.get_family(), true);
+  if (listen_sd < 0) {
+    return -ceph_sock_errno();
+  }
+
+  int r = net.set_nonblock(listen_sd);
+  if (r < 0) {
+    ::close(listen_sd);
+    return -ceph_sock_errno();
+  }
+
+  r = net.set_socket_options(listen_sd, opt.nodelay, opt.rcbuf_size);
+  if (r < 0) {
+    ::close(listen_sd);
+    return -ceph_sock_errno();
+  }
+
+  r = ::bind(listen_sd, sa.get_sockaddr(), sa.get_sockaddr_len());
+  if (r < 0) {
+    r = -ceph_sock_errno();
+    ldout(cct, 10) << __func__ << " unable to bind to " << sa.get_sockaddr()
+		   << ": " << cpp_strerror(r) << dendl;
+    ::close(listen_sd);
+    return r;
+  }
+
+  r = ::listen(listen_sd, cct->_conf->ms_tcp_listen_backlog);
+  if (r < 0) {
+    r = -ceph_sock_errno();
+    lderr(cct) << __func__ << " unable to listen on " << sa << ": " << cpp_strerror(r) << dendl;
+    ::close(listen_sd);
+    return r;
+  }
+
+  *sock = ServerSocket(
+    std::unique_ptr<UringServerSocketImpl>(
+      new UringServerSocketImpl(net, listen_sd, sa, addr_slot)));
+  return 0;
+}
+
+int UringWorker::connect(const entity_addr_t &addr, const SocketOptions &opts, ConnectedSocket *socket) {
+  int sd;
+
+  if (opts.nonblock) {
+    sd = net.nonblock_connect(addr, opts.connect_bind_addr);
+  } else {
+    sd = net.connect(addr, opts.connect_bind_addr);
+  }
+
+  if (sd < 0) {
+    return -ceph_sock_errno();
+  }
+
+  net.set_priority(sd, opts.priority, addr.get_family());
+  auto driver = static_cast<UringDriver*>(center.get_driver());
+  *socket = ConnectedSocket(
+    std::unique_ptr<UringConnectedSocketImpl>(
+      new UringConnectedSocketImpl(net, driver, addr, sd, !opts.nonblock)));
+  return 0;
+}
+
+UringNetworkStack::UringNetworkStack(CephContext *c)
+    : NetworkStack(c)
+{
+}
+
+bool UringNetworkStack::is_supported()
+{
+  // the driver sets its rings up with IORING_SETUP_SINGLE_ISSUER, which
+  // comes with Linux 6.0 as multishot recv does
+  struct io_uring ring;
+  if (io_uring_queue_init(8, &ring, IORING_SETUP_SINGLE_ISSUER) < 0) {
+    return false;
+  }
+  int r;
+  struct io_uring_buf_ring *br = io_uring_setup_buf_ring(&ring, 1, 0, 0, &r);
+  if (br) {
+    io_uring_free_buf_ring(&ring, br, 1, 0);
+  }
+  io_uring_queue_exit(&ring);
+  return br != nullptr;
+}
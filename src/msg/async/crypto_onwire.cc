@@ -42,8 +42,15 @@ class AES128GCM_OnWireTxHandler : public ceph::crypto::onwire::TxHandler {
   nonce_t nonce, initial_nonce;
   bool used_initial_nonce;
   bool new_nonce_format;  // 64-bit counter?
+  const uint64_t batch_size;
+  // plaintext of small buffers copied to 'buffer', to encrypt in place
+  unsigned char* gathered_start = nullptr;
+  unsigned gathered = 0;
   static_assert(sizeof(nonce) == AESGCM_IV_LEN);
 
+  void encrypt(unsigned char* out, const unsigned char* in, unsigned len);
+  void encrypt_gathered();
+
 public:
   AES128GCM_OnWireTxHandler(CephContext* const cct,
 			    const key_t& key,
@@ -52,7 +59,8 @@ public:
     : cct(cct),
       ectx(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free),
       nonce(nonce), initial_nonce(nonce), used_initial_nonce(false),
-      new_nonce_format(new_nonce_format) {
+      new_nonce_format(new_nonce_format),
+      batch_size(cct->_conf.get_val<Option::size_t>("ms_secure_mode_batch_size")) {
     ceph_assert_always(ectx);
     ceph_assert_always(key.size() * CHAR_BIT == 128);
 
@@ -94,6 +102,7 @@ void AES128GCM_OnWireTxHandler::reset_tx_handler(const uint32_t* first,
   }
 
   ceph_assert(buffer.get_append_buffer_unused_tail_length() == 0);
+  gathered = 0;
   buffer.reserve(std::accumulate(first, last, AESGCM_TAG_LEN));
 
   if (!new_nonce_format) {
@@ -105,27 +114,55 @@ void AES128GCM_OnWireTxHandler::reset_tx_handler(const uint32_t* first,
   }
 }
 
+void AES128GCM_OnWireTxHandler::encrypt(unsigned char* out,
+					const unsigned char* in,
+					unsigned len)
+{
+  int update_len = 0;
+  if(1 != EVP_EncryptUpdate(ectx.get(), out, &update_len, in, len)) {
+    throw std::runtime_error("EVP_EncryptUpdate failed");
+  }
+  ceph_assert_always(update_len >= 0);
+  ceph_assert(static_cast<unsigned>(update_len) == len);
+}
+
+void AES128GCM_OnWireTxHandler::encrypt_gathered()
+{
+  if (gathered) {
+    encrypt(gathered_start, gathered_start, gathered);
+    gathered = 0;
+  }
+}
+
 void AES128GCM_OnWireTxHandler::authenticated_encrypt_update(
   const ceph::bufferlist& plaintext)
 {
   ceph_assert(buffer.get_append_buffer_unused_tail_length() >=
               plaintext.length());
   auto filler = buffer.append_hole(plaintext.length());
+  auto out = reinterpret_cast<unsigned char*>(filler.c_str());
 
+  // small buffers, of this and the following segments, are gathered where
+  // their ciphertext goes and encrypted there together: the stitched
+  // AES-GCM code of OpenSSL only kicks in for a few hundred bytes per call
   for (const auto& plainbuf : plaintext.buffers()) {
-    int update_len = 0;
-
-    if(1 != EVP_EncryptUpdate(ectx.get(),
-	reinterpret_cast<unsigned char*>(filler.c_str()),
-	&update_len,
-	reinterpret_cast<const unsigned char*>(plainbuf.c_str()),
-	plainbuf.length())) {
-      throw std::runtime_error("EVP_EncryptUpdate failed");
+    auto in = reinterpret_cast<const unsigned char*>(plainbuf.c_str());
+    if (plainbuf.length() < batch_size) {
+      memcpy(out, in, plainbuf.length());
+      if (!gathered) {
+	gathered_start = out;
+      }
+      gathered += plainbuf.length();
+      if (gathered >= batch_size) {
+	encrypt_gathered();
+      }
+    } else {
+      encrypt_gathered();
+      encrypt(out, in, plainbuf.length());
     }
-    ceph_assert_always(update_len >= 0);
-    ceph_assert(static_cast<unsigned>(update_len) == plainbuf.length());
-    filler.advance(update_len);
+    out += plainbuf.length();
   }
+  filler.advance(plaintext.length());
 
   ldout(cct, 15) << __func__
 		 << " plaintext.length()=" << plaintext.length()
@@ -135,6 +172,8 @@ void AES128GCM_OnWireTxHandler::authenticated_encrypt_update(
 
 ceph::bufferlist AES128GCM_OnWireTxHandler::authenticated_encrypt_final()
 {
+  encrypt_gathered();
+
   int final_len = 0;
   ceph_assert(buffer.get_append_buffer_unused_tail_length() ==
               AESGCM_BLOCK_LEN);
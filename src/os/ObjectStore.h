@@ -564,6 +564,26 @@ public:
      return total;
    }
 
+  /**
+   * get_data_location_hint -- where on the device an object's data starts
+   *
+   * Meant for callers walking through many objects (e.g. deep scrub) which
+   * want to visit them in on-disk order. It is only a hint, stores which
+   * can't tell return -EOPNOTSUPP.
+   *
+   * @param cid collection for object
+   * @param oid oid of object
+   * @param hint device offset of the first allocated extent of the object
+   * @returns 0 on success, -ENODATA if the object has no data allocated,
+   *          or negative error code on failure.
+   */
+  virtual int get_data_location_hint(
+    CollectionHandle &c,
+    const ghobject_t& oid,
+    uint64_t *hint) {
+    return -EOPNOTSUPP;
+  }
+
   /**
    * dump_onode -- dumps onode metadata in human readable form,
      intended primiarily for debugging
@@ -397,6 +397,11 @@ void BlueFS::_init_logger()
                     "Average lock duration while compacting bluefs log",
                     "c_lt",
                     PerfCountersBuilder::PRIO_INTERESTING);
+  b.add_u64_counter(l_bluefs_compaction_mirror_bytes, "compact_mirror_bytes",
+		    "Log bytes copied to the new log during compaction",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluefs_compaction_aborts, "compact_aborts",
+		    "Background log compactions given up");
   b.add_time_avg   (l_bluefs_fsync_lat, "fsync_lat",
                     "Average bluefs fsync latency",
                     "fs_t",
@@ -2479,6 +2484,8 @@ void BlueFS::compact_log()/*_LNF_LD_NF_D*/
   if (!cct->_conf->bluefs_replay_recovery_disable_compact) {
     if (cct->_conf->bluefs_compact_log_sync) {
       _compact_log_sync_LNF_LD();
+    } else if (cct->_conf->bluefs_compact_log_mirror) {
+      _compact_log_mirror_LNF_L_D();
     } else {
       _compact_log_async_LD_LNF_D();
     }
@@ -2512,7 +2519,8 @@ bool BlueFS::_should_start_compact_log_L_N()
 void BlueFS::_compact_log_dump_metadata_NF(uint64_t start_seq,
                                         bluefs_transaction_t *t,
 					int bdev_update_flags,
-                                        uint64_t capture_before_seq)
+                                        uint64_t capture_before_seq,
+                                        bool committed)
 {
   dout(20) << __func__ << dendl;
   t->seq = start_seq;
@@ -2555,7 +2563,13 @@ void BlueFS::_compact_log_dump_metadata_NF(uint64_t start_seq,
       dout(20) << __func__ << " op_file_update just modified, dirty_seq="
                << file_ref->dirty_seq << " " << file_ref->fnode << dendl;
     }
-    t->op_file_update(file_ref->fnode);
+    if (committed) {
+      // leave the live delta alone, it still has to go to the current log
+      auto fnode = file_ref->fnode.get_committed();
+      t->op_file_update(fnode);
+    } else {
+      t->op_file_update(file_ref->fnode);
+    }
   }
   for (auto& [path, dir_ref] : nodes.dir_map) {
     dout(20) << __func__ << " op_dir_create " << path << dendl;
@@ -3115,6 +3129,232 @@ void BlueFS::_compact_log_async_LD_LNF_D() //also locks FW for new_writer
   ceph_assert(old_is_comp);
 }
 
+/*
+ * MIRRORED ASYNC LOG COMPACTION
+ *
+ * Unlike the above the current log is neither jumped nor forbidden to
+ * expand, it remains the one and only log until the superblock is
+ * switched to the new one.
+ *
+ * 0. Under the log lock capture the metadata as the current log knows it
+ *    (committed fnodes, uncommitted extents are left to the deltas which
+ *    are still to be logged) and start mirroring: every transaction
+ *    written to the current log from now on is queued for the new log too.
+ *    Log extensions are queued as empty transactions to keep seq numbers
+ *    contiguous.
+ *
+ * 1. Without the lock build and write out the new log's starter and
+ *    compacted metadata. The latter jumps to the first mirrored seq.
+ *
+ * 2. Without the lock append the queued transactions to the new log
+ *    for a few passes to catch up with the current one.
+ *
+ * 3. Under the lock append what is left, write the superblock pointing
+ *    to the new log and make the log writer use it.
+ *
+ * 4. Release the old log's space.
+ */
+
+void BlueFS::_compact_log_mirror_LNF_L_D()
+{
+  dout(10) << __func__ << dendl;
+  utime_t mtime = ceph_clock_now();
+  uint64_t starter_seq = 1;
+
+  // Part 0.
+  log.lock.lock();
+  bool old_is_comp = std::atomic_exchange(&log_is_compacting, true);
+  if (old_is_comp) {
+    dout(10) << __func__ << " ongoing" << dendl;
+    log.lock.unlock();
+    return;
+  }
+  auto t0 = mono_clock::now();
+  File *log_file = log.writer->file.get();
+  uint64_t seq_now = log.seq_live;
+  ceph_assert(log.t.seq == seq_now);
+  if (seq_now <= starter_seq + 1) {
+    // nothing to jump over to, the log is tiny anyway
+    log_is_compacting = false;
+    log.lock.unlock();
+    return;
+  }
+  bluefs_transaction_t compacted_meta_t;
+  _compact_log_dump_metadata_NF(starter_seq + 1, &compacted_meta_t, 0, seq_now,
+				true);
+  // whatever is in log.t already is in compacted_meta_t as well
+  ceph_assert(log.mirror_q.empty());
+  log.mirror = true;
+  log.mirror_skip = log.t.op_bl.length();
+  uint8_t prefer_bdev = vselector->select_prefer_bdev(log_file->vselector_hint);
+  logger->tinc(l_bluefs_compaction_lock_lat, mono_clock::now() - t0);
+  log.lock.unlock();
+
+  // Part 1.
+  // New log is starter, compacted metadata and then mirrored transactions
+  // in the runway allocated along with the metadata.
+  uint64_t compacted_meta_need = _estimate_transaction_size(&compacted_meta_t);
+  bluefs_fnode_t fnode_tail;
+  int r = _allocate(prefer_bdev,
+		    compacted_meta_need + cct->_conf->bluefs_max_log_runway,
+		    0,
+		    &fnode_tail);
+  ceph_assert(r == 0);
+  FileRef new_log = ceph::make_ref<File>();
+  new_log->fnode.ino = log_file->fnode.ino;
+  new_log->fnode.mtime = mtime;
+  uint64_t starter_need =
+    _make_initial_transaction(starter_seq, fnode_tail, 0, nullptr);
+  r = _allocate(prefer_bdev, starter_need, 0, &new_log->fnode);
+  ceph_assert(r == 0);
+  // superblock refers the starter only
+  bluefs_fnode_t new_log_starter(new_log->fnode);
+  new_log->fnode.reset_delta();
+  new_log->fnode.claim_extents(fnode_tail.extents);
+
+  bufferlist starter_bl;
+  _make_initial_transaction(starter_seq, new_log->fnode, starter_need,
+    &starter_bl);
+  // next transaction is the first mirrored one
+  compacted_meta_t.op_jump(seq_now - 1, starter_need + compacted_meta_need);
+  bufferlist compacted_meta_bl;
+  compacted_meta_bl.reserve(compacted_meta_need);
+  encode(compacted_meta_t, compacted_meta_bl);
+  ceph_assert(compacted_meta_bl.length() <= compacted_meta_need);
+  _pad_bl(compacted_meta_bl, compacted_meta_need);
+
+  FileWriter *new_log_writer = _create_writer(new_log);
+  new_log_writer->append(starter_bl);
+  new_log_writer->append(compacted_meta_bl);
+  _flush_special(new_log_writer);
+  _flush_bdev(new_log_writer, false); // do not check log.lock is locked
+
+  // Part 2.
+  // Catch up. Ends with the log lock taken and the remainder in q.
+  bool ok = true;
+  std::vector<bluefs_transaction_t> q;
+  for (unsigned pass = 0; ; ++pass) {
+    log.lock.lock();
+    q.clear();
+    q.swap(log.mirror_q);
+    if (!ok || q.empty() || pass >= cct->_conf->bluefs_compact_log_mirror_passes) {
+      break;
+    }
+    log.lock.unlock();
+    ok = _compact_log_mirror_append(new_log_writer, prefer_bdev, q);
+  }
+
+  // Part 3.
+  auto t1 = mono_clock::now();
+  if (ok) {
+    ok = _compact_log_mirror_append(new_log_writer, prefer_bdev, q);
+  }
+  if (ok && log.mirror_skip) {
+    // the capture time transaction is still being built,
+    // its leading ops are in the compacted metadata already
+    bufferlist rest;
+    rest.substr_of(log.t.op_bl, log.mirror_skip,
+		   log.t.op_bl.length() - log.mirror_skip);
+    log.t.op_bl.swap(rest);
+  }
+  log.mirror = false;
+  log.mirror_skip = 0;
+  log.mirror_q.clear();
+  if (ok) {
+    super.log_fnode = new_log_starter;
+    _write_super(BDEV_DB);
+    _flush_bdev();
+
+    vselector->sub_usage(log_file->vselector_hint, log_file->fnode);
+    log_file->fnode.size = new_log->fnode.size;
+    log_file->fnode.mtime = std::max(mtime, log_file->fnode.mtime);
+    // new_log gets the old extents to release
+    log_file->fnode.swap_extents(new_log->fnode);
+    log.writer->pos = log_file->fnode.size;
+    vselector->add_usage(log_file->vselector_hint, log_file->fnode);
+    logger->set(l_bluefs_log_bytes, log_file->fnode.size);
+  }
+  logger->tinc(l_bluefs_compaction_lock_lat, mono_clock::now() - t1);
+  log.lock.unlock();
+
+  // Part 4.
+  if (ok) {
+    dout(10) << __func__ << " log extents " << log_file->fnode.extents
+	     << ", release old log extents " << new_log->fnode.extents
+	     << dendl;
+    logger->inc(l_bluefs_log_compactions);
+  } else {
+    derr << __func__ << " failed to catch up, new log extents "
+	 << new_log->fnode.extents << " dropped" << dendl;
+    logger->inc(l_bluefs_compaction_aborts);
+  }
+  {
+    std::lock_guard dl(dirty.lock);
+    for (auto& e : new_log->fnode.extents) {
+      dirty.pending_release[e.bdev].insert(e.offset, e.length);
+    }
+  }
+  _close_writer(new_log_writer);
+  new_log_writer = nullptr;
+  new_log = nullptr;
+
+  old_is_comp = atomic_exchange(&log_is_compacting, false);
+  ceph_assert(old_is_comp);
+}
+
+// Appends mirrored transactions to the log being built by compaction.
+// Returns false if they can't be placed, it's the caller to give up then.
+bool BlueFS::_compact_log_mirror_append(FileWriter *w,
+					uint8_t prefer_bdev,
+					std::vector<bluefs_transaction_t>& q)
+{
+  if (q.empty()) {
+    return true;
+  }
+  auto encode_q = [&](bufferlist& bl) {
+    for (auto& t : q) {
+      bufferlist tbl;
+      encode(t, tbl);
+      _pad_bl(tbl, super.block_size);
+      bl.claim_append(tbl);
+    }
+  };
+  bufferlist bl;
+  encode_q(bl);
+  uint64_t runway = w->file->fnode.get_allocated() - w->pos;
+  if (bl.length() + cct->_conf->bluefs_min_log_runway > runway) {
+    // extend the new log, the first transaction records that
+    uint64_t amount = round_up_to(bl.length() + cct->_conf->bluefs_max_log_runway,
+				  super.block_size);
+    int r = _allocate(prefer_bdev, amount, 0, &w->file->fnode);
+    if (r < 0) {
+      return false;
+    }
+    bluefs_transaction_t ext;
+    ext.op_file_update_inc(w->file->fnode);
+    ext.op_bl.claim_append(q.front().op_bl);
+    q.front().op_bl.swap(ext.op_bl);
+    bufferlist first;
+    encode(q.front(), first);
+    _pad_bl(first, super.block_size);
+    if (first.length() > runway) {
+      dout(1) << __func__ << " transaction seq " << q.front().seq
+	      << " doesn't fit runway 0x" << std::hex << runway << std::dec
+	      << dendl;
+      return false;
+    }
+    bl.clear();
+    encode_q(bl);
+  }
+  dout(20) << __func__ << " seq " << q.front().seq << "-" << q.back().seq
+	   << " 0x" << std::hex << bl.length() << std::dec << dendl;
+  logger->inc(l_bluefs_compaction_mirror_bytes, bl.length());
+  w->append(bl);
+  _flush_special(w);
+  _flush_bdev(w, false);
+  return true;
+}
+
 void BlueFS::_pad_bl(bufferlist& bl, uint64_t pad_size)
 {
   pad_size = std::max(pad_size, uint64_t(super.block_size));
@@ -3217,6 +3457,13 @@ void BlueFS::_extend_log(uint64_t amount) {
   _pad_bl(bl, super.block_size);
   log.writer->append(bl);
   ceph_assert(allocated_before_extension >= log.writer->get_effective_write_pos());
+  if (log.mirror) {
+    // the extension means nothing to the new log but its seq has to be there
+    bluefs_transaction_t m;
+    m.uuid = log_extend_transaction.uuid;
+    m.seq = log_extend_transaction.seq;
+    log.mirror_q.push_back(std::move(m));
+  }
 
   // before sync_core we advance the seq
   {
@@ -3251,6 +3498,17 @@ void BlueFS::_flush_and_sync_log_core()
 
 
   log.writer->append(bl);
+  if (log.mirror) {
+    bluefs_transaction_t m;
+    m.uuid = log.t.uuid;
+    m.seq = log.t.seq;
+    if (log.mirror_skip < log.t.op_bl.length()) {
+      m.op_bl.substr_of(log.t.op_bl, log.mirror_skip,
+			log.t.op_bl.length() - log.mirror_skip);
+    }
+    log.mirror_skip = 0;
+    log.mirror_q.push_back(std::move(m));
+  }
 
   // prepare log for new transactions
   log.t.clear();
@@ -4097,6 +4355,8 @@ void BlueFS::_maybe_compact_log_LNF_NF_LD_D()
     auto t0 = mono_clock::now();
     if (cct->_conf->bluefs_compact_log_sync) {
       _compact_log_sync_LNF_LD();
+    } else if (cct->_conf->bluefs_compact_log_mirror) {
+      _compact_log_mirror_LNF_L_D();
     } else {
       _compact_log_async_LD_LNF_D();
     }
@@ -71,6 +71,8 @@ enum {
   l_bluefs_write_bytes,
   l_bluefs_compaction_lat,
   l_bluefs_compaction_lock_lat,
+  l_bluefs_compaction_mirror_bytes,
+  l_bluefs_compaction_aborts,
   l_bluefs_fsync_lat,
   l_bluefs_flush_lat,
   l_bluefs_unlink_lat,
@@ -463,6 +465,11 @@ private:
     uint64_t seq_live = 1;   //seq that log is currently writing to; mirrors dirty.seq_live
     FileWriter *writer = 0;
     bluefs_transaction_t t;
+    // set while a background compaction builds the new log: transactions
+    // written to the current log are queued to be appended to the new one
+    bool mirror = false;
+    uint64_t mirror_skip = 0;  ///< leading bytes of t covered by the new log
+    std::vector<bluefs_transaction_t> mirror_q;
   } log;
 
   struct {
@@ -584,10 +591,15 @@ private:
   void _compact_log_dump_metadata_NF(uint64_t start_seq,
                                      bluefs_transaction_t *t,
 				     int flags,
-				     uint64_t capture_before_seq);
+				     uint64_t capture_before_seq,
+				     bool committed = false);
 
   void _compact_log_sync_LNF_LD();
   void _compact_log_async_LD_LNF_D();
+  void _compact_log_mirror_LNF_L_D();
+  bool _compact_log_mirror_append(FileWriter *w,
+				  uint8_t prefer_bdev,
+				  std::vector<bluefs_transaction_t>& q);
 
   void _rewrite_log_and_layout_sync_LNF_LD(bool permit_dev_fallback,
 				    int super_dev,
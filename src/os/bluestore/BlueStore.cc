@@ -34,13 +34,17 @@
 #include "include/compat.h"
 #include "include/intarith.h"
 #include "include/stringify.h"
+#include "include/str_list.h"
 #include "include/str_map.h"
 #include "include/util.h"
+#include "common/admin_socket.h"
 #include "common/errno.h"
 #include "common/safe_io.h"
+#include "common/strtol.h"
 #include "common/PriorityCache.h"
 #include "common/url_escape.h"
 #include "Allocator.h"
+#include "FrontCacheAllocator.h"
 #include "FreelistManager.h"
 #include "BlueFS.h"
 #include "BlueRocksEnv.h"
@@ -128,6 +132,7 @@ const string PREFIX_DEFERRED = "L";    // id -> deferred_transaction_t
 const string PREFIX_ALLOC = "B";       // u64 offset -> u64 length (freelist)
 const string PREFIX_ALLOC_BITMAP = "b";// (see BitmapFreelistManager)
 const string PREFIX_SHARED_BLOB = "X"; // u64 SB id -> shared_blob_t
+const string PREFIX_ALLOC_JOURNAL = "J"; // u32 serial + u64 seq -> alloc deltas (NCB)
 
 const string BLUESTORE_GLOBAL_STATFS_KEY = "bluestore_statfs";
 
@@ -543,6 +548,24 @@ static void get_deferred_key(uint64_t seq, string *out)
   _key_encode_u64(seq, out);
 }
 
+/*
+ * allocation journal keys: records of an allocation-file serial sort
+ * after that serial's stats key (the bare serial), so a serial's base
+ * statfs is always seen before the records applied on top of it.
+ */
+static void get_alloc_journal_key(uint32_t serial, uint64_t seq, string *out)
+{
+  out->clear();
+  _key_encode_u32(serial, out);
+  _key_encode_u64(seq, out);
+}
+
+static void get_alloc_journal_stats_key(uint32_t serial, string *out)
+{
+  out->clear();
+  _key_encode_u32(serial, out);
+}
+
 static void get_pool_stat_key(int64_t pool_id, string *key)
 {
   key->clear();
@@ -1073,7 +1096,8 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
 
   list_t lru;
 
-  explicit LruOnodeCacheShard(CephContext *cct) : BlueStore::OnodeCacheShard(cct) {}
+  explicit LruOnodeCacheShard(CephContext *cct, bool shared_lookup = false)
+    : BlueStore::OnodeCacheShard(cct, shared_lookup) {}
 
   void _add(BlueStore::Onode* o, int level) override
   {
@@ -1118,13 +1142,18 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
 	  dout(20) << __func__ << " " << this << " " << o->oid << " unpinned"
                    << dendl;
         } else {
-	  ceph_assert(num);
-	  --num;
-	  o->clear_cached();
-	  dout(20) << __func__ << " " << this << " " << o->oid << " removed"
-                   << dendl;
-          // remove will also decrement nref
-          o->c->onode_space._remove(o->oid);
+          // with shared lookups the onode can be re-pinned until we own
+          // the map, so re-check once we do
+          auto ml = o->c->onode_space._lock_map();
+          if (o->pin_nref == 1) {
+	    ceph_assert(num);
+	    --num;
+	    o->clear_cached();
+	    dout(20) << __func__ << " " << this << " " << o->oid << " removed"
+                     << dendl;
+            // remove will also decrement nref
+            o->c->onode_space._remove(o->oid);
+          }
         }
       } else if (o->exists) {
         // move onode within LRU
@@ -1159,6 +1188,7 @@ struct LruOnodeCacheShard : public BlueStore::OnodeCacheShard {
                << o->nref << " " << o->cached << dendl;
 
       *(o->cache_age_bin) -= 1;
+      auto ml = o->c->onode_space._lock_map();
       if (o->pin_nref > 1) {
         dout(20) << __func__ << " " << this << " " << " " << " " << o->oid << dendl;
       } else {
@@ -1198,8 +1228,12 @@ BlueStore::OnodeCacheShard *BlueStore::OnodeCacheShard::create(
     PerfCounters *logger)
 {
   BlueStore::OnodeCacheShard *c = nullptr;
-  // Currently we only implement an LRU cache for onodes
-  c = new LruOnodeCacheShard(cct);
+  // Currently we only implement an LRU cache for onodes; "lru_shared"
+  // differs in how OnodeSpace lookups are serialized.
+  if (type == "lru_shared")
+    c = new LruOnodeCacheShard(cct, true);
+  else
+    c = new LruOnodeCacheShard(cct);
   c->logger = logger;
   return c;
 }
@@ -1956,12 +1990,17 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::add_onode(const ghobject_t& oid,
 {
   std::lock_guard l(cache->lock);
   // add entry or return existing one
-  auto p = onode_map.emplace(oid, o);
-  if (!p.second) {
+  decltype(onode_map)::iterator it;
+  bool inserted;
+  {
+    auto ml = _lock_map();
+    std::tie(it, inserted) = onode_map.emplace(oid, o);
+  }
+  if (!inserted) {
     ldout(cache->cct, 30) << __func__ << " " << oid << " " << o
-			  << " raced, returning existing " << p.first->second
+			  << " raced, returning existing " << it->second
 			  << dendl;
-    return p.first->second;
+    return it->second;
   }
   ldout(cache->cct, 20) << __func__ << " " << oid << " " << o << dendl;
   cache->_add(o.get(), 1);
@@ -1981,7 +2020,16 @@ BlueStore::OnodeRef BlueStore::OnodeSpace::lookup(const ghobject_t& oid)
   OnodeRef o;
 
   {
-    std::lock_guard l(cache->lock);
+    std::unique_lock l(cache->lock, std::defer_lock);
+    std::shared_lock sl(map_lock, std::defer_lock);
+    bool locked = cache->shared_lookup ? sl.try_lock() : l.try_lock();
+    if (!locked) {
+      auto start = mono_clock::now();
+      cache->shared_lookup ? sl.lock() : l.lock();
+      cache->logger->inc(l_bluestore_onode_lookup_contended);
+      cache->logger->tinc(l_bluestore_onode_lookup_wait_lat,
+			  mono_clock::now() - start);
+    }
     ceph::unordered_map<ghobject_t,OnodeRef>::iterator p = onode_map.find(oid);
     if (p == onode_map.end()) {
       ldout(cache->cct, 30) << __func__ << " " << oid << " miss" << dendl;
@@ -2009,6 +2057,8 @@ void BlueStore::OnodeSpace::clear()
   for (auto &p : onode_map) {
     cache->_rm(p.second.get());
   }
+  // onodes are no longer cached, so dropping them can't re-enter map_lock
+  auto ml = _lock_map();
   onode_map.clear();
 }
 
@@ -2033,23 +2083,29 @@ void BlueStore::OnodeSpace::rename(
   ceph_assert(po != pn);
 
   ceph_assert(po != onode_map.end());
-  if (pn != onode_map.end()) {
-    ldout(cache->cct, 30) << __func__ << "  removing target " << pn->second
-			  << dendl;
-    cache->_rm(pn->second.get());
-    onode_map.erase(pn);
-  }
   OnodeRef o = po->second;
 
   // install a non-existent onode at old location
   oldo.reset(new Onode(o->c, old_oid, o->key));
-  po->second = oldo;
+  // takes over the old location's ref to 'o'; dropped only after
+  // map_lock is released as that may unpin 'o'
+  OnodeRef replaced = oldo;
+  {
+    auto ml = _lock_map();
+    if (pn != onode_map.end()) {
+      ldout(cache->cct, 30) << __func__ << "  removing target " << pn->second
+			    << dendl;
+      cache->_rm(pn->second.get());
+      onode_map.erase(pn);
+    }
+    po->second.swap(replaced);
+    // add at new position.
+    // This will pin 'o' and implicitly touch cache
+    // when it will eventually become unpinned
+    onode_map.insert(make_pair(new_oid, o));
+  }
   cache->_add(oldo.get(), 1);
-  // add at new position and fix oid, key.
-  // This will pin 'o' and implicitly touch cache
-  // when it will eventually become unpinned
-  onode_map.insert(make_pair(new_oid, o));
-
+  // fix oid, key.
   o->oid = new_oid;
   o->key = new_okey;
   cache->_trim();
@@ -4181,11 +4237,13 @@ void BlueStore::ExtentMap::encode_spanning_blobs(
 void BlueStore::ExtentMap::init_shards(bool loaded, bool dirty)
 {
   shards.resize(onode->onode.extent_map_shards.size());
+  prefetched_shards = 0;
   unsigned i = 0;
   for (auto &s : onode->onode.extent_map_shards) {
     shards[i].shard_info = &s;
     shards[i].loaded = loaded;
     shards[i].dirty = dirty;
+    shards[i].prefetched = false;
     ++i;
   }
 }
@@ -4193,10 +4251,11 @@ void BlueStore::ExtentMap::init_shards(bool loaded, bool dirty)
 void BlueStore::ExtentMap::fault_range(
   KeyValueDB *db,
   uint32_t offset,
-  uint32_t length)
+  uint32_t length,
+  unsigned prefetch)
 {
   dout(30) << __func__ << " 0x" << std::hex << offset << "~" << length
-	   << std::dec << dendl;
+	   << std::dec << " prefetch " << prefetch << dendl;
   if (shards.size() == 0) {
     // no sharding yet; everyting is loaded
     return;
@@ -4205,41 +4264,100 @@ void BlueStore::ExtentMap::fault_range(
   auto last = seek_shard(offset + length);
   ceph_assert(last >= start);
   ceph_assert(start >= 0);
+  auto end = std::min<int>(last + prefetch, shards.size() - 1);
 
+  auto logger = onode->c->store->logger;
   string key;
-  while (start <= last) {
-    ceph_assert((size_t)start < shards.size());
-    auto p = &shards[start];
+  std::set<string> keys;
+  std::map<string, int> key_shard;
+  for (int i = start; i <= end; ++i) {
+    ceph_assert((size_t)i < shards.size());
+    auto p = &shards[i];
     if (!p->loaded) {
-      dout(30) << __func__ << " opening shard 0x" << std::hex
-	       << p->shard_info->offset << std::dec << dendl;
-      bufferlist v;
       generate_extent_shard_key_and_apply(
 	onode->key, p->shard_info->offset, &key,
-        [&](const string& final_key) {
-          int r = db->get(PREFIX_OBJ, final_key, &v);
-          if (r < 0) {
-	    derr << __func__ << " missing shard 0x" << std::hex
-		 << p->shard_info->offset << std::dec << " for " << onode->oid
-		 << dendl;
-	    ceph_assert(r >= 0);
-          }
-        }
+	[&](const string& final_key) {
+	  keys.insert(final_key);
+	  key_shard[final_key] = i;
+	}
       );
-      p->extents = decode_some(v);
-      p->loaded = true;
-      dout(20) << __func__ << " open shard 0x" << std::hex
-	       << p->shard_info->offset
-	       << " for range 0x" << offset << "~" << length << std::dec
-	       << " (" << v.length() << " bytes)" << dendl;
-      ceph_assert(p->dirty == false);
-      ceph_assert(v.length() == p->shard_info->bytes);
-      onode->c->store->logger->inc(l_bluestore_onode_shard_misses);
+    } else if (i <= last) {
+      if (p->prefetched) {
+	p->prefetched = false;
+	ceph_assert(prefetched_shards > 0);
+	--prefetched_shards;
+	logger->inc(l_bluestore_onode_shard_prefetch_hits);
+      }
+      logger->inc(l_bluestore_onode_shard_hits);
+    }
+  }
+  if (keys.empty()) {
+    return;
+  }
+
+  // fetch all missing shards at once
+  std::map<string, bufferlist> vals;
+  if (keys.size() == 1) {
+    int r = db->get(PREFIX_OBJ, *keys.begin(), &vals[*keys.begin()]);
+    if (r < 0) {
+      vals.clear();
+    }
+  } else {
+    db->get(PREFIX_OBJ, keys, &vals);
+  }
+  for (auto& [k, i] : key_shard) {
+    auto p = &shards[i];
+    auto v = vals.find(k);
+    if (v == vals.end()) {
+      derr << __func__ << " missing shard 0x" << std::hex
+	   << p->shard_info->offset << std::dec << " for " << onode->oid
+	   << dendl;
+      ceph_assert(v != vals.end());
+    }
+    p->extents = decode_some(v->second);
+    p->loaded = true;
+    dout(20) << __func__ << " open shard 0x" << std::hex
+	     << p->shard_info->offset
+	     << " for range 0x" << offset << "~" << length << std::dec
+	     << " (" << v->second.length() << " bytes)"
+	     << (i > last ? " prefetch" : "") << dendl;
+    ceph_assert(p->dirty == false);
+    ceph_assert(v->second.length() == p->shard_info->bytes);
+    if (i > last) {
+      p->prefetched = true;
+      ++prefetched_shards;
+      logger->inc(l_bluestore_onode_shard_prefetch);
     } else {
-      onode->c->store->logger->inc(l_bluestore_onode_shard_hits);
+      logger->inc(l_bluestore_onode_shard_misses);
+    }
+  }
+}
+
+void BlueStore::ExtentMap::fault_range_read(
+  KeyValueDB *db,
+  uint32_t offset,
+  uint32_t length)
+{
+  unsigned prefetch = 0;
+  if (offset == seq_read_end && offset != 0) {
+    if (seq_reads < std::numeric_limits<decltype(seq_reads)>::max()) {
+      ++seq_reads;
+    }
+    prefetch = onode->c->store->extent_map_prefetch_shards;
+  } else {
+    seq_reads = 0;
+    if (prefetched_shards) {
+      // the stream we read ahead for is gone
+      onode->c->store->logger->inc(l_bluestore_onode_shard_prefetch_wasted,
+				   prefetched_shards);
+      for (auto& s : shards) {
+	s.prefetched = false;
+      }
+      prefetched_shards = 0;
     }
-    ++start;
   }
+  seq_read_end = offset + length;
+  fault_range(db, offset, length, prefetch);
 }
 
 void BlueStore::ExtentMap::dirty_range(
@@ -5156,8 +5274,12 @@ void BlueStore::Collection::split_cache(
       // ensuring that nref is always >= 2 and hence onode is pinned
       OnodeRef o_pin = o;
 
-      p = onode_space.onode_map.erase(p);
-      dest->onode_space.onode_map[o->oid] = o;
+      {
+	auto ml = onode_space._lock_map();
+	auto ml2 = dest->onode_space._lock_map();
+	p = onode_space.onode_map.erase(p);
+	dest->onode_space.onode_map[o->oid] = o;
+      }
       if (o->cached) {
         get_onode_cache()->_move_pinned(dest->get_onode_cache(), o.get());
       }
@@ -5657,6 +5779,8 @@ BlueStore::BlueStore(CephContext *cct,
     finisher(cct, "commit_finisher", "cfin"),
     kv_sync_thread(this),
     kv_finalize_thread(this),
+    alloc_journal_thread(this),
+    compressed_gc_thread(this),
     min_alloc_size(_min_alloc_size),
     min_alloc_size_order(std::countr_zero(_min_alloc_size)),
     mempool_thread(this)
@@ -5729,6 +5853,8 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_warn_on_no_per_pool_omap",
     "bluestore_warn_on_no_per_pg_omap",
     "bluestore_max_defer_interval",
+    "bluestore_extent_map_prefetch_shards",
+    "bluestore_compressed_gc_interval",
     NULL
   };
   return KEYS;
@@ -5793,6 +5919,13 @@ void BlueStore::handle_conf_change(const ConfigProxy& conf,
       _set_max_defer_interval();
     }
   }
+  if (changed.count("bluestore_extent_map_prefetch_shards")) {
+    _set_extent_map_prefetch();
+  }
+  if (changed.count("bluestore_compressed_gc_interval")) {
+    std::lock_guard l(compressed_gc_lock);
+    compressed_gc_cond.notify_all();
+  }
   if (changed.count("osd_memory_target") ||
       changed.count("osd_memory_base") ||
       changed.count("osd_memory_cache_min") ||
@@ -6243,6 +6376,15 @@ void BlueStore::_init_logger()
 		    NULL,
 		    PerfCountersBuilder::PRIO_DEBUGONLY,
 		    unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_submitted_deferred_batches,
+		    "submitted_deferred_batches",
+		    "Total deferred write batches submitted to disk");
+  b.add_u64_avg(l_bluestore_deferred_batch_extents,
+		"deferred_batch_extents",
+		"Average number of extents in a submitted deferred batch");
+  b.add_u64_avg(l_bluestore_deferred_batch_ios,
+		"deferred_batch_ios",
+		"Average number of disk writes a deferred batch is coalesced into");
 
   b.add_u64_counter(l_bluestore_write_big_skipped_blobs,
       "write_big_skipped_blobs",
@@ -6298,6 +6440,20 @@ void BlueStore::_init_logger()
   b.add_u64_counter(l_bluestore_onode_shard_misses,
 		    "onode_shard_misses",
 		    "Count of onode shard cache lookups misses");
+  b.add_u64_counter(l_bluestore_onode_shard_prefetch,
+		    "onode_shard_prefetch",
+		    "Count of onode shards loaded ahead of sequential reads");
+  b.add_u64_counter(l_bluestore_onode_shard_prefetch_hits,
+		    "onode_shard_prefetch_hits",
+		    "Count of prefetched onode shards used by a later read");
+  b.add_u64_counter(l_bluestore_onode_shard_prefetch_wasted,
+		    "onode_shard_prefetch_wasted",
+		    "Count of prefetched onode shards not used before the read stream broke");
+  b.add_u64_counter(l_bluestore_onode_lookup_contended,
+		    "onode_lookup_contended",
+		    "Count of onode cache lookups that had to wait for a lock");
+  b.add_time_avg(l_bluestore_onode_lookup_wait_lat, "onode_lookup_wait_lat",
+		 "Average wait for the onode cache lock by contended lookups");
   b.add_u64(l_bluestore_extents, "onode_extents",
 	    "Number of extents in cache");
   b.add_u64(l_bluestore_blobs, "onode_blobs",
@@ -6323,6 +6479,14 @@ void BlueStore::_init_logger()
 	    NULL,
 	    PerfCountersBuilder::PRIO_DEBUGONLY,
 	    unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_read_bypass_cache, "read_bypass_cache",
+	    "Count of large reads not inserted into the cache");
+  b.add_u64_counter(l_bluestore_read_bypass_cache_bytes,
+	    "read_bypass_cache_bytes",
+	    "Sum for bytes of large reads not inserted into the cache",
+	    NULL,
+	    PerfCountersBuilder::PRIO_DEBUGONLY,
+	    unit_t(UNIT_BYTES));
   //****************************************
 
   // internal stats
@@ -6336,6 +6500,15 @@ void BlueStore::_init_logger()
   b.add_u64_counter(l_bluestore_gc_merged, "gc_merged",
 		    "Sum for extents that have been merged due to garbage "
 		    "collection");
+  b.add_u64_counter(l_bluestore_compressed_gc_scanned, "compressed_gc_scanned",
+		    "Objects scanned by background compressed blob GC");
+  b.add_u64_counter(l_bluestore_compressed_gc_blobs, "compressed_gc_blobs",
+		    "Compressed blobs rewritten by background GC");
+  b.add_u64_counter(l_bluestore_compressed_gc_bytes, "compressed_gc_bytes",
+		    "Logical bytes rewritten by background compressed blob GC",
+		    NULL,
+		    PerfCountersBuilder::PRIO_DEBUGONLY,
+		    unit_t(UNIT_BYTES));
   //****************************************
   // misc
   //****************************************
@@ -6437,6 +6610,19 @@ void BlueStore::_init_logger()
     "Average bluestore allocator latency",
     "bsal",
     PerfCountersBuilder::PRIO_USEFUL);
+  b.add_u64_counter(l_bluestore_alloc_cache_hit, "alloc_cache_hit",
+    "Allocations served by the allocator front cache");
+  b.add_u64_counter(l_bluestore_alloc_cache_miss, "alloc_cache_miss",
+    "Allocations passed through the allocator front cache");
+  b.add_u64_counter(l_bluestore_alloc_cache_refill, "alloc_cache_refill",
+    "Batched allocations refilling the allocator front cache");
+  b.add_u64_counter(l_bluestore_alloc_cache_drain, "alloc_cache_drain",
+    "Batched releases draining the allocator front cache");
+  b.add_u64(l_bluestore_alloc_cache_bytes, "alloc_cache_bytes",
+    "Free space held by the allocator front cache",
+    "acb",
+    PerfCountersBuilder::PRIO_USEFUL,
+    unit_t(UNIT_BYTES));
 
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
@@ -6663,6 +6849,7 @@ int BlueStore::_open_bdev(bool create)
   block_size_order = std::countr_zero(block_size);
   ceph_assert(block_size == 1u << block_size_order);
   _set_max_defer_interval();
+  _set_extent_map_prefetch();
   // and set cache_size based on device type
   r = _set_cache_sizes();
   if (r < 0) {
@@ -6875,16 +7062,39 @@ int BlueStore::_create_alloc()
 
   std::string allocator_type = cct->_conf->bluestore_allocator;
 
+  bool front_cache = cct->_conf.get_val<bool>("bluestore_allocator_front_cache");
+  // the front cache takes over the "block" name, so the admin socket
+  // commands report free space including the cached extents while the
+  // backend can still be inspected on its own
   alloc = Allocator::create(
     cct, allocator_type,
     bdev->get_size(),
     alloc_size,
-    "block");
+    front_cache ? "block-backend" : "block");
   if (!alloc) {
     lderr(cct) << __func__ << " failed to create " << allocator_type << " allocator"
 	       << dendl;
     return -EINVAL;
   }
+  if (front_cache) {
+    std::vector<uint64_t> sizes = { alloc_size };
+    for (auto& s : get_str_list(
+	   cct->_conf.get_val<std::string>("bluestore_allocator_front_cache_sizes"))) {
+      std::string err;
+      uint64_t size = strict_iecstrtoll(s, &err);
+      if (!err.empty()) {
+	derr << __func__ << " ignoring front cache size '" << s << "': "
+	     << err << dendl;
+	continue;
+      }
+      sizes.push_back(size);
+    }
+    alloc_front_cache = new FrontCacheAllocator(
+      cct, alloc, sizes,
+      cct->_conf.get_val<Option::size_t>("bluestore_allocator_front_cache_batch"),
+      "block");
+    alloc = alloc_front_cache;
+  }
 
   // BlueFS will share the same allocator
   shared_alloc.set(alloc, alloc_size);
@@ -6938,6 +7148,11 @@ int BlueStore::_init_alloc(std::map<uint64_t, uint64_t> *zone_adjustments)
 	derr << __func__ << "::NCB::If no HW fault is found, please report failure and consider redeploying OSD" << dendl;
 	return -ENOTRECOVERABLE;
       }
+      if (cct->_conf.get_val<bool>("bluestore_allocation_journal")) {
+	// keep the rebuilt state (db is still read-only, so bluefs is stable)
+	// to seed a fresh allocation file once the journal is opened
+	alloc_journal_base.reset(clone_allocator_without_bluefs(alloc));
+      }
     }
   }
   dout(1) << __func__
@@ -6956,7 +7171,8 @@ int BlueStore::_init_alloc(std::map<uint64_t, uint64_t> *zone_adjustments)
 void BlueStore::_post_init_alloc(const std::map<uint64_t, uint64_t>& zone_adjustments)
 {
   int r = 0;
-  if (fm->is_null_manager()) {
+  if (fm->is_null_manager() &&
+      !cct->_conf.get_val<bool>("bluestore_allocation_journal")) {
     // Now that we load the allocation map we need to invalidate the file as new allocation won't be reflected
     // Changes to the allocation map (alloc/release) are not updated inline and will only be stored on umount()
     // This means that we should not use the existing file on failure case (unplanned shutdown) and must resort
@@ -6983,6 +7199,8 @@ void BlueStore::_close_alloc()
 
   shared_alloc.reset();
   alloc = nullptr;
+  alloc_front_cache = nullptr;
+  alloc_journal_base.reset();
 }
 
 int BlueStore::_open_fsid(bool create)
@@ -7440,16 +7658,16 @@ int BlueStore::_open_db_and_around(bool read_only, bool to_repair)
   // when function is called in repair mode (to_repair=true) we skip db->open()/create()
   // we can't change bluestore allocation so no need to invlidate allocation-file
   if (fm->is_null_manager() && !read_only && !to_repair) {
-    // Now that we load the allocation map we need to invalidate the file as new allocation won't be reflected
-    // Changes to the allocation map (alloc/release) are not updated inline and will only be stored on umount()
-    // This means that we should not use the existing file on failure case (unplanned shutdown) and must resort
-    //  to recovery from RocksDB::ONodes
-    r = invalidate_allocation_file_on_bluefs();
+    // Either journal allocation changes on top of the allocation file, or
+    // invalidate it as new allocations won't be reflected in it (and will
+    // only be stored on umount()).
+    r = _open_alloc_journal();
     if (r != 0) {
-      derr << __func__ << "::NCB::invalidate_allocation_file_on_bluefs() failed!" << dendl;
+      derr << __func__ << "::NCB::_open_alloc_journal() failed!" << dendl;
       goto out_alloc;
     }
   }
+  alloc_journal_base.reset();
 
   // when function is called in repair mode (to_repair=true) we skip db->open()/create()
   if (!is_db_rotational() && !read_only && !to_repair && cct->_conf->bluestore_allocation_from_file) {
@@ -7779,6 +7997,9 @@ void BlueStore::_close_db()
       t->set(PREFIX_STAT, BLUESTORE_GLOBAL_STATFS_KEY, bl);
       dout(10) << __func__ << "persisting: " << s << dendl;
     }
+    if (alloc_journal_active) {
+      _alloc_journal_prepare_close(t);
+    }
     int r = db->submit_transaction_sync(t);
     dout(10) << __func__ << " statfs persisted." << dendl;
     ceph_assert(r >= 0);
@@ -7810,6 +8031,7 @@ void BlueStore::_close_db()
       derr << __func__ << "::NCB::store_allocator() failed (we will need to rebuild it on startup)" << dendl;
     }
   }
+  alloc_journal_active = false;
 
   if (bluefs) {
     _close_bluefs();
@@ -8658,8 +8880,9 @@ void BlueStore::set_cache_shards(unsigned num)
   buffer_cache_shards.resize(num);
   for (unsigned i = oold; i < num; ++i) {
     onode_cache_shards[i] = 
-        OnodeCacheShard::create(cct, cct->_conf->bluestore_cache_type,
-                                 logger);
+        OnodeCacheShard::create(cct,
+          cct->_conf.get_val<std::string>("bluestore_onode_cache_type"),
+          logger);
   }
   for (unsigned i = bold; i < num; ++i) {
     buffer_cache_shards[i] = 
@@ -8888,6 +9111,8 @@ int BlueStore::_mount()
     }
   }
 
+  _compressed_gc_start();
+
   mounted = true;
   return 0;
 }
@@ -8896,6 +9121,7 @@ int BlueStore::umount()
 {
   dout(5) << __func__ << dendl;
   ceph_assert(_kv_only || mounted);
+  _compressed_gc_stop();
   _osr_drain_all();
 
   mounted = false;
@@ -8977,7 +9203,8 @@ int BlueStore::_fsck_check_extents(
   BlueStoreRepairer* repairer,
   store_statfs_t& expected_statfs,
   BlueStore::pool_fsck_stats_t& pool_fsck_stat,
-  FSCKDepth depth)
+  FSCKDepth depth,
+  ceph::mutex* used_lock)
 {
   dout(30) << __func__ << " " << ctx_descr << ", extents " << extents << dendl;
   int errors = 0;
@@ -8991,6 +9218,10 @@ int BlueStore::_fsck_check_extents(
     }
     if (depth != FSCK_SHALLOW) {
       bool already = false;
+      std::unique_lock<ceph::mutex> l;
+      if (used_lock) {
+	l = std::unique_lock(*used_lock);
+      }
       apply_for_bitset_range(
         e.offset, e.length, granularity, used_blocks,
         [&](uint64_t pos, mempool_dynamic_bitset &bs) {
@@ -9009,6 +9240,9 @@ int BlueStore::_fsck_check_extents(
 	  else
 	    bs.set(pos);
         });
+      if (l.owns_lock()) {
+	l.unlock();
+      }
 
       if (e.end() > bdev->get_size()) {
         derr << "fsck error:  " << ctx_descr << ", extent " << e
@@ -9468,7 +9702,8 @@ BlueStore::OnodeRef BlueStore::fsck_check_objects_shallow(
         repairer,
         *res_statfs,
         *pool_fsck_stat,
-        depth);
+        depth,
+        ctx.used_lock);
     } else {
       errors += _fsck_sum_extents(
         blob.get_extents(),
@@ -9918,269 +10153,673 @@ void BlueStore::_fsck_check_object_omap(FSCKDepth depth,
   }
 }
 
-void BlueStore::_fsck_check_objects(
-  FSCKDepth depth,
-  BlueStore::FSCK_ObjectCtx& ctx)
+/*
+ * Runs fn(worker, task) for every task in [0, tasks) on up to @threads
+ * workers, the calling thread being the worker 0.
+ */
+static void fsck_run_parallel(
+  size_t threads,
+  size_t tasks,
+  std::function<void(size_t, size_t)> fn)
 {
-  auto& errors = ctx.errors;
-  auto sb_info_lock = ctx.sb_info_lock;
-  auto& sb_info = ctx.sb_info;
-  auto& sb_ref_counts = ctx.sb_ref_counts;
-  auto repairer = ctx.repairer;
-
-  uint64_t_btree_t used_nids;
+  std::atomic<size_t> next = {0};
+  auto work = [&](size_t worker) {
+    for (size_t t = next++; t < tasks; t = next++) {
+      fn(worker, t);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(threads, tasks); ++i) {
+    workers.emplace_back(make_named_thread("bstore_fsck", work, i));
+  }
+  work(0);
+  for (auto& t : workers) {
+    t.join();
+  }
+}
 
-  size_t processed_myself = 0;
+/*
+ * Per worker counterpart of the FSCK_ObjectCtx accumulators, merged into
+ * the shared ones once all the workers are done.
+ */
+struct fsck_worker_stats_t {
+  int64_t errors = 0;
+  int64_t warnings = 0;
+  uint64_t num_objects = 0;
+  uint64_t num_extents = 0;
+  uint64_t num_blobs = 0;
+  uint64_t num_sharded_objects = 0;
+  uint64_t num_spanning_blobs = 0;
+  uint64_t num_shared_blobs = 0;
+  size_t processed = 0;
+  store_statfs_t expected_store_statfs;
+  BlueStore::per_pool_statfs expected_pool_statfs;
+  BlueStore::per_pool_fsck_stats_t per_pool_fsck_stats;
+
+  // counters are zeroed so that the worker context can be reused for
+  // the next phase
+  void merge_to(BlueStore::FSCK_ObjectCtx& ctx) {
+    ctx.errors += errors;
+    ctx.warnings += warnings;
+    ctx.num_objects += num_objects;
+    ctx.num_extents += num_extents;
+    ctx.num_blobs += num_blobs;
+    ctx.num_sharded_objects += num_sharded_objects;
+    ctx.num_spanning_blobs += num_spanning_blobs;
+    ctx.expected_store_statfs.add(expected_store_statfs);
+    for (auto& [pool, statfs] : expected_pool_statfs) {
+      ctx.expected_pool_statfs[pool].add(statfs);
+    }
+    for (auto& [pool, stats] : per_pool_fsck_stats) {
+      ctx.per_pool_fsck_stats[pool].add(stats);
+    }
+    *this = fsck_worker_stats_t();
+  }
+};
 
-  auto it = db->get_iterator(PREFIX_OBJ, KeyValueDB::ITERATOR_NOCACHE);
-  mempool::bluestore_fsck::list<string> expecting_shards;
-  if (it) {
-    const size_t thread_count = cct->_conf->bluestore_fsck_quick_fix_threads;
-    typedef ShallowFSCKThreadPool::FSCKWorkQueue<256> WQ;
-    std::unique_ptr<WQ> wq(
-      new WQ(
-        "FSCKWorkQueue",
-        (thread_count ? : 1) * 32,
-        this,
-        sb_info_lock,
-        sb_info,
-	sb_ref_counts,
-        repairer));
+using fsck_range_fn_t = std::function<void(BlueStore::FSCK_ObjectCtx&,
+                                           fsck_worker_stats_t&,
+                                           const std::string& first,
+                                           const std::string& last)>;
 
-    ShallowFSCKThreadPool thread_pool(cct, "ShallowFSCKThreadPool", "ShallowFSCK", thread_count);
+/*
+ * Checks every key range delimited by @splits with a worker private
+ * context (sharing the lookup structures of @ctx) and merges the results
+ * into @ctx.
+ */
+static void fsck_run_ranges(
+  size_t threads,
+  const std::vector<std::string>& splits,
+  BlueStore::FSCK_ObjectCtx& ctx,
+  ceph::mutex* sb_info_lock,
+  const fsck_range_fn_t& fn,
+  uint64_t* num_shared_blobs = nullptr)
+{
+  ceph::mutex used_lock = ceph::make_mutex("BlueStore::fsck::used_lock");
+  std::vector<fsck_worker_stats_t> stats(threads);
+  std::vector<std::unique_ptr<BlueStore::FSCK_ObjectCtx>> ctxs;
+  for (auto& st : stats) {
+    ctxs.emplace_back(std::make_unique<BlueStore::FSCK_ObjectCtx>(
+      st.errors,
+      st.warnings,
+      st.num_objects,
+      st.num_extents,
+      st.num_blobs,
+      st.num_sharded_objects,
+      st.num_spanning_blobs,
+      ctx.used_blocks,
+      ctx.used_omap_head,
+      ctx.zone_refs,
+      sb_info_lock,
+      ctx.sb_info,
+      ctx.sb_ref_counts,
+      st.expected_store_statfs,
+      st.expected_pool_statfs,
+      st.per_pool_fsck_stats,
+      ctx.repairer));
+    ctxs.back()->used_lock = &used_lock;
+  }
+  fsck_run_parallel(threads, splits.size() + 1,
+    [&](size_t worker, size_t task) {
+      fn(*ctxs[worker], stats[worker],
+         task > 0 ? splits[task - 1] : std::string(),
+         task < splits.size() ? splits[task] : std::string());
+    });
+  for (auto& st : stats) {
+    if (num_shared_blobs) {
+      *num_shared_blobs += st.num_shared_blobs;
+    }
+    st.merge_to(ctx);
+  }
+}
 
-    thread_pool.add_work_queue(wq.get());
-    if (depth == FSCK_SHALLOW && thread_count > 0) {
-      //not the best place but let's check anyway
-      ceph_assert(sb_info_lock);
-      thread_pool.start();
+void BlueStore::_fsck_get_split_keys(
+  const string& prefix,
+  size_t count,
+  std::vector<string>* keys)
+{
+  keys->clear();
+  if (count < 2) {
+    return;
+  }
+  auto split_uniform = [&](uint64_t max) {
+    for (size_t i = 1; i < count; ++i) {
+      string k;
+      _key_encode_u64(max / count * i, &k);
+      keys->push_back(std::move(k));
+    }
+  };
+  if (prefix == PREFIX_SHARED_BLOB) {
+    for (size_t i = 1; i < count; ++i) {
+      string k;
+      get_shared_blob_key(blobid_max / count * i, &k);
+      keys->push_back(std::move(k));
+    }
+  } else if (prefix == PREFIX_OMAP || prefix == PREFIX_PGMETA_OMAP) {
+    split_uniform(nid_max);
+  } else {
+    // objects and per-pool/per-pg omap are split on collection boundaries
+    for (auto& [cid, c] : coll_map) {
+      spg_t pgid;
+      bool is_pg = cid.is_pg(&pgid);
+      if (prefix == PREFIX_OBJ) {
+	ghobject_t temp_start, temp_end, start, end;
+	get_coll_range(cid, c->cnode.bits, &temp_start, &temp_end,
+		       &start, &end, false);
+	keys->emplace_back();
+	get_object_key(cct, start, &keys->back());
+	if (is_pg) {
+	  keys->emplace_back();
+	  get_object_key(cct, temp_start, &keys->back());
+	}
+      } else if (is_pg) {
+	string k;
+	_key_encode_u64(pgid.pool(), &k);
+	if (prefix == PREFIX_PERPG_OMAP) {
+	  _key_encode_u32(hobject_t::_reverse_bits(pgid.ps()), &k);
+	}
+	keys->push_back(std::move(k));
+      }
+    }
+    std::sort(keys->begin(), keys->end());
+    keys->erase(std::unique(keys->begin(), keys->end()), keys->end());
+    if (keys->size() >= count) {
+      std::vector<string> picked;
+      for (size_t i = 1; i < count; ++i) {
+	picked.push_back(std::move((*keys)[keys->size() * i / count]));
+      }
+      keys->swap(picked);
     }
+  }
+  keys->erase(std::unique(keys->begin(), keys->end()), keys->end());
+}
 
-    // fill global if not overriden below
-    CollectionRef c;
-    int64_t pool_id = -1;
-    spg_t pgid;
-    for (it->lower_bound(string()); it->valid(); it->next()) {
-      dout(30) << __func__ << " key "
-        << pretty_binary_string(it->key()) << dendl;
-      if (is_extent_shard_key(it->key())) {
-        if (depth == FSCK_SHALLOW) {
-          continue;
-        }
-        while (!expecting_shards.empty() &&
-          expecting_shards.front() < it->key()) {
-          derr << "fsck error: missing shard key "
-            << pretty_binary_string(expecting_shards.front())
-            << dendl;
-          ++errors;
-          expecting_shards.pop_front();
-        }
-        if (!expecting_shards.empty() &&
-          expecting_shards.front() == it->key()) {
-          // all good
-          expecting_shards.pop_front();
-          continue;
-        }
+void BlueStore::_fsck_check_objects_range(
+  FSCKDepth depth,
+  const string& first,
+  const string& last,
+  BlueStore::FSCK_ObjectCtx& ctx,
+  uint64_t_btree_t& used_nids,
+  ceph::mutex* used_nids_lock,
+  const fsck_queue_object_fn_t& queue,
+  size_t* processed_myself)
+{
+  auto& errors = ctx.errors;
 
-        uint32_t offset;
-        string okey;
-        get_key_extent_shard(it->key(), &okey, &offset);
-        derr << "fsck error: stray shard 0x" << std::hex << offset
-          << std::dec << dendl;
-        if (expecting_shards.empty()) {
-          derr << "fsck error: " << pretty_binary_string(it->key())
-            << " is unexpected" << dendl;
-          ++errors;
-          continue;
-        }
-        while (expecting_shards.front() > it->key()) {
-          derr << "fsck error:   saw " << pretty_binary_string(it->key())
-            << dendl;
-          derr << "fsck error:   exp "
-            << pretty_binary_string(expecting_shards.front()) << dendl;
-          ++errors;
-          expecting_shards.pop_front();
-          if (expecting_shards.empty()) {
-            break;
-          }
-        }
+  auto it = db->get_iterator(PREFIX_OBJ, KeyValueDB::ITERATOR_NOCACHE);
+  if (!it) {
+    return;
+  }
+  mempool::bluestore_fsck::list<string> expecting_shards;
+  // fill global if not overriden below
+  CollectionRef c;
+  int64_t pool_id = -1;
+  spg_t pgid;
+  for (it->lower_bound(first);
+       it->valid() && (last.empty() || it->key() < last);
+       it->next()) {
+    dout(30) << __func__ << " key "
+      << pretty_binary_string(it->key()) << dendl;
+    if (is_extent_shard_key(it->key())) {
+      if (depth == FSCK_SHALLOW) {
+        continue;
+      }
+      while (!expecting_shards.empty() &&
+        expecting_shards.front() < it->key()) {
+        derr << "fsck error: missing shard key "
+          << pretty_binary_string(expecting_shards.front())
+          << dendl;
+        ++errors;
+        expecting_shards.pop_front();
+      }
+      if (!expecting_shards.empty() &&
+        expecting_shards.front() == it->key()) {
+        // all good
+        expecting_shards.pop_front();
         continue;
       }
 
-      ghobject_t oid;
-      int r = get_key_object(it->key(), &oid);
-      if (r < 0) {
-        derr << "fsck error: bad object key "
-          << pretty_binary_string(it->key()) << dendl;
+      uint32_t offset;
+      string okey;
+      get_key_extent_shard(it->key(), &okey, &offset);
+      derr << "fsck error: stray shard 0x" << std::hex << offset
+        << std::dec << dendl;
+      if (expecting_shards.empty()) {
+        derr << "fsck error: " << pretty_binary_string(it->key())
+          << " is unexpected" << dendl;
         ++errors;
         continue;
       }
-      if (!c ||
-        oid.shard_id != pgid.shard ||
-        oid.hobj.get_logical_pool() != (int64_t)pgid.pool() ||
-        !c->contains(oid)) {
-        c = nullptr;
-        for (auto& p : coll_map) {
-          if (p.second->contains(oid)) {
-            c = p.second;
-            break;
-          }
-        }
-        if (!c) {
-          derr << "fsck error: stray object " << oid
-            << " not owned by any collection" << dendl;
-          ++errors;
-          continue;
-        }
-        pool_id = c->cid.is_pg(&pgid) ? pgid.pool() : META_POOL_ID;
-        dout(20) << __func__ << "  collection " << c->cid << " " << c->cnode
+      while (expecting_shards.front() > it->key()) {
+        derr << "fsck error:   saw " << pretty_binary_string(it->key())
           << dendl;
+        derr << "fsck error:   exp "
+          << pretty_binary_string(expecting_shards.front()) << dendl;
+        ++errors;
+        expecting_shards.pop_front();
+        if (expecting_shards.empty()) {
+          break;
+        }
       }
+      continue;
+    }
 
-      if (depth != FSCK_SHALLOW &&
-        !expecting_shards.empty()) {
-        for (auto& k : expecting_shards) {
-          derr << "fsck error: missing shard key "
-            << pretty_binary_string(k) << dendl;
+    ghobject_t oid;
+    int r = get_key_object(it->key(), &oid);
+    if (r < 0) {
+      derr << "fsck error: bad object key "
+        << pretty_binary_string(it->key()) << dendl;
+      ++errors;
+      continue;
+    }
+    if (!c ||
+      oid.shard_id != pgid.shard ||
+      oid.hobj.get_logical_pool() != (int64_t)pgid.pool() ||
+      !c->contains(oid)) {
+      c = nullptr;
+      for (auto& p : coll_map) {
+        if (p.second->contains(oid)) {
+          c = p.second;
+          break;
         }
+      }
+      if (!c) {
+        derr << "fsck error: stray object " << oid
+          << " not owned by any collection" << dendl;
         ++errors;
-        expecting_shards.clear();
+        continue;
       }
+      pool_id = c->cid.is_pg(&pgid) ? pgid.pool() : META_POOL_ID;
+      dout(20) << __func__ << "  collection " << c->cid << " " << c->cnode
+        << dendl;
+    }
 
-      bool queued = false;
-      if (depth == FSCK_SHALLOW && thread_count > 0) {
-        queued = wq->queue(
-          pool_id,
-          c,
-          oid,
-          it->key(),
-          it->value());
-      }
-      OnodeRef o;
-      map<BlobRef, bluestore_blob_t::unused_t> referenced;
-
-      if (!queued) {
-        ++processed_myself;
-         o = fsck_check_objects_shallow(
-          depth,
-          pool_id,
-          c,
-          oid,
-          it->key(),
-          it->value(),
-          &expecting_shards,
-          &referenced,
-          ctx);
+    if (depth != FSCK_SHALLOW &&
+      !expecting_shards.empty()) {
+      for (auto& k : expecting_shards) {
+        derr << "fsck error: missing shard key "
+          << pretty_binary_string(k) << dendl;
       }
+      ++errors;
+      expecting_shards.clear();
+    }
+
+    bool queued = false;
+    if (queue) {
+      queued = queue(
+        pool_id,
+        c,
+        oid,
+        it->key(),
+        it->value());
+    }
+    OnodeRef o;
+    map<BlobRef, bluestore_blob_t::unused_t> referenced;
+
+    if (!queued) {
+      ++(*processed_myself);
+       o = fsck_check_objects_shallow(
+        depth,
+        pool_id,
+        c,
+        oid,
+        it->key(),
+        it->value(),
+        &expecting_shards,
+        &referenced,
+        ctx);
+    }
 
-      if (depth != FSCK_SHALLOW) {
-        ceph_assert(o != nullptr);
-        if (o->onode.nid) {
-          if (o->onode.nid > nid_max) {
-            derr << "fsck error: " << oid << " nid " << o->onode.nid
-              << " > nid_max " << nid_max << dendl;
-            ++errors;
-          }
-          if (used_nids.count(o->onode.nid)) {
-            derr << "fsck error: " << oid << " nid " << o->onode.nid
-              << " already in use" << dendl;
-            ++errors;
-            continue; // go for next object
-          }
-          used_nids.insert(o->onode.nid);
+    if (depth != FSCK_SHALLOW) {
+      ceph_assert(o != nullptr);
+      if (o->onode.nid) {
+        if (o->onode.nid > nid_max) {
+          derr << "fsck error: " << oid << " nid " << o->onode.nid
+            << " > nid_max " << nid_max << dendl;
+          ++errors;
         }
-        for (auto& i : referenced) {
-          dout(20) << __func__ << "  referenced 0x" << std::hex << i.second
-            << std::dec << " for " << *i.first << dendl;
-          const bluestore_blob_t& blob = i.first->get_blob();
-          if (i.second & blob.unused) {
-            derr << "fsck error: " << oid << " blob claims unused 0x"
-              << std::hex << blob.unused
-              << " but extents reference 0x" << i.second << std::dec
-              << " on blob " << *i.first << dendl;
-            ++errors;
-          }
-          if (blob.has_csum()) {
-            uint64_t blob_len = blob.get_logical_length();
-            uint64_t unused_chunk_size = blob_len / (sizeof(blob.unused) * 8);
-            unsigned csum_count = blob.get_csum_count();
-            unsigned csum_chunk_size = blob.get_csum_chunk_size();
-            for (unsigned p = 0; p < csum_count; ++p) {
-              unsigned pos = p * csum_chunk_size;
-              unsigned firstbit = pos / unused_chunk_size;    // [firstbit,lastbit]
-              unsigned lastbit = (pos + csum_chunk_size - 1) / unused_chunk_size;
-              unsigned mask = 1u << firstbit;
-              for (unsigned b = firstbit + 1; b <= lastbit; ++b) {
-                mask |= 1u << b;
-              }
-              if ((blob.unused & mask) == mask) {
-                // this csum chunk region is marked unused
-                if (blob.get_csum_item(p) != 0) {
-                  derr << "fsck error: " << oid
-                    << " blob claims csum chunk 0x" << std::hex << pos
-                    << "~" << csum_chunk_size
-                    << " is unused (mask 0x" << mask << " of unused 0x"
-                    << blob.unused << ") but csum is non-zero 0x"
-                    << blob.get_csum_item(p) << std::dec << " on blob "
-                    << *i.first << dendl;
-                  ++errors;
-                }
+        std::unique_lock<ceph::mutex> l;
+        if (used_nids_lock) {
+          l = std::unique_lock(*used_nids_lock);
+        }
+        if (used_nids.count(o->onode.nid)) {
+          derr << "fsck error: " << oid << " nid " << o->onode.nid
+            << " already in use" << dendl;
+          ++errors;
+          continue; // go for next object
+        }
+        used_nids.insert(o->onode.nid);
+      }
+      for (auto& i : referenced) {
+        dout(20) << __func__ << "  referenced 0x" << std::hex << i.second
+          << std::dec << " for " << *i.first << dendl;
+        const bluestore_blob_t& blob = i.first->get_blob();
+        if (i.second & blob.unused) {
+          derr << "fsck error: " << oid << " blob claims unused 0x"
+            << std::hex << blob.unused
+            << " but extents reference 0x" << i.second << std::dec
+            << " on blob " << *i.first << dendl;
+          ++errors;
+        }
+        if (blob.has_csum()) {
+          uint64_t blob_len = blob.get_logical_length();
+          uint64_t unused_chunk_size = blob_len / (sizeof(blob.unused) * 8);
+          unsigned csum_count = blob.get_csum_count();
+          unsigned csum_chunk_size = blob.get_csum_chunk_size();
+          for (unsigned p = 0; p < csum_count; ++p) {
+            unsigned pos = p * csum_chunk_size;
+            unsigned firstbit = pos / unused_chunk_size;    // [firstbit,lastbit]
+            unsigned lastbit = (pos + csum_chunk_size - 1) / unused_chunk_size;
+            unsigned mask = 1u << firstbit;
+            for (unsigned b = firstbit + 1; b <= lastbit; ++b) {
+              mask |= 1u << b;
+            }
+            if ((blob.unused & mask) == mask) {
+              // this csum chunk region is marked unused
+              if (blob.get_csum_item(p) != 0) {
+                derr << "fsck error: " << oid
+                  << " blob claims csum chunk 0x" << std::hex << pos
+                  << "~" << csum_chunk_size
+                  << " is unused (mask 0x" << mask << " of unused 0x"
+                  << blob.unused << ") but csum is non-zero 0x"
+                  << blob.get_csum_item(p) << std::dec << " on blob "
+                  << *i.first << dendl;
+                ++errors;
               }
             }
           }
         }
-        // omap
-        if (o->onode.has_omap()) {
-          ceph_assert(ctx.used_omap_head);
-          if (ctx.used_omap_head->count(o->onode.nid)) {
-            derr << "fsck error: " << o->oid << " omap_head " << o->onode.nid
-                 << " already in use" << dendl;
+      }
+      // omap
+      if (o->onode.has_omap()) {
+        ceph_assert(ctx.used_omap_head);
+        std::unique_lock<ceph::mutex> l;
+        if (ctx.used_lock) {
+          l = std::unique_lock(*ctx.used_lock);
+        }
+        if (ctx.used_omap_head->count(o->onode.nid)) {
+          derr << "fsck error: " << o->oid << " omap_head " << o->onode.nid
+               << " already in use" << dendl;
+          ++errors;
+        } else {
+          ctx.used_omap_head->insert(o->onode.nid);
+        }
+      } // if (o->onode.has_omap())
+      if (depth == FSCK_DEEP) {
+        bufferlist bl;
+        uint64_t max_read_block = cct->_conf->bluestore_fsck_read_bytes_cap;
+        uint64_t offset = 0;
+        do {
+          uint64_t l = std::min(uint64_t(o->onode.size - offset), max_read_block);
+          int r = _do_read(c.get(), o, offset, l, bl,
+            CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+          if (r < 0) {
             ++errors;
-          } else {
-            ctx.used_omap_head->insert(o->onode.nid);
+            derr << "fsck error: " << oid << std::hex
+              << " error during read: "
+              << " " << offset << "~" << l
+              << " " << cpp_strerror(r) << std::dec
+              << dendl;
+            break;
           }
-        } // if (o->onode.has_omap())
-        if (depth == FSCK_DEEP) {
-          bufferlist bl;
-          uint64_t max_read_block = cct->_conf->bluestore_fsck_read_bytes_cap;
-          uint64_t offset = 0;
-          do {
-            uint64_t l = std::min(uint64_t(o->onode.size - offset), max_read_block);
-            int r = _do_read(c.get(), o, offset, l, bl,
-              CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
-            if (r < 0) {
-              ++errors;
-              derr << "fsck error: " << oid << std::hex
-                << " error during read: "
-                << " " << offset << "~" << l
-                << " " << cpp_strerror(r) << std::dec
-                << dendl;
-              break;
-            }
-            offset += l;
-          } while (offset < o->onode.size);
-        } // deep
-      } //if (depth != FSCK_SHALLOW)
-    } // for (it->lower_bound(string()); it->valid(); it->next())
-    if (depth == FSCK_SHALLOW && thread_count > 0) {
-      wq->finalize(thread_pool, ctx);
-      if (processed_myself) {
-        // may be needs more threads?
-        dout(0) << __func__ << " partial offload"
-                << ", done myself " << processed_myself
-                << " of " << ctx.num_objects
-                << "objects, threads " << thread_count
-                << dendl;
-      }
-    }
-  } // if (it)
+          offset += l;
+        } while (offset < o->onode.size);
+      } // deep
+    } //if (depth != FSCK_SHALLOW)
+  } // for (it->lower_bound(first); it->valid(); it->next())
 }
-/**
-An overview for currently implemented repair logics 
-performed in fsck in two stages: detection(+preparation) and commit.
-Detection stage (in processing order):
-  (Issue -> Repair action to schedule)
-  - Detect undecodable keys for Shared Blobs -> Remove
+
+void BlueStore::_fsck_check_objects(
+  FSCKDepth depth,
+  BlueStore::FSCK_ObjectCtx& ctx)
+{
+  auto sb_info_lock = ctx.sb_info_lock;
+  auto& sb_info = ctx.sb_info;
+  auto& sb_ref_counts = ctx.sb_ref_counts;
+  auto repairer = ctx.repairer;
+
+  uint64_t_btree_t used_nids;
+
+  size_t processed_myself = 0;
+
+  const size_t fsck_threads =
+    cct->_conf.get_val<uint64_t>("bluestore_fsck_threads");
+  if (depth != FSCK_SHALLOW && fsck_threads > 1) {
+    // regular and deep modes: split the keyspace on collection boundaries
+    // (an onode and its extent shards never straddle them) and let every
+    // worker walk its ranges with a private iterator and accumulators
+    std::vector<string> splits;
+    _fsck_get_split_keys(PREFIX_OBJ, fsck_threads * 8, &splits);
+
+    ceph::mutex nids_lock = ceph::make_mutex("BlueStore::fsck::nids_lock");
+    dout(1) << __func__ << " " << splits.size() + 1 << " key ranges, "
+	    << fsck_threads << " threads" << dendl;
+    ceph_assert(sb_info_lock);
+    fsck_run_ranges(fsck_threads, splits, ctx, sb_info_lock,
+      [&](FSCK_ObjectCtx& wctx, fsck_worker_stats_t& st,
+          const string& first, const string& last) {
+        _fsck_check_objects_range(depth, first, last, wctx,
+          used_nids, &nids_lock, {}, &st.processed);
+      });
+    return;
+  }
+
+  const size_t thread_count = cct->_conf->bluestore_fsck_quick_fix_threads;
+  typedef ShallowFSCKThreadPool::FSCKWorkQueue<256> WQ;
+  std::unique_ptr<WQ> wq(
+    new WQ(
+      "FSCKWorkQueue",
+      (thread_count ? : 1) * 32,
+      this,
+      sb_info_lock,
+      sb_info,
+      sb_ref_counts,
+      repairer));
+
+  ShallowFSCKThreadPool thread_pool(cct, "ShallowFSCKThreadPool", "ShallowFSCK", thread_count);
+
+  thread_pool.add_work_queue(wq.get());
+  fsck_queue_object_fn_t queue;
+  if (depth == FSCK_SHALLOW && thread_count > 0) {
+    //not the best place but let's check anyway
+    ceph_assert(sb_info_lock);
+    thread_pool.start();
+    queue = [&](int64_t pool_id,
+                CollectionRef c,
+                const ghobject_t& oid,
+                const string& key,
+                const bufferlist& value) {
+      return wq->queue(pool_id, c, oid, key, value);
+    };
+  }
+
+  _fsck_check_objects_range(depth, string(), string(), ctx,
+    used_nids, nullptr, queue, &processed_myself);
+
+  if (depth == FSCK_SHALLOW && thread_count > 0) {
+    wq->finalize(thread_pool, ctx);
+    if (processed_myself) {
+      // may be needs more threads?
+      dout(0) << __func__ << " partial offload"
+              << ", done myself " << processed_myself
+              << " of " << ctx.num_objects
+              << "objects, threads " << thread_count
+              << dendl;
+    }
+  }
+}
+
+void BlueStore::_fsck_check_shared_blobs_range(
+  FSCKDepth depth,
+  const string& first,
+  const string& last,
+  size_t sb_ref_mismatches,
+  uint64_t& num_shared_blobs,
+  BlueStore::FSCK_ObjectCtx& ctx)
+{
+  auto& errors = ctx.errors;
+  auto& sb_info = ctx.sb_info;
+  auto repairer = ctx.repairer;
+
+  auto it = db->get_iterator(PREFIX_SHARED_BLOB, KeyValueDB::ITERATOR_NOCACHE);
+  if (!it) {
+    return;
+  }
+  // FIXME minor: perhaps simplify for shallow mode?
+  // fill global if not overriden below
+  auto expected_statfs = &ctx.expected_store_statfs;
+  for (it->lower_bound(first);
+       it->valid() && (last.empty() || it->key() < last);
+       it->next()) {
+    string key = it->key();
+    uint64_t sbid;
+    if (get_key_shared_blob(key, &sbid)) {
+      derr << "fsck error: bad key '" << key
+	<< "' in shared blob namespace" << dendl;
+      if (repairer) {
+	repairer->remove_key(db, PREFIX_SHARED_BLOB, key);
+      }
+      ++errors;
+      continue;
+    }
+    auto p = sb_info.find(sbid);
+    if (p == sb_info.end()) {
+      if (sb_ref_mismatches > 0) {
+	// highly likely this has been already reported before, ignoring...
+	dout(5) << __func__ << " found duplicate(?) stray shared blob data for sbid 0x"
+	  << std::hex << sbid << std::dec << dendl;
+      } else {
+	derr<< "fsck error: found stray shared blob data for sbid 0x"
+	  << std::hex << sbid << std::dec << dendl;
+	++errors;
+	if (repairer) {
+	  repairer->remove_key(db, PREFIX_SHARED_BLOB, key);
+	}
+      }
+    } else {
+      ++num_shared_blobs;
+      sb_info_t& sbi = *p;
+      bluestore_shared_blob_t shared_blob(sbid);
+      bufferlist bl = it->value();
+      auto blp = bl.cbegin();
+      try {
+	decode(shared_blob, blp);
+      }
+      catch (ceph::buffer::error& e) {
+	++errors;
+
+	derr << "fsck error: failed to decode Shared Blob"
+	  << pretty_binary_string(key) << dendl;
+	if (repairer) {
+	  dout(20) << __func__ << " undecodable Shared Blob, key:'"
+	    << pretty_binary_string(key)
+	    << "', removing" << dendl;
+	  repairer->remove_key(db, PREFIX_SHARED_BLOB, key);
+	}
+	continue;
+      }
+      dout(20) << __func__ << "  " << shared_blob << dendl;
+      PExtentVector extents;
+      for (auto& r : shared_blob.ref_map.ref_map) {
+	extents.emplace_back(bluestore_pextent_t(r.first, r.second.length));
+      }
+      if (sbi.pool_id != sb_info_t::INVALID_POOL_ID &&
+	  (per_pool_stat_collection || repairer)) {
+	expected_statfs = &ctx.expected_pool_statfs[sbi.pool_id];
+      }
+      std::stringstream ss;
+      ss << "sbid 0x" << std::hex << sbid << std::dec;
+
+      pool_fsck_stats_t& ppfs = ctx.per_pool_fsck_stats[sbi.pool_id];
+      ppfs.shared_blobs++;
+      errors += _fsck_check_extents(ss.str(),
+	extents,
+	sbi.allocated_chunks < 0,
+	*ctx.used_blocks,
+	fm->get_alloc_size(),
+	repairer,
+	*expected_statfs,
+	ppfs,
+	depth,
+	ctx.used_lock);
+    }
+  }
+}
+
+void BlueStore::_fsck_check_omap_range(
+  const string& prefix,
+  const string& first,
+  const string& last,
+  BlueStore::FSCK_ObjectCtx& ctx)
+{
+  auto& errors = ctx.errors;
+  auto& used_omap_head = *ctx.used_omap_head;
+
+  auto it = db->get_iterator(prefix, KeyValueDB::ITERATOR_NOCACHE);
+  if (!it) {
+    return;
+  }
+  const char* kind =
+    prefix == PREFIX_PGMETA_OMAP ? " (pgmeta)" :
+    prefix == PREFIX_PERPOOL_OMAP ? " (per-pool)" :
+    prefix == PREFIX_PERPG_OMAP ? " (per-pg)" : "";
+  uint64_t last_omap_head = 0;
+  for (it->lower_bound(first);
+       it->valid() && (last.empty() || it->key() < last);
+       it->next()) {
+    uint64_t pool = 0;
+    uint32_t hash;
+    uint64_t omap_head;
+    string k = it->key();
+    const char* c = k.c_str();
+    if (prefix == PREFIX_PERPOOL_OMAP || prefix == PREFIX_PERPG_OMAP) {
+      c = _key_decode_u64(c, &pool);
+    }
+    if (prefix == PREFIX_PERPG_OMAP) {
+      c = _key_decode_u32(c, &hash);
+    }
+    c = _key_decode_u64(c, &omap_head);
+
+    if (prefix != PREFIX_OMAP) {
+      auto p =
+	prefix == PREFIX_PGMETA_OMAP || pool == 0 ?
+	  META_POOL_ID : // we erroneously use pool==0 for
+	                 // meta (aka pool==-1) objects
+			 // (see #64153)
+			 // hence treat it as meta
+	  pool;
+      pool_fsck_stats_t& ppfs = ctx.per_pool_fsck_stats[p];
+      ppfs.omaps++;
+      ppfs.omap_key_size += it->key().size();
+      ppfs.omap_val_size += it->value().length();
+    }
+    if (used_omap_head.count(omap_head) == 0 &&
+        omap_head != last_omap_head) {
+      if (prefix == PREFIX_PERPG_OMAP) {
+        fsck_derr(errors, MAX_FSCK_ERROR_LINES)
+          << "fsck error: found stray (per-pg) omap data on omap_head "
+	  << " key " << pretty_binary_string(it->key())
+          << omap_head << " " << last_omap_head << " " << used_omap_head.count(omap_head) << fsck_dendl;
+      } else {
+        pair<string,string> rk = it->raw_key();
+        fsck_derr(errors, MAX_FSCK_ERROR_LINES)
+          << "fsck error: found stray" << kind << " omap data on omap_head "
+          << omap_head << " " << last_omap_head
+          << " prefix/key: " << url_escape(rk.first)
+          << " " << url_escape(rk.second)
+          << fsck_dendl;
+      }
+      ++errors;
+      last_omap_head = omap_head;
+    }
+  }
+}
+/**
+An overview for currently implemented repair logics 
+performed in fsck in two stages: detection(+preparation) and commit.
+Detection stage (in processing order):
+  (Issue -> Repair action to schedule)
+  - Detect undecodable keys for Shared Blobs -> Remove
   - Detect undecodable records for Shared Blobs -> Remove 
     (might trigger missed Shared Blob detection below)
   - Detect stray records for Shared Blobs -> Remove
@@ -10308,6 +10947,15 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
   auto alloc_size = fm->get_alloc_size();
 
   utime_t start = ceph_clock_now();
+  const size_t fsck_threads =
+    cct->_conf.get_val<uint64_t>("bluestore_fsck_threads");
+  fsck_phase_timings.clear();
+  utime_t phase_start = start;
+  auto note_phase = [&](const char* phase) {
+    utime_t now = ceph_clock_now();
+    fsck_phase_timings.emplace_back(phase, (double)(now - phase_start));
+    phase_start = now;
+  };
 
   _fsck_collections(&errors);
   used_blocks.resize(fm->get_alloc_units());
@@ -10383,6 +11031,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
     goto out_scan;
   }
 
+  note_phase("init");
   dout(1) << __func__ << " checking shared_blobs (phase 1)" << dendl;
   it = db->get_iterator(PREFIX_SHARED_BLOB, KeyValueDB::ITERATOR_NOCACHE);
   if (it) {
@@ -10420,6 +11069,8 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
     }
   } // if (it) //checking shared_blobs (phase1)
 
+  note_phase("shared_blobs_phase1");
+
   // walk PREFIX_OBJ
   {
     dout(1) << __func__ << " walking object keyspace" << dendl;
@@ -10435,9 +11086,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
       &used_blocks,
       &used_omap_head,
       &zone_refs,
-      //no need for the below lock when in non-shallow mode as
-      // there is no multithreading in this case
-      depth == FSCK_SHALLOW ? &sb_info_lock : nullptr,
+      &sb_info_lock,
       sb_info,
       sb_ref_counts,
       expected_store_statfs,
@@ -10447,6 +11096,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
 
     _fsck_check_objects(depth, ctx);
   }
+  note_phase("objects");
 
   sb_ref_mismatches = sb_ref_counts.count_non_zero();
   if (sb_ref_mismatches != 0) {
@@ -10482,86 +11132,43 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
   if (depth != FSCK_SHALLOW && repair) {
     _fsck_repair_shared_blobs(repairer, sb_ref_counts, sb_info);
   }
+  note_phase("shared_blob_refs");
   dout(1) << __func__ << " checking shared_blobs (phase 2)" << dendl;
-  it = db->get_iterator(PREFIX_SHARED_BLOB, KeyValueDB::ITERATOR_NOCACHE);
-  if (it) {
-    // FIXME minor: perhaps simplify for shallow mode?
-    // fill global if not overriden below
-    auto expected_statfs = &expected_store_statfs;
-    for (it->lower_bound(string()); it->valid(); it->next()) {
-      string key = it->key();
-      uint64_t sbid;
-      if (get_key_shared_blob(key, &sbid)) {
-	derr << "fsck error: bad key '" << key
-	  << "' in shared blob namespace" << dendl;
-	if (repair) {
-	  repairer.remove_key(db, PREFIX_SHARED_BLOB, key);
-	}
-	++errors;
-	continue;
-      }
-      auto p = sb_info.find(sbid);
-      if (p == sb_info.end()) {
-        if (sb_ref_mismatches > 0) {
-	  // highly likely this has been already reported before, ignoring...
-	  dout(5) << __func__ << " found duplicate(?) stray shared blob data for sbid 0x"
-	    << std::hex << sbid << std::dec << dendl;
-	} else {
-	  derr<< "fsck error: found stray shared blob data for sbid 0x"
-	    << std::hex << sbid << std::dec << dendl;
-	  ++errors;
-	  if (repair) {
-	    repairer.remove_key(db, PREFIX_SHARED_BLOB, key);
-	  }
-	}
-      } else {
-	++num_shared_blobs;
-	sb_info_t& sbi = *p;
-	bluestore_shared_blob_t shared_blob(sbid);
-	bufferlist bl = it->value();
-	auto blp = bl.cbegin();
-	try {
-	  decode(shared_blob, blp);
-	}
-	catch (ceph::buffer::error& e) {
-	  ++errors;
-
-	  derr << "fsck error: failed to decode Shared Blob"
-	    << pretty_binary_string(key) << dendl;
-	  if (repair) {
-	    dout(20) << __func__ << " undecodable Shared Blob, key:'"
-	      << pretty_binary_string(key)
-	      << "', removing" << dendl;
-	    repairer.remove_key(db, PREFIX_SHARED_BLOB, key);
-	  }
-	  continue;
-	}
-	dout(20) << __func__ << "  " << shared_blob << dendl;
-	PExtentVector extents;
-	for (auto& r : shared_blob.ref_map.ref_map) {
-	  extents.emplace_back(bluestore_pextent_t(r.first, r.second.length));
-	}
-	if (sbi.pool_id != sb_info_t::INVALID_POOL_ID &&
-	    (per_pool_stat_collection || repair)) {
-	  expected_statfs = &expected_pool_statfs[sbi.pool_id];
-	}
-	std::stringstream ss;
-	ss << "sbid 0x" << std::hex << sbid << std::dec;
-
-	pool_fsck_stats_t& ppfs = per_pool_fsck_stats[sbi.pool_id];
-	ppfs.shared_blobs++;
-	errors += _fsck_check_extents(ss.str(),
-	  extents,
-	  sbi.allocated_chunks < 0,
-	  used_blocks,
-	  fm->get_alloc_size(),
-	  repair ? &repairer : nullptr,
-	  *expected_statfs,
-	  ppfs,
-	  depth);
-      }
+  {
+    BlueStore::FSCK_ObjectCtx ctx(
+      errors,
+      warnings,
+      num_objects,
+      num_extents,
+      num_blobs,
+      num_sharded_objects,
+      num_spanning_blobs,
+      &used_blocks,
+      &used_omap_head,
+      &zone_refs,
+      nullptr,
+      sb_info,
+      sb_ref_counts,
+      expected_store_statfs,
+      expected_pool_statfs,
+      per_pool_fsck_stats,
+      repair ? &repairer : nullptr);
+    if (fsck_threads > 1) {
+      std::vector<string> splits;
+      _fsck_get_split_keys(PREFIX_SHARED_BLOB, fsck_threads * 8, &splits);
+      fsck_run_ranges(fsck_threads, splits, ctx, nullptr,
+        [&](FSCK_ObjectCtx& wctx, fsck_worker_stats_t& st,
+            const string& first, const string& last) {
+          _fsck_check_shared_blobs_range(depth, first, last,
+            sb_ref_mismatches, st.num_shared_blobs, wctx);
+        },
+        &num_shared_blobs);
+    } else {
+      _fsck_check_shared_blobs_range(depth, string(), string(),
+        sb_ref_mismatches, num_shared_blobs, ctx);
     }
-  } // if (it) /* checking shared_blobs (phase 2)*/
+  }
+  note_phase("shared_blobs_phase2");
 
   if (repair && repairer.preprocess_misreference(db)) {
 
@@ -10765,123 +11372,49 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
   } //if (repair && repairer.preprocess_misreference()) {
   sb_info.clear();
   sb_ref_counts.reset();
+  note_phase("misreferences");
 
   dout(1) << __func__ << " checking pool_statfs" << dendl;
   _fsck_check_statfs(expected_store_statfs, expected_pool_statfs,
     errors, warnings, repair ? &repairer : nullptr);
+  note_phase("statfs");
   if (depth != FSCK_SHALLOW) {
     dout(1) << __func__ << " checking for stray omap data " << dendl;
-    it = db->get_iterator(PREFIX_OMAP, KeyValueDB::ITERATOR_NOCACHE);
-    if (it) {
-      uint64_t last_omap_head = 0;
-      for (it->lower_bound(string()); it->valid(); it->next()) {
-        uint64_t omap_head;
-
-        _key_decode_u64(it->key().c_str(), &omap_head);
-
-        if (used_omap_head.count(omap_head) == 0 &&
-           omap_head != last_omap_head) {
-          pair<string,string> rk = it->raw_key();
-          fsck_derr(errors, MAX_FSCK_ERROR_LINES)
-            << "fsck error: found stray omap data on omap_head "
-            << omap_head << " " << last_omap_head
-            << " prefix/key: " << url_escape(rk.first)
-            << " " << url_escape(rk.second)
-            << fsck_dendl;
-          ++errors;
-          last_omap_head = omap_head;
-        }
-      }
-    }
-    it = db->get_iterator(PREFIX_PGMETA_OMAP, KeyValueDB::ITERATOR_NOCACHE);
-    if (it) {
-      uint64_t last_omap_head = 0;
-      pool_fsck_stats_t& ppfs = per_pool_fsck_stats[META_POOL_ID];
-      for (it->lower_bound(string()); it->valid(); it->next()) {
-        uint64_t omap_head;
-        _key_decode_u64(it->key().c_str(), &omap_head);
-        ppfs.omaps++;
-        ppfs.omap_key_size += it->key().size();
-        ppfs.omap_val_size += it->value().length();
-        if (used_omap_head.count(omap_head) == 0 &&
-	    omap_head != last_omap_head) {
-          pair<string,string> rk = it->raw_key();
-          fsck_derr(errors, MAX_FSCK_ERROR_LINES)
-            << "fsck error: found stray (pgmeta) omap data on omap_head "
-            << omap_head << " " << last_omap_head
-            << " prefix/key: " << url_escape(rk.first)
-            << " " << url_escape(rk.second)
-            << fsck_dendl;
-          last_omap_head = omap_head;
-	  ++errors;
-        }
-      }
-    }
-    it = db->get_iterator(PREFIX_PERPOOL_OMAP, KeyValueDB::ITERATOR_NOCACHE);
-    if (it) {
-      uint64_t last_omap_head = 0;
-      for (it->lower_bound(string()); it->valid(); it->next()) {
-        uint64_t pool;
-        uint64_t omap_head;
-        string k = it->key();
-        const char *c = k.c_str();
-        c = _key_decode_u64(c, &pool);
-        c = _key_decode_u64(c, &omap_head);
-        auto p =
-	  pool > 0 ? pool : META_POOL_ID; // we erroneously use pool==0 for
-	                                  // meta (aka pool==-1) objects
-					  // (see #64153)
-					  // hence treat it as meta
-        pool_fsck_stats_t& ppfs = per_pool_fsck_stats[p];
-        ppfs.omaps++;
-        ppfs.omap_key_size += it->key().size();
-        ppfs.omap_val_size += it->value().length();
-        if (used_omap_head.count(omap_head) == 0 &&
-          omap_head != last_omap_head) {
-          pair<string,string> rk = it->raw_key();
-          fsck_derr(errors, MAX_FSCK_ERROR_LINES)
-            << "fsck error: found stray (per-pool) omap data on omap_head "
-            << omap_head << " " << last_omap_head
-            << " prefix/key: " << url_escape(rk.first)
-            << " " << url_escape(rk.second)
-            << fsck_dendl;
-          ++errors;
-          last_omap_head = omap_head;
-        }
-      }
-    }
-    it = db->get_iterator(PREFIX_PERPG_OMAP, KeyValueDB::ITERATOR_NOCACHE);
-    if (it) {
-      uint64_t last_omap_head = 0;
-      for (it->lower_bound(string()); it->valid(); it->next()) {
-        uint64_t pool;
-        uint32_t hash;
-        uint64_t omap_head;
-        string k = it->key();
-        const char* c = k.c_str();
-        c = _key_decode_u64(c, &pool);
-        c = _key_decode_u32(c, &hash);
-        c = _key_decode_u64(c, &omap_head);
-        auto p =
-	  pool > 0 ? pool : META_POOL_ID; // we erroneously use pool==0 for
-	                                  // meta (aka pool==-1) objects
-					  // (see #64153)
-					  // hence treat it as meta
-        pool_fsck_stats_t& ppfs = per_pool_fsck_stats[p];
-        ppfs.omaps++;
-        ppfs.omap_key_size += it->key().size();
-        ppfs.omap_val_size += it->value().length();
-        if (used_omap_head.count(omap_head) == 0 &&
-          omap_head != last_omap_head) {
-          fsck_derr(errors, MAX_FSCK_ERROR_LINES)
-            << "fsck error: found stray (per-pg) omap data on omap_head "
-	    << " key " << pretty_binary_string(it->key())
-            << omap_head << " " << last_omap_head << " " << used_omap_head.count(omap_head) << fsck_dendl;
-          ++errors;
-          last_omap_head = omap_head;
+    {
+      BlueStore::FSCK_ObjectCtx ctx(
+        errors,
+        warnings,
+        num_objects,
+        num_extents,
+        num_blobs,
+        num_sharded_objects,
+        num_spanning_blobs,
+        &used_blocks,
+        &used_omap_head,
+        &zone_refs,
+        nullptr,
+        sb_info,
+        sb_ref_counts,
+        expected_store_statfs,
+        expected_pool_statfs,
+        per_pool_fsck_stats,
+        repair ? &repairer : nullptr);
+      for (auto& prefix : { PREFIX_OMAP, PREFIX_PGMETA_OMAP,
+                            PREFIX_PERPOOL_OMAP, PREFIX_PERPG_OMAP }) {
+        if (fsck_threads > 1) {
+          std::vector<string> splits;
+          _fsck_get_split_keys(prefix, fsck_threads * 8, &splits);
+          fsck_run_ranges(fsck_threads, splits, ctx, nullptr,
+            [&](FSCK_ObjectCtx& wctx, fsck_worker_stats_t&,
+                const string& first, const string& last) {
+              _fsck_check_omap_range(prefix, first, last, wctx);
+            });
+        } else {
+          _fsck_check_omap_range(prefix, string(), string(), ctx);
         }
       }
     }
+    note_phase("omap");
     dout(1) << __func__ << " checking deferred events" << dendl;
     it = db->get_iterator(PREFIX_DEFERRED, KeyValueDB::ITERATOR_NOCACHE);
     if (it) {
@@ -10916,6 +11449,8 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
       }
     }
 
+    note_phase("deferred");
+
     // skip freelist vs allocated compare when we have Null fm
     if (!fm->is_null_manager()) {
       dout(1) << __func__ << " checking freelist vs allocated" << dendl;
@@ -10992,6 +11527,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
       }
     }
   }
+  note_phase("freelist");
   if (repair) {
     if (per_pool_omap != OMAP_PER_PG) {
       dout(5) << __func__ << " fixing per_pg_omap" << dendl;
@@ -11001,6 +11537,7 @@ int BlueStore::_fsck_on_open(BlueStore::FSCKDepth depth, bool repair)
     dout(5) << __func__ << " applying repair results" << dendl;
     repaired = repairer.apply(db);
     dout(5) << __func__ << " repair applied" << dendl;
+    note_phase("repair");
   }
 
 out_scan:
@@ -11021,6 +11558,10 @@ out_scan:
             << dendl;
   }
 
+  for (auto& [phase, secs] : fsck_phase_timings) {
+    dout(1) << __func__ << " phase " << phase << " took " << secs
+	    << " seconds" << dendl;
+  }
   utime_t duration = ceph_clock_now() - start;
   dout(1) << __func__ << " <<<FINISH>>> with " << errors << " errors, "
 	  << warnings << " warnings, "
@@ -11217,6 +11758,11 @@ void BlueStore::inject_global_statfs(const store_statfs_t& new_statfs)
   vstatfs = new_statfs;
 }
 
+void BlueStore::inject_unclean_umount()
+{
+  need_to_destage_allocation_file = false;
+}
+
 void BlueStore::inject_misreference(coll_t cid1, ghobject_t oid1,
 				    coll_t cid2, ghobject_t oid2,
 				    uint64_t offset)
@@ -12095,6 +12641,33 @@ int BlueStore::_generate_read_result_bl(
   return 0;
 }
 
+bool BlueStore::_use_read_cache(uint32_t op_flags, uint64_t length)
+{
+  // generally, don't buffer anything, unless the client explicitly requests
+  // it.
+  if (op_flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED) {
+    dout(20) << __func__ << " will do buffered read" << dendl;
+    return true;
+  }
+  if (!cct->_conf->bluestore_default_buffered_read ||
+      (op_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+		   CEPH_OSD_OP_FLAG_FADVISE_NOCACHE))) {
+    return false;
+  }
+  // large (scan, backup) reads would only evict the hot data, return them
+  // straight from the aligned buffers they were read into instead
+  uint64_t bypass = cct->_conf->bluestore_read_bypass_cache_size;
+  if (bypass && length >= bypass) {
+    dout(20) << __func__ << " bypassing cache for 0x" << std::hex << length
+	     << std::dec << " read" << dendl;
+    logger->inc(l_bluestore_read_bypass_cache);
+    logger->inc(l_bluestore_read_bypass_cache_bytes, length);
+    return false;
+  }
+  dout(20) << __func__ << " defaulting to buffered read" << dendl;
+  return true;
+}
+
 int BlueStore::_do_read(
   Collection *c,
   OnodeRef& o,
@@ -12117,25 +12690,14 @@ int BlueStore::_do_read(
     return r;
   }
 
-  // generally, don't buffer anything, unless the client explicitly requests
-  // it.
-  bool buffered = false;
-  if (op_flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED) {
-    dout(20) << __func__ << " will do buffered read" << dendl;
-    buffered = true;
-  } else if (cct->_conf->bluestore_default_buffered_read &&
-	     (op_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
-			  CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) == 0) {
-    dout(20) << __func__ << " defaulting to buffered read" << dendl;
-    buffered = true;
-  }
-
   if (offset + length > o->onode.size) {
     length = o->onode.size - offset;
   }
 
+  bool buffered = _use_read_cache(op_flags, length);
+
   auto start = mono_clock::now();
-  o->extent_map.fault_range(db, offset, length);
+  o->extent_map.fault_range_read(db, offset, length);
   log_latency(__func__,
     l_bluestore_read_onode_meta_lat,
     mono_clock::now() - start,
@@ -12334,7 +12896,7 @@ int BlueStore::_fiemap(
       length = o->onode.size - offset;
     }
 
-    o->extent_map.fault_range(db, offset, length);
+    o->extent_map.fault_range_read(db, offset, length);
     eend = o->extent_map.extent_map.end();
     ep = o->extent_map.seek_lextent(offset);
     while (length > 0) {
@@ -12403,6 +12965,38 @@ int BlueStore::fiemap(
   return r;
 }
 
+int BlueStore::get_data_location_hint(
+  CollectionHandle &c_,
+  const ghobject_t& oid,
+  uint64_t *hint)
+{
+  Collection *c = static_cast<Collection *>(c_.get());
+  if (!c->exists)
+    return -ENOENT;
+  std::shared_lock l(c->lock);
+  OnodeRef o = c->get_onode(oid, false);
+  if (!o || !o->exists) {
+    return -ENOENT;
+  }
+  if (o->onode.size == 0) {
+    return -ENODATA;
+  }
+  // the leading extents may be holes; the callers read the object right
+  // after, so loading all the shards now costs them nothing extra
+  o->extent_map.fault_range_read(db, 0, o->onode.size);
+  for (auto& e : o->extent_map.extent_map) {
+    for (auto& p : e.blob->get_blob().get_extents()) {
+      if (p.is_valid()) {
+	*hint = p.offset;
+	dout(20) << __func__ << " " << c->cid << " " << oid << " 0x"
+		 << std::hex << *hint << std::dec << dendl;
+	return 0;
+      }
+    }
+  }
+  return -ENODATA;
+}
+
 int BlueStore::readv(
   CollectionHandle &c_,
   const ghobject_t& oid,
@@ -12482,18 +13076,7 @@ int BlueStore::_do_readv(
            << " size 0x" << o->onode.size << " (" << std::dec
            << o->onode.size << ")" << dendl;
 
-  // generally, don't buffer anything, unless the client explicitly requests
-  // it.
-  bool buffered = false;
-  if (op_flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED) {
-    dout(20) << __func__ << " will do buffered read" << dendl;
-    buffered = true;
-  } else if (cct->_conf->bluestore_default_buffered_read &&
-             (op_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
-                          CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) == 0) {
-    dout(20) << __func__ << " defaulting to buffered read" << dendl;
-    buffered = true;
-  }
+  bool buffered = _use_read_cache(op_flags, m.size());
   // this method must be idempotent since we may call it several times
   // before we finally read the expected result.
   bl.clear();
@@ -13752,12 +14335,14 @@ void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
 	   << " released 0x" << txc->released
 	   << std::dec << dendl;
 
-  if (!fm->is_null_manager())
+  if (!fm->is_null_manager() || alloc_journal_active)
   {
     // We have to handle the case where we allocate *and* deallocate the
     // same region in this transaction.  The freelist doesn't like that.
     // (Actually, the only thing that cares is the BitmapFreelistManager
     // debug check. But that's important.)
+    // The allocation journal is replayed with init_rm_free/init_add_free
+    // and needs the same non-overlapping sets.
     interval_set<uint64_t> tmp_allocated, tmp_released;
     interval_set<uint64_t> *pallocated = &txc->allocated;
     interval_set<uint64_t> *preleased = &txc->released;
@@ -13778,24 +14363,64 @@ void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
       }
     }
 
-    // update freelist with non-overlap sets
-    for (interval_set<uint64_t>::iterator p = pallocated->begin();
-	 p != pallocated->end();
-	 ++p) {
-      fm->allocate(p.get_start(), p.get_len(), t);
-    }
-    for (interval_set<uint64_t>::iterator p = preleased->begin();
-	 p != preleased->end();
-	 ++p) {
-      dout(20) << __func__ << " release 0x" << std::hex << p.get_start()
-	       << "~" << p.get_len() << std::dec << dendl;
-      fm->release(p.get_start(), p.get_len(), t);
+    if (alloc_journal_active) {
+      // must precede _txc_update_store_statfs() which resets statfs_delta
+      _txc_alloc_journal(txc, t, *pallocated, *preleased);
+    } else {
+      // update freelist with non-overlap sets
+      for (interval_set<uint64_t>::iterator p = pallocated->begin();
+	   p != pallocated->end();
+	   ++p) {
+	fm->allocate(p.get_start(), p.get_len(), t);
+      }
+      for (interval_set<uint64_t>::iterator p = preleased->begin();
+	   p != preleased->end();
+	   ++p) {
+	dout(20) << __func__ << " release 0x" << std::hex << p.get_start()
+		 << "~" << p.get_len() << std::dec << dendl;
+	fm->release(p.get_start(), p.get_len(), t);
+      }
     }
   }
 
   _txc_update_store_statfs(txc);
 }
 
+void BlueStore::_txc_alloc_journal(
+  TransContext *txc,
+  KeyValueDB::Transaction t,
+  const interval_set<uint64_t>& allocated,
+  const interval_set<uint64_t>& released)
+{
+  if (allocated.empty() && released.empty() && txc->statfs_delta.is_empty()) {
+    return;
+  }
+  bufferlist bl;
+  ENCODE_START(1, 1, bl);
+  encode(allocated, bl);
+  encode(released, bl);
+  encode(txc->osd_pool_id, bl);
+  txc->statfs_delta.encode(bl);
+  ENCODE_FINISH(bl);
+
+  string key;
+  bool wake = false;
+  {
+    std::lock_guard l(alloc_journal_lock);
+    txc->alloc_journal_serial = alloc_journal_serial;
+    ++alloc_journal_inflight[alloc_journal_serial];
+    get_alloc_journal_key(alloc_journal_serial, ++alloc_journal_seq, &key);
+    wake = ++alloc_journal_entries == alloc_journal_checkpoint_records;
+  }
+  if (wake) {
+    alloc_journal_cond.notify_all();
+  }
+  dout(20) << __func__ << " txc " << txc << " key " << pretty_binary_string(key)
+	   << std::hex << " allocated 0x" << allocated
+	   << " released 0x" << released << std::dec << dendl;
+  t->set(PREFIX_ALLOC_JOURNAL, key, bl);
+}
+
 void BlueStore::_txc_apply_kv(TransContext *txc, bool sync_submit_transaction)
 {
   ceph_assert(txc->get_state() == TransContext::STATE_KV_QUEUED);
@@ -13847,6 +14472,15 @@ void BlueStore::_txc_committed_kv(TransContext *txc)
 {
   dout(20) << __func__ << " txc " << txc << dendl;
   throttle.complete_kv(*txc);
+  if (txc->alloc_journal_serial) {
+    std::lock_guard l(alloc_journal_lock);
+    auto p = alloc_journal_inflight.find(txc->alloc_journal_serial);
+    ceph_assert(p != alloc_journal_inflight.end());
+    if (--p->second == 0) {
+      alloc_journal_inflight.erase(p);
+      alloc_journal_cond.notify_all();
+    }
+  }
   {
     std::lock_guard l(txc->osr->qlock);
     txc->set_state(TransContext::STATE_KV_DONE);
@@ -14134,11 +14768,28 @@ void BlueStore::_kv_start()
   finisher.start();
   kv_sync_thread.create("bstore_kv_sync");
   kv_finalize_thread.create("bstore_kv_final");
+  if (alloc_journal_active) {
+    alloc_journal_thread.create("bstore_alloc_jrn");
+  }
 }
 
 void BlueStore::_kv_stop()
 {
   dout(10) << __func__ << dendl;
+  if (alloc_journal_thread.is_started()) {
+    {
+      std::unique_lock l{alloc_journal_lock};
+      while (!alloc_journal_started) {
+	alloc_journal_cond.wait(l);
+      }
+      alloc_journal_stop = true;
+      alloc_journal_cond.notify_all();
+    }
+    alloc_journal_thread.join();
+    std::lock_guard l(alloc_journal_lock);
+    alloc_journal_started = false;
+    alloc_journal_stop = false;
+  }
   {
     std::unique_lock l{kv_lock};
     while (!kv_sync_started) {
@@ -14502,6 +15153,14 @@ void BlueStore::_kv_finalize_thread()
       _reap_collections();
       logger->set(l_bluestore_fragmentation,
 	(uint64_t)(alloc ? alloc->get_fragmentation() * 1000 : 0));
+      if (alloc_front_cache) {
+	auto stats = alloc_front_cache->get_stats();
+	logger->set(l_bluestore_alloc_cache_hit, stats.hits);
+	logger->set(l_bluestore_alloc_cache_miss, stats.misses);
+	logger->set(l_bluestore_alloc_cache_refill, stats.refills);
+	logger->set(l_bluestore_alloc_cache_drain, stats.drains);
+	logger->set(l_bluestore_alloc_cache_bytes, stats.cached);
+      }
 
       log_latency("kv_final",
 	l_bluestore_kv_final_lat,
@@ -14587,10 +15246,53 @@ void BlueStore::deferred_try_submit()
     }
   }
 
+  uint64_t sweep_end = 0;
+  if (osrs.size() > 1 &&
+      cct->_conf.get_val<bool>("bluestore_deferred_submit_elevator")) {
+    // one-way elevator: order the batches by their lowest disk offset and
+    // start with the first one past where the previous sweep ended.
+    // This is a snapshot, a batch may get more ios before it is submitted.
+    vector<pair<uint64_t, OpSequencerRef>> sorted;
+    sorted.reserve(osrs.size());
+    for (auto& osr : osrs) {
+      uint64_t first = std::numeric_limits<uint64_t>::max();
+      {
+	std::lock_guard l(osr->deferred_lock);
+	if (osr->deferred_pending && !osr->deferred_pending->iomap.empty()) {
+	  first = osr->deferred_pending->iomap.begin()->first;
+	}
+      }
+      sorted.emplace_back(first, std::move(osr));
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+		     [](const auto& a, const auto& b) {
+		       return a.first < b.first;
+		     });
+    uint64_t pos;
+    {
+      std::lock_guard l(deferred_lock);
+      pos = deferred_elevator_pos;
+    }
+    auto p = std::partition_point(sorted.begin(), sorted.end(),
+				  [pos](const auto& i) {
+				    return i.first < pos;
+				  });
+    std::rotate(sorted.begin(), p, sorted.end());
+    osrs.clear();
+    for (auto& i : sorted) {
+      osrs.push_back(std::move(i.second));
+    }
+  }
+
   for (auto& osr : osrs) {
     osr->deferred_lock.lock();
     if (osr->deferred_pending) {
       if (!osr->deferred_running) {
+	auto& iomap = osr->deferred_pending->iomap;
+	if (!iomap.empty()) {
+	  auto last = iomap.rbegin();
+	  sweep_end = last->first + last->second.bl.length();
+	}
 	_deferred_submit_unlock(osr.get());
       } else {
 	osr->deferred_lock.unlock();
@@ -14606,6 +15308,9 @@ void BlueStore::deferred_try_submit()
   {
     std::lock_guard l(deferred_lock);
     deferred_last_submitted = ceph_clock_now();
+    if (sweep_end) {
+      deferred_elevator_pos = sweep_end;
+    }
   }
 }
 
@@ -14629,7 +15334,10 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
   for (auto& txc : b->txcs) {
     throttle.log_state_latency(txc, logger, l_bluestore_state_deferred_queued_lat);
   }
+  // iomap is sorted by disk offset: runs of adjacent extents go down as a
+  // single vectored write, the buffers are chained rather than copied.
   uint64_t start = 0, pos = 0;
+  uint64_t ios = 0;
   bufferlist bl;
   auto i = b->iomap.begin();
   while (true) {
@@ -14637,12 +15345,14 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
       if (bl.length()) {
 	dout(20) << __func__ << " write 0x" << std::hex
 		 << start << "~" << bl.length()
-		 << " crc " << bl.crc32c(-1) << std::dec << dendl;
+		 << " crc " << bl.crc32c(-1) << std::dec
+		 << " in " << bl.get_num_buffers() << " buffers" << dendl;
 	if (!g_conf()->bluestore_debug_omit_block_device_write) {
 	  logger->inc(l_bluestore_submitted_deferred_writes);
 	  logger->inc(l_bluestore_submitted_deferred_write_bytes, bl.length());
 	  int r = bdev->aio_write(start, bl, &b->ioc, false);
 	  ceph_assert(r == 0);
+	  ++ios;
 	}
       }
       if (i == b->iomap.end()) {
@@ -14662,6 +15372,9 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
     bl.claim_append(i->second.bl);
     ++i;
   }
+  logger->inc(l_bluestore_submitted_deferred_batches);
+  logger->inc(l_bluestore_deferred_batch_extents, b->iomap.size());
+  logger->inc(l_bluestore_deferred_batch_ios, ios);
 
   bdev->aio_submit(&b->ioc);
 }
@@ -14880,6 +15593,10 @@ int BlueStore::queue_transactions(
   OpSequencer *osr = c->osr.get();
   dout(10) << __func__ << " ch " << c << " " << c->cid << dendl;
 
+  // orders the txc with background GC ones on this sequencer; those take
+  // their throttle budget up front, so it is never held while they block
+  std::unique_lock sl(osr->submit_lock);
+
   // prepare
   TransContext *txc = _txc_create(static_cast<Collection*>(ch.get()), osr,
 				  &on_commit, op);
@@ -14890,19 +15607,8 @@ int BlueStore::queue_transactions(
   }
   _txc_calc_cost(txc);
 
-  _txc_write_nodes(txc, txc->t);
-
-  // journal deferred items
-  if (txc->deferred_txn) {
-    txc->deferred_txn->seq = ++deferred_seq;
-    bufferlist bl;
-    encode(*txc->deferred_txn, bl);
-    string key;
-    get_deferred_key(txc->deferred_txn->seq, &key);
-    txc->t->set(PREFIX_DEFERRED, key, bl);
-  }
-
-  _txc_finalize_kv(txc, txc->t);
+  _txc_prepare_kv(txc);
+  sl.unlock();
 
 #ifdef WITH_BLKIN
   if (txc->trace) {
@@ -14914,27 +15620,7 @@ int BlueStore::queue_transactions(
     handle->suspend_tp_timeout();
 
   auto tstart = mono_clock::now();
-
-  if (!throttle.try_start_transaction(
-	*db,
-	*txc,
-	tstart)) {
-    // ensure we do not block here because of deferred writes
-    dout(10) << __func__ << " failed get throttle_deferred_bytes, aggressive"
-	     << dendl;
-    ++deferred_aggressive;
-    deferred_try_submit();
-    {
-      // wake up any previously finished deferred events
-      std::lock_guard l(kv_lock);
-      if (!kv_sync_in_progress) {
-	kv_sync_in_progress = true;
-	kv_cond.notify_one();
-      }
-    }
-    throttle.finish_start_transaction(*db, *txc, tstart);
-    --deferred_aggressive;
-  }
+  _txc_throttle(txc, tstart);
   auto tend = mono_clock::now();
 
   if (handle)
@@ -14974,6 +15660,47 @@ int BlueStore::queue_transactions(
   return 0;
 }
 
+void BlueStore::_txc_prepare_kv(TransContext *txc)
+{
+  _txc_write_nodes(txc, txc->t);
+
+  // journal deferred items
+  if (txc->deferred_txn) {
+    txc->deferred_txn->seq = ++deferred_seq;
+    bufferlist bl;
+    encode(*txc->deferred_txn, bl);
+    string key;
+    get_deferred_key(txc->deferred_txn->seq, &key);
+    txc->t->set(PREFIX_DEFERRED, key, bl);
+  }
+
+  _txc_finalize_kv(txc, txc->t);
+}
+
+void BlueStore::_txc_throttle(TransContext *txc, mono_clock::time_point tstart)
+{
+  if (!throttle.try_start_transaction(
+	*db,
+	*txc,
+	tstart)) {
+    // ensure we do not block here because of deferred writes
+    dout(10) << __func__ << " failed get throttle_deferred_bytes, aggressive"
+	     << dendl;
+    ++deferred_aggressive;
+    deferred_try_submit();
+    {
+      // wake up any previously finished deferred events
+      std::lock_guard l(kv_lock);
+      if (!kv_sync_in_progress) {
+	kv_sync_in_progress = true;
+	kv_cond.notify_one();
+      }
+    }
+    throttle.finish_start_transaction(*db, *txc, tstart);
+    --deferred_aggressive;
+  }
+}
+
 void BlueStore::_txc_aio_submit(TransContext *txc)
 {
   dout(10) << __func__ << " txc " << txc << dendl;
@@ -16872,6 +17599,382 @@ int BlueStore::_do_write(
   return r;
 }
 
+// background compressed blob GC
+
+class BlueStore::SocketHook : public AdminSocketHook {
+  BlueStore* store;
+public:
+  static BlueStore::SocketHook* create(BlueStore* store)
+  {
+    BlueStore::SocketHook* hook = nullptr;
+    AdminSocket* admin_socket = store->cct->get_admin_socket();
+    if (admin_socket) {
+      hook = new BlueStore::SocketHook(store);
+      int r = admin_socket->register_command(
+	"bluestore compressed gc estimate",
+	hook,
+	"Start a background scan of all objects for poorly referenced "
+	"compressed blobs and report the space rewriting them would reclaim, "
+	"as found by the last completed scan.");
+      if (r != 0) {
+	ldout(store->cct, 1) << __func__ << " cannot register SocketHook" << dendl;
+	delete hook;
+	hook = nullptr;
+      } else {
+	r = admin_socket->register_command(
+	  "bluestore compressed gc run",
+	  hook,
+	  "Start a background compressed blob GC pass now.");
+	ceph_assert(r == 0);
+      }
+    }
+    return hook;
+  }
+
+  ~SocketHook() {
+    AdminSocket* admin_socket = store->cct->get_admin_socket();
+    admin_socket->unregister_commands(this);
+  }
+private:
+  SocketHook(BlueStore* store) :
+    store(store) {}
+  int call(std::string_view command, const cmdmap_t& cmdmap,
+	   const bufferlist&,
+	   Formatter *f,
+	   std::ostream& errss,
+	   bufferlist& out) override {
+    if (command == "bluestore compressed gc estimate") {
+      // a scan reads every onode, it runs on the GC thread rather than here
+      std::lock_guard l(store->compressed_gc_lock);
+      if (!store->compressed_gc_estimate_running) {
+	store->compressed_gc_estimate_kick = true;
+	store->compressed_gc_cond.notify_all();
+      }
+      f->open_object_section("compressed_gc_estimate");
+      if (store->compressed_gc_last_estimate) {
+	f->dump_stream("last_scan") << store->compressed_gc_last_estimate_stamp;
+	store->compressed_gc_last_estimate->dump(f);
+      }
+      f->close_section();
+    } else if (command == "bluestore compressed gc run") {
+      std::lock_guard l(store->compressed_gc_lock);
+      store->compressed_gc_kick = true;
+      store->compressed_gc_cond.notify_all();
+    } else {
+      errss << "Invalid command" << std::endl;
+      return -ENOSYS;
+    }
+    return 0;
+  }
+};
+
+void BlueStore::compressed_gc_stats_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("objects", objects);
+  f->dump_unsigned("compressed_blobs", blobs);
+  f->dump_unsigned("candidates", candidates);
+  f->dump_unsigned("allocated", allocated);
+  f->dump_unsigned("referenced", referenced);
+  f->dump_unsigned("reclaimable", reclaimable);
+  f->dump_unsigned("rewritten", rewritten);
+}
+
+void BlueStore::_compressed_gc_start()
+{
+  compressed_gc_stop = false;
+  compressed_gc_thread.create("bstore_comp_gc");
+  asok_hook = SocketHook::create(this);
+}
+
+void BlueStore::_compressed_gc_stop()
+{
+  {
+    std::lock_guard l(compressed_gc_lock);
+    compressed_gc_stop = true;
+    compressed_gc_cond.notify_all();
+  }
+  delete asok_hook;
+  asok_hook = nullptr;
+  if (compressed_gc_thread.is_started()) {
+    compressed_gc_thread.join();
+  }
+}
+
+void BlueStore::_compressed_gc_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  std::unique_lock l{compressed_gc_lock};
+  auto last = mono_clock::now();
+  while (!compressed_gc_stop) {
+    if (compressed_gc_estimate_kick) {
+      compressed_gc_estimate_kick = false;
+      compressed_gc_estimate_running = true;
+      l.unlock();
+      compressed_gc_stats_t stats;
+      compressed_gc(false, &stats);
+      l.lock();
+      compressed_gc_estimate_running = false;
+      compressed_gc_last_estimate = stats;
+      compressed_gc_last_estimate_stamp = ceph_clock_now();
+      continue;
+    }
+    auto interval =
+      cct->_conf.get_val<double>("bluestore_compressed_gc_interval");
+    if (!compressed_gc_kick) {
+      if (interval <= 0) {
+	compressed_gc_cond.wait(l);
+	continue;
+      }
+      auto due = last + make_timespan(interval);
+      auto now = mono_clock::now();
+      if (now < due) {
+	compressed_gc_cond.wait_for(l, due - now);
+	continue;
+      }
+    }
+    compressed_gc_kick = false;
+    l.unlock();
+    compressed_gc_stats_t stats;
+    auto start = mono_clock::now();
+    compressed_gc(true, &stats);
+    dout(5) << __func__ << " pass done in "
+	    << ceph::to_seconds<double>(mono_clock::now() - start) << "s"
+	    << ", objects " << stats.objects
+	    << ", candidate blobs " << stats.candidates
+	    << ", bytes 0x" << std::hex << stats.rewritten
+	    << ", expected to reclaim 0x" << stats.reclaimable << std::dec
+	    << dendl;
+    l.lock();
+    last = mono_clock::now();
+  }
+  dout(10) << __func__ << " finish" << dendl;
+}
+
+void BlueStore::_compressed_gc_pace(mono_clock::time_point start,
+				    uint64_t bytes)
+{
+  uint64_t rate = cct->_conf.get_val<Option::size_t>(
+    "bluestore_compressed_gc_max_bytes_per_sec");
+  if (!rate) {
+    return;
+  }
+  auto due = start + make_timespan((double)bytes / rate);
+  std::unique_lock l{compressed_gc_lock};
+  auto now = mono_clock::now();
+  if (now < due) {
+    compressed_gc_cond.wait_for(l, due - now, [this] {
+      return compressed_gc_stop.load();
+    });
+  }
+}
+
+void BlueStore::_compressed_gc_find(
+  OnodeRef& o,
+  compressed_gc_stats_t *stats,
+  interval_set<uint64_t> *extents)
+{
+  auto ratio = cct->_conf.get_val<double>("bluestore_compressed_gc_ratio");
+  o->extent_map.fault_range(db, 0, OBJECT_MAX_SIZE);
+
+  // shared blobs are skipped, rewriting one reference frees nothing
+  std::map<Blob*, interval_set<uint64_t>> blobs;
+  for (auto& e : o->extent_map.extent_map) {
+    auto& blob = e.blob->get_blob();
+    if (blob.is_compressed() && !blob.is_shared()) {
+      blobs[e.blob.get()].insert(e.logical_offset, e.length);
+    }
+  }
+  for (auto& [b, ranges] : blobs) {
+    ++stats->blobs;
+    auto& blob = b->get_blob();
+    uint64_t logical = blob.get_logical_length();
+    uint64_t ondisk = blob.get_ondisk_length();
+    uint64_t referenced = b->get_referenced_bytes();
+    if (referenced >= logical * ratio) {
+      continue;
+    }
+    // assume what is left compresses as well as the whole blob did
+    uint64_t release = round_up_to(ondisk, (uint64_t)min_alloc_size);
+    uint64_t expected = round_up_to(referenced * ondisk / logical,
+				    (uint64_t)min_alloc_size);
+    if (expected >= release) {
+      continue;
+    }
+    dout(20) << __func__ << " " << o->oid << " " << *b
+	     << " referenced 0x" << std::hex << referenced
+	     << " reclaimable 0x" << release - expected << std::dec << dendl;
+    ++stats->candidates;
+    stats->allocated += release;
+    stats->referenced += referenced;
+    stats->reclaimable += release - expected;
+    extents->union_of(ranges);
+  }
+}
+
+uint64_t BlueStore::_compressed_gc_object(
+  CollectionRef& c,
+  const ghobject_t& oid,
+  bool rewrite,
+  compressed_gc_stats_t *stats)
+{
+  // the object might have been moved away by a split since listing
+  auto owned = [&c, &oid]() {
+    spg_t pgid;
+    return c->exists &&
+      (!c->cid.is_pg(&pgid) || oid.match(c->cnode.bits, pgid.ps()));
+  };
+  if (!rewrite) {
+    std::shared_lock l(c->lock);
+    if (!owned()) {
+      return 0;
+    }
+    OnodeRef o = c->get_onode(oid, false);
+    if (o && o->exists) {
+      interval_set<uint64_t> extents;
+      _compressed_gc_find(o, stats, &extents);
+    }
+    return 0;
+  }
+
+  // size the rewrite first: its throttle budget is taken before
+  // submit_lock, so that owner's txcs never wait behind a throttled GC one
+  interval_set<uint64_t> planned;
+  {
+    std::shared_lock l(c->lock);
+    if (!owned()) {
+      return 0;
+    }
+    OnodeRef o = c->get_onode(oid, false);
+    if (!o || !o->exists) {
+      return 0;
+    }
+    compressed_gc_stats_t scratch;
+    _compressed_gc_find(o, &scratch, &planned);
+    if (planned.empty()) {
+      return 0;
+    }
+  }
+  // one io per allocation unit and per extent at most, plus the kv commit
+  uint64_t reserved = planned.size() +
+    throttle_cost_per_io.load() *
+    (1 + planned.size() / min_alloc_size + 2 * planned.num_intervals());
+  throttle.reserve_transaction(reserved);
+
+  // the rewrite is a regular txc on the collection's sequencer, ordered
+  // with the owner's transactions by submit_lock
+  OpSequencer *osr = c->osr.get();
+  std::unique_lock sl(osr->submit_lock);
+  TransContext *txc = nullptr;
+  uint64_t candidates = stats->candidates;
+  uint64_t length = 0;
+  {
+    std::unique_lock l(c->lock);
+    OnodeRef o;
+    if (owned()) {
+      o = c->get_onode(oid, false);
+    }
+    interval_set<uint64_t> extents;
+    if (o && o->exists) {
+      _compressed_gc_find(o, stats, &extents);
+    }
+    if (extents.empty() || !extents.subset_of(planned)) {
+      // changed meanwhile, leave it to the next pass
+      throttle.cancel_reservation(reserved);
+      return 0;
+    }
+    length = extents.size();
+    if (alloc->get_free() < length * 2) {
+      dout(5) << __func__ << " " << c->cid << " " << oid
+	      << " skipped, not enough free space" << dendl;
+      throttle.cancel_reservation(reserved);
+      return 0;
+    }
+    dout(10) << __func__ << " " << c->cid << " " << oid
+	     << " rewriting 0x" << std::hex << extents << std::dec << dendl;
+
+    txc = _txc_create(c.get(), osr, nullptr);
+    spg_t pgid;
+    if (c->cid.is_pg(&pgid)) {
+      txc->osd_pool_id = pgid.pool();
+    }
+    txc->bytes = length;
+
+    WriteContext wctx;
+    _choose_write_options(c, o, CEPH_OSD_OP_FLAG_FADVISE_DONTNEED, &wctx);
+    wctx.extents_to_gc = extents;
+    uint64_t dirty_start = extents.range_start();
+    uint64_t dirty_end = extents.range_end();
+    int r = _do_gc(txc, c, o, wctx, &dirty_start, &dirty_end);
+    if (r < 0) {
+      // the txc is partially built, nothing better to do than a failed
+      // client write does
+      derr << __func__ << " " << c->cid << " " << oid
+	   << " _do_gc failed with " << cpp_strerror(r) << dendl;
+      ceph_abort_msg("unexpected error code");
+    }
+    o->extent_map.compress_extent_map(dirty_start, dirty_end - dirty_start);
+    o->extent_map.dirty_range(dirty_start, dirty_end - dirty_start);
+    txc->write_onode(o);
+  }
+  _txc_calc_cost(txc);
+  _txc_prepare_kv(txc);
+  sl.unlock();
+  throttle.start_reserved_transaction(*db, *txc, reserved, mono_clock::now());
+  logger->inc(l_bluestore_txc);
+  _txc_state_proc(txc);
+
+  stats->rewritten += length;
+  logger->inc(l_bluestore_compressed_gc_blobs, stats->candidates - candidates);
+  logger->inc(l_bluestore_compressed_gc_bytes, length);
+  return length;
+}
+
+void BlueStore::compressed_gc(bool rewrite, compressed_gc_stats_t *stats)
+{
+  dout(10) << __func__ << (rewrite ? " rewrite" : " estimate") << dendl;
+  vector<CollectionRef> colls;
+  {
+    std::shared_lock l(coll_lock);
+    colls.reserve(coll_map.size());
+    for (auto& [cid, c] : coll_map) {
+      colls.push_back(c);
+    }
+  }
+  auto start = mono_clock::now();
+  for (auto& c : colls) {
+    ghobject_t next;
+    while (!compressed_gc_stop) {
+      vector<ghobject_t> ls;
+      {
+	std::shared_lock l(c->lock);
+	if (!c->exists) {
+	  break;
+	}
+	int r = _collection_list(c.get(), next, ghobject_t::get_max(), 64,
+				 false, &ls, &next);
+	if (r < 0) {
+	  derr << __func__ << " " << c->cid << " listing failed with "
+	       << cpp_strerror(r) << dendl;
+	  break;
+	}
+      }
+      for (auto& oid : ls) {
+	if (compressed_gc_stop) {
+	  break;
+	}
+	++stats->objects;
+	logger->inc(l_bluestore_compressed_gc_scanned);
+	if (_compressed_gc_object(c, oid, rewrite, stats)) {
+	  _compressed_gc_pace(start, stats->rewritten);
+	}
+      }
+      if (next.is_max()) {
+	break;
+      }
+    }
+  }
+}
+
 int BlueStore::_write(TransContext *txc,
 		      CollectionRef& c,
 		      OnodeRef& o,
@@ -18068,6 +19171,28 @@ void BlueStore::BlueStoreThrottle::finish_start_transaction(
   emit_initial_tracepoint(db, txc, start_throttle_acquire);
 }
 
+void BlueStore::BlueStoreThrottle::start_reserved_transaction(
+  KeyValueDB &db,
+  TransContext &txc,
+  uint64_t reserved,
+  mono_clock::time_point start_throttle_acquire)
+{
+  if (txc.cost > reserved) {
+    // the reservation is an estimate; this may block, but rarely does
+    throttle_bytes.get(txc.cost - reserved);
+    if (txc.deferred_txn) {
+      throttle_deferred_bytes.get(txc.cost - reserved);
+    } else {
+      throttle_deferred_bytes.put(reserved);
+    }
+  } else {
+    throttle_bytes.put(reserved - txc.cost);
+    throttle_deferred_bytes.put(
+      txc.deferred_txn ? reserved - txc.cost : reserved);
+  }
+  emit_initial_tracepoint(db, txc, start_throttle_acquire);
+}
+
 #if defined(WITH_LTTNG)
 void BlueStore::BlueStoreThrottle::complete_kv(TransContext &txc)
 {
@@ -19172,49 +20297,15 @@ static uint32_t flush_extent_buffer_with_crc(BlueFS::FileWriter *p_handle, const
 const unsigned MAX_EXTENTS_IN_BUFFER = 4 * 1024; // 4K extents = 64KB of data
 // write the allocator to a flat bluefs file - 4K extents at a time
 //-----------------------------------------------------------------------------------
-int BlueStore::store_allocator(Allocator* src_allocator)
+int BlueStore::__store_allocator(BlueFS::FileWriter *p_handle, Allocator* allocator, uint32_t serial,
+				 uint64_t *p_extent_count, uint64_t *p_allocation_size)
 {
-  // when storing allocations to file we must be sure there is no background compactions
-  // the easiest way to achieve it is to make sure db is closed
-  ceph_assert(db == nullptr);
-  utime_t  start_time = ceph_clock_now();
   int ret = 0;
-
-  // create dir if doesn't exist already
-  if (!bluefs->dir_exists(allocator_dir) ) {
-    ret = bluefs->mkdir(allocator_dir);
-    if (ret != 0) {
-      derr << "Failed mkdir with error-code " << ret << dendl;
-      return -1;
-    }
-  }
-  bluefs->compact_log();
-  // reuse previous file-allocation if exists
-  ret = bluefs->stat(allocator_dir, allocator_file, nullptr, nullptr);
-  bool overwrite_file = (ret == 0);
-  BlueFS::FileWriter *p_handle = nullptr;
-  ret = bluefs->open_for_write(allocator_dir, allocator_file, &p_handle, overwrite_file);
-  if (ret != 0) {
-    derr <<  __func__ << "Failed open_for_write with error-code " << ret << dendl;
-    return -1;
-  }
-
-  uint64_t file_size = p_handle->file->fnode.size;
-  uint64_t allocated = p_handle->file->fnode.get_allocated();
-  dout(10) << "file_size=" << file_size << ", allocated=" << allocated << dendl;
-
-  bluefs->sync_metadata(false);
-  unique_ptr<Allocator> allocator(clone_allocator_without_bluefs(src_allocator));
-  if (!allocator) {
-    bluefs->close_writer(p_handle);
-    return -1;
-  }
-
-  // store all extents (except for the bluefs extents we removed) in a single flat file
+  // store all extents in a single flat file
   utime_t                 timestamp = ceph_clock_now();
   uint32_t                crc       = -1;
   {
-    allocator_image_header  header(timestamp, s_format_version, s_serial);
+    allocator_image_header  header(timestamp, s_format_version, serial);
     bufferlist              header_bl;
     encode(header, header_bl);
     crc = header_bl.crc32c(crc);
@@ -19249,10 +20340,7 @@ int BlueStore::store_allocator(Allocator* src_allocator)
   // if got null extent -> fail the operation
   if (ret != 0) {
     derr << "Illegal extent, fail store operation" << dendl;
-    derr << "invalidate using bluefs->truncate(p_handle, 0)" << dendl;
-    bluefs->truncate(p_handle, 0);
-    bluefs->close_writer(p_handle);
-    return -1;
+    return ret;
   }
 
   // if we got any leftovers -> add crc and append to file
@@ -19261,7 +20349,7 @@ int BlueStore::store_allocator(Allocator* src_allocator)
   }
 
   {
-    allocator_image_trailer trailer(timestamp, s_format_version, s_serial, extent_count, allocation_size);
+    allocator_image_trailer trailer(timestamp, s_format_version, serial, extent_count, allocation_size);
     bufferlist trailer_bl;
     encode(trailer, trailer_bl);
     uint32_t crc = -1;
@@ -19269,6 +20357,60 @@ int BlueStore::store_allocator(Allocator* src_allocator)
     encode(crc, trailer_bl);
     p_handle->append(trailer_bl);
   }
+  *p_extent_count    = extent_count;
+  *p_allocation_size = allocation_size;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------------
+int BlueStore::store_allocator(Allocator* src_allocator)
+{
+  // when storing allocations to file we must be sure there is no background compactions
+  // the easiest way to achieve it is to make sure db is closed
+  ceph_assert(db == nullptr);
+  utime_t  start_time = ceph_clock_now();
+  int ret = 0;
+
+  // create dir if doesn't exist already
+  if (!bluefs->dir_exists(allocator_dir) ) {
+    ret = bluefs->mkdir(allocator_dir);
+    if (ret != 0) {
+      derr << "Failed mkdir with error-code " << ret << dendl;
+      return -1;
+    }
+  }
+  bluefs->compact_log();
+  // reuse previous file-allocation if exists
+  ret = bluefs->stat(allocator_dir, allocator_file, nullptr, nullptr);
+  bool overwrite_file = (ret == 0);
+  BlueFS::FileWriter *p_handle = nullptr;
+  ret = bluefs->open_for_write(allocator_dir, allocator_file, &p_handle, overwrite_file);
+  if (ret != 0) {
+    derr <<  __func__ << "Failed open_for_write with error-code " << ret << dendl;
+    return -1;
+  }
+
+  uint64_t file_size = p_handle->file->fnode.size;
+  uint64_t allocated = p_handle->file->fnode.get_allocated();
+  dout(10) << "file_size=" << file_size << ", allocated=" << allocated << dendl;
+
+  bluefs->sync_metadata(false);
+  unique_ptr<Allocator> allocator(clone_allocator_without_bluefs(src_allocator));
+  if (!allocator) {
+    bluefs->close_writer(p_handle);
+    return -1;
+  }
+
+  // BlueFS stores its own allocations, the clone above already hid them
+  uint64_t extent_count    = 0;
+  uint64_t allocation_size = 0;
+  ret = __store_allocator(p_handle, allocator.get(), s_serial, &extent_count, &allocation_size);
+  if (ret != 0) {
+    derr << "invalidate using bluefs->truncate(p_handle, 0)" << dendl;
+    bluefs->truncate(p_handle, 0);
+    bluefs->close_writer(p_handle);
+    return -1;
+  }
 
   bluefs->fsync(p_handle);
   bluefs->truncate(p_handle, p_handle->pos);
@@ -19283,6 +20425,53 @@ int BlueStore::store_allocator(Allocator* src_allocator)
   return 0;
 }
 
+//-----------------------------------------------------------------------------------
+// Write a new allocation file while the db is open (allocation journal checkpoint).
+// The allocator must not hold bluefs extents as allocated. The image is built
+// in a temporary file and renamed over the old one so a crash leaves either
+// the old or the new file intact.
+int BlueStore::_write_alloc_image(Allocator* allocator, uint32_t serial)
+{
+  utime_t start_time = ceph_clock_now();
+  int ret = 0;
+  if (!bluefs->dir_exists(allocator_dir)) {
+    ret = bluefs->mkdir(allocator_dir);
+    if (ret != 0) {
+      derr << __func__ << " failed mkdir with error-code " << ret << dendl;
+      return ret;
+    }
+  }
+  const std::string tmp_file = allocator_file + ".tmp";
+  BlueFS::FileWriter *p_handle = nullptr;
+  ret = bluefs->open_for_write(allocator_dir, tmp_file, &p_handle, false);
+  if (ret != 0) {
+    derr << __func__ << " failed open_for_write with error-code " << ret << dendl;
+    return ret;
+  }
+  uint64_t extent_count    = 0;
+  uint64_t allocation_size = 0;
+  ret = __store_allocator(p_handle, allocator, serial, &extent_count, &allocation_size);
+  if (ret == 0) {
+    bluefs->fsync(p_handle);
+  }
+  bluefs->close_writer(p_handle);
+  if (ret != 0) {
+    bluefs->unlink(allocator_dir, tmp_file);
+    return ret;
+  }
+  ret = bluefs->rename(allocator_dir, tmp_file, allocator_dir, allocator_file);
+  if (ret != 0) {
+    derr << __func__ << " failed rename with error-code " << ret << dendl;
+    return ret;
+  }
+  bluefs->sync_metadata(false);
+
+  utime_t duration = ceph_clock_now() - start_time;
+  dout(5) << __func__ << " extent_count=" << extent_count << ", allocation_size=" << allocation_size
+	  << ", serial=" << serial << ", duration=" << duration << " seconds" << dendl;
+  return 0;
+}
+
 //-----------------------------------------------------------------------------------
 Allocator* BlueStore::create_bitmap_allocator(uint64_t bdev_size) {
   // create allocator
@@ -19328,7 +20517,8 @@ int calc_allocator_image_trailer_size()
 }
 
 //-----------------------------------------------------------------------------------
-int BlueStore::__restore_allocator(Allocator* allocator, uint64_t *num, uint64_t *bytes)
+int BlueStore::__restore_allocator(Allocator* allocator, uint64_t *num, uint64_t *bytes,
+				   uint32_t *p_serial)
 {
   if (cct->_conf->bluestore_debug_inject_allocation_from_file_failure > 0) {
      boost::mt11213b rng(time(NULL));
@@ -19481,6 +20671,9 @@ int BlueStore::__restore_allocator(Allocator* allocator, uint64_t *num, uint64_t
   dout(5) << "READ duration=" << duration << " seconds, s_serial=" << header.serial << dendl;
   *num   = extent_count;
   *bytes = read_alloc_size;
+  if (p_serial) {
+    *p_serial = header.serial;
+  }
   return 0;
 }
 
@@ -19489,11 +20682,41 @@ int BlueStore::restore_allocator(Allocator* dest_allocator, uint64_t *num, uint6
 {
   utime_t    start = ceph_clock_now();
   auto temp_allocator = unique_ptr<Allocator>(create_bitmap_allocator(bdev->get_size()));
-  int ret = __restore_allocator(temp_allocator.get(), num, bytes);
+  uint32_t image_serial = 0;
+  int ret = __restore_allocator(temp_allocator.get(), num, bytes, &image_serial);
   if (ret != 0) {
     return ret;
   }
 
+  // apply allocation journal records written on top of this file (if any)
+  // regardless of the current config so an unclean shutdown with the journal
+  // enabled is never mistaken for a valid file
+  uint64_t records = 0;
+  uint32_t max_serial = image_serial;
+  uint64_t max_seq = 0;
+  bool has_stats = false;
+  osd_pools_map pools;
+  volatile_statfs vs;
+  ret = _replay_alloc_journal(temp_allocator.get(), image_serial, std::numeric_limits<uint32_t>::max(),
+			      &records, &max_serial, &max_seq, &has_stats, &pools, &vs);
+  if (ret != 0) {
+    return ret;
+  }
+  if (has_stats) {
+    std::lock_guard l(vstatfs_lock);
+    if (per_pool_stat_collection) {
+      osd_pools = std::move(pools);
+    }
+    vstatfs = vs;
+  }
+  alloc_journal_image_serial = image_serial;
+  alloc_journal_serial = max_serial;
+  alloc_journal_seq = max_seq;
+  alloc_journal_entries = records;
+  s_serial = std::max(s_serial, max_serial + 1);
+  dout(5) << __func__ << " replayed " << records << " alloc journal records on top of serial "
+	  << image_serial << dendl;
+
   uint64_t num_entries = 0;
   dout(5) << " calling copy_allocator(bitmap_allocator -> shared_alloc.a)" << dendl;
   copy_allocator(temp_allocator.get(), dest_allocator, &num_entries);
@@ -19502,6 +20725,310 @@ int BlueStore::restore_allocator(Allocator* dest_allocator, uint64_t *num, uint6
   return ret;
 }
 
+//-----------------------------------------------------------------------------------
+void BlueStore::_alloc_journal_encode_stats(bool per_pool, osd_pools_map& pools,
+					    volatile_statfs& vs, bufferlist& bl)
+{
+  ENCODE_START(1, 1, bl);
+  encode(per_pool, bl);
+  encode((uint32_t)pools.size(), bl);
+  for (auto& [pool_id, st] : pools) {
+    encode(pool_id, bl);
+    st.encode(bl);
+  }
+  vs.encode(bl);
+  ENCODE_FINISH(bl);
+}
+
+//-----------------------------------------------------------------------------------
+// Apply the allocation journal records in [image_serial, end_serial) to the allocator
+// restored from the allocation file with image_serial, starting the statfs from the
+// stats stored for that serial.
+int BlueStore::_replay_alloc_journal(Allocator* allocator, uint32_t image_serial, uint32_t end_serial,
+				     uint64_t *p_records, uint32_t *p_max_serial, uint64_t *p_max_seq,
+				     bool *p_has_stats, osd_pools_map *p_pools, volatile_statfs *p_vstatfs)
+{
+  utime_t start = ceph_clock_now();
+  uint64_t records = 0;
+  uint32_t max_serial = image_serial;
+  uint64_t max_seq = 0;
+  bool has_stats = false;
+  string start_key;
+  get_alloc_journal_stats_key(image_serial, &start_key);
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_ALLOC_JOURNAL, KeyValueDB::ITERATOR_NOCACHE);
+  for (it->lower_bound(start_key); it->valid(); it->next()) {
+    string key = it->key();
+    const char *p = key.c_str();
+    uint32_t serial;
+    p = _key_decode_u32(p, &serial);
+    if (serial >= end_serial) {
+      break;
+    }
+    bufferlist bl = it->value();
+    auto bp = bl.cbegin();
+    try {
+      if (key.length() == sizeof(uint32_t)) {
+	// stats key; only the one matching the image is a valid base, others
+	// belong to checkpoints that did not complete or were superseded
+	if (serial != image_serial) {
+	  continue;
+	}
+	DECODE_START(1, bp);
+	bool per_pool;
+	uint32_t n;
+	decode(per_pool, bp);
+	decode(n, bp);
+	p_pools->clear();
+	while (n--) {
+	  uint64_t pool_id;
+	  decode(pool_id, bp);
+	  (*p_pools)[pool_id].decode(bp);
+	}
+	p_vstatfs->decode(bp);
+	DECODE_FINISH(bp);
+	has_stats = true;
+	continue;
+      }
+      uint64_t seq;
+      _key_decode_u64(p, &seq);
+      if (!has_stats) {
+	derr << __func__ << " alloc journal record " << serial << "." << seq
+	     << " without stats for serial " << image_serial << dendl;
+	return -EIO;
+      }
+      interval_set<uint64_t> allocated, released;
+      uint64_t pool_id;
+      volatile_statfs delta;
+      DECODE_START(1, bp);
+      decode(allocated, bp);
+      decode(released, bp);
+      decode(pool_id, bp);
+      delta.decode(bp);
+      DECODE_FINISH(bp);
+      for (auto e = allocated.begin(); e != allocated.end(); ++e) {
+	allocator->init_rm_free(e.get_start(), e.get_len());
+      }
+      for (auto e = released.begin(); e != released.end(); ++e) {
+	allocator->init_add_free(e.get_start(), e.get_len());
+      }
+      if (!delta.is_empty()) {
+	(*p_pools)[pool_id] += delta;
+	*p_vstatfs += delta;
+      }
+      max_serial = std::max(max_serial, serial);
+      max_seq = std::max(max_seq, seq);
+      ++records;
+    } catch (ceph::buffer::error& e) {
+      derr << __func__ << " failed to decode alloc journal key "
+	   << pretty_binary_string(key) << dendl;
+      return -EIO;
+    }
+  }
+  *p_records = records;
+  *p_has_stats = has_stats;
+  if (p_max_serial) {
+    *p_max_serial = max_serial;
+  }
+  if (p_max_seq) {
+    *p_max_seq = max_seq;
+  }
+  utime_t duration = ceph_clock_now() - start;
+  dout(5) << __func__ << " serial=" << image_serial << ", records=" << records
+	  << ", duration=" << duration << " seconds" << dendl;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------------
+// Called on read-write mount in NULL-FM mode once the db is reopened.
+// Without the journal the allocation file is invalidated as before.
+// With the journal the file restored in _init_alloc() stays valid, and when
+// the allocation was rebuilt from the onodes a fresh file is written first.
+int BlueStore::_open_alloc_journal()
+{
+  int ret = 0;
+  auto t = db->get_transaction();
+  if (!cct->_conf.get_val<bool>("bluestore_allocation_journal")) {
+    ret = invalidate_allocation_file_on_bluefs();
+    if (ret != 0) {
+      return ret;
+    }
+    // records left by a previous run are stale once the file is gone
+    t->rmkeys_by_prefix(PREFIX_ALLOC_JOURNAL);
+    db->submit_transaction_sync(t);
+    return 0;
+  }
+
+  bluefs->unlink(allocator_dir, allocator_file + ".tmp");
+  if (alloc_journal_base) {
+    // the allocation was rebuilt from the onodes, start over with a new file
+    ret = invalidate_allocation_file_on_bluefs();
+    if (ret != 0) {
+      return ret;
+    }
+    alloc_journal_image_serial = s_serial;
+    alloc_journal_serial = s_serial;
+    alloc_journal_seq = 0;
+    alloc_journal_entries = 0;
+    bufferlist bl;
+    string key;
+    {
+      std::lock_guard l(vstatfs_lock);
+      _alloc_journal_encode_stats(per_pool_stat_collection, osd_pools, vstatfs, bl);
+    }
+    get_alloc_journal_stats_key(s_serial, &key);
+    t->rmkeys_by_prefix(PREFIX_ALLOC_JOURNAL);
+    t->set(PREFIX_ALLOC_JOURNAL, key, bl);
+    db->submit_transaction_sync(t);
+    ret = _write_alloc_image(alloc_journal_base.get(), s_serial);
+    if (ret != 0) {
+      return ret;
+    }
+    alloc_journal_base.reset();
+    ++s_serial;
+  } else {
+    // restored from the file (plus replayed records); drop what precedes it
+    // and make sure the file has a stats base to replay on top of
+    string from, to, key;
+    get_alloc_journal_stats_key(0, &from);
+    get_alloc_journal_stats_key(alloc_journal_image_serial, &to);
+    t->rm_range_keys(PREFIX_ALLOC_JOURNAL, from, to);
+    bufferlist bl;
+    if (db->get(PREFIX_ALLOC_JOURNAL, to, &bl) < 0) {
+      ceph_assert(alloc_journal_entries == 0);
+      std::lock_guard l(vstatfs_lock);
+      _alloc_journal_encode_stats(per_pool_stat_collection, osd_pools, vstatfs, bl);
+      t->set(PREFIX_ALLOC_JOURNAL, to, bl);
+    }
+    db->submit_transaction_sync(t);
+  }
+  alloc_journal_checkpoint_records =
+    cct->_conf.get_val<uint64_t>("bluestore_allocation_journal_checkpoint_records");
+  alloc_journal_inflight.clear();
+  alloc_journal_active = true;
+  // the file is kept valid but a clean umount still stores a final copy
+  need_to_destage_allocation_file = true;
+  dout(5) << __func__ << " image serial=" << alloc_journal_image_serial
+	  << ", journal serial=" << alloc_journal_serial
+	  << ", records=" << alloc_journal_entries << dendl;
+  return 0;
+}
+
+//-----------------------------------------------------------------------------------
+// Fold the records written since the current allocation file into a new one.
+// The live allocator is not used as bluefs keeps allocating from it while
+// the db is open; the file is rebuilt from the previous file instead.
+int BlueStore::_alloc_journal_checkpoint()
+{
+  utime_t start = ceph_clock_now();
+  uint32_t image_serial, serial;
+  {
+    std::unique_lock l{alloc_journal_lock};
+    image_serial = alloc_journal_image_serial;
+    serial = ++alloc_journal_serial;
+    alloc_journal_entries = 0;
+    // wait for records of the previous serials to commit
+    alloc_journal_cond.wait(l, [&] {
+      return alloc_journal_stop ||
+	alloc_journal_inflight.empty() ||
+	alloc_journal_inflight.begin()->first >= serial;
+    });
+    if (alloc_journal_stop) {
+      return -ECANCELED;
+    }
+  }
+
+  auto allocator = unique_ptr<Allocator>(create_bitmap_allocator(bdev->get_size()));
+  uint64_t num = 0, bytes = 0;
+  uint32_t file_serial = 0;
+  int ret = __restore_allocator(allocator.get(), &num, &bytes, &file_serial);
+  if (ret != 0 || file_serial != image_serial) {
+    derr << __func__ << " failed to restore allocation file serial " << image_serial
+	 << " (ret=" << ret << ", serial=" << file_serial << ")" << dendl;
+    return -EIO;
+  }
+  uint64_t records = 0;
+  bool has_stats = false;
+  osd_pools_map pools;
+  volatile_statfs vs;
+  ret = _replay_alloc_journal(allocator.get(), image_serial, serial,
+			      &records, nullptr, nullptr, &has_stats, &pools, &vs);
+  if (ret != 0) {
+    return ret;
+  }
+  if (!has_stats) {
+    derr << __func__ << " no stats for serial " << image_serial << dendl;
+    return -EIO;
+  }
+
+  string key;
+  bufferlist bl;
+  _alloc_journal_encode_stats(per_pool_stat_collection, pools, vs, bl);
+  get_alloc_journal_stats_key(serial, &key);
+  auto t = db->get_transaction();
+  t->set(PREFIX_ALLOC_JOURNAL, key, bl);
+  db->submit_transaction_sync(t);
+
+  ret = _write_alloc_image(allocator.get(), serial);
+  if (ret != 0) {
+    return ret;
+  }
+  {
+    std::lock_guard l(alloc_journal_lock);
+    alloc_journal_image_serial = serial;
+  }
+
+  // records and stats of older serials are no longer needed
+  string from;
+  get_alloc_journal_stats_key(0, &from);
+  t = db->get_transaction();
+  t->rm_range_keys(PREFIX_ALLOC_JOURNAL, from, key);
+  db->submit_transaction(t);
+
+  utime_t duration = ceph_clock_now() - start;
+  dout(5) << __func__ << " serial=" << serial << ", folded records=" << records
+	  << ", duration=" << duration << " seconds" << dendl;
+  return 0;
+}
+
+void BlueStore::_alloc_journal_thread()
+{
+  dout(10) << __func__ << " start" << dendl;
+  std::unique_lock l{alloc_journal_lock};
+  ceph_assert(!alloc_journal_started);
+  alloc_journal_started = true;
+  alloc_journal_cond.notify_all();
+  while (!alloc_journal_stop) {
+    if (alloc_journal_entries < alloc_journal_checkpoint_records) {
+      alloc_journal_cond.wait(l);
+      continue;
+    }
+    l.unlock();
+    int r = _alloc_journal_checkpoint();
+    if (r < 0 && r != -ECANCELED) {
+      derr << __func__ << " checkpoint failed: " << cpp_strerror(r) << dendl;
+    }
+    l.lock();
+  }
+  dout(10) << __func__ << " finish" << dendl;
+}
+
+//-----------------------------------------------------------------------------------
+// Clean umount: the allocation file about to be stored by _close_db() gets a serial
+// past every journaled record, so those are ignored (and purged) on the next mount.
+void BlueStore::_alloc_journal_prepare_close(KeyValueDB::Transaction t)
+{
+  s_serial = std::max(s_serial, alloc_journal_serial + 1);
+  string key;
+  bufferlist bl;
+  {
+    std::lock_guard l(vstatfs_lock);
+    _alloc_journal_encode_stats(per_pool_stat_collection, osd_pools, vstatfs, bl);
+  }
+  get_alloc_journal_stats_key(s_serial, &key);
+  t->set(PREFIX_ALLOC_JOURNAL, key, bl);
+  dout(10) << __func__ << " serial=" << s_serial << dendl;
+}
+
 //-----------------------------------------------------------------------------------
 void BlueStore::set_allocation_in_simple_bmap(SimpleBitmap* sbmap, uint64_t offset, uint64_t length)
 {
@@ -60,6 +60,7 @@
 #endif
 
 class Allocator;
+class FrontCacheAllocator;
 class FreelistManager;
 class BlueStoreRepairer;
 class SimpleBitmap;
@@ -143,6 +144,9 @@ enum {
   l_bluestore_issued_deferred_write_bytes,
   l_bluestore_submitted_deferred_writes,
   l_bluestore_submitted_deferred_write_bytes,
+  l_bluestore_submitted_deferred_batches,
+  l_bluestore_deferred_batch_extents,
+  l_bluestore_deferred_batch_ios,
 
   l_bluestore_write_big_skipped_blobs,
   l_bluestore_write_big_skipped_bytes,
@@ -169,6 +173,11 @@ enum {
   l_bluestore_onode_misses,
   l_bluestore_onode_shard_hits,
   l_bluestore_onode_shard_misses,
+  l_bluestore_onode_shard_prefetch,
+  l_bluestore_onode_shard_prefetch_hits,
+  l_bluestore_onode_shard_prefetch_wasted,
+  l_bluestore_onode_lookup_contended,
+  l_bluestore_onode_lookup_wait_lat,
   l_bluestore_extents,
   l_bluestore_blobs,
   //****************************************
@@ -179,6 +188,8 @@ enum {
   l_bluestore_buffer_bytes,
   l_bluestore_buffer_hit_bytes,
   l_bluestore_buffer_miss_bytes,
+  l_bluestore_read_bypass_cache,
+  l_bluestore_read_bypass_cache_bytes,
   //****************************************
 
   // internal stats
@@ -187,6 +198,9 @@ enum {
   l_bluestore_blob_split,
   l_bluestore_extent_compress,
   l_bluestore_gc_merged,
+  l_bluestore_compressed_gc_scanned,
+  l_bluestore_compressed_gc_blobs,
+  l_bluestore_compressed_gc_bytes,
   //****************************************
 
   // misc
@@ -219,6 +233,11 @@ enum {
   //****************************************
   l_bluestore_allocate_hist,
   l_bluestore_allocator_lat,
+  l_bluestore_alloc_cache_hit,
+  l_bluestore_alloc_cache_miss,
+  l_bluestore_alloc_cache_refill,
+  l_bluestore_alloc_cache_drain,
+  l_bluestore_alloc_cache_bytes,
   //****************************************
 
   // slow op counter
@@ -255,6 +274,10 @@ public:
     max_defer_interval =
 	cct->_conf.get_val<double>("bluestore_max_defer_interval");
   }
+  void _set_extent_map_prefetch() {
+    extent_map_prefetch_shards =
+	cct->_conf.get_val<uint64_t>("bluestore_extent_map_prefetch_shards");
+  }
 
   struct TransContext;
 
@@ -962,6 +985,7 @@ public:
       unsigned extents = 0;  ///< count extents in this shard
       bool loaded = false;   ///< true if shard is loaded
       bool dirty = false;    ///< true if shard is dirty and needs reencoding
+      bool prefetched = false; ///< true if loaded ahead of a sequential read
     };
 
     mempool::bluestore_cache_meta::vector<Shard> shards;    ///< shards
@@ -971,6 +995,10 @@ public:
     uint32_t needs_reshard_begin = 0;
     uint32_t needs_reshard_end = 0;
 
+    uint32_t seq_read_end = 0;     ///< end of the last read
+    uint16_t seq_reads = 0;        ///< sequential reads in a row
+    uint16_t prefetched_shards = 0; ///< shards loaded ahead, not read yet
+
     void scan_shared_blobs(uint64_t start, uint64_t length,
 			   std::multimap<uint64_t /*blob_start*/, Blob*>& candidates);
     Blob* find_mergable_companion(Blob* blob_to_dissolve, uint32_t blob_start, uint32_t& blob_width,
@@ -1133,9 +1161,15 @@ public:
       return true;
     }
 
-    /// ensure that a range of the map is loaded
+    /// ensure that a range of the map is loaded, along with up to
+    /// @prefetch following shards
     void fault_range(KeyValueDB *db,
-		     uint32_t offset, uint32_t length);
+		     uint32_t offset, uint32_t length,
+		     unsigned prefetch = 0);
+
+    /// fault_range() for reads, prefetches shards when reads are sequential
+    void fault_range_read(KeyValueDB *db,
+			  uint32_t offset, uint32_t length);
 
     /// ensure a range of the map is marked dirty
     void dirty_range(uint32_t offset, uint32_t length);
@@ -1306,6 +1340,19 @@ public:
 				    uint64_t min_alloc_size);
   };
 
+  /// outcome of a background compressed blob GC pass (or its estimate)
+  struct compressed_gc_stats_t {
+    uint64_t objects = 0;      ///< objects scanned
+    uint64_t blobs = 0;        ///< unshared compressed blobs seen
+    uint64_t candidates = 0;   ///< blobs worth rewriting
+    uint64_t allocated = 0;    ///< bytes allocated by candidates
+    uint64_t referenced = 0;   ///< logical bytes still referenced in candidates
+    uint64_t reclaimable = 0;  ///< estimated bytes freed by rewriting them
+    uint64_t rewritten = 0;    ///< logical bytes actually rewritten
+
+    void dump(ceph::Formatter *f) const;
+  };
+
   struct OnodeSpace;
   struct OnodeCacheShard;
   /// an in-memory object
@@ -1521,8 +1568,13 @@ private:
   struct OnodeCacheShard : public CacheShard {
     std::array<std::pair<ghobject_t, ceph::mono_clock::time_point>, 64> dumped_onodes;
 
+    /// serve OnodeSpace lookups under OnodeSpace::map_lock (shared)
+    /// rather than under this shard's lock
+    const bool shared_lookup;
+
   public:
-    OnodeCacheShard(CephContext* cct) : CacheShard(cct) {}
+    OnodeCacheShard(CephContext* cct, bool shared_lookup = false)
+      : CacheShard(cct), shared_lookup(shared_lookup) {}
     static OnodeCacheShard *create(CephContext* cct, std::string type,
                                    PerfCounters *logger);
 
@@ -1598,6 +1650,22 @@ private:
     friend struct Collection; // for split_cache()
     friend struct Onode; // for put()
     friend struct LruOnodeCacheShard;
+
+    /// Guards onode_map against lookups when cache->shared_lookup is set.
+    /// Taken exclusively (after cache->lock) around every onode_map
+    /// mutation and shared by lookup(); never held while an OnodeRef
+    /// that could unpin an onode is dropped.
+    ceph::shared_mutex map_lock =
+      ceph::make_shared_mutex("BlueStore::OnodeSpace::map_lock", true, false);
+
+    std::unique_lock<ceph::shared_mutex> _lock_map() {
+      std::unique_lock l(map_lock, std::defer_lock);
+      if (cache->shared_lookup) {
+	l.lock();
+      }
+      return l;
+    }
+    /// caller must hold cache->lock and _lock_map()
     void _remove(const ghobject_t& oid);
   public:
     OnodeSpace(OnodeCacheShard *c) : cache(c) {}
@@ -1905,6 +1973,7 @@ private:
     interval_set<uint64_t> allocated, released;
     volatile_statfs statfs_delta;	   ///< overall store statistics delta
     uint64_t osd_pool_id = META_POOL_ID;    ///< osd pool id we're operating on
+    uint32_t alloc_journal_serial = 0; ///< alloc journal serial, 0 if not journaled
 
     IOContext ioc;
     bool had_ios = false;  ///< true if we submitted IOs before our kv txn
@@ -2058,6 +2127,21 @@ private:
       KeyValueDB &db,
       TransContext &txc,
       ceph::mono_clock::time_point);
+    /// take the budget of a txc costing up to cost before building it, so
+    /// that admitting it with start_reserved_transaction() doesn't block
+    void reserve_transaction(uint64_t cost) {
+      throttle_bytes.get(cost);
+      throttle_deferred_bytes.get(cost);
+    }
+    void cancel_reservation(uint64_t cost) {
+      throttle_bytes.put(cost);
+      throttle_deferred_bytes.put(cost);
+    }
+    void start_reserved_transaction(
+      KeyValueDB &db,
+      TransContext &txc,
+      uint64_t reserved,
+      ceph::mono_clock::time_point);
     void release_kv_throttle(uint64_t cost) {
       throttle_bytes.put(cost);
     }
@@ -2133,6 +2217,10 @@ private:
 
     ceph::mutex deferred_lock = ceph::make_mutex("BlueStore::OpSequencer::deferred_lock");
 
+    /// held while a txc is prepared and admitted, so background rewrites
+    /// can't interleave with the transactions of the collection's owner
+    ceph::mutex submit_lock = ceph::make_mutex("BlueStore::OpSequencer::submit_lock");
+
     BlueStore *store;
     coll_t cid;
 
@@ -2272,6 +2360,22 @@ private:
       return NULL;
     }
   };
+  struct AllocJournalThread : public Thread {
+    BlueStore *store;
+    explicit AllocJournalThread(BlueStore *s) : store(s) {}
+    void *entry() override {
+      store->_alloc_journal_thread();
+      return NULL;
+    }
+  };
+  struct CompressedGCThread : public Thread {
+    BlueStore *store;
+    explicit CompressedGCThread(BlueStore *s) : store(s) {}
+    void *entry() override {
+      store->_compressed_gc_thread();
+      return NULL;
+    }
+  };
 
   struct BigDeferredWriteContext {
     uint64_t off = 0;     // original logical offset
@@ -2308,6 +2412,7 @@ private:
   FreelistManager *fm = nullptr;
 
   Allocator *alloc = nullptr;   ///< allocator consumed by BlueStore
+  FrontCacheAllocator *alloc_front_cache = nullptr; ///< == alloc if enabled
   bluefs_shared_alloc_context_t shared_alloc; ///< consumed by BlueFS (may be == alloc)
 
   uuid_d fsid;
@@ -2347,6 +2452,7 @@ private:
   std::atomic_int deferred_aggressive = {0}; ///< aggressive wakeup of kv thread
   Finisher  finisher;
   utime_t  deferred_last_submitted = utime_t();
+  uint64_t deferred_elevator_pos = 0; ///< disk offset the next deferred_try_submit sweep starts at
 
   KVSyncThread kv_sync_thread;
   ceph::mutex kv_lock = ceph::make_mutex("BlueStore::kv_lock");
@@ -2369,6 +2475,35 @@ private:
   std::deque<DeferredBatch*> deferred_stable_to_finalize; ///< pending finalization
   bool kv_finalize_in_progress = false;
 
+  // allocation journal (NCB mode): per-txc allocation deltas recorded on top
+  // of the last allocation file so it stays valid while mounted
+  AllocJournalThread alloc_journal_thread;
+  ceph::mutex alloc_journal_lock = ceph::make_mutex("BlueStore::alloc_journal_lock");
+  ceph::condition_variable alloc_journal_cond;
+  bool alloc_journal_active = false;
+  bool alloc_journal_started = false;
+  bool alloc_journal_stop = false;
+  uint32_t alloc_journal_serial = 0;       ///< serial new records are written with
+  uint32_t alloc_journal_image_serial = 0; ///< serial of the allocation file
+  uint64_t alloc_journal_seq = 0;          ///< last record seq
+  uint64_t alloc_journal_entries = 0;      ///< records since last checkpoint
+  uint64_t alloc_journal_checkpoint_records = 0;
+  std::map<uint32_t, uint64_t> alloc_journal_inflight; ///< serial -> uncommitted records
+  std::unique_ptr<Allocator> alloc_journal_base; ///< rebuilt allocation to seed the journal
+
+  CompressedGCThread compressed_gc_thread;
+  ceph::mutex compressed_gc_lock = ceph::make_mutex("BlueStore::compressed_gc_lock");
+  ceph::condition_variable compressed_gc_cond;
+  std::atomic_bool compressed_gc_stop = {false};
+  bool compressed_gc_kick = false;  ///< run a pass now
+  bool compressed_gc_estimate_kick = false;  ///< run an estimate now
+  bool compressed_gc_estimate_running = false;
+  std::optional<compressed_gc_stats_t> compressed_gc_last_estimate;
+  utime_t compressed_gc_last_estimate_stamp;
+
+  class SocketHook;
+  SocketHook* asok_hook = nullptr;
+
   PerfCounters *logger = nullptr;
 
   std::list<CollectionRef> removed_collections;
@@ -2442,6 +2577,7 @@ private:
   uint64_t osd_memory_cache_min = 0; ///< Min memory to assign when autotuning cache
   double osd_memory_cache_resize_interval = 0; ///< Time to wait between cache resizing 
   double max_defer_interval = 0; ///< Time to wait between last deferred submit
+  std::atomic<uint32_t> extent_map_prefetch_shards = {0}; ///< shards to load ahead of sequential reads
   std::atomic<uint32_t> config_changed = {0}; ///< Counter to determine if there is a configuration change.
 
   typedef std::map<uint64_t, volatile_statfs> osd_pools_map;
@@ -2802,6 +2938,8 @@ private:
   void _txc_add_transaction(TransContext *txc, Transaction *t);
   void _txc_calc_cost(TransContext *txc);
   void _txc_write_nodes(TransContext *txc, KeyValueDB::Transaction t);
+  void _txc_prepare_kv(TransContext *txc);
+  void _txc_throttle(TransContext *txc, ceph::mono_clock::time_point tstart);
   void _txc_state_proc(TransContext *txc);
   void _txc_aio_submit(TransContext *txc);
 public:
@@ -2815,6 +2953,9 @@ private:
   void _txc_committed_kv(TransContext *txc);
   void _txc_finish(TransContext *txc);
   void _txc_release_alloc(TransContext *txc);
+  void _txc_alloc_journal(TransContext *txc, KeyValueDB::Transaction t,
+			  const interval_set<uint64_t>& allocated,
+			  const interval_set<uint64_t>& released);
 
   void _osr_attach(Collection *c);
   void _osr_register_zombie(OpSequencer *osr);
@@ -2826,6 +2967,17 @@ private:
   void _kv_stop();
   void _kv_sync_thread();
   void _kv_finalize_thread();
+  void _alloc_journal_thread();
+
+  void _compressed_gc_start();
+  void _compressed_gc_stop();
+  void _compressed_gc_thread();
+  void _compressed_gc_pace(ceph::mono_clock::time_point start,
+			   uint64_t bytes);
+  void _compressed_gc_find(OnodeRef& o, compressed_gc_stats_t *stats,
+			   interval_set<uint64_t> *extents);
+  uint64_t _compressed_gc_object(CollectionRef& c, const ghobject_t& oid,
+				 bool rewrite, compressed_gc_stats_t *stats);
 
   bluestore_deferred_op_t *_get_deferred_op(TransContext *txc, uint64_t len);
   void _deferred_queue(TransContext *txc);
@@ -2887,7 +3039,8 @@ private:
     BlueStoreRepairer* repairer,
     store_statfs_t& expected_statfs,
     pool_fsck_stats_t& pool_fsck_stat,
-    FSCKDepth depth);
+    FSCKDepth depth,
+    ceph::mutex* used_lock = nullptr);
 
   void _fsck_check_statfs(
     const store_statfs_t& expected_store_statfs,
@@ -2906,6 +3059,9 @@ private:
   int _fsck(FSCKDepth depth, bool repair);
   int _fsck_on_open(BlueStore::FSCKDepth depth, bool repair);
 
+  /// wall time spent in each phase of the last fsck
+  std::vector<std::pair<std::string, double>> fsck_phase_timings;
+
   void _buffer_cache_write(
     TransContext *txc,
     BlobRef b,
@@ -3036,6 +3192,12 @@ public:
   int quick_fix() override {
     return _fsck(FSCK_SHALLOW, true);
   }
+  const std::vector<std::pair<std::string, double>>& get_fsck_phase_timings() const {
+    return fsck_phase_timings;
+  }
+  /// scan every object for poorly referenced compressed blobs and,
+  /// if @rewrite is set, rewrite them (throttled)
+  void compressed_gc(bool rewrite, compressed_gc_stats_t *stats);
 
   void set_cache_shards(unsigned num) override;
   void dump_cache_stats(ceph::Formatter *f) override {
@@ -3193,6 +3355,9 @@ private:
     bool* csum_error,
     ceph::buffer::list& bl);
 
+  // whether data read from disk is to be inserted into the buffer cache
+  bool _use_read_cache(uint32_t op_flags, uint64_t length);
+
   int _do_read(
     Collection *c,
     OnodeRef& o,
@@ -3225,6 +3390,9 @@ public:
     ceph::buffer::list& bl,
     uint32_t op_flags) override;
 
+  int get_data_location_hint(CollectionHandle &c, const ghobject_t& oid,
+    uint64_t *hint) override;
+
   int dump_onode(CollectionHandle &c, const ghobject_t& oid,
     const std::string& section_name, ceph::Formatter *f) override;
 
@@ -3389,6 +3557,13 @@ public:
   void inject_false_free(coll_t cid, ghobject_t oid);
   void inject_statfs(const std::string& key, const store_statfs_t& new_statfs);
   void inject_global_statfs(const store_statfs_t& new_statfs);
+  // the next umount() stores neither statfs nor the allocation file, as an
+  // unclean shutdown would
+  void inject_unclean_umount();
+  // fold the allocation journal into a new allocation file right away
+  int debug_alloc_journal_checkpoint() {
+    return _alloc_journal_checkpoint();
+  }
   void inject_misreference(coll_t cid1, ghobject_t oid1,
 			   coll_t cid2, ghobject_t oid2,
 			   uint64_t offset);
@@ -3803,6 +3978,8 @@ public:
     per_pool_statfs& expected_pool_statfs;
     per_pool_fsck_stats_t& per_pool_fsck_stats;
     BlueStoreRepairer* repairer;
+    // guards used_blocks and used_omap_head when several workers share them
+    ceph::mutex* used_lock = nullptr;
 
     FSCK_ObjectCtx(int64_t& e,
                    int64_t& w,
@@ -3943,11 +4120,23 @@ private:
 				      uint64_t  *p_extent_count, const void *v_header, BlueFS::FileReader *p_handle, uint64_t offset);
 
   int  copy_allocator(Allocator* src_alloc, Allocator *dest_alloc, uint64_t* p_num_entries);
+  int  __store_allocator(BlueFS::FileWriter *p_handle, Allocator* allocator, uint32_t serial,
+			 uint64_t *p_extent_count, uint64_t *p_allocation_size);
   int  store_allocator(Allocator* allocator);
+  int  _write_alloc_image(Allocator* allocator, uint32_t serial);
   int  invalidate_allocation_file_on_bluefs();
-  int  __restore_allocator(Allocator* allocator, uint64_t *num, uint64_t *bytes);
+  int  __restore_allocator(Allocator* allocator, uint64_t *num, uint64_t *bytes,
+			   uint32_t *p_serial = nullptr);
   int  restore_allocator(Allocator* allocator, uint64_t *num, uint64_t *bytes);
   int  read_allocation_from_drive_on_startup();
+  int  _replay_alloc_journal(Allocator* allocator, uint32_t image_serial, uint32_t end_serial,
+			     uint64_t *p_records, uint32_t *p_max_serial, uint64_t *p_max_seq,
+			     bool *p_has_stats, osd_pools_map *p_pools, volatile_statfs *p_vstatfs);
+  int  _open_alloc_journal();
+  int  _alloc_journal_checkpoint();
+  void _alloc_journal_prepare_close(KeyValueDB::Transaction t);
+  static void _alloc_journal_encode_stats(bool per_pool, osd_pools_map& pools,
+					  volatile_statfs& vs, ceph::buffer::list& bl);
   int  reconstruct_allocations(SimpleBitmap *smbmp, read_alloc_stats_t &stats);
   int  read_allocation_from_onodes(SimpleBitmap *smbmp, read_alloc_stats_t& stats);
   int  commit_freelist_type();
@@ -3967,6 +4156,36 @@ private:
 
   void _fsck_check_objects(FSCKDepth depth,
     FSCK_ObjectCtx& ctx);
+
+  using fsck_queue_object_fn_t = std::function<bool(
+    int64_t pool_id,
+    CollectionRef c,
+    const ghobject_t& oid,
+    const std::string& key,
+    const ceph::buffer::list& value)>;
+  // check objects with keys in [first, last), empty last means no bound
+  void _fsck_check_objects_range(FSCKDepth depth,
+    const std::string& first,
+    const std::string& last,
+    FSCK_ObjectCtx& ctx,
+    uint64_t_btree_t& used_nids,
+    ceph::mutex* used_nids_lock,
+    const fsck_queue_object_fn_t& queue,
+    size_t* processed_myself);
+  void _fsck_check_shared_blobs_range(FSCKDepth depth,
+    const std::string& first,
+    const std::string& last,
+    size_t sb_ref_mismatches,
+    uint64_t& num_shared_blobs,
+    FSCK_ObjectCtx& ctx);
+  void _fsck_check_omap_range(const std::string& prefix,
+    const std::string& first,
+    const std::string& last,
+    FSCK_ObjectCtx& ctx);
+  // keys splitting @prefix keyspace in up to @count ranges of similar size
+  void _fsck_get_split_keys(const std::string& prefix,
+    size_t count,
+    std::vector<std::string>* keys);
 };
 
 inline std::ostream& operator<<(std::ostream& out, const BlueStore::volatile_statfs& s) {
@@ -0,0 +1,305 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "FrontCacheAllocator.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef  dout_prefix
+#define dout_prefix *_dout << "FrontCacheAllocator(" << this << ") "
+
+FrontCacheAllocator::FrontCacheAllocator(CephContext* cct,
+					 Allocator* _backend,
+					 const std::vector<uint64_t>& sizes,
+					 uint64_t batch_bytes,
+					 std::string_view name)
+  : Allocator(name, _backend->get_capacity(), _backend->get_block_size()),
+    cct(cct),
+    backend(_backend)
+{
+  std::vector<uint64_t> s(sizes);
+  std::sort(s.begin(), s.end());
+  s.erase(std::unique(s.begin(), s.end()), s.end());
+  for (auto size : s) {
+    if (size == 0 || size % block_size != 0 ||
+	size > std::numeric_limits<decltype(bluestore_pextent_t::length)>::max()) {
+      ldout(cct, 1) << __func__ << " ignoring size class 0x" << std::hex << size
+		    << ", not a multiple of block size 0x" << block_size
+		    << std::dec << dendl;
+      continue;
+    }
+    classes.push_back({size, std::max<size_t>(1, batch_bytes / size)});
+  }
+  for (auto& shard : shards) {
+    shard.mags.resize(classes.size());
+  }
+  ldout(cct, 1) << __func__ << " " << backend->get_type()
+		<< " classes " << classes.size() << dendl;
+}
+
+FrontCacheAllocator::~FrontCacheAllocator()
+{
+}
+
+int FrontCacheAllocator::_find_class(uint64_t length) const
+{
+  for (size_t i = 0; i < classes.size(); ++i) {
+    if (classes[i].size == length) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void FrontCacheAllocator::_carve(const PExtentVector& from, uint64_t size,
+				 std::vector<uint64_t>* to,
+				 interval_set<uint64_t>* leftovers)
+{
+  for (auto& e : from) {
+    uint64_t off = e.offset;
+    uint64_t end = e.end();
+    for (; end - off >= size; off += size) {
+      to->push_back(off);
+    }
+    if (off < end) {
+      leftovers->insert(off, end - off);
+    }
+  }
+}
+
+void FrontCacheAllocator::_drain_all(interval_set<uint64_t>* to)
+{
+  for (auto& shard : shards) {
+    std::lock_guard l(shard.lock);
+    bool drained = false;
+    for (size_t c = 0; c < classes.size(); ++c) {
+      auto& offs = shard.mags[c].offsets;
+      for (auto off : offs) {
+	to->insert(off, classes[c].size);
+      }
+      shard.stats.cached -= offs.size() * classes[c].size;
+      drained = drained || !offs.empty();
+      offs.clear();
+    }
+    if (drained) {
+      ++shard.stats.drains;
+    }
+  }
+}
+
+int64_t FrontCacheAllocator::allocate(
+  uint64_t want,
+  uint64_t unit,
+  uint64_t max_alloc_size,
+  int64_t  hint,
+  PExtentVector *extents)
+{
+  ldout(cct, 20) << __func__ << std::hex
+		 << " 0x" << want
+		 << "/" << unit
+		 << "," << max_alloc_size
+		 << "," << hint
+		 << std::dec << dendl;
+  auto& shard = _pick_shard();
+  int c = _find_class(want);
+  if (c >= 0 && unit <= want &&
+      (max_alloc_size == 0 || max_alloc_size >= want)) {
+    auto& offs = shard.mags[c].offsets;
+    {
+      std::lock_guard l(shard.lock);
+      if (!offs.empty() && p2phase(offs.back(), unit) == 0) {
+	extents->emplace_back(offs.back(), want);
+	offs.pop_back();
+	shard.stats.cached -= want;
+	++shard.stats.hits;
+	return want;
+      }
+    }
+    // refill with class aligned extents so that any unit not larger than
+    // the class fits them
+    auto& cls = classes[c];
+    PExtentVector got;
+    int64_t r = backend->allocate(cls.size * cls.batch, cls.size, cls.size,
+				  hint, &got);
+    if (r > 0) {
+      std::vector<uint64_t> carved;
+      interval_set<uint64_t> leftovers;
+      _carve(got, cls.size, &carved, &leftovers);
+      if (!leftovers.empty()) {
+	backend->release(leftovers);
+      }
+      std::lock_guard l(shard.lock);
+      ++shard.stats.refills;
+      offs.insert(offs.end(), carved.begin(), carved.end());
+      shard.stats.cached += carved.size() * cls.size;
+      if (!offs.empty() && p2phase(offs.back(), unit) == 0) {
+	extents->emplace_back(offs.back(), want);
+	offs.pop_back();
+	shard.stats.cached -= want;
+	++shard.stats.hits;
+	return want;
+      }
+    }
+  }
+  {
+    std::lock_guard l(shard.lock);
+    ++shard.stats.misses;
+  }
+
+  auto orig_size = extents->size();
+  int64_t res = backend->allocate(want, unit, max_alloc_size, hint, extents);
+  if (res < 0) {
+    ceph_assert(orig_size == extents->size());
+    res = 0;
+  }
+  if ((uint64_t)res < want) {
+    // space held by the cache might be what's missing
+    interval_set<uint64_t> cached;
+    _drain_all(&cached);
+    if (!cached.empty()) {
+      ldout(cct, 5) << __func__ << " short allocation 0x" << std::hex << res
+		    << "/0x" << want << ", drained 0x" << cached.size()
+		    << std::dec << dendl;
+      backend->release(cached);
+      int64_t r = backend->allocate(want - res, unit, max_alloc_size, hint,
+				    extents);
+      if (r > 0) {
+	res += r;
+      }
+    }
+  }
+  return res ? res : -ENOSPC;
+}
+
+void FrontCacheAllocator::release(const interval_set<uint64_t>& release_set)
+{
+  interval_set<uint64_t> to_release;
+  auto& shard = _pick_shard();
+  {
+    std::lock_guard l(shard.lock);
+    for (auto p = release_set.begin(); p != release_set.end(); ++p) {
+      int c = _find_class(p.get_len());
+      if (c < 0) {
+	to_release.insert(p.get_start(), p.get_len());
+	continue;
+      }
+      auto& cls = classes[c];
+      auto& offs = shard.mags[c].offsets;
+      if (offs.size() >= cls.batch * 2) {
+	// oldest extents go back first
+	for (size_t i = 0; i < cls.batch; ++i) {
+	  to_release.insert(offs[i], cls.size);
+	}
+	offs.erase(offs.begin(), offs.begin() + cls.batch);
+	shard.stats.cached -= cls.batch * cls.size;
+	++shard.stats.drains;
+      }
+      offs.push_back(p.get_start());
+      shard.stats.cached += cls.size;
+    }
+  }
+  if (!to_release.empty()) {
+    backend->release(to_release);
+  }
+}
+
+void FrontCacheAllocator::dump()
+{
+  auto stats = get_stats();
+  ldout(cct, 0) << __func__ << " hits " << stats.hits
+		<< " misses " << stats.misses
+		<< " refills " << stats.refills
+		<< " drains " << stats.drains
+		<< " cached 0x" << std::hex << stats.cached << std::dec
+		<< dendl;
+  for (size_t i = 0; i < std::size(shards); ++i) {
+    std::lock_guard l(shards[i].lock);
+    for (size_t c = 0; c < classes.size(); ++c) {
+      auto& offs = shards[i].mags[c].offsets;
+      if (!offs.empty()) {
+	ldout(cct, 0) << __func__ << " shard " << i << " class 0x" << std::hex
+		      << classes[c].size << std::dec << " extents "
+		      << offs.size() << dendl;
+      }
+    }
+  }
+  backend->dump();
+}
+
+void FrontCacheAllocator::foreach(
+  std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  backend->foreach(notify);
+  std::vector<std::pair<uint64_t, uint64_t>> cached;
+  for (auto& shard : shards) {
+    cached.clear();
+    {
+      std::lock_guard l(shard.lock);
+      for (size_t c = 0; c < classes.size(); ++c) {
+	for (auto off : shard.mags[c].offsets) {
+	  cached.emplace_back(off, classes[c].size);
+	}
+      }
+    }
+    for (auto& [off, len] : cached) {
+      notify(off, len);
+    }
+  }
+}
+
+void FrontCacheAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  backend->init_add_free(offset, length);
+}
+
+void FrontCacheAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  // the range might be partially cached
+  drain();
+  backend->init_rm_free(offset, length);
+}
+
+uint64_t FrontCacheAllocator::get_free()
+{
+  return backend->get_free() + get_stats().cached;
+}
+
+double FrontCacheAllocator::get_fragmentation()
+{
+  return backend->get_fragmentation();
+}
+
+void FrontCacheAllocator::shutdown()
+{
+  drain();
+  backend->shutdown();
+}
+
+FrontCacheAllocator::stats_t FrontCacheAllocator::get_stats()
+{
+  stats_t res;
+  for (auto& shard : shards) {
+    std::lock_guard l(shard.lock);
+    res.hits += shard.stats.hits;
+    res.misses += shard.stats.misses;
+    res.refills += shard.stats.refills;
+    res.drains += shard.stats.drains;
+    res.cached += shard.stats.cached;
+  }
+  return res;
+}
+
+void FrontCacheAllocator::drain()
+{
+  interval_set<uint64_t> cached;
+  _drain_all(&cached);
+  if (!cached.empty()) {
+    backend->release(cached);
+  }
+}
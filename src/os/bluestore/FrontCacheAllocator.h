@@ -0,0 +1,108 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Allocator.h"
+#include "include/mempool.h"
+#include "include/spinlock.h"
+
+/*
+ * Size-class front cache which can be put in front of any Allocator.
+ *
+ * Each shard (picked by the calling thread, the same way mempool does)
+ * keeps a magazine of pre-carved free extents per size class. Allocation
+ * requests for exactly one class-sized extent and releases of class-sized
+ * extents are served by the shard without touching the backend allocator;
+ * magazines are refilled from and drained to the backend in batches.
+ *
+ * Cached extents are still free space: they are accounted in get_free()
+ * and reported by foreach(), so fragmentation score and the allocation
+ * map persisted on shutdown include them.
+ */
+class FrontCacheAllocator : public Allocator {
+public:
+  struct stats_t {
+    uint64_t hits = 0;      ///< allocations served by the cache
+    uint64_t misses = 0;    ///< allocations passed to the backend
+    uint64_t refills = 0;   ///< batched allocations from the backend
+    uint64_t drains = 0;    ///< batched releases to the backend
+    uint64_t cached = 0;    ///< bytes currently held by the cache
+  };
+
+  /*
+   * Takes ownership of @backend.
+   * @sizes lists the cached extent sizes, each has to be a multiple of
+   * the backend's block size.
+   * @batch_bytes is the amount of space moved between a magazine and
+   * the backend at once, a magazine holds up to twice as much.
+   */
+  FrontCacheAllocator(CephContext* cct,
+		      Allocator* backend,
+		      const std::vector<uint64_t>& sizes,
+		      uint64_t batch_bytes,
+		      std::string_view name);
+  ~FrontCacheAllocator() override;
+
+  const char* get_type() const override
+  {
+    return backend->get_type();
+  }
+  int64_t allocate(
+    uint64_t want,
+    uint64_t unit,
+    uint64_t max_alloc_size,
+    int64_t  hint,
+    PExtentVector *extents) override;
+  void release(const interval_set<uint64_t>& release_set) override;
+  void dump() override;
+  void foreach(
+    std::function<void(uint64_t offset, uint64_t length)> notify) override;
+  void init_add_free(uint64_t offset, uint64_t length) override;
+  void init_rm_free(uint64_t offset, uint64_t length) override;
+  uint64_t get_free() override;
+  double get_fragmentation() override;
+  void shutdown() override;
+
+  stats_t get_stats();
+  // return every cached extent to the backend
+  void drain();
+
+  Allocator* get_backend() {
+    return backend.get();
+  }
+
+private:
+  struct size_class_t {
+    uint64_t size;
+    size_t batch;     ///< extents per refill/drain
+  };
+  struct magazine_t {
+    std::vector<uint64_t> offsets;  ///< all of the class size
+  };
+  // keep shards on separate cache lines
+  struct alignas(64) shard_t {
+    ceph::spinlock lock;
+    std::vector<magazine_t> mags;
+    stats_t stats;
+  };
+
+  CephContext* cct;
+  std::unique_ptr<Allocator> backend;
+  std::vector<size_class_t> classes;
+  shard_t shards[mempool::num_shards];
+
+  shard_t& _pick_shard() {
+    return shards[mempool::pick_a_shard_int()];
+  }
+  int _find_class(uint64_t length) const;
+  // carve backend extents into class sized ones, leftovers go back
+  void _carve(const PExtentVector& from, uint64_t size,
+	      std::vector<uint64_t>* to,
+	      interval_set<uint64_t>* leftovers);
+  void _drain_all(interval_set<uint64_t>* to);
+};
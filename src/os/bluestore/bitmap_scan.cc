@@ -0,0 +1,151 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "bitmap_scan.h"
+
+#include <cstring>
+
+#include "arch/probe.h"
+#include "arch/intel.h"
+#include "arch/arm.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_BITMAP_SCAN_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_BITMAP_SCAN_NEON 1
+#endif
+
+#ifdef HAVE_BITMAP_SCAN_X86
+__attribute__((target("avx2")))
+static size_t bitmap_scan_skip_avx2(const uint64_t* words,
+				    size_t pos,
+				    size_t end,
+				    uint64_t pattern)
+{
+  const __m256i pat = _mm256_set1_epi64x(pattern);
+  const __m256i ones = _mm256_set1_epi64x(-1);
+  // a cache line per iteration while everything matches
+  while (pos + 8 <= end) {
+    __m256i a = _mm256_cmpeq_epi64(
+      _mm256_loadu_si256((const __m256i*)(words + pos)), pat);
+    __m256i b = _mm256_cmpeq_epi64(
+      _mm256_loadu_si256((const __m256i*)(words + pos + 4)), pat);
+    if (!_mm256_testc_si256(_mm256_and_si256(a, b), ones)) {
+      break;
+    }
+    pos += 8;
+  }
+  while (pos + 4 <= end) {
+    __m256i eq = _mm256_cmpeq_epi64(
+      _mm256_loadu_si256((const __m256i*)(words + pos)), pat);
+    unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+    if (mask != 0xf) {
+      return pos + __builtin_ctz(~mask);
+    }
+    pos += 4;
+  }
+  return bitmap_scan_skip_scalar(words, pos, end, pattern);
+}
+
+__attribute__((target("avx512f")))
+static size_t bitmap_scan_skip_avx512(const uint64_t* words,
+				      size_t pos,
+				      size_t end,
+				      uint64_t pattern)
+{
+  const __m512i pat = _mm512_set1_epi64(pattern);
+  while (pos + 8 <= end) {
+    __mmask8 ne = _mm512_cmpneq_epi64_mask(
+      _mm512_loadu_si512((const void*)(words + pos)), pat);
+    if (ne) {
+      return pos + __builtin_ctz(ne);
+    }
+    pos += 8;
+  }
+  if (pos < end) {
+    // masked tail, lanes past the end are neither loaded nor compared
+    __mmask8 m = (__mmask8)((1u << (end - pos)) - 1);
+    __mmask8 ne = _mm512_mask_cmpneq_epi64_mask(
+      m, _mm512_maskz_loadu_epi64(m, words + pos), pat);
+    pos = ne ? pos + __builtin_ctz(ne) : end;
+  }
+  return pos;
+}
+#endif // HAVE_BITMAP_SCAN_X86
+
+#ifdef HAVE_BITMAP_SCAN_NEON
+static size_t bitmap_scan_skip_neon(const uint64_t* words,
+				    size_t pos,
+				    size_t end,
+				    uint64_t pattern)
+{
+  const uint64x2_t pat = vdupq_n_u64(pattern);
+  while (pos + 4 <= end) {
+    uint64x2_t a = vceqq_u64(vld1q_u64(words + pos), pat);
+    uint64x2_t b = vceqq_u64(vld1q_u64(words + pos + 2), pat);
+    if (vminvq_u32(vreinterpretq_u32_u64(vandq_u64(a, b))) != 0xffffffff) {
+      break;
+    }
+    pos += 4;
+  }
+  return bitmap_scan_skip_scalar(words, pos, end, pattern);
+}
+#endif // HAVE_BITMAP_SCAN_NEON
+
+struct bitmap_scan_impl_t {
+  const char* name;
+  bitmap_scan_skip_func_t func;
+  bool (*supported)();
+};
+
+static const bitmap_scan_impl_t bitmap_scan_impls[] = {
+#ifdef HAVE_BITMAP_SCAN_X86
+  { "avx512", bitmap_scan_skip_avx512, [] { return !!ceph_arch_intel_avx512f; } },
+  { "avx2", bitmap_scan_skip_avx2, [] { return !!ceph_arch_intel_avx2; } },
+#endif
+#ifdef HAVE_BITMAP_SCAN_NEON
+  { "neon", bitmap_scan_skip_neon, [] { return !!ceph_arch_neon; } },
+#endif
+  { "scalar", bitmap_scan_skip_scalar, [] { return true; } },
+};
+
+static const bitmap_scan_impl_t* bitmap_scan_impl = nullptr;
+
+/*
+ * choose the best implementation based on the CPU architecture,
+ * the table above is ordered by preference.
+ */
+static bitmap_scan_skip_func_t bitmap_scan_choose()
+{
+  // make sure we've probed cpu features; this might depend on the
+  // link order of this file relative to arch/probe.cc.
+  ceph_arch_probe();
+  for (auto& i : bitmap_scan_impls) {
+    if (i.supported()) {
+      bitmap_scan_impl = &i;
+      break;
+    }
+  }
+  return bitmap_scan_impl->func;
+}
+
+bitmap_scan_skip_func_t bitmap_scan_skip_func = bitmap_scan_choose();
+
+const char* bitmap_scan_get_impl()
+{
+  return bitmap_scan_impl->name;
+}
+
+bool bitmap_scan_set_impl(const char* name)
+{
+  for (auto& i : bitmap_scan_impls) {
+    if (strcmp(i.name, name) == 0 && i.supported()) {
+      bitmap_scan_impl = &i;
+      bitmap_scan_skip_func = i.func;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,61 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Word scanning primitives shared by the bitmap allocators.
+ *
+ * Skipping long runs of fully free/fully allocated words dominates the
+ * search on large fragmented devices, so this is vectorized where the CPU
+ * allows it and the implementation is picked at runtime.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+typedef size_t (*bitmap_scan_skip_func_t)(const uint64_t* words,
+					  size_t pos,
+					  size_t end,
+					  uint64_t pattern);
+
+inline size_t bitmap_scan_skip_scalar(const uint64_t* words,
+				      size_t pos,
+				      size_t end,
+				      uint64_t pattern)
+{
+  while (pos < end && words[pos] == pattern) {
+    ++pos;
+  }
+  return pos;
+}
+
+#ifndef NON_CEPH_BUILD
+extern bitmap_scan_skip_func_t bitmap_scan_skip_func;
+
+// name of the implementation in use: "scalar", "avx2", "avx512" or "neon"
+const char* bitmap_scan_get_impl();
+// switch implementation (for benchmarking), false if it isn't supported
+// by this build or CPU
+bool bitmap_scan_set_impl(const char* name);
+#endif
+
+// returns the index of the first word in [pos, end) which differs from
+// @pattern or @end if there is none
+inline size_t bitmap_scan_skip(const uint64_t* words,
+			       size_t pos,
+			       size_t end,
+			       uint64_t pattern)
+{
+  // most runs are short, don't pay for the indirect call on those
+  if (pos >= end || words[pos] != pattern) {
+    return pos;
+  }
+  if (++pos >= end || words[pos] != pattern) {
+    return pos;
+  }
+#ifdef NON_CEPH_BUILD
+  return bitmap_scan_skip_scalar(words, pos + 1, end, pattern);
+#else
+  return bitmap_scan_skip_func(words, pos + 1, end, pattern);
+#endif
+}
@@ -194,6 +194,19 @@ bluefs_fnode_delta_t* bluefs_fnode_t::make_delta(bluefs_fnode_delta_t* delta) {
   return delta;
 }
 
+bluefs_fnode_t bluefs_fnode_t::get_committed() const
+{
+  bluefs_fnode_t f(ino, std::min(size, allocated_commited), mtime);
+  uint64_t left = allocated_commited;
+  for (auto p = extents.begin(); p != extents.end() && left > 0; ++p) {
+    uint64_t len = std::min<uint64_t>(p->length, left);
+    f.append_extent(bluefs_extent_t(p->bdev, p->offset, len));
+    left -= len;
+  }
+  f.reset_delta();
+  return f;
+}
+
 void bluefs_fnode_t::dump(Formatter *f) const
 {
   f->dump_unsigned("ino", ino);
@@ -178,6 +178,9 @@ struct bluefs_fnode_t {
   mempool::bluefs::vector<bluefs_extent_t>::iterator seek(
     uint64_t off, uint64_t *x_off);
   bluefs_fnode_delta_t* make_delta(bluefs_fnode_delta_t* delta);
+  // the fnode as it is known to the log, i.e. without the extents
+  // which haven't been streamed by make_delta() yet
+  bluefs_fnode_t get_committed() const;
 
   void dump(ceph::Formatter *f) const;
   static void generate_test_instances(std::list<bluefs_fnode_t*>& ls);
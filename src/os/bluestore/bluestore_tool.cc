@@ -290,6 +290,7 @@ int main(int argc, char **argv)
   string resharding_ctrl;
   int log_level = 30;
   bool fsck_deep = false;
+  unsigned fsck_threads = 0;
   po::options_description po_options("Options");
   po_options.add_options()
     ("help,h", "produce help message")
@@ -306,6 +307,7 @@ int main(int argc, char **argv)
     ("devs-source", po::value<vector<string>>(&devs_source), "bluefs-dev-migrate source device(s)")
     ("dev-target", po::value<string>(&dev_target), "target/resulting device")
     ("deep", po::value<bool>(&fsck_deep), "deep fsck (read all data)")
+    ("threads", po::value<unsigned>(&fsck_threads), "amount of threads to run fsck, repair and quick-fix with")
     ("key,k", po::value<string>(&key), "label metadata key name")
     ("value,v", po::value<string>(&value), "label metadata value")
     ("allocator", po::value<vector<string>>(&allocs_name), "allocator to inspect: 'block'/'bluefs-wal'/'bluefs-db'")
@@ -339,6 +341,7 @@ int main(int argc, char **argv)
         "free-score, "
         "free-fragmentation, "
         "bluefs-stats, "
+        "bench-mount, "
         "reshard, "
         "show-sharding")
     ;
@@ -453,7 +456,7 @@ int main(int argc, char **argv)
     }
   }
 
-  if (action == "fsck" || action == "repair" || action == "quick-fix" || action == "allocmap" || action == "qfsck" || action == "restore_cfb") {
+  if (action == "fsck" || action == "repair" || action == "quick-fix" || action == "allocmap" || action == "qfsck" || action == "restore_cfb" || action == "bench-mount") {
     if (path.empty()) {
       cerr << "must specify bluestore path" << std::endl;
       exit(EXIT_FAILURE);
@@ -628,6 +631,15 @@ int main(int argc, char **argv)
       action == "repair" ||
       action == "quick-fix") {
     validate_path(cct.get(), path, false);
+    if (fsck_threads) {
+      // make sure we can adjust any config settings
+      g_conf()._clear_safe_to_start_threads();
+      g_conf().set_val_or_die("bluestore_fsck_threads",
+                              stringify(fsck_threads));
+      // quick-fix threads are in addition to the main one
+      g_conf().set_val_or_die("bluestore_fsck_quick_fix_threads",
+                              stringify(fsck_threads - 1));
+    }
     BlueStore bluestore(cct.get(), path);
     int r;
     if (action == "fsck") {
@@ -637,6 +649,10 @@ int main(int argc, char **argv)
     } else {
       r = bluestore.quick_fix();
     }
+    for (auto& [phase, secs] : bluestore.get_fsck_phase_timings()) {
+      cout << action << " phase " << phase << ": " << secs << " seconds"
+           << std::endl;
+    }
     if (r < 0) {
       cerr << action << " failed: " << cpp_strerror(r) << std::endl;
       exit(EXIT_FAILURE);
@@ -1109,6 +1125,34 @@ int main(int argc, char **argv)
     }
     cout << std::string(out.c_str(), out.length()) << std::endl;
      bluestore.cold_close();
+  } else if (action == "bench-mount") {
+    // time loading the allocation state: first from the allocation file
+    // (plus allocation journal replay), then a full rebuild from the onodes
+    validate_path(cct.get(), path, false);
+    g_conf()._clear_safe_to_start_threads();
+    JSONFormatter jf(true);
+    jf.open_object_section("bench-mount");
+    for (auto from_file : { true, false }) {
+      g_conf().set_val_or_die("bluestore_debug_inject_allocation_from_file_failure",
+                              from_file ? "0" : "1");
+      BlueStore bluestore(cct.get(), path);
+      auto start = ceph::mono_clock::now();
+      int r = bluestore.cold_open();
+      if (r < 0) {
+        cerr << "error from cold_open: " << cpp_strerror(r) << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      auto open_lat = ceph::mono_clock::now() - start;
+      if (from_file) {
+        jf.dump_bool("null_manager", bluestore.has_null_manager());
+      }
+      bluestore.cold_close();
+      jf.dump_float(from_file ? "allocation_file_sec" : "onode_rebuild_sec",
+                    ceph::to_seconds<double>(open_lat));
+    }
+    jf.close_section();
+    jf.flush(cout);
+    cout << std::endl;
   } else if (action == "reshard") {
     auto get_ctrl = [&](size_t& val) {
       if (!resharding_ctrl.empty()) {
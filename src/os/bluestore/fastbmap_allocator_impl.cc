@@ -41,73 +41,63 @@ interval_t AllocatorLevel01Loose::_get_longest_from_l0(uint64_t pos0,
   *tail = interval_t();
 
   auto d = bits_per_slot;
-  slot_t bits = l0[pos / d];
-  bits >>= pos % d;
-  bool end_loop = false;
   auto min_granules = min_length / l0_granularity;
 
-  do {
-    if ((pos % d) == 0) {
-      bits = l0[pos / d];
-      if (pos1 - pos >= d) {
-        switch(bits) {
-	  case all_slot_set:
-	    // slot is totally free
-	    if (!res_candidate.length) {
-	      res_candidate.offset = pos;
-	    }
-	    res_candidate.length += d;
-	    pos += d;
-	    end_loop = pos >= pos1;
-	    if (end_loop) {
-	      *tail = res_candidate;
-	      res_candidate = _align2units(res_candidate.offset,
-		res_candidate.length, min_granules);
-	      if(res.length < res_candidate.length) {
-		res = res_candidate;
-	      }
-	    }
-	    continue;
-	  case all_slot_clear:
-	    // slot is totally allocated
-	    res_candidate = _align2units(res_candidate.offset,
-	      res_candidate.length, min_granules);
-	    if (res.length < res_candidate.length) {
-	      res = res_candidate;
-	    }
-	    res_candidate = interval_t();
-	    pos += d;
-	    end_loop = pos >= pos1;
-	    continue;
-	}
-      }
-    } //if ((pos % d) == 0)
-
-    end_loop = ++pos >= pos1;
-    if (bits & 1) {
-      // item is free
-      if (!res_candidate.length) {
-	res_candidate.offset = pos - 1;
-      }
-      ++res_candidate.length;
-      if (end_loop) {
-	*tail = res_candidate;
-	res_candidate = _align2units(res_candidate.offset,
-	  res_candidate.length, min_granules);
-	if (res.length < res_candidate.length) {
-	  res = res_candidate;
-	}
+  auto close_candidate = [&]() {
+    res_candidate = _align2units(res_candidate.offset,
+      res_candidate.length, min_granules);
+    if (res.length < res_candidate.length) {
+      res = res_candidate;
+    }
+    res_candidate = interval_t();
+  };
+  auto extend_candidate = [&](uint64_t p, uint64_t len) {
+    if (!res_candidate.length) {
+      res_candidate.offset = p;
+    }
+    res_candidate.length += len;
+  };
+
+  while (pos < pos1) {
+    auto idx = pos / d;
+    auto bit = pos % d;
+    slot_t bits = l0[idx];
+    if (bit == 0 && pos1 - pos >= d &&
+        (bits == all_slot_set || bits == all_slot_clear)) {
+      // a run of totally free or totally allocated slots, skip at once
+      auto idx_end = bitmap_scan_skip(l0.data(), idx + 1, pos1 / d, bits);
+      auto len = (idx_end - idx) * d;
+      if (bits == all_slot_set) {
+	extend_candidate(pos, len);
+      } else {
+	close_candidate();
       }
-    } else {
-      res_candidate = _align2units(res_candidate.offset,
-	res_candidate.length, min_granules);
-      if (res.length < res_candidate.length) {
-	res = res_candidate;
+      pos += len;
+      continue;
+    }
+    // partial slot (or one cut by pos1): walk the runs of equal bits
+    bits >>= bit;
+    uint64_t avail = std::min<uint64_t>(d - bit, pos1 - pos);
+    while (avail) {
+      uint64_t n;
+      if (bits & 1) {
+	// item(s) free
+	n = std::min<uint64_t>(std::countr_one(bits), avail);
+	extend_candidate(pos, n);
+      } else {
+	n = std::min<uint64_t>(std::countr_zero(bits), avail);
+	close_candidate();
       }
-      res_candidate = interval_t();
+      bits = n < d ? bits >> n : 0;
+      pos += n;
+      avail -= n;
     }
-    bits >>= 1;
-  } while (!end_loop);
+  }
+  if (res_candidate.length) {
+    // range ends with a free run, let the caller continue it
+    *tail = res_candidate;
+    close_candidate();
+  }
   res.offset *= l0_granularity;
   res.length *= l0_granularity;
   tail->offset *= l0_granularity;
@@ -132,8 +122,15 @@ void AllocatorLevel01Loose::_analyze_partials(uint64_t pos_start,
   uint64_t next_free_l1_pos = 0;
   for (auto pos = pos_start / d; pos < pos_end / d; ++pos) {
     slot_t slot_val = l1[pos];
-    // FIXME minor: code below can be optimized to check slot_val against
-    // all_slot_set(_clear) value
+    if (slot_val == all_slot_clear) {
+      // all entries are L1_ENTRY_FULL, skip the whole run of such slots
+      auto next = bitmap_scan_skip(l1.data(), pos + 1, pos_end / d,
+	all_slot_clear);
+      prev_tail = empty_tail;
+      l1_pos += (next - pos) * d;
+      pos = next - 1;
+      continue;
+    }
 
     for (auto c = 0; c < d; c++) {
       switch (slot_val & L1_ENTRY_MASK) {
@@ -445,6 +442,8 @@ bool AllocatorLevel01Loose::_allocate_l1(uint64_t length,
       ++idx) {
       slot_t& slot_val = l1[idx];
       if (slot_val == all_slot_clear) {
+	idx = bitmap_scan_skip(l1.data(), idx + 1, l1_pos_end / d1,
+	  all_slot_clear) - 1;
         continue;
       } else if (slot_val == all_slot_set) {
         uint64_t to_alloc = std::min(length - *allocated,
@@ -9,6 +9,7 @@
 #ifndef __FAST_BITMAP_ALLOCATOR_IMPL_H
 #define __FAST_BITMAP_ALLOCATOR_IMPL_H
 #include "include/intarith.h"
+#include "os/bluestore/bitmap_scan.h"
 
 #include <bit>
 #include <vector>
@@ -740,8 +741,12 @@ protected:
 	size_t free_pos = 0;
 	bool all_set = false;
 	if (slot_val == all_slot_clear) {
-	  l2_pos += d;
+	  // skip the whole run of fully allocated slots
+	  auto next = bitmap_scan_skip(l2.data(), pos + 1, pos_end,
+	    all_slot_clear);
+	  l2_pos += d * (next - pos);
 	  last_pos = l2_pos;
+	  pos = next - 1;
 	  continue;
 	} else if (slot_val == all_slot_set) {
 	  free_pos = 0;
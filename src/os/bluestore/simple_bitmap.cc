@@ -13,6 +13,7 @@
  */
 
 #include "simple_bitmap.h"
+#include "bitmap_scan.h"
 
 #include "include/ceph_assert.h"
 #include "bluestore_types.h"
@@ -173,7 +174,7 @@ extent_t SimpleBitmap::get_next_set_extent(uint64_t offset)
   // if there are no set bits in this word
   if (word == 0) {
       // skip past all clear words
-    while (++word_idx < m_word_count && !m_arr[word_idx]);
+    word_idx = bitmap_scan_skip(m_arr, word_idx + 1, m_word_count, 0);
 
     if (word_idx < m_word_count ) {
       word = m_arr[word_idx];
@@ -197,7 +198,7 @@ extent_t SimpleBitmap::get_next_set_extent(uint64_t offset)
 
   // skipped past fully set words
   if (word == FULL_MASK) {
-    while ( (++word_idx < m_word_count) && (m_arr[word_idx] == FULL_MASK) );
+    word_idx = bitmap_scan_skip(m_arr, word_idx + 1, m_word_count, FULL_MASK);
 
     if (word_idx < m_word_count) {
       word = m_arr[word_idx];
@@ -235,7 +236,7 @@ extent_t SimpleBitmap::get_next_clr_extent(uint64_t offset)
   }
   if (word == FULL_MASK) {
     // skipped past fully set words
-    while ( (++word_idx < m_word_count) && (m_arr[word_idx] == FULL_MASK) );
+    word_idx = bitmap_scan_skip(m_arr, word_idx + 1, m_word_count, FULL_MASK);
 
     if (word_idx < m_word_count) {
       word = m_arr[word_idx];
@@ -257,7 +258,7 @@ extent_t SimpleBitmap::get_next_clr_extent(uint64_t offset)
 
   // skip past all clear words
   if (word == 0) {
-    while ( (++word_idx < m_word_count) && (m_arr[word_idx] == 0) );
+    word_idx = bitmap_scan_skip(m_arr, word_idx + 1, m_word_count, 0);
 
     if (word_idx < m_word_count) {
       word = m_arr[word_idx];
@@ -1037,26 +1037,23 @@ void ECBackend::handle_sub_read(
 	  bl, j->get<2>()); // Allow EIO return
       } else {
         dout(25) << __func__ << " case2: going to do fragmented read." << dendl;
+        // the sub-chunks of every chunk in the extent, in a single pass
+        // over the object; they are listed in ascending order so the
+        // result is laid out as if each range was read in turn
         int subchunk_size =
           sinfo.get_chunk_size() / ec_impl->get_sub_chunk_count();
-        bool error = false;
-        for (int m = 0; m < (int)j->get<1>() && !error;
-             m += sinfo.get_chunk_size()) {
+        interval_set<uint64_t> ranges;
+        for (uint64_t m = 0; m < j->get<1>(); m += sinfo.get_chunk_size()) {
           for (auto &&k:op.subchunks.find(i->first)->second) {
-            bufferlist bl0;
-            r = store->read(
-                ch,
-                ghobject_t(i->first, ghobject_t::NO_GEN, shard),
-                j->get<0>() + m + (k.first)*subchunk_size,
-                (k.second)*subchunk_size,
-                bl0, j->get<2>());
-            if (r < 0) {
-              error = true;
-              break;
-            }
-            bl.claim_append(bl0);
+            ranges.insert(j->get<0>() + m + (k.first)*subchunk_size,
+                          (k.second)*subchunk_size);
           }
         }
+        r = store->readv(
+          ch,
+          ghobject_t(i->first, ghobject_t::NO_GEN, shard),
+          ranges,
+          bl, j->get<2>());
       }
 
       if (r < 0) {
@@ -1214,6 +1211,15 @@ void ECBackend::handle_sub_read_reply(
       dout(20) << __func__ << " to_read skipping" << dendl;
       continue;
     }
+    if (rop.complete[i->first].partial) {
+      auto &buffers = rop.complete[i->first].shard_buffers[from];
+      for (auto &&j : i->second) {
+	if (j.second.length()) {
+	  buffers.insert(j.first, j.second.length(), std::move(j.second));
+	}
+      }
+      continue;
+    }
     list<boost::tuple<uint64_t, uint64_t, uint32_t> >::const_iterator req_iter =
       rop.to_read.find(i->first)->second.to_read.begin();
     list<
@@ -1271,6 +1277,25 @@ void ECBackend::handle_sub_read_reply(
         rop.complete.begin();
       iter != rop.complete.end();
       ++iter) {
+      if (iter->second.partial) {
+	// partial reads can't be reconstructed from other shards, read
+	// the whole stripes instead unless the caller takes the shards
+	// as they are
+	if (iter->second.r == 0 &&
+	    !iter->second.errors.empty() &&
+	    !rop.want_to_read[iter->first].empty()) {
+	  int r = read_pipeline.send_stripe_reads(iter->first, rop);
+	  if (r == 0) {
+	    need_resend = true;
+	    continue;
+	  }
+	  rop.complete[iter->first].r = r;
+	}
+	rop.to_read.at(iter->first).need.clear();
+	rop.to_read.at(iter->first).want_attrs = false;
+	++is_complete;
+	continue;
+      }
       set<int> have;
       for (map<pg_shard_t, bufferlist>::const_iterator j =
           iter->second.returned.front().get<2>().begin();
@@ -1280,8 +1305,17 @@ void ECBackend::handle_sub_read_reply(
         dout(20) << __func__ << " have shard=" << j->first.shard << dendl;
       }
       map<int, vector<pair<int, int>>> dummy_minimum;
-      int err;
-      if ((err = ec_impl->minimum_to_decode(rop.want_to_read[iter->first], have, &dummy_minimum)) < 0) {
+      int err = ec_impl->minimum_to_decode(rop.want_to_read[iter->first], have, &dummy_minimum);
+      if (err >= 0 &&
+	  !read_pipeline.read_subchunks_match(
+	    rop.to_read.at(iter->first), dummy_minimum)) {
+	// the sub-chunks read for a repair can't be decoded with another
+	// set of shards
+	dout(20) << __func__ << " sub-chunks read don't match "
+		 << dummy_minimum << dendl;
+	err = -EIO;
+      }
+      if (err < 0) {
 	dout(20) << __func__ << " minimum_to_decode failed" << dendl;
         if (rop.in_progress.empty()) {
 	  // If we don't have enough copies, try other pg_shard_ts if available.
@@ -1418,6 +1452,7 @@ struct ECClassicalOp : ECCommon::RMWPipeline::Op {
       pgid,
       sinfo,
       remote_read_result,
+      delta_read_result,
       log_entries,
       written,
       transactions,
@@ -1432,13 +1467,15 @@ struct ECClassicalOp : ECCommon::RMWPipeline::Op {
     const ECUtil::stripe_info_t &sinfo,
     PGTransaction& t,
     F &&get_hinfo,
-    DoutPrefixProvider *dpp)
+    DoutPrefixProvider *dpp,
+    bool allow_delta)
   {
     return ECTransaction::get_write_plan(
       sinfo,
       t,
       std::forward<F>(get_hinfo),
-      dpp);
+      dpp,
+      allow_delta);
   }
 };
 
@@ -1514,7 +1551,8 @@ void ECBackend::submit_transaction(
       }
       return ref;
     },
-    get_parent()->get_dpp());
+    get_parent()->get_dpp(),
+    rmw_pipeline.parity_delta_enabled());
   dout(10) << __func__ << ": op " << *op << " starting" << dendl;
   rmw_pipeline.start_rmw(std::move(op));
 }
@@ -1539,6 +1577,8 @@ void ECBackend::objects_read_async(
   map<hobject_t,std::list<boost::tuple<uint64_t, uint64_t, uint32_t> > >
     reads;
 
+  // extents are aligned to stripes by objects_read_and_reconstruct unless
+  // they can be read as they are, @see ReadPipeline::partial_reads_enabled
   uint32_t flags = 0;
   extent_set es;
   for (list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
@@ -1546,11 +1586,7 @@ void ECBackend::objects_read_async(
 	 to_read.begin();
        i != to_read.end();
        ++i) {
-    pair<uint64_t, uint64_t> tmp =
-      sinfo.offset_len_to_stripe_bounds(
-	make_pair(i->first.get<0>(), i->first.get<1>()));
-
-    es.union_insert(tmp.first, tmp.second);
+    es.union_insert(i->first.get<0>(), i->first.get<1>());
     flags |= i->first.get<2>();
   }
 
@@ -1660,6 +1696,13 @@ void ECBackend::objects_read_and_reconstruct(
     reads, fast_read, std::move(func));
 }
 
+void ECBackend::objects_read_shards(
+  const map<hobject_t, map<int, extent_set>> &reads,
+  GenContextURef<map<hobject_t, map<int, extent_map>> &&> &&func)
+{
+  read_pipeline.objects_read_shards(reads, std::move(func));
+}
+
 void ECBackend::kick_reads() {
   read_pipeline.kick_reads();
 }
@@ -1761,6 +1804,7 @@ int ECBackend::be_deep_scrub(
     pos.data_hash << bl;
   }
   pos.data_pos += r;
+  pos.data_bytes_read += r;
   if (r == (int)stride) {
     return -EINPROGRESS;
   }
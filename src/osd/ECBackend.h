@@ -146,6 +146,10 @@ public:
     bool fast_read,
     GenContextURef<std::map<hobject_t,std::pair<int, extent_map> > &&> &&func) override;
 
+  void objects_read_shards(
+    const std::map<hobject_t, std::map<int, extent_set>> &reads,
+    GenContextURef<std::map<hobject_t, std::map<int, extent_map>> &&> &&func) override;
+
   void objects_read_async(
     const hobject_t &hoid,
     const std::list<std::pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
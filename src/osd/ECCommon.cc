@@ -12,6 +12,7 @@
  *
  */
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 
@@ -65,15 +66,10 @@ static ostream& _prefix(std::ostream *_dout,
 }
 
 ostream &operator<<(ostream &lhs, const ECCommon::RMWPipeline::pipeline_state_t &rhs) {
-  switch (rhs.pipeline_state) {
-  case ECCommon::RMWPipeline::pipeline_state_t::CACHE_VALID:
+  if (rhs.invalid.empty()) {
     return lhs << "CACHE_VALID";
-  case ECCommon::RMWPipeline::pipeline_state_t::CACHE_INVALID:
-    return lhs << "CACHE_INVALID";
-  default:
-    ceph_abort_msg("invalid pipeline state");
   }
-  return lhs; // unreachable
+  return lhs << "CACHE_INVALID(" << rhs.invalid << ")";
 }
 
 ostream &operator<<(ostream &lhs, const ECCommon::read_request_t &rhs)
@@ -81,6 +77,7 @@ ostream &operator<<(ostream &lhs, const ECCommon::read_request_t &rhs)
   return lhs << "read_request_t(to_read=[" << rhs.to_read << "]"
 	     << ", need=" << rhs.need
 	     << ", want_attrs=" << rhs.want_attrs
+	     << ", shard_reads=" << rhs.shard_reads
 	     << ")";
 }
 
@@ -93,6 +90,9 @@ ostream &operator<<(ostream &lhs, const ECCommon::read_result_t &rhs)
   } else {
     lhs << ", noattrs";
   }
+  if (rhs.partial) {
+    return lhs << ", shard_buffers=" << rhs.shard_buffers << ")";
+  }
   return lhs << ", returned=" << rhs.returned << ")";
 }
 
@@ -148,6 +148,7 @@ ostream &operator<<(ostream &lhs, const ECCommon::RMWPipeline::Op &rhs)
       << " pending_read=" << rhs.pending_read
       << " remote_read=" << rhs.remote_read
       << " remote_read_result=" << rhs.remote_read_result
+      << " delta_read_result=" << rhs.delta_read_result
       << " pending_apply=" << rhs.pending_apply
       << " pending_commit=" << rhs.pending_commit
       << " plan.to_read=" << rhs.plan.to_read
@@ -325,6 +326,16 @@ int ECCommon::ReadPipeline::get_remaining_shards(
     return -EIO;
   }
 
+  if (ec_impl->get_sub_chunk_count() > 1) {
+    // which sub-chunks are needed depends on all the shards picked by
+    // minimum_to_decode, start over and read all of them
+    for (auto &&[shard, subchunks] : need) {
+      ceph_assert(shards.count(shard_id_t(shard)));
+      to_read->insert(make_pair(shards[shard_id_t(shard)], subchunks));
+    }
+    return 0;
+  }
+
   set<int> shards_left;
   for (auto p : need) {
     if (avail.find(p.first) == avail.end()) {
@@ -400,6 +411,20 @@ void ECCommon::ReadPipeline::do_read_op(ReadOp &op)
       op.obj_to_source[i->first].insert(j->first);
       op.source_to_obj[j->first].insert(i->first);
     }
+    if (!i->second.shard_reads.empty()) {
+      uint32_t flags = 0;
+      for (auto &&extent : i->second.to_read) {
+	flags |= extent.get<2>();
+      }
+      for (auto &&k : i->second.need) {
+	for (auto &&range : i->second.shard_reads.at(k.first)) {
+	  messages[k.first].to_read[i->first].push_back(
+	    boost::make_tuple(range.first, range.second, flags));
+	}
+      }
+      ceph_assert(!need_attrs);
+      continue;
+    }
     for (list<boost::tuple<uint64_t, uint64_t, uint32_t> >::const_iterator j =
 	   i->second.to_read.begin();
 	 j != i->second.to_read.end();
@@ -454,13 +479,110 @@ void ECCommon::ReadPipeline::do_read_op(ReadOp &op)
 void ECCommon::ReadPipeline::get_want_to_read_shards(
   std::set<int> *want_to_read) const
 {
-  const std::vector<int> &chunk_mapping = ec_impl->get_chunk_mapping();
   for (int i = 0; i < (int)ec_impl->get_data_chunk_count(); ++i) {
-    int chunk = (int)chunk_mapping.size() > i ? chunk_mapping[i] : i;
-    want_to_read->insert(chunk);
+    want_to_read->insert(ECUtil::chunk_to_shard(ec_impl, i));
   }
 }
 
+bool ECCommon::ReadPipeline::partial_reads_enabled() const
+{
+  const pg_pool_t &pool = get_parent()->get_pool();
+  // without overwrites shards are checked against their hash, which
+  // needs whole chunks
+  return pool.allows_ecoptimizations() &&
+    pool.allows_ecoverwrites() &&
+    ec_impl->get_sub_chunk_count() == 1 &&
+    (ec_impl->get_supported_optimizations() &
+     ceph::ErasureCodeInterface::FLAG_EC_PLUGIN_PARTIAL_READ_OPTIMIZATION);
+}
+
+int ECCommon::ReadPipeline::get_partial_read_shards(
+  const hobject_t &hoid,
+  const list<boost::tuple<uint64_t, uint64_t, uint32_t> > &to_read,
+  map<pg_shard_t, vector<pair<int, int>>> *need,
+  map<pg_shard_t, extent_set> *shard_reads)
+{
+  set<int> have;
+  map<shard_id_t, pg_shard_t> shards;
+  get_all_avail_shards(hoid, set<pg_shard_t>(), have, shards, false);
+
+  vector<pair<int, int>> subchunks;
+  subchunks.push_back(make_pair(0, ec_impl->get_sub_chunk_count()));
+  for (auto &&extent : to_read) {
+    auto ranges = sinfo.offset_len_to_chunk_ranges(
+      make_pair(extent.get<0>(), extent.get<1>()));
+    for (auto &&[i, range] : ranges) {
+      auto p = shards.find(shard_id_t(ECUtil::chunk_to_shard(ec_impl, i)));
+      if (p == shards.end()) {
+	dout(20) << __func__ << " " << hoid << " shard of chunk " << i
+		 << " unavailable" << dendl;
+	return -EIO;
+      }
+      (*shard_reads)[p->second].union_insert(range.first, range.second);
+      (*need)[p->second] = subchunks;
+    }
+  }
+  return shard_reads->empty() ? -EINVAL : 0;
+}
+
+static list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_stripe_bounds(
+  const ECUtil::stripe_info_t &sinfo,
+  const list<boost::tuple<uint64_t, uint64_t, uint32_t> > &to_read)
+{
+  uint32_t flags = 0;
+  extent_set es;
+  for (auto &&extent : to_read) {
+    pair<uint64_t, uint64_t> tmp =
+      sinfo.offset_len_to_stripe_bounds(
+	make_pair(extent.get<0>(), extent.get<1>()));
+    es.union_insert(tmp.first, tmp.second);
+    flags |= extent.get<2>();
+  }
+  list<boost::tuple<uint64_t, uint64_t, uint32_t> > ret;
+  for (auto j = es.begin(); j != es.end(); ++j) {
+    ret.push_back(boost::make_tuple(j.get_start(), j.get_len(), flags));
+  }
+  return ret;
+}
+
+// the content of the chunk range starting at @off as far as it was read
+static bufferlist get_chunk_range(
+  const extent_map &em, uint64_t off, uint64_t len)
+{
+  bufferlist bl;
+  auto range = em.get_containing_range(off, len);
+  if (range.first != range.second && range.first.get_off() <= off) {
+    uint64_t rel = off - range.first.get_off();
+    if (rel < range.first.get_len()) {
+      bl.substr_of(range.first.get_val(), rel,
+		   std::min(len, range.first.get_len() - rel));
+    }
+  }
+  return bl;
+}
+
+void ECCommon::gather_partial_read(
+  const ECUtil::stripe_info_t &sinfo,
+  const ErasureCodeInterfaceRef &ec_impl,
+  const map<int, const extent_map*> &by_shard,
+  uint64_t off,
+  uint64_t len,
+  bufferlist *bl)
+{
+  auto ranges = sinfo.offset_len_to_chunk_ranges(make_pair(off, len));
+  map<int, pair<uint64_t, bufferlist>> chunks;
+  for (auto &&[i, range] : ranges) {
+    auto p = by_shard.find(ECUtil::chunk_to_shard(ec_impl, i));
+    if (p == by_shard.end()) {
+      continue;
+    }
+    chunks[i] = make_pair(
+      range.first,
+      get_chunk_range(*p->second, range.first, range.second));
+  }
+  ECUtil::gather_range(sinfo, off, len, chunks, bl);
+}
+
 struct ClientReadCompleter : ECCommon::ReadCompleter {
   ClientReadCompleter(ECCommon::ReadPipeline &read_pipeline,
                       ECCommon::ClientAsyncReadStatus *status)
@@ -475,6 +597,10 @@ struct ClientReadCompleter : ECCommon::ReadCompleter {
     extent_map result;
     if (res.r != 0)
       goto out;
+    if (res.partial) {
+      finish_partial(res, to_read, &result);
+      goto out;
+    }
     ceph_assert(res.returned.size() == to_read.size());
     ceph_assert(res.errors.empty());
     for (auto &&read: to_read) {
@@ -515,6 +641,28 @@ out:
     read_pipeline.kick_reads();
   }
 
+  // the data chunks hold the object as is, nothing to decode
+  void finish_partial(
+    ECCommon::read_result_t &res,
+    const list<boost::tuple<uint64_t, uint64_t, uint32_t> > &to_read,
+    extent_map *result)
+  {
+    ceph_assert(res.errors.empty());
+    map<int, const extent_map*> by_shard;
+    for (auto &&[shard, em] : res.shard_buffers) {
+      by_shard[shard.shard] = &em;
+    }
+    for (auto &&read : to_read) {
+      bufferlist bl;
+      ECCommon::gather_partial_read(
+	read_pipeline.sinfo, read_pipeline.ec_impl, by_shard,
+	read.get<0>(), read.get<1>(), &bl);
+      if (bl.length()) {
+	result->insert(read.get<0>(), bl.length(), std::move(bl));
+      }
+    }
+  }
+
   void finish(int priority) && override
   {
     // NOP
@@ -524,6 +672,36 @@ out:
   ECCommon::ClientAsyncReadStatus *status;
 };
 
+struct ShardReadCompleter : ECCommon::ReadCompleter {
+  ShardReadCompleter(
+    GenContextURef<map<hobject_t, map<int, extent_map>> &&> &&func,
+    map<hobject_t, map<int, extent_map>> &&results)
+    : func(std::move(func)),
+      results(std::move(results)) {}
+
+  void finish_single_request(
+    const hobject_t &hoid,
+    ECCommon::read_result_t &res,
+    list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_read) override
+  {
+    ceph_assert(res.partial);
+    auto &out = results[hoid];
+    for (auto &&[shard, em] : res.shard_buffers) {
+      if (!res.errors.count(shard)) {
+	out[shard.shard] = std::move(em);
+      }
+    }
+  }
+
+  void finish(int priority) && override
+  {
+    func.release()->complete(std::move(results));
+  }
+
+  GenContextURef<map<hobject_t, map<int, extent_map>> &&> func;
+  map<hobject_t, map<int, extent_map>> results;
+};
+
 void ECCommon::ReadPipeline::objects_read_and_reconstruct(
   const map<hobject_t,
     std::list<boost::tuple<uint64_t, uint64_t, uint32_t> >
@@ -542,8 +720,27 @@ void ECCommon::ReadPipeline::objects_read_and_reconstruct(
   set<int> want_to_read;
   get_want_to_read_shards(&want_to_read);
     
+  const bool partial = !fast_read && partial_reads_enabled();
   map<hobject_t, read_request_t> for_read_op;
   for (auto &&to_read: reads) {
+    obj_want_to_read.insert(make_pair(to_read.first, want_to_read));
+    if (partial) {
+      map<pg_shard_t, vector<pair<int, int>>> need;
+      map<pg_shard_t, extent_set> shard_reads;
+      if (get_partial_read_shards(
+	    to_read.first, to_read.second, &need, &shard_reads) == 0) {
+	for_read_op.insert(
+	  make_pair(
+	    to_read.first,
+	    read_request_t(
+	      to_read.second,
+	      need,
+	      false,
+	      shard_reads)));
+	continue;
+      }
+    }
+
     map<pg_shard_t, vector<pair<int, int>>> shards;
     int r = get_min_avail_to_read_shards(
       to_read.first,
@@ -557,10 +754,9 @@ void ECCommon::ReadPipeline::objects_read_and_reconstruct(
       make_pair(
 	to_read.first,
 	read_request_t(
-	  to_read.second,
+	  to_stripe_bounds(sinfo, to_read.second),
 	  shards,
 	  false)));
-    obj_want_to_read.insert(make_pair(to_read.first, want_to_read));
   }
 
   start_read_op(
@@ -574,6 +770,128 @@ void ECCommon::ReadPipeline::objects_read_and_reconstruct(
 }
 
 
+void ECCommon::ReadPipeline::objects_read_shards(
+  const map<hobject_t, map<int, extent_set>> &reads,
+  GenContextURef<map<hobject_t, map<int, extent_map>> &&> &&func)
+{
+  map<hobject_t, set<int>> obj_want_to_read;
+  map<hobject_t, read_request_t> for_read_op;
+  map<hobject_t, map<int, extent_map>> results;
+  vector<pair<int, int>> subchunks;
+  subchunks.push_back(make_pair(0, ec_impl->get_sub_chunk_count()));
+  for (auto &&[hoid, to_read] : reads) {
+    set<int> have;
+    map<shard_id_t, pg_shard_t> shards;
+    get_all_avail_shards(hoid, set<pg_shard_t>(), have, shards, false);
+
+    map<pg_shard_t, vector<pair<int, int>>> need;
+    map<pg_shard_t, extent_set> shard_reads;
+    for (auto &&[shard, extents] : to_read) {
+      auto p = shards.find(shard_id_t(shard));
+      if (p == shards.end() || extents.empty()) {
+	continue;
+      }
+      need[p->second] = subchunks;
+      shard_reads[p->second] = extents;
+    }
+    results[hoid];
+    if (shard_reads.empty()) {
+      continue;
+    }
+    // nothing to reconstruct, errors are left to the caller
+    obj_want_to_read[hoid];
+    for_read_op.insert(
+      make_pair(
+	hoid,
+	read_request_t(
+	  list<boost::tuple<uint64_t, uint64_t, uint32_t> >(),
+	  need,
+	  false,
+	  shard_reads)));
+  }
+  if (for_read_op.empty()) {
+    func.release()->complete(std::move(results));
+    return;
+  }
+
+  start_read_op(
+    CEPH_MSG_PRIO_DEFAULT,
+    obj_want_to_read,
+    for_read_op,
+    OpRequestRef(),
+    false,
+    false,
+    std::make_unique<ShardReadCompleter>(std::move(func), std::move(results)));
+}
+
+int ECCommon::ReadPipeline::send_stripe_reads(
+  const hobject_t &hoid,
+  ReadOp &rop)
+{
+  read_result_t &result = rop.complete[hoid];
+  dout(10) << __func__ << " " << hoid << " partial read failed "
+	   << result << dendl;
+  map<pg_shard_t, vector<pair<int, int>>> shards;
+  int r = get_remaining_shards(hoid, set<int>(), rop.want_to_read[hoid],
+			       result, &shards, rop.for_recovery);
+  if (r)
+    return r;
+
+  auto &req = rop.to_read.find(hoid)->second;
+  auto offsets = to_stripe_bounds(sinfo, req.to_read);
+  bool want_attrs =
+    req.want_attrs && (!result.attrs || result.attrs->empty());
+  rop.to_read.erase(hoid);
+  rop.to_read.insert(make_pair(
+      hoid,
+      read_request_t(
+	offsets,
+	shards,
+	want_attrs)));
+
+  // the shards read so far don't count as read
+  for (auto &&shard : rop.obj_to_source[hoid]) {
+    auto p = rop.source_to_obj.find(shard);
+    p->second.erase(hoid);
+    if (p->second.empty()) {
+      rop.source_to_obj.erase(p);
+    }
+  }
+  rop.obj_to_source.erase(hoid);
+  result.partial = false;
+  result.shard_buffers.clear();
+  for (auto &&extent : offsets) {
+    result.returned.push_back(
+      boost::make_tuple(
+	extent.get<0>(),
+	extent.get<1>(),
+	map<pg_shard_t, bufferlist>()));
+  }
+  return 0;
+}
+
+bool ECCommon::ReadPipeline::read_subchunks_match(
+  const read_request_t &req,
+  const map<int, vector<pair<int, int>>> &minimum) const
+{
+  const vector<pair<int, int>> whole_chunk{
+    make_pair(0, ec_impl->get_sub_chunk_count())};
+  if (std::all_of(req.need.begin(), req.need.end(),
+		  [&](auto &&i) { return i.second == whole_chunk; })) {
+    // whole chunks decode along with any other shards
+    return true;
+  }
+  for (auto &&[shard, subchunks] : minimum) {
+    auto p = std::find_if(
+      req.need.begin(), req.need.end(),
+      [shard=shard](auto &&i) { return i.first.shard == shard; });
+    if (p == req.need.end() || p->second != subchunks) {
+      return false;
+    }
+  }
+  return true;
+}
+
 int ECCommon::ReadPipeline::send_all_remaining_reads(
   const hobject_t &hoid,
   ReadOp &rop)
@@ -592,6 +910,13 @@ int ECCommon::ReadPipeline::send_all_remaining_reads(
   list<boost::tuple<uint64_t, uint64_t, uint32_t> > offsets =
     rop.to_read.find(hoid)->second.to_read;
 
+  if (ec_impl->get_sub_chunk_count() > 1) {
+    // @see get_remaining_shards, drop what was read from the other shards
+    for (auto &&extent : rop.complete[hoid].returned) {
+      extent.get<2>().clear();
+    }
+  }
+
   // (Note cuixf) If we need to read attrs and we read failed, try to read again.
   bool want_attrs =
     rop.to_read.find(hoid)->second.want_attrs &&
@@ -637,7 +962,14 @@ bool ECCommon::RMWPipeline::try_state_to_reads()
     return false;
 
   Op *op = &(waiting_state.front());
-  if (op->requires_rmw() && pipeline_state.cache_invalid()) {
+  if (op->is_delta()) {
+    if (delta_conflicts(*op)) {
+      dout(20) << __func__ << ": blocking " << *op
+	       << " because it writes parity deltas of an object"
+	       << " with writes in flight" << dendl;
+      return false;
+    }
+  } else if (op->requires_rmw() && !caching_enabled(*op)) {
     ceph_assert(get_parent()->get_pool().allows_ecoverwrites());
     dout(20) << __func__ << ": blocking " << *op
 	     << " because it requires an rmw and the cache is invalid "
@@ -646,12 +978,23 @@ bool ECCommon::RMWPipeline::try_state_to_reads()
     return false;
   }
 
-  if (!pipeline_state.caching_enabled()) {
+  if (op->is_delta()) {
+    // the cache doesn't see the delta writes, later rmw ops on the same
+    // objects have to read the stripes back from the shards
+    dout(20) << __func__ << ": invalidating cache after this parity delta op"
+	     << dendl;
+    op->using_cache = false;
+  } else if (!caching_enabled(*op)) {
     op->using_cache = false;
   } else if (op->invalidates_cache()) {
     dout(20) << __func__ << ": invalidating cache after this op"
 	     << dendl;
-    pipeline_state.invalidate();
+  }
+  if (!op->using_cache || op->invalidates_cache()) {
+    // hash_infos covers the written objects and the clone/rename sources
+    for (auto &&hpair : op->plan.hash_infos) {
+      pipeline_state.invalidate(hpair.first);
+    }
   }
 
   waiting_state.pop_front();
@@ -701,10 +1044,151 @@ bool ECCommon::RMWPipeline::try_state_to_reads()
 	check_ops();
       });
   }
+  if (op->is_delta()) {
+    start_delta_reads(op);
+  }
 
   return true;
 }
 
+bool ECCommon::RMWPipeline::caching_enabled(const Op &op) const
+{
+  for (auto &&hpair : op.plan.hash_infos) {
+    if (pipeline_state.cache_invalid(hpair.first)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ECCommon::RMWPipeline::parity_delta_enabled() const
+{
+  const pg_pool_t &pool = get_parent()->get_pool();
+  return pool.allows_ecoptimizations() &&
+    pool.allows_ecoverwrites() &&
+    ec_impl->get_sub_chunk_count() == 1 &&
+    (ec_impl->get_supported_optimizations() &
+     ceph::ErasureCodeInterface::FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION);
+}
+
+bool ECCommon::RMWPipeline::delta_conflicts(const Op &op) const
+{
+  // the old content is read from the shards directly, it must not race
+  // with earlier writes to the same object
+  for (auto &&l : {&waiting_reads, &waiting_commit}) {
+    for (auto &&i : *l) {
+      for (auto &&hpair : op.plan.delta_writes) {
+	if (i.plan.will_write.count(hpair.first)) {
+	  return true;
+	}
+      }
+    }
+  }
+  return false;
+}
+
+void ECCommon::RMWPipeline::start_delta_reads(Op *op)
+{
+  map<hobject_t, map<int, extent_set>> to_read;
+  const int k = ec_impl->get_data_chunk_count();
+  for (auto &&[hoid, dw] : op->plan.delta_writes) {
+    auto &shards = to_read[hoid];
+    for (auto &&[i, ranges] : dw.data) {
+      shards[ECUtil::chunk_to_shard(ec_impl, i)] = ranges;
+    }
+    for (int j = k; j < (int)ec_impl->get_chunk_count(); ++j) {
+      shards[ECUtil::chunk_to_shard(ec_impl, j)] = dw.parity;
+    }
+  }
+  dout(20) << __func__ << ": " << to_read << dendl;
+  op->delta_read_pending = true;
+  auto on_complete =
+    [op, this, to_read](map<hobject_t, map<int, extent_map>> &&results) {
+      finish_delta_reads(op, to_read, std::move(results));
+    };
+  ec_backend.objects_read_shards(
+    to_read,
+    make_gen_lambda_context<
+      map<hobject_t, map<int, extent_map>> &&, decltype(on_complete)>(
+	std::move(on_complete)));
+}
+
+void ECCommon::RMWPipeline::finish_delta_reads(
+  Op *op,
+  const map<hobject_t, map<int, extent_set>> &wanted,
+  map<hobject_t, map<int, extent_map>> &&results)
+{
+  dout(20) << __func__ << ": got " << results << dendl;
+  // every data chunk is needed for its delta, coding chunks only if they
+  // get written. The others, e.g. backfill targets which don't have the
+  // object yet, are left out of the delta: they get no parity update.
+  set<int> data_shards;
+  for (int i = 0; i < (int)ec_impl->get_data_chunk_count(); ++i) {
+    data_shards.insert(ECUtil::chunk_to_shard(ec_impl, i));
+  }
+  bool missing = false;
+  for (auto &&[hoid, shards] : wanted) {
+    set<int> written_shards;
+    for (auto &&i : get_parent()->get_acting_recovery_backfill_shards()) {
+      if (get_parent()->should_send_op(i, hoid)) {
+	written_shards.insert(i.shard);
+      }
+    }
+    auto &got = results[hoid];
+    for (auto &&[shard, ranges] : shards) {
+      if (!data_shards.count(shard) && !written_shards.count(shard)) {
+	got.erase(shard);
+	continue;
+      }
+      auto p = got.find(shard);
+      for (auto r = ranges.begin(); r != ranges.end() && !missing; ++r) {
+	if (p == got.end()) {
+	  missing = true;
+	  break;
+	}
+	auto range = p->second.get_containing_range(r.get_start(), r.get_len());
+	missing = range.first == range.second ||
+	  range.first.get_off() > r.get_start() ||
+	  range.first.get_off() + range.first.get_len() <
+	    r.get_start() + r.get_len();
+      }
+    }
+  }
+  if (missing) {
+    // a shard to be written couldn't be read, e.g. one which is only a
+    // backfill target: reconstruct the stripes instead
+    dout(10) << __func__ << ": shards missing, falling back to rmw" << dendl;
+    fall_back_to_rmw(op);
+    return;
+  }
+  op->delta_read_result = std::move(results);
+  op->delta_read_pending = false;
+  check_ops();
+}
+
+void ECCommon::RMWPipeline::fall_back_to_rmw(Op *op)
+{
+  ceph_assert(!op->using_cache);
+  for (auto &&[hoid, dw] : op->plan.delta_writes) {
+    op->plan.to_read[hoid] = std::move(dw.rmw_to_read);
+    op->plan.will_write[hoid] = std::move(dw.rmw_will_write);
+  }
+  op->plan.delta_writes.clear();
+  op->delta_read_result.clear();
+  op->delta_read_pending = false;
+  op->remote_read = op->plan.to_read;
+  dout(10) << __func__ << ": " << *op << dendl;
+  // a failed read is now treated like that of any other rmw
+  objects_read_async_no_cache(
+    op->remote_read,
+    [op, this](map<hobject_t,pair<int, extent_map> > &&results) {
+      for (auto &&i: results) {
+	op->remote_read_result.emplace(i.first, i.second.second);
+      }
+      check_ops();
+    });
+}
+
 bool ECCommon::RMWPipeline::try_reads_to_commit()
 {
   if (waiting_reads.empty())
@@ -784,6 +1268,7 @@ bool ECCommon::RMWPipeline::try_reads_to_commit()
   }
   op->remote_read.clear();
   op->remote_read_result.clear();
+  op->delta_read_result.clear();
 
   ObjectStore::Transaction empty;
   bool should_write_local = false;
@@ -915,14 +1400,17 @@ bool ECCommon::RMWPipeline::try_finish_rmw()
   if (op->using_cache) {
     cache.release_write_pin(op->pin);
   }
+  if (!op->using_cache || op->invalidates_cache()) {
+    for (auto &&hpair : op->plan.hash_infos) {
+      pipeline_state.release(hpair.first);
+    }
+    dout(20) << __func__ << ": pipeline_state " << pipeline_state << dendl;
+  }
   tid_to_op_map.erase(op->tid);
 
   if (waiting_reads.empty() &&
       waiting_commit.empty()) {
-    pipeline_state.clear();
-    dout(20) << __func__ << ": clearing pipeline_state "
-	     << pipeline_state
-	     << dendl;
+    ceph_assert(pipeline_state.empty());
   }
   return true;
 }
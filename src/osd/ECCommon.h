@@ -29,10 +29,17 @@
 #include "osd/osd_op_util.h"
 
 struct ECTransaction {
+  struct DeltaWrite {
+    std::map<int, extent_set> data;
+    extent_set parity;
+    extent_set rmw_to_read;
+    extent_set rmw_will_write;
+  };
   struct WritePlan {
     bool invalidates_cache = false; // Yes, both are possible
     std::map<hobject_t,extent_set> to_read;
     std::map<hobject_t,extent_set> will_write; // superset of to_read
+    std::map<hobject_t,DeltaWrite> delta_writes;
 
     std::map<hobject_t,ECUtil::HashInfoRef> hash_infos;
   };
@@ -225,15 +232,26 @@ struct ECCommon {
     bool fast_read,
     GenContextURef<std::map<hobject_t,std::pair<int, extent_map> > &&> &&func) = 0;
 
+  /// read ranges of individual shards as they are, shards which can't be
+  /// read are left out of the result
+  virtual void objects_read_shards(
+    const std::map<hobject_t, std::map<int, extent_set>> &reads,
+    GenContextURef<std::map<hobject_t, std::map<int, extent_map>> &&> &&func) = 0;
+
   struct read_request_t {
     const std::list<boost::tuple<uint64_t, uint64_t, uint32_t> > to_read;
     std::map<pg_shard_t, std::vector<std::pair<int, int>>> need;
     bool want_attrs;
+    /// if not empty, the ranges of the shards in need to be read instead
+    /// of the stripes covering to_read, nothing gets decoded
+    std::map<pg_shard_t, extent_set> shard_reads;
     read_request_t(
       const std::list<boost::tuple<uint64_t, uint64_t, uint32_t> > &to_read,
       const std::map<pg_shard_t, std::vector<std::pair<int, int>>> &need,
-      bool want_attrs)
-      : to_read(to_read), need(need), want_attrs(want_attrs) {}
+      bool want_attrs,
+      const std::map<pg_shard_t, extent_set> &shard_reads = {})
+      : to_read(to_read), need(need), want_attrs(want_attrs),
+	shard_reads(shard_reads) {}
   };
   friend std::ostream &operator<<(std::ostream &lhs, const read_request_t &rhs);
   struct ReadOp;
@@ -265,9 +283,22 @@ struct ECCommon {
     std::list<
       boost::tuple<
 	uint64_t, uint64_t, std::map<pg_shard_t, ceph::buffer::list> > > returned;
+    /// read_request_t::shard_reads were used, results are in shard_buffers
+    bool partial = false;
+    std::map<pg_shard_t, extent_map> shard_buffers;
     read_result_t() : r(0) {}
   };
 
+  /// gather [off, off+len) of the object from the data chunk ranges of a
+  /// partial read, by shard; stops at the first byte which wasn't read
+  static void gather_partial_read(
+    const ECUtil::stripe_info_t &sinfo,
+    const ceph::ErasureCodeInterfaceRef &ec_impl,
+    const std::map<int, const extent_map*> &by_shard,
+    uint64_t off,
+    uint64_t len,
+    ceph::buffer::list *bl);
+
   struct ReadCompleter {
     virtual void finish_single_request(
       const hobject_t &hoid,
@@ -349,6 +380,10 @@ struct ECCommon {
         want_to_read(std::move(_want_to_read)),
 	to_read(std::move(_to_read)) {
       for (auto &&hpair: to_read) {
+	if (!hpair.second.shard_reads.empty()) {
+	  complete[hpair.first].partial = true;
+	  continue;
+	}
 	auto &returned = complete[hpair.first].returned;
 	for (auto &&extent: hpair.second.to_read) {
 	  returned.push_back(
@@ -370,6 +405,10 @@ struct ECCommon {
       bool fast_read,
       GenContextURef<std::map<hobject_t,std::pair<int, extent_map> > &&> &&func);
 
+    void objects_read_shards(
+      const std::map<hobject_t, std::map<int, extent_set>> &reads,
+      GenContextURef<std::map<hobject_t, std::map<int, extent_map>> &&> &&func);
+
     template <class F, class G>
     void filter_read_op(
       const OSDMapRef& osdmap,
@@ -400,6 +439,17 @@ struct ECCommon {
       const hobject_t &hoid,
       ReadOp &rop);
 
+    /// false if the sub-chunks read for @req aren't those @minimum
+    /// (as returned by minimum_to_decode) needs to decode
+    bool read_subchunks_match(
+      const read_request_t &req,
+      const std::map<int, std::vector<std::pair<int, int>>> &minimum) const;
+
+    /// turn a failed partial read into reads of the whole stripes
+    int send_stripe_reads(
+      const hobject_t &hoid,
+      ReadOp &rop);
+
     void on_change();
 
     void kick_reads();
@@ -449,6 +499,17 @@ struct ECCommon {
 
     void get_want_to_read_shards(std::set<int> *want_to_read) const;
 
+    /// @see pg_pool_t::FLAG_EC_OPTIMIZATIONS
+    bool partial_reads_enabled() const;
+
+    /// shards and their ranges holding the extents, fails if any of
+    /// them isn't available
+    int get_partial_read_shards(
+      const hobject_t &hoid,
+      const std::list<boost::tuple<uint64_t, uint64_t, uint32_t> > &to_read,
+      std::map<pg_shard_t, std::vector<std::pair<int, int>>> *need,
+      std::map<pg_shard_t, extent_set> *shard_reads);
+
     /// Returns to_read replicas sufficient to reconstruct want
     int get_min_avail_to_read_shards(
       const hobject_t &hoid,     ///< [in] object
@@ -511,9 +572,14 @@ struct ECCommon {
       std::map<hobject_t,extent_set> pending_read; // subset already being read
       std::map<hobject_t,extent_set> remote_read;  // subset we must read
       std::map<hobject_t,extent_map> remote_read_result;
+      /// old content of the shard ranges rewritten by parity delta writes
+      std::map<hobject_t,std::map<int, extent_map>> delta_read_result;
+      bool delta_read_pending = false;
       bool read_in_progress() const {
-        return !remote_read.empty() && remote_read_result.empty();
+        return (!remote_read.empty() && remote_read_result.empty()) ||
+	  delta_read_pending;
       }
+      bool is_delta() const { return !plan.delta_writes.empty(); }
 
       /// In progress write state.
       std::set<pg_shard_t> pending_commit;
@@ -556,7 +622,13 @@ struct ECCommon {
      * We model the possible rmw states as a std::set of waitlists.
      * All writes at this time complete in order, so a write blocked
      * at waiting_state blocks all writes behind it as well (same for
-     * other states).
+     * other states).  An rmw write only blocks at waiting_state on
+     * in-flight writes to its own objects which bypass the cache (see
+     * pipeline_state_t), writes to other objects no longer make it
+     * wait.  While it waits, the writes behind it wait too, whatever
+     * objects they write.  Writes past waiting_state are read and
+     * encoded concurrently, ExtentCache pins serialize overlapping
+     * extents.
      *
      * Future work: We can break this up into a per-object pipeline
      * (almost).  First, provide an ordering token to submit_transaction
@@ -572,26 +644,38 @@ struct ECCommon {
      * versioned.  We can't assign versions to them until we actually
      * submit the operation.  That's probably going to be the hard part.
      */
+    /// Tracks, per object, the in-flight writes which don't go through
+    /// the cache.  Until they complete, the cache can't tell the content
+    /// of the object, so rmw writes to it have to wait and other writes
+    /// to it must not use the cache either.
     class pipeline_state_t {
-      enum {
-        CACHE_VALID = 0,
-        CACHE_INVALID = 1
-      } pipeline_state = CACHE_VALID;
+      std::map<hobject_t, unsigned> invalid;  ///< object -> bypassing ops
     public:
-      bool caching_enabled() const {
-        return pipeline_state == CACHE_VALID;
+      bool caching_enabled(const hobject_t &hoid) const {
+        return !invalid.count(hoid);
       }
-      bool cache_invalid() const {
-        return !caching_enabled();
+      bool cache_invalid(const hobject_t &hoid) const {
+        return !caching_enabled(hoid);
       }
-      void invalidate() {
-        pipeline_state = CACHE_INVALID;
+      void invalidate(const hobject_t &hoid) {
+        ++invalid[hoid];
+      }
+      void release(const hobject_t &hoid) {
+        auto p = invalid.find(hoid);
+        ceph_assert(p != invalid.end());
+        if (--p->second == 0) {
+          invalid.erase(p);
+        }
+      }
+      bool empty() const {
+        return invalid.empty();
       }
       void clear() {
-        pipeline_state = CACHE_VALID;
+        invalid.clear();
       }
       friend std::ostream &operator<<(std::ostream &lhs, const pipeline_state_t &rhs);
     } pipeline_state;
+    bool caching_enabled(const Op &op) const;
 
     op_list waiting_state;        /// writes waiting on pipe_state
     op_list waiting_reads;        /// writes waiting on partial stripe reads
@@ -604,6 +688,17 @@ struct ECCommon {
     bool try_finish_rmw();
     void check_ops();
 
+    /// @see pg_pool_t::FLAG_EC_OPTIMIZATIONS
+    bool parity_delta_enabled() const;
+    bool delta_conflicts(const Op &op) const;
+    void start_delta_reads(Op *op);
+    void finish_delta_reads(
+      Op *op,
+      const std::map<hobject_t, std::map<int, extent_set>> &wanted,
+      std::map<hobject_t, std::map<int, extent_map>> &&results);
+    /// drop the parity deltas of @op and write its stripes as a plain rmw
+    void fall_back_to_rmw(Op *op);
+
     void on_change();
     void call_write_ordered(std::function<void(void)> &&cb);
 
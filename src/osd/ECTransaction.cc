@@ -30,6 +30,7 @@ using std::string;
 using std::vector;
 
 using ceph::bufferlist;
+using ceph::bufferptr;
 using ceph::decode;
 using ceph::encode;
 using ceph::ErasureCodeInterfaceRef;
@@ -94,6 +95,168 @@ static void encode_and_write(
   }
 }
 
+bool ECTransaction::get_delta_write(
+  const ECUtil::stripe_info_t &sinfo,
+  const extent_set &raw_write_set,
+  uint64_t size,
+  DeltaWrite *dw)
+{
+  if (raw_write_set.empty()) {
+    return false;
+  }
+  const uint64_t stripe_width = sinfo.get_stripe_width();
+  const uint64_t stripe = sinfo.logical_to_prev_stripe_offset(
+    raw_write_set.range_start());
+  if (raw_write_set.range_end() > size ||
+      raw_write_set.range_end() > stripe + stripe_width) {
+    return false;
+  }
+  // rewrite whole pages of the chunks so that the shards don't need to
+  // read-modify-write their blocks
+  const uint64_t chunk_size = sinfo.get_chunk_size();
+  const uint64_t chunk_start = sinfo.aligned_logical_offset_to_chunk_offset(
+    stripe);
+  const uint64_t align =
+    chunk_size % CEPH_PAGE_SIZE ? chunk_size : CEPH_PAGE_SIZE;
+  for (auto extent = raw_write_set.begin();
+       extent != raw_write_set.end();
+       ++extent) {
+    auto ranges = sinfo.offset_len_to_chunk_ranges(
+      make_pair(extent.get_start(), extent.get_len()));
+    for (auto &&[i, range] : ranges) {
+      uint64_t start = range.first - chunk_start;
+      uint64_t end = start + range.second;
+      start = start / align * align;
+      end = (end + align - 1) / align * align;
+      dw->data[i].union_insert(chunk_start + start, end - start);
+      dw->parity.union_insert(chunk_start + start, end - start);
+    }
+  }
+  // updating every data chunk costs more than encoding the stripe
+  return dw->data.size() < sinfo.get_data_chunk_count();
+}
+
+static bufferlist get_old_range(
+  const map<int, extent_map> &old_extents,
+  int shard,
+  uint64_t off,
+  uint64_t len)
+{
+  auto p = old_extents.find(shard);
+  ceph_assert(p != old_extents.end());
+  auto range = p->second.get_containing_range(off, len);
+  ceph_assert(range.first != range.second);
+  ceph_assert(range.first.get_off() <= off);
+  ceph_assert(off + len <= range.first.get_off() + range.first.get_len());
+  bufferlist bl;
+  bl.substr_of(range.first.get_val(), off - range.first.get_off(), len);
+  return bl;
+}
+
+static bufferptr copy_aligned(bufferlist &bl)
+{
+  bufferptr ptr = ceph::buffer::create_page_aligned(bl.length());
+  bl.begin().copy(bl.length(), ptr.c_str());
+  return ptr;
+}
+
+static void delta_and_write(
+  pg_t pgid,
+  const hobject_t &oid,
+  const ECUtil::stripe_info_t &sinfo,
+  ErasureCodeInterfaceRef &ecimpl,
+  const ECTransaction::DeltaWrite &dw,
+  const map<int, extent_map> &old_extents,
+  const extent_map &updates,
+  uint32_t flags,
+  map<shard_id_t, ObjectStore::Transaction> *transactions,
+  DoutPrefixProvider *dpp)
+{
+  const uint64_t stripe_width = sinfo.get_stripe_width();
+  const uint64_t chunk_size = sinfo.get_chunk_size();
+  const int k = ecimpl->get_data_chunk_count();
+  const int m = ecimpl->get_chunk_count() - k;
+
+  // coding chunks start as they were and get the deltas applied in place,
+  // by shard and offset. Only those read are updated: the others don't get
+  // the op, e.g. backfill targets which don't have the object yet.
+  map<int, map<uint64_t, bufferptr>> parity;
+  for (int j = 0; j < m; ++j) {
+    int shard = ECUtil::chunk_to_shard(ecimpl, k + j);
+    if (!transactions->count(shard_id_t(shard)) ||
+	!old_extents.count(shard)) {
+      continue;
+    }
+    for (auto p = dw.parity.begin(); p != dw.parity.end(); ++p) {
+      bufferlist bl = get_old_range(
+	old_extents, shard, p.get_start(), p.get_len());
+      parity[shard][p.get_start()] = copy_aligned(bl);
+    }
+  }
+
+  for (auto &&[i, ranges] : dw.data) {
+    int shard = ECUtil::chunk_to_shard(ecimpl, i);
+    for (auto r = ranges.begin(); r != ranges.end(); ++r) {
+      uint64_t off = r.get_start();
+      uint64_t len = r.get_len();
+      bufferlist old_bl = get_old_range(old_extents, shard, off, len);
+      bufferptr old_data = copy_aligned(old_bl);
+      bufferptr new_data = copy_aligned(old_bl);
+      uint64_t logical = (off / chunk_size) * stripe_width +
+	i * chunk_size + off % chunk_size;
+      for (auto &&u : updates.intersect(logical, len)) {
+	u.get_val().begin().copy(
+	  u.get_len(), new_data.c_str() + (u.get_off() - logical));
+      }
+      ldpp_dout(dpp, 20) << __func__ << ": " << oid << " chunk " << i
+			 << " " << off << "~" << len
+			 << " logical " << logical << dendl;
+
+      bufferptr delta;
+      ecimpl->encode_delta(old_data, new_data, &delta);
+      map<int, bufferptr> in;
+      in[shard] = delta;
+      map<int, bufferptr> out;
+      for (auto &&[pshard, pranges] : parity) {
+	auto q = pranges.upper_bound(off);
+	ceph_assert(q != pranges.begin());
+	--q;
+	ceph_assert(off + len <= q->first + q->second.length());
+	out[pshard] = bufferptr(q->second, off - q->first, len);
+      }
+      ecimpl->apply_delta(in, out);
+
+      auto t = transactions->find(shard_id_t(shard));
+      if (t != transactions->end()) {
+	bufferlist bl;
+	bl.append(new_data);
+	t->second.write(
+	  coll_t(spg_t(pgid, t->first)),
+	  ghobject_t(oid, ghobject_t::NO_GEN, t->first),
+	  off,
+	  len,
+	  bl,
+	  flags);
+      }
+    }
+  }
+
+  for (auto &&[shard, pranges] : parity) {
+    shard_id_t s(shard);
+    for (auto &&[off, ptr] : pranges) {
+      bufferlist bl;
+      bl.append(ptr);
+      (*transactions)[s].write(
+	coll_t(spg_t(pgid, s)),
+	ghobject_t(oid, ghobject_t::NO_GEN, s),
+	off,
+	ptr.length(),
+	bl,
+	flags);
+    }
+  }
+}
+
 void ECTransaction::generate_transactions(
   PGTransaction* _t,
   WritePlan &plan,
@@ -101,6 +264,7 @@ void ECTransaction::generate_transactions(
   pg_t pgid,
   const ECUtil::stripe_info_t &sinfo,
   const map<hobject_t,extent_map> &partial_extents,
+  const map<hobject_t, map<int, extent_map>> &delta_extents,
   vector<pg_log_entry_t> &entries,
   map<hobject_t,extent_map> *written_map,
   map<shard_id_t, ObjectStore::Transaction> *transactions,
@@ -389,6 +553,79 @@ void ECTransaction::generate_transactions(
 	}
       }
 
+      auto dwiter = plan.delta_writes.find(oid);
+      if (dwiter != plan.delta_writes.end()) {
+	ceph_assert(!op.truncate);
+	ceph_assert(!op.is_delete());
+	auto dxiter = delta_extents.find(oid);
+	ceph_assert(dxiter != delta_extents.end());
+	const auto &dw = dwiter->second;
+	if (entry) {
+	  vector<pair<uint64_t, uint64_t> > rollback_extents;
+	  for (auto &&st : *transactions) {
+	    st.second.touch(
+	      coll_t(spg_t(pgid, st.first)),
+	      ghobject_t(oid, entry->version.version, st.first));
+	  }
+	  for (auto p = dw.parity.begin(); p != dw.parity.end(); ++p) {
+	    rollback_extents.emplace_back(make_pair(p.get_start(), p.get_len()));
+	    for (auto &&st : *transactions) {
+	      st.second.clone_range(
+		coll_t(spg_t(pgid, st.first)),
+		ghobject_t(oid, ghobject_t::NO_GEN, st.first),
+		ghobject_t(oid, entry->version.version, st.first),
+		p.get_start(),
+		p.get_len(),
+		p.get_start());
+	    }
+	  }
+	  ldpp_dout(dpp, 20) << "generate_transactions: " << oid
+			     << " marking rollback extents "
+			     << rollback_extents
+			     << dendl;
+	  entry->mod_desc.rollback_extents(
+	    entry->version.version, rollback_extents);
+	}
+
+	extent_map updates;
+	uint32_t fadvise_flags = 0;
+	for (auto &&extent: op.buffer_updates) {
+	  using BufferUpdate = PGTransaction::ObjectOperation::BufferUpdate;
+	  bufferlist bl;
+	  match(
+	    extent.get_val(),
+	    [&](const BufferUpdate::Write &op) {
+	      bl = op.buffer;
+	      fadvise_flags |= op.fadvise_flags;
+	    },
+	    [&](const BufferUpdate::Zero &) {
+	      bl.append_zero(extent.get_len());
+	    },
+	    [&](const BufferUpdate::CloneRange &) {
+	      ceph_assert(
+		0 ==
+		"CloneRange is not allowed, do_op should have returned ENOTSUPP");
+	    });
+	  updates.insert(extent.get_off(), extent.get_len(), bl);
+	  written.insert(extent.get_off(), extent.get_len(), bl);
+	}
+	delta_and_write(pgid, oid, sinfo, ecimpl, dw, dxiter->second,
+			updates, fadvise_flags, transactions, dpp);
+
+	// the shard hashes are gone with the first overwrite already
+	hinfo->set_total_chunk_size_clear_hash(hinfo->get_total_chunk_size());
+	bufferlist hbuf;
+	encode(*hinfo, hbuf);
+	for (auto &&i : *transactions) {
+	  i.second.setattr(
+	    coll_t(spg_t(pgid, i.first)),
+	    ghobject_t(oid, ghobject_t::NO_GEN, i.first),
+	    ECUtil::get_hinfo_key(),
+	    hbuf);
+	}
+	return;
+      }
+
       extent_map to_write;
       auto pextiter = partial_extents.find(oid);
       if (pextiter != partial_extents.end()) {
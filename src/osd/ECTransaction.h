@@ -22,10 +22,31 @@
 #include "PGTransaction.h"
 
 namespace ECTransaction {
+  /// overwrite within a stripe applied by updating the coding chunks
+  /// with the delta of the data chunks, all ranges are chunk offsets
+  struct DeltaWrite {
+    std::map<int, extent_set> data; ///< rewritten ranges by data chunk index
+    extent_set parity;              ///< rewritten ranges of every coding chunk
+    /// the stripe rmw plan of the object, to fall back to if the old
+    /// content can't be read
+    extent_set rmw_to_read;
+    extent_set rmw_will_write;
+  };
+
+  /// @return false if the overwrite is better done as a stripe rmw
+  bool get_delta_write(
+    const ECUtil::stripe_info_t &sinfo,
+    const extent_set &raw_write_set,
+    uint64_t size,
+    DeltaWrite *dw);
+
   struct WritePlan {
     bool invalidates_cache = false; // Yes, both are possible
     std::map<hobject_t,extent_set> to_read;
     std::map<hobject_t,extent_set> will_write; // superset of to_read
+    /// objects written with parity deltas instead of read-modify-write,
+    /// they are not in to_read and will_write is the raw write set
+    std::map<hobject_t,DeltaWrite> delta_writes;
 
     std::map<hobject_t,ECUtil::HashInfoRef> hash_infos;
   };
@@ -35,7 +56,8 @@ namespace ECTransaction {
     const ECUtil::stripe_info_t &sinfo,
     PGTransaction& t,
     F &&get_hinfo,
-    DoutPrefixProvider *dpp) {
+    DoutPrefixProvider *dpp,
+    bool allow_delta = false) {
     WritePlan plan;
     t.safe_create_traverse(
       [&](std::pair<const hobject_t, PGTransaction::ObjectOperation> &i) {
@@ -146,6 +168,26 @@ namespace ECTransaction {
 	  }
 	}
 
+	auto to_read = plan.to_read.find(obj);
+	if (allow_delta &&
+	    t.op_map.size() == 1 &&
+	    to_read != plan.to_read.end() &&
+	    !op.deletes_first() &&
+	    !op.has_source() &&
+	    !op.truncate) {
+	  DeltaWrite dw;
+	  if (get_delta_write(sinfo, raw_write_set, orig_size, &dw)) {
+	    ldpp_dout(dpp, 20) << __func__ << ": parity delta, data "
+			       << dw.data << " parity " << dw.parity
+			       << dendl;
+	    dw.rmw_to_read = std::move(to_read->second);
+	    dw.rmw_will_write = will_write;
+	    plan.to_read.erase(to_read);
+	    will_write = raw_write_set;
+	    plan.delta_writes[obj] = std::move(dw);
+	  }
+	}
+
 	if (op.truncate && op.truncate->second > projected_size) {
 	  uint64_t truncating_to =
 	    sinfo.logical_to_next_stripe_offset(op.truncate->second);
@@ -183,6 +225,7 @@ namespace ECTransaction {
     pg_t pgid,
     const ECUtil::stripe_info_t &sinfo,
     const std::map<hobject_t,extent_map> &partial_extents,
+    const std::map<hobject_t, std::map<int, extent_map>> &delta_extents,
     std::vector<pg_log_entry_t> &entries,
     std::map<hobject_t,extent_map> *written,
     std::map<shard_id_t, ceph::os::Transaction> *transactions,
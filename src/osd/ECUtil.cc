@@ -161,6 +161,43 @@ int ECUtil::encode(
   return 0;
 }
 
+void ECUtil::gather_range(
+  const stripe_info_t &sinfo,
+  uint64_t off,
+  uint64_t len,
+  const map<int, pair<uint64_t, bufferlist>> &chunks,
+  bufferlist *out)
+{
+  const uint64_t stripe_width = sinfo.get_stripe_width();
+  const uint64_t chunk_size = sinfo.get_chunk_size();
+  const uint64_t end = off + len;
+  for (uint64_t pos = off; pos < end; ) {
+    uint64_t in_stripe = pos % stripe_width;
+    int i = in_stripe / chunk_size;
+    uint64_t in_chunk = in_stripe % chunk_size;
+    uint64_t piece = std::min(end - pos, chunk_size - in_chunk);
+    auto p = chunks.find(i);
+    if (p == chunks.end()) {
+      break;
+    }
+    uint64_t chunk_off = (pos / stripe_width) * chunk_size + in_chunk;
+    ceph_assert(chunk_off >= p->second.first);
+    uint64_t rel = chunk_off - p->second.first;
+    const bufferlist &bl = p->second.second;
+    if (rel >= bl.length()) {
+      break;
+    }
+    uint64_t avail = std::min<uint64_t>(piece, bl.length() - rel);
+    bufferlist t;
+    t.substr_of(bl, rel, avail);
+    out->claim_append(t);
+    if (avail < piece) {
+      break;
+    }
+    pos += piece;
+  }
+}
+
 void ECUtil::HashInfo::append(uint64_t old_size,
 			      map<int, bufferlist> &to_append) {
   ceph_assert(old_size == total_chunk_size);
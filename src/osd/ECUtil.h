@@ -77,8 +77,41 @@ public:
       (in.first - off) + in.second);
     return std::make_pair(off, len);
   }
+  uint64_t get_data_chunk_count() const {
+    return stripe_width / chunk_size;
+  }
+  /// offset within data chunk @data_chunk (0 .. k-1) of the first byte it
+  /// holds at or after logical @offset
+  uint64_t logical_to_chunk_offset(
+    uint64_t offset, unsigned data_chunk) const {
+    uint64_t in_stripe = offset % stripe_width;
+    uint64_t begin = data_chunk * chunk_size;
+    return (offset / stripe_width) * chunk_size +
+      (in_stripe < begin ? 0 : std::min(in_stripe - begin, chunk_size));
+  }
+  /// the part of each data chunk holding the logical range @in is a
+  /// single range of that chunk, data chunks not involved are skipped
+  std::map<int, std::pair<uint64_t, uint64_t>> offset_len_to_chunk_ranges(
+    std::pair<uint64_t, uint64_t> in) const {
+    std::map<int, std::pair<uint64_t, uint64_t>> ret;
+    for (unsigned i = 0; i < get_data_chunk_count(); ++i) {
+      uint64_t start = logical_to_chunk_offset(in.first, i);
+      uint64_t end = logical_to_chunk_offset(in.first + in.second, i);
+      if (end > start) {
+	ret[i] = std::make_pair(start, end - start);
+      }
+    }
+    return ret;
+  }
 };
 
+/// shard holding chunk @i, data chunks are 0 .. k-1
+inline int chunk_to_shard(
+  const ceph::ErasureCodeInterfaceRef &ec_impl, int i) {
+  const std::vector<int> &chunk_mapping = ec_impl->get_chunk_mapping();
+  return (int)chunk_mapping.size() > i ? chunk_mapping[i] : i;
+}
+
 int decode(
   const stripe_info_t &sinfo,
   ceph::ErasureCodeInterfaceRef &ec_impl,
@@ -98,6 +131,20 @@ int encode(
   const std::set<int> &want,
   std::map<int, ceph::buffer::list> *out);
 
+/**
+ * Gather the logical range [off, off + len) from the data chunks holding
+ * it, without decoding. @chunks maps data chunk indexes to the offset
+ * within the chunk and the content read from there, as laid out by
+ * stripe_info_t::offset_len_to_chunk_ranges. Stops at the first byte
+ * missing from @chunks, which is where the object ends.
+ */
+void gather_range(
+  const stripe_info_t &sinfo,
+  uint64_t off,
+  uint64_t len,
+  const std::map<int, std::pair<uint64_t, ceph::buffer::list>> &chunks,
+  ceph::buffer::list *out);
+
 class HashInfo {
   uint64_t total_chunk_size = 0;
   std::vector<uint32_t> cumulative_shard_hashes;
@@ -15,6 +15,7 @@
 
 #include "acconfig.h"
 
+#include <algorithm>
 #include <cctype>
 #include <fstream>
 #include <iostream>
@@ -244,6 +245,10 @@ OSDService::OSDService(OSD *osd, ceph::async::io_context_pool& poolctx) :
   monc(osd->monc),
   osd_max_object_size(cct->_conf, "osd_max_object_size"),
   osd_skip_data_digest(cct->_conf, "osd_skip_data_digest"),
+  osd_op_stage_histograms(cct->_conf, "osd_op_stage_histograms"),
+  osd_op_queue_steal_min_depth(cct->_conf, "osd_op_queue_steal_min_depth"),
+  osd_op_queue_steal_interval_ms(cct->_conf,
+				 "osd_op_queue_steal_interval_ms"),
   publish_lock{ceph::make_mutex("OSDService::publish_lock")},
   pre_publish_lock{ceph::make_mutex("OSDService::pre_publish_lock")},
   m_osd_scrub{cct, *this, cct->_conf},
@@ -512,6 +517,11 @@ void OSDService::shutdown()
     f->stop();
   }
 
+  {
+    std::lock_guard l(peering_maps_lock);
+    peering_pin_from = peering_pin_to = 0;
+    peering_maps.clear();
+  }
   publish_map(OSDMapRef());
   next_osdmap = OSDMapRef();
 }
@@ -1571,7 +1581,7 @@ OSDMapRef OSDService::_add_map(OSDMap *o)
 
 OSDMapRef OSDService::try_get_map(epoch_t epoch)
 {
-  std::lock_guard l(map_cache_lock);
+  std::unique_lock l(map_cache_lock);
   OSDMapRef retval = map_cache.lookup(epoch);
   if (retval) {
     dout(30) << "get_map " << epoch << " -cached" << dendl;
@@ -1588,20 +1598,81 @@ OSDMapRef OSDService::try_get_map(epoch_t epoch)
     }
   }
 
-  OSDMap *map = new OSDMap;
-  if (epoch > 0) {
-    dout(20) << "get_map " << epoch << " - loading and decoding " << map << dendl;
-    bufferlist bl;
-    if (!_get_map_bl(epoch, bl) || bl.length() == 0) {
-      derr << "failed to load OSD map for epoch " << epoch << ", got " << bl.length() << " bytes" << dendl;
-      delete map;
-      return OSDMapRef();
+  if (epoch == 0) {
+    OSDMap *map = new OSDMap;
+    dout(20) << "get_map " << epoch << " - return initial " << map << dendl;
+    return _add_map(map);
+  }
+
+  // pgs on other shards are likely after the same epoch; wait for the
+  // one loading it rather than decoding it again
+  if (map_loading.count(epoch)) {
+    logger->inc(l_osd_map_cache_load_wait);
+    map_loaded_cond.wait(l, [this, epoch] {
+      return map_loading.count(epoch) == 0;
+    });
+    retval = map_cache.lookup(epoch);
+    if (retval) {
+      dout(30) << "get_map " << epoch << " - loaded by another thread" << dendl;
+      return retval;
     }
+  }
+  map_loading.insert(epoch);
+  l.unlock();
+
+  // map_bl_cache has its own lock, so reads and decodes of different
+  // epochs can go in parallel
+  OSDMap *map = new OSDMap;
+  dout(20) << "get_map " << epoch << " - loading and decoding " << map << dendl;
+  bufferlist bl;
+  bool found = _get_map_bl(epoch, bl) && bl.length() > 0;
+  if (found) {
     map->decode(bl);
+  }
+
+  l.lock();
+  map_loading.erase(epoch);
+  map_loaded_cond.notify_all();
+  if (!found) {
+    derr << "failed to load OSD map for epoch " << epoch << ", got " << bl.length() << " bytes" << dendl;
+    delete map;
+    return OSDMapRef();
+  }
+  retval = _add_map(map);
+  l.unlock();
+  pin_peering_map(retval);
+  return retval;
+}
+
+void OSDService::pin_peering_maps(epoch_t min_pg_epoch, epoch_t to)
+{
+  epoch_t max = cct->_conf.get_val<uint64_t>("osd_peering_map_pin_max");
+  std::lock_guard l(peering_maps_lock);
+  if (max == 0 || min_pg_epoch == 0 || to <= min_pg_epoch) {
+    // nothing to catch up with
+    peering_pin_from = peering_pin_to = 0;
+    peering_maps.clear();
   } else {
-    dout(20) << "get_map " << epoch << " - return initial " << map << dendl;
+    peering_pin_from = min_pg_epoch;
+    peering_pin_to = std::min<epoch_t>(to, min_pg_epoch + max);
+    peering_maps.erase(peering_maps.begin(),
+		       peering_maps.upper_bound(peering_pin_from));
+    peering_maps.erase(peering_maps.upper_bound(peering_pin_to),
+		       peering_maps.end());
+  }
+  dout(20) << __func__ << " (" << peering_pin_from << "," << peering_pin_to
+	   << "], " << peering_maps.size() << " pinned" << dendl;
+  logger->set(l_osd_map_cache_pinned, peering_maps.size());
+}
+
+void OSDService::pin_peering_map(const OSDMapRef& map)
+{
+  std::lock_guard l(peering_maps_lock);
+  epoch_t e = map->get_epoch();
+  if (e > peering_pin_from && e <= peering_pin_to &&
+      peering_maps.emplace(e, map).second) {
+    logger->set(l_osd_map_cache_pinned, peering_maps.size());
   }
-  return _add_map(map);
 }
 
 // ops
@@ -2071,7 +2142,8 @@ void OSDService::_queue_for_recovery(
 
   uint64_t cost_for_queue = [this, &reserved_pushes, &p] {
     if (op_queue_type_t::mClockScheduler == osd->osd_op_queue_type()) {
-      return p.cost_per_object * reserved_pushes;
+      // each reserved push may recover a batch of small objects
+      return p.cost_per_object * reserved_pushes * p.batch_objects;
     } else {
       /* We retain this legacy behavior for WeightedPriorityQueue. It seems to
        * require very large costs for several messages in order to do any
@@ -6385,6 +6457,17 @@ void OSD::tick_without_osd_lock()
   logger->set(l_osd_cached_crc_adjusted, ceph::buffer::get_cached_crc_adjusted());
   logger->set(l_osd_missed_crc, ceph::buffer::get_missed_crc());
 
+  // release maps pgs have advanced past
+  service.pin_peering_maps(get_min_pg_epoch(), get_osdmap_epoch());
+
+  uint64_t depth_max = 0;
+  for (auto shard : shards) {
+    uint64_t depth = shard->queue_depth.load(std::memory_order_relaxed);
+    depth_max = std::max(depth_max, depth);
+    logger->inc(l_osd_op_wq_depth_avg, depth);
+  }
+  logger->set(l_osd_op_wq_depth_max, depth_max);
+
   // refresh osd stats
   struct store_statfs_t stbuf;
   osd_alert_list_t alerts;
@@ -6425,6 +6508,8 @@ void OSD::tick_without_osd_lock()
   }
 
   if (is_active()) {
+    service.get_scrub_services().update_deep_scrub_bandwidth(
+      logger->get_tavg_ns(l_osd_op_lat));
     service.get_scrub_services().initiate_scrub(service.is_recovery_active());
     service.promote_throttle_recalibrate();
     resume_creating_pg();
@@ -8053,13 +8138,7 @@ void OSD::handle_osd_map(MOSDMap *m)
     epoch_t max_lag = cct->_conf->osd_map_cache_size *
       m_osd_pg_epoch_max_lag_factor;
     ceph_assert(max_lag > 0);
-    epoch_t osd_min = 0;
-    for (auto shard : shards) {
-      epoch_t min = shard->get_min_pg_epoch();
-      if (osd_min == 0 || min < osd_min) {
-	osd_min = min;
-      }
-    }
+    epoch_t osd_min = get_min_pg_epoch();
     epoch_t osdmap_epoch = get_osdmap_epoch();
     if (osd_min > 0 &&
 	osdmap_epoch > max_lag &&
@@ -8294,6 +8373,12 @@ void OSD::handle_osd_map(MOSDMap *m)
     superblock.clean_thru = last;
   }
 
+  // keep the new maps around until every pg has advanced past them
+  service.pin_peering_maps(get_min_pg_epoch(), last);
+  for (auto& i : added_maps) {
+    service.pin_peering_map(i.second);
+  }
+
   // check for pg_num changes and deleted pools
   OSDMapRef lastmap;
   for (auto& i : added_maps) {
@@ -9538,6 +9623,7 @@ void OSD::do_recovery(
   ThreadPool::TPHandle &handle)
 {
   uint64_t started = 0;
+  uint64_t max_to_start = reserved_pushes;
 
   /*
    * When the value of osd_recovery_sleep is set greater than zero, recovery
@@ -9593,8 +9679,12 @@ void OSD::do_recovery(
     dout(20) << "  active was " << service.recovery_oids[pg->pg_id] << dendl;
 #endif
 
-    bool do_unfound = pg->start_recovery_ops(reserved_pushes, handle, &started);
-    dout(10) << "do_recovery started " << started << "/" << reserved_pushes
+    // a reserved push starts a batch of small objects, which still count
+    // as active recovery ops until they complete, holding back the next
+    // reservation
+    max_to_start = reserved_pushes * pg->get_recovery_batch_objects();
+    bool do_unfound = pg->start_recovery_ops(max_to_start, handle, &started);
+    dout(10) << "do_recovery started " << started << "/" << max_to_start
 	     << " on " << *pg << dendl;
 
     if (do_unfound) {
@@ -9606,7 +9696,7 @@ void OSD::do_recovery(
   }
 
  out:
-  ceph_assert(started <= reserved_pushes);
+  ceph_assert(started <= max_to_start);
   service.release_reserved_pushes(reserved_pushes);
 }
 
@@ -9656,6 +9746,24 @@ bool OSDService::is_recovery_active()
   return local_reserver.has_reservation() || remote_reserver.has_reservation();
 }
 
+uint64_t OSDService::get_recovery_batch_objects(uint64_t avg_object_size) const
+{
+  return get_recovery_batch_objects(
+    avg_object_size,
+    cct->_conf->osd_recovery_batch_bytes,
+    cct->_conf->osd_recovery_batch_max_objects);
+}
+
+uint64_t OSDService::get_recovery_batch_objects(
+  uint64_t avg_object_size, uint64_t budget, uint64_t max_objects)
+{
+  if (budget == 0 || max_objects <= 1 || avg_object_size >= budget) {
+    return 1;
+  }
+  return std::clamp<uint64_t>(budget / std::max<uint64_t>(avg_object_size, 1),
+			      1, max_objects);
+}
+
 void OSDService::release_reserved_pushes(uint64_t pushes)
 {
   std::lock_guard l(recovery_lock);
@@ -9708,6 +9816,7 @@ void OSD::enqueue_op(spg_t pg, OpRequestRef&& op, epoch_t epoch)
     {"type", type}
     });
 
+  op->stage_tracking = service.osd_op_stage_histograms;
   op->mark_queued_for_pg();
   logger->tinc(l_osd_op_before_queue_op_lat, latency);
   if (PGRecoveryMsg::is_recovery_msg(op)) {
@@ -10468,6 +10577,18 @@ void OSDShard::update_pg_epoch(OSDShardPGSlot *slot, epoch_t e)
   }
 }
 
+epoch_t OSD::get_min_pg_epoch()
+{
+  epoch_t osd_min = 0;
+  for (auto shard : shards) {
+    epoch_t min = shard->get_min_pg_epoch();
+    if (min && (osd_min == 0 || min < osd_min)) {
+      osd_min = min;
+    }
+  }
+  return osd_min;
+}
+
 epoch_t OSDShard::get_min_pg_epoch()
 {
   std::lock_guard l(shard_lock);
@@ -10632,6 +10753,7 @@ int OSDShard::_wake_pg_slot(
   }
   slot->waiting_peering.clear();
   ++slot->requeue_seq;
+  queue_depth += count;
   return count;
 }
 
@@ -10903,6 +11025,15 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
 
   // peek at spg_t
   sdata->shard_lock.lock();
+  if (sdata->scheduler->empty() &&
+      (!is_smallest_thread_index || sdata->context_queue.empty())) {
+    // nothing to do here, help a busy shard before going to sleep
+    sdata->shard_lock.unlock();
+    if (_steal(thread_index, hb)) {
+      return;
+    }
+    sdata->shard_lock.lock();
+  }
   if (sdata->scheduler->empty() &&
       (!is_smallest_thread_index || sdata->context_queue.empty())) {
     std::unique_lock wait_lock{sdata->sdata_wait_lock};
@@ -10913,7 +11044,14 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
       dout(20) << __func__ << " empty q, waiting" << dendl;
       osd->cct->get_heartbeat_map()->clear_timeout(hb);
       sdata->shard_lock.unlock();
-      sdata->sdata_cond.wait(wait_lock);
+      if (osd->service.osd_op_queue_steal_min_depth) {
+	// other shards filling up don't wake us, look again soon
+	uint64_t interval_ms = osd->service.osd_op_queue_steal_interval_ms;
+	sdata->sdata_cond.wait_for(wait_lock,
+				   std::chrono::milliseconds(interval_ms));
+      } else {
+	sdata->sdata_cond.wait(wait_lock);
+      }
       wait_lock.unlock();
       sdata->shard_lock.lock();
       if (sdata->scheduler->empty() &&
@@ -10995,6 +11133,7 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
 
   // Access the stored item
   auto item = std::move(std::get<OpSchedulerItem>(work_item));
+  --sdata->queue_depth;
   if (osd->is_stopping()) {
     sdata->shard_lock.unlock();
     for (auto c : oncommits) {
@@ -11004,6 +11143,64 @@ void OSD::ShardedOpWQ::_process(uint32_t thread_index, heartbeat_handle_d *hb)
     return;    // OSD shutdown, discard.
   }
 
+  _process_item(sdata, std::move(item), oncommits, hb);
+}
+
+bool OSD::ShardedOpWQ::_steal(uint32_t thread_index, heartbeat_handle_d *hb)
+{
+  uint64_t min_depth = osd->service.osd_op_queue_steal_min_depth;
+  if (min_depth == 0 || osd->num_shards < 2) {
+    return false;
+  }
+  // pick the busiest other shard; depths are read without the shard
+  // locks, good enough to choose a victim
+  uint32_t shard_index = thread_index % osd->num_shards;
+  OSDShard *victim = nullptr;
+  uint64_t victim_depth = 0;
+  for (uint32_t i = 1; i < osd->num_shards; ++i) {
+    auto sdata = osd->shards[(shard_index + i) % osd->num_shards];
+    uint64_t depth = sdata->queue_depth.load(std::memory_order_relaxed);
+    if (depth >= min_depth && depth > victim_depth) {
+      victim = sdata;
+      victim_depth = depth;
+    }
+  }
+  if (!victim) {
+    return false;
+  }
+
+  victim->shard_lock.lock();
+  if (victim->scheduler->empty() || osd->is_stopping()) {
+    victim->shard_lock.unlock();
+    return false;
+  }
+  WorkItem work_item = victim->scheduler->dequeue();
+  if (!std::get_if<OpSchedulerItem>(&work_item)) {
+    // only work scheduled in the future is left, the shard's own
+    // threads are waiting for it
+    victim->shard_lock.unlock();
+    return false;
+  }
+  auto item = std::move(std::get<OpSchedulerItem>(work_item));
+  --victim->queue_depth;
+  dout(20) << __func__ << " shard " << shard_index << " took " << item
+	   << " from shard " << victim->shard_id
+	   << " (depth " << victim_depth << ")" << dendl;
+  osd->logger->inc(l_osd_op_wq_steal);
+
+  // the item goes through the victim's pg slot like any other, which
+  // keeps it ordered with the ones its own threads are running.  the
+  // victim's oncommits are left to its smallest thread.
+  list<Context *> oncommits;
+  _process_item(victim, std::move(item), oncommits, hb);
+  return true;
+}
+
+void OSD::ShardedOpWQ::_process_item(OSDShard *sdata,
+				     OpSchedulerItem&& item,
+				     list<Context *>& oncommits,
+				     heartbeat_handle_d *hb)
+{
   const auto token = item.get_ordering_token();
   auto r = sdata->pg_slots.emplace(token, nullptr);
   if (r.second) {
@@ -11246,6 +11443,7 @@ void OSD::ShardedOpWQ::_enqueue(OpSchedulerItem&& item) {
     std::lock_guard l{sdata->shard_lock};
     empty = sdata->scheduler->empty();
     sdata->scheduler->enqueue(std::move(item));
+    ++sdata->queue_depth;
   }
 
   {
@@ -11286,6 +11484,7 @@ void OSD::ShardedOpWQ::_enqueue_front(OpSchedulerItem&& item)
     dout(20) << __func__ << " " << item << dendl;
   }
   sdata->scheduler->enqueue_front(std::move(item));
+  ++sdata->queue_depth;
   sdata->shard_lock.unlock();
   std::lock_guard l{sdata->sdata_wait_lock};
   sdata->sdata_cond.notify_one();
@@ -11302,6 +11501,7 @@ void OSD::ShardedOpWQ::stop_for_fast_shutdown()
     while (!sdata->scheduler->empty()) {
       sdata->scheduler->dequeue();
     }
+    sdata->queue_depth = 0;
   }
 }
 
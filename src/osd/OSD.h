@@ -116,6 +116,9 @@ public:
 
   md_config_cacher_t<Option::size_t> osd_max_object_size;
   md_config_cacher_t<bool> osd_skip_data_digest;
+  md_config_cacher_t<bool> osd_op_stage_histograms;
+  md_config_cacher_t<uint64_t> osd_op_queue_steal_min_depth;
+  md_config_cacher_t<uint64_t> osd_op_queue_steal_interval_ms;
 
   void enqueue_back(OpSchedulerItem&& qi);
   void enqueue_front(OpSchedulerItem&& qi);
@@ -579,6 +582,9 @@ private:
     PGRef pg;
     const uint64_t cost_per_object;
     const int priority;
+    /// objects started per reserved push, >1 for batched small object
+    /// recovery
+    const uint64_t batch_objects;
   };
   std::list<pg_awaiting_throttle_t> awaiting_throttle;
 
@@ -616,6 +622,10 @@ public:
   void finish_recovery_op(PG *pg, const hobject_t& soid, bool dequeue);
   bool is_recovery_active();
   void release_reserved_pushes(uint64_t pushes);
+  // objects to start at once, >1 when objects are small
+  uint64_t get_recovery_batch_objects(uint64_t avg_object_size) const;
+  static uint64_t get_recovery_batch_objects(
+    uint64_t avg_object_size, uint64_t budget, uint64_t max_objects);
   void defer_recovery(float defer_for) {
     defer_recovery_until = ceph_clock_now();
     defer_recovery_until += defer_for;
@@ -650,17 +660,19 @@ public:
   // delayed pg activation
   void queue_for_recovery(
     PG *pg, uint64_t cost_per_object,
-    int priority) {
+    int priority, uint64_t batch_objects = 1) {
     std::lock_guard l(recovery_lock);
 
     if (pg->is_forced_recovery_or_backfill()) {
       awaiting_throttle.emplace_front(
         pg_awaiting_throttle_t{
-          pg->get_osdmap()->get_epoch(), pg, cost_per_object, priority});
+          pg->get_osdmap()->get_epoch(), pg, cost_per_object, priority,
+          batch_objects});
     } else {
       awaiting_throttle.emplace_back(
         pg_awaiting_throttle_t{
-          pg->get_osdmap()->get_epoch(), pg, cost_per_object, priority});
+          pg->get_osdmap()->get_epoch(), pg, cost_per_object, priority,
+          batch_objects});
     }
     _maybe_queue_recovery();
   }
@@ -671,7 +683,7 @@ public:
     // Send cost as 1 in pg_awaiting_throttle_t below. The cost is ignored
     // as this path is only applicable for WeightedPriorityQueue scheduler.
     _queue_for_recovery(
-      pg_awaiting_throttle_t{queued, pg, 1, priority},
+      pg_awaiting_throttle_t{queued, pg, 1, priority, 1},
       reserved_pushes);
   }
 
@@ -684,6 +696,21 @@ public:
   SharedLRU<epoch_t, const OSDMap> map_cache;
   SimpleLRU<epoch_t, ceph::buffer::list> map_bl_cache;
   SimpleLRU<epoch_t, ceph::buffer::list> map_bl_inc_cache;
+  /// epochs being read and decoded outside of map_cache_lock
+  std::set<epoch_t> map_loading;
+  ceph::condition_variable map_loaded_cond;
+
+  // maps between the oldest pg epoch and the newest map, kept decoded
+  // while pgs catch up so that each one is loaded once for all of them
+  ceph::mutex peering_maps_lock =
+    ceph::make_mutex("OSDService::peering_maps_lock");
+  std::map<epoch_t, OSDMapRef> peering_maps;
+  epoch_t peering_pin_from = 0;  ///< exclusive
+  epoch_t peering_pin_to = 0;    ///< inclusive
+
+  /// move the pinned window to (min_pg_epoch, to], bounded by osd_peering_map_pin_max
+  void pin_peering_maps(epoch_t min_pg_epoch, epoch_t to);
+  void pin_peering_map(const OSDMapRef& map);
 
   OSDMapRef try_get_map(epoch_t e);
   OSDMapRef get_map(epoch_t e) {
@@ -1015,6 +1042,9 @@ struct OSDShard {
 
   /// priority queue
   ceph::osd::scheduler::OpSchedulerRef scheduler;
+  /// items in scheduler; updated under shard_lock, read without it by
+  /// threads of other shards looking for work
+  std::atomic<uint64_t> queue_depth = {0};
 
   bool stop_waiting = false;
 
@@ -1571,6 +1601,13 @@ protected:
 
     /// try to do some work
     void _process(uint32_t thread_index, ceph::heartbeat_handle_d *hb) override;
+    /// run an item of the busiest other shard, if one is deep enough
+    bool _steal(uint32_t thread_index, ceph::heartbeat_handle_d *hb);
+    /// run an item just dequeued from sdata, called with its shard_lock held
+    void _process_item(OSDShard *sdata,
+		       OpSchedulerItem&& item,
+		       std::list<Context*>& oncommits,
+		       ceph::heartbeat_handle_d *hb);
 
     void stop_for_fast_shutdown();
 
@@ -1609,6 +1646,7 @@ protected:
 
 	std::scoped_lock l{sdata->shard_lock};
 	f->open_object_section(queue_name);
+	f->dump_unsigned("queued", sdata->queue_depth);
 	sdata->scheduler->dump(*f);
 	f->close_section();
       }
@@ -1715,6 +1753,8 @@ protected:
     PeeringCtx &rctx);
   void consume_map();
   void activate_map();
+  /// oldest epoch of any pg on this osd, 0 if there are none
+  epoch_t get_min_pg_epoch();
 
   // osd map cache (past osd maps)
   OSDMapRef get_map(epoch_t e) {
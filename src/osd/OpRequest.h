@@ -25,6 +25,15 @@
 struct OpRequest : public TrackedOp {
   friend class OpTracker;
 
+  /// stages of a write once it reached the pg, see mark_stage()
+  enum stage_t {
+    STAGE_SUBMITTED,       ///< about to send the repops and queue the
+                           ///< transaction to the ObjectStore
+    STAGE_LOCAL_COMMIT,    ///< committed by the local ObjectStore
+    STAGE_REPLICA_COMMIT,  ///< last commit received from a replica
+    STAGE_MAX
+  };
+
 private:
   OpInfo op_info;
 
@@ -70,6 +79,7 @@ private:
   uint8_t latest_flag_point;
   const char* last_event_detail = nullptr;
   utime_t dequeued_time;
+  utime_t stage_stamps[STAGE_MAX];
   static const uint8_t flag_queued_for_pg=1 << 0;
   static const uint8_t flag_reached_pg =  1 << 1;
   static const uint8_t flag_delayed =     1 << 2;
@@ -95,6 +105,7 @@ public:
 
   bool hitset_inserted;
   jspan_ptr osd_parent_span;
+  bool stage_tracking = false; ///< osd_op_stage_histograms as of enqueue
 
   template<class T>
   const T* get_req() const { return static_cast<const T*>(request); }
@@ -178,6 +189,16 @@ public:
     dequeued_time = deq_time;
   }
 
+  /// a plain store unlike mark_event(): no lock, no string, no allocation
+  void mark_stage(stage_t s) {
+    if (stage_tracking) {
+      stage_stamps[s] = ceph_clock_now();
+    }
+  }
+  utime_t get_stage_stamp(stage_t s) const {
+    return stage_stamps[s];
+  }
+
   osd_reqid_t get_reqid() const {
     return reqid;
   }
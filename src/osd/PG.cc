@@ -422,11 +422,20 @@ void PG::queue_recovery()
     // Let cost per object be the average object size
     uint64_t cost_per_object = get_average_object_size();
     osd->queue_for_recovery(
-      this, cost_per_object, recovery_state.get_recovery_op_priority()
-    );
+      this, cost_per_object, recovery_state.get_recovery_op_priority(),
+      get_recovery_batch_objects());
   }
 }
 
+uint64_t PG::get_recovery_batch_objects()
+{
+  // only ReplicatedBackend pushes the objects of a batch together
+  if (!pool.info.is_replicated()) {
+    return 1;
+  }
+  return osd->get_recovery_batch_objects(get_average_object_size());
+}
+
 void PG::queue_scrub_after_repair()
 {
   dout(10) << __func__ << dendl;
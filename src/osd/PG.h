@@ -1007,6 +1007,10 @@ public:
     return std::max<uint64_t>(num_bytes / num_objects, 1);
   }
 
+  /// objects started per reserved recovery push, >1 when a replicated PG
+  /// has small objects
+  uint64_t get_recovery_batch_objects();
+
 protected:
 
   /*
@@ -591,6 +591,8 @@ PGBackend *PGBackend::build_pg_backend(
       &ec_impl,
       &ss);
     ceph_assert(ec_impl);
+    ec_impl->set_encode_sg(
+      cct->_conf.get_val<bool>("osd_ec_encode_scatter_gather"));
     return new ECBackend(
       l,
       coll,
@@ -606,6 +608,34 @@ PGBackend *PGBackend::build_pg_backend(
   }
 }
 
+void PGBackend::be_sort_scan_list(ScrubMapBuilder &pos)
+{
+  std::vector<std::pair<uint64_t, hobject_t>> located;
+  located.reserve(pos.ls.size());
+  for (auto& poid : pos.ls) {
+    uint64_t hint = 0;
+    int r = store->get_data_location_hint(
+      ch,
+      ghobject_t(
+	poid, ghobject_t::NO_GEN, get_parent()->whoami_shard().shard),
+      &hint);
+    if (r == -EOPNOTSUPP) {
+      dout(20) << __func__ << " no location hints from the store" << dendl;
+      return;
+    }
+    // objects without data (or gone already) go first, their order
+    // doesn't matter
+    located.emplace_back(r == 0 ? hint : 0, poid);
+  }
+  std::stable_sort(
+    located.begin(), located.end(),
+    [](const auto& a, const auto& b) { return a.first < b.first; });
+  for (size_t i = 0; i < located.size(); ++i) {
+    pos.ls[i] = std::move(located[i].second);
+  }
+  dout(20) << __func__ << " sorted " << pos.ls.size() << " objects" << dendl;
+}
+
 int PGBackend::be_scan_list(
   ScrubMap &map,
   ScrubMapBuilder &pos)
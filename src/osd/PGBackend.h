@@ -568,6 +568,8 @@ typedef std::shared_ptr<const OSDMap> OSDMapRef;
    int be_scan_list(
      ScrubMap &map,
      ScrubMapBuilder &pos);
+   /// order the objects to deep scrub by the on-disk location of their data
+   void be_sort_scan_list(ScrubMapBuilder &pos);
 
    virtual uint64_t be_get_ondisk_size(
      uint64_t logical_size) const = 0;
@@ -189,6 +189,8 @@ void PGLog::clear() {
   log.clear();
   log_keys_debug.clear();
   undirty();
+  trim_pending = 0;
+  trim_pending_to = eversion_t();
 }
 
 void PGLog::clear_info_log(
@@ -646,6 +648,29 @@ void PGLog::write_log_and_missing(
 	     << ", trimmed_dups: " << trimmed_dups
 	     << ", clear_divergent_priors: " << clear_divergent_priors
 	     << dendl;
+    auto defer = cct->_conf.get_val<uint64_t>("osd_pg_log_trim_defer_entries");
+    auto dups_per_key = cct->_conf.get_val<uint64_t>("osd_pg_log_dups_per_key");
+    bool remove_trimmed = false;
+    if (defer || dups_per_key || dup_blocks || trim_pending) {
+      // trimmed keys stay on disk until enough of them pile up to go with a
+      // single range delete; rewriting the front of the log may move the
+      // tail back, so they have to go along with it
+      trim_pending += trimmed.size() + trimmed_dups.size();
+      if (!trimmed.empty()) {
+	trim_pending_to = std::max(trim_pending_to, *trimmed.rbegin());
+      }
+      remove_trimmed = trim_pending &&
+	(trim_pending >= defer || dirty_to != eversion_t());
+      if (pg_log_debug) {
+	for (auto& v : trimmed) {
+	  auto it = log_keys_debug.find(v.get_key_name());
+	  ceph_assert(it != log_keys_debug.end());
+	  log_keys_debug.erase(it);
+	}
+      }
+      trimmed.clear();
+      trimmed_dups.clear();
+    }
     _write_log_and_missing(
       t, km, log, coll, log_oid,
       dirty_to,
@@ -660,9 +685,22 @@ void PGLog::write_log_and_missing(
       dirty_to_dups,
       dirty_from_dups,
       write_from_dups,
+      remove_trimmed,
+      trim_pending_to,
+      dups_per_key,
+      dup_blocks,
       &may_include_deletes_in_missing_dirty,
       (pg_log_debug ? &log_keys_debug : nullptr),
       this);
+    if (remove_trimmed) {
+      trim_pending = 0;
+      trim_pending_to = eversion_t();
+    }
+    if (dups_per_key) {
+      dup_blocks = true;
+    } else if (dirty_to_dups == eversion_t::max()) {
+      dup_blocks = false;
+    }
     undirty();
   } else {
     dout(10) << "log is not dirty" << dendl;
@@ -711,6 +749,7 @@ void PGLog::write_log_and_missing(
     eversion_t::max(),
     eversion_t(),
     eversion_t(),
+    false, eversion_t(), 0, false,
     may_include_deletes_in_missing_dirty, nullptr, dpp);
 }
 
@@ -863,6 +902,10 @@ void PGLog::_write_log_and_missing(
   eversion_t dirty_to_dups,
   eversion_t dirty_from_dups,
   eversion_t write_from_dups,
+  bool remove_trimmed,
+  eversion_t trimmed_to,
+  uint64_t dups_per_key,
+  bool dup_blocks,
   bool *may_include_deletes_in_missing_dirty, // in/out param
   set<string> *log_keys_debug,
   const DoutPrefixProvider *dpp
@@ -871,7 +914,9 @@ void PGLog::_write_log_and_missing(
 		     << " dirty_to_dups=" << dirty_to_dups
 		     << " dirty_from_dups=" << dirty_from_dups
 		     << " write_from_dups=" << write_from_dups
-		     << " trimmed_dups.size()=" << trimmed_dups.size() << dendl;
+		     << " trimmed_dups.size()=" << trimmed_dups.size()
+		     << " remove_trimmed=" << remove_trimmed
+		     << " trimmed_to=" << trimmed_to << dendl;
   set<string> to_remove;
   to_remove.swap(trimmed_dups);
   for (auto& t : trimmed) {
@@ -887,6 +932,32 @@ void PGLog::_write_log_and_missing(
 
   if (touch_log)
     t.touch(coll, log_oid);
+  if (remove_trimmed) {
+    // trimmed entries are all at or below trimmed_to and trimmed dups are
+    // all older than the oldest one we keep; this has to precede the
+    // writes below which may fill the range back in
+    if (trimmed_to != eversion_t()) {
+      eversion_t end(trimmed_to.epoch, trimmed_to.version + 1);
+      ldpp_dout(dpp, 10) << __func__ << " remove log up to " << end << dendl;
+      t.omap_rmkeyrange(
+	coll, log_oid,
+	eversion_t().get_key_name(), end.get_key_name());
+    }
+    pg_log_dup_t min, keep;
+    keep.version = log.dups.empty() ? eversion_t::max() :
+      log.dups.front().version;
+    ldpp_dout(dpp, 10) << __func__ << " remove dups before " << keep.version
+		       << dendl;
+    t.omap_rmkeyrange(
+      coll, log_oid,
+      min.get_key_name(), keep.get_key_name());
+    if (dup_blocks || dups_per_key) {
+      t.omap_rmkeyrange(
+	coll, log_oid,
+	pg_log_dup_t::get_block_key_name(eversion_t()),
+	pg_log_dup_t::get_block_key_name(keep.version));
+    }
+  }
   if (dirty_to != eversion_t()) {
     t.omap_rmkeyrange(
       coll, log_oid,
@@ -933,50 +1004,63 @@ void PGLog::_write_log_and_missing(
 
   // process dups after log_keys_debug is filled, so dups do not
   // end up in that set
-  if (dirty_to_dups != eversion_t()) {
-    pg_log_dup_t min, dirty_to_dup;
-    dirty_to_dup.version = dirty_to_dups;
-    ldpp_dout(dpp, 10) << __func__ << " remove dups min=" << min.get_key_name()
-		       << " to dirty_to_dup=" << dirty_to_dup.get_key_name() << dendl;
-    t.omap_rmkeyrange(
-      coll, log_oid,
-      min.get_key_name(), dirty_to_dup.get_key_name());
-  }
-  if (dirty_to_dups != eversion_t::max() && dirty_from_dups != eversion_t::max()) {
-    pg_log_dup_t max, dirty_from_dup;
-    max.version = eversion_t::max();
-    dirty_from_dup.version = dirty_from_dups;
-    ldpp_dout(dpp, 10) << __func__ << " remove dups dirty_from_dup="
-		       << dirty_from_dup.get_key_name()
-		       << " to max=" << max.get_key_name() << dendl;
-    t.omap_rmkeyrange(
-      coll, log_oid,
-      dirty_from_dup.get_key_name(), max.get_key_name());
-  }
-
-  ldpp_dout(dpp, 10) << __func__ << " going to encode log.dups.size()="
-		     << log.dups.size() << dendl;
-  for (const auto& entry : log.dups) {
-    if (entry.version > dirty_to_dups)
-      break;
-    bufferlist bl;
-    encode(entry, bl);
-    (*km)[entry.get_key_name()] = std::move(bl);
-  }
-  ldpp_dout(dpp, 10) << __func__ << " 1st round encoded log.dups.size()="
-		     << log.dups.size() << dendl;
+  if (dups_per_key) {
+    _write_dup_blocks(t, km, log, coll, log_oid,
+		      dirty_to_dups, dirty_from_dups, write_from_dups,
+		      dups_per_key, dpp);
+  } else {
+    if (dirty_to_dups != eversion_t()) {
+      pg_log_dup_t min, dirty_to_dup;
+      dirty_to_dup.version = dirty_to_dups;
+      ldpp_dout(dpp, 10) << __func__ << " remove dups min=" << min.get_key_name()
+			 << " to dirty_to_dup=" << dirty_to_dup.get_key_name() << dendl;
+      t.omap_rmkeyrange(
+	coll, log_oid,
+	min.get_key_name(), dirty_to_dup.get_key_name());
+    }
+    if (dirty_to_dups != eversion_t::max() && dirty_from_dups != eversion_t::max()) {
+      pg_log_dup_t max, dirty_from_dup;
+      max.version = eversion_t::max();
+      dirty_from_dup.version = dirty_from_dups;
+      ldpp_dout(dpp, 10) << __func__ << " remove dups dirty_from_dup="
+			 << dirty_from_dup.get_key_name()
+			 << " to max=" << max.get_key_name() << dendl;
+      t.omap_rmkeyrange(
+	coll, log_oid,
+	dirty_from_dup.get_key_name(), max.get_key_name());
+    }
+    if (dirty_to_dups == eversion_t::max() && dup_blocks) {
+      // blocks written while osd_pg_log_dups_per_key was set
+      t.omap_rmkeyrange(
+	coll, log_oid,
+	pg_log_dup_t::get_block_key_name(eversion_t()),
+	pg_log_dup_t::get_block_key_name(eversion_t::max()));
+    }
 
-  for (auto p = log.dups.rbegin();
-       p != log.dups.rend() &&
-	 (p->version >= dirty_from_dups || p->version >= write_from_dups) &&
-	 p->version >= dirty_to_dups;
-       ++p) {
-    bufferlist bl;
-    encode(*p, bl);
-    (*km)[p->get_key_name()] = std::move(bl);
+    ldpp_dout(dpp, 10) << __func__ << " going to encode log.dups.size()="
+		       << log.dups.size() << dendl;
+    for (const auto& entry : log.dups) {
+      if (entry.version > dirty_to_dups)
+	break;
+      bufferlist bl;
+      encode(entry, bl);
+      (*km)[entry.get_key_name()] = std::move(bl);
+    }
+    ldpp_dout(dpp, 10) << __func__ << " 1st round encoded log.dups.size()="
+		       << log.dups.size() << dendl;
+
+    for (auto p = log.dups.rbegin();
+	 p != log.dups.rend() &&
+	   (p->version >= dirty_from_dups || p->version >= write_from_dups) &&
+	   p->version >= dirty_to_dups;
+	 ++p) {
+      bufferlist bl;
+      encode(*p, bl);
+      (*km)[p->get_key_name()] = std::move(bl);
+    }
+    ldpp_dout(dpp, 10) << __func__ << " 2st round encoded log.dups.size()="
+		       << log.dups.size() << dendl;
   }
-  ldpp_dout(dpp, 10) << __func__ << " 2st round encoded log.dups.size()="
-		     << log.dups.size() << dendl;
 
   if (clear_divergent_priors) {
     ldpp_dout(dpp, 10) << "write_log_and_missing: writing divergent_priors"
@@ -1013,6 +1097,58 @@ void PGLog::_write_log_and_missing(
   ldpp_dout(dpp, 10) << "end of " << __func__ << dendl;
 }
 
+// static
+void PGLog::_write_dup_blocks(
+  ObjectStore::Transaction& t,
+  map<string,bufferlist>* km,
+  pg_log_t &log,
+  const coll_t& coll, const ghobject_t &log_oid,
+  eversion_t dirty_to_dups,
+  eversion_t dirty_from_dups,
+  eversion_t write_from_dups,
+  uint64_t dups_per_key,
+  const DoutPrefixProvider *dpp)
+{
+  // a block is named after its newest dup and is only ever written once,
+  // new dups from a trim go to new blocks and anything else rewrites all
+  auto p = log.dups.end();
+  if (dirty_to_dups != eversion_t() || dirty_from_dups != eversion_t::max()) {
+    pg_log_dup_t min, max;
+    max.version = eversion_t::max();
+    ldpp_dout(dpp, 10) << __func__ << " rewriting " << log.dups.size()
+		       << " dups" << dendl;
+    t.omap_rmkeyrange(
+      coll, log_oid,
+      min.get_key_name(), max.get_key_name());
+    t.omap_rmkeyrange(
+      coll, log_oid,
+      pg_log_dup_t::get_block_key_name(eversion_t()),
+      pg_log_dup_t::get_block_key_name(eversion_t::max()));
+    p = log.dups.begin();
+  } else {
+    while (p != log.dups.begin() && std::prev(p)->version >= write_from_dups) {
+      --p;
+    }
+  }
+  while (p != log.dups.end()) {
+    // dups sharing a version stay in one block so that block names are unique
+    bufferlist entries;
+    uint32_t n = 0;
+    eversion_t last;
+    for (; p != log.dups.end() && (n < dups_per_key || p->version == last);
+	 ++p, ++n) {
+      encode(*p, entries);
+      last = p->version;
+    }
+    bufferlist bl;
+    encode(n, bl);
+    bl.claim_append(entries);
+    ldpp_dout(dpp, 20) << __func__ << " " << n << " dups up to " << last
+		       << dendl;
+    (*km)[pg_log_dup_t::get_block_key_name(last)] = std::move(bl);
+  }
+}
+
 void PGLog::rebuild_missing_set_with_deletes(
   ObjectStore *store,
   ObjectStore::CollectionHandle& ch,
@@ -1081,6 +1217,7 @@ namespace {
     std::set<std::string>* log_keys_debug = NULL;
     pg_missing_tracker_t &missing;
     const DoutPrefixProvider *dpp;
+    bool *dup_blocks = nullptr;
 
     eversion_t on_disk_can_rollback_to;
     eversion_t on_disk_rollback_info_trimmed_to;
@@ -1089,6 +1226,7 @@ namespace {
     bool must_rebuild = false;
     std::list<pg_log_entry_t> entries;
     std::list<pg_log_dup_t> dups;
+    std::list<pg_log_dup_t> block_dups;
 
     std::optional<std::string> next;
 
@@ -1125,10 +1263,25 @@ namespace {
           ceph_assert(dups.back().version < dup.version);
         }
         dups.push_back(dup);
+      } else if (key.substr(0, 5) == std::string("dupb_")) {
+        uint32_t n;
+        decode(n, bp);
+        while (n--) {
+          pg_log_dup_t dup;
+          decode(dup, bp);
+          if (!block_dups.empty()) {
+            ceph_assert(block_dups.back().version <= dup.version);
+          }
+          block_dups.push_back(dup);
+        }
       } else {
         pg_log_entry_t e;
         e.decode_with_checksum(bp);
         ldpp_dout(dpp, 20) << "read_log_and_missing " << e << dendl;
+        if (e.version <= info.log_tail) {
+          // trimmed, removal from disk is deferred
+          return;
+        }
         if (!entries.empty()) {
           pg_log_entry_t last_e(entries.back());
           ceph_assert(last_e.version.version < e.version.version);
@@ -1167,6 +1320,13 @@ namespace {
               );
             }, crimson::os::FuturizedStore::Shard::read_errorator::assert_all{});
           }).then([this] {
+            if (dup_blocks) {
+              *dup_blocks = !block_dups.empty();
+            }
+            dups.merge(block_dups, [](const pg_log_dup_t& a,
+                                      const pg_log_dup_t& b) {
+              return a.version < b.version;
+            });
             if (info.pgid.is_no_shard()) {
               // replicated pool pg does not persist this key
               assert(on_disk_rollback_info_trimmed_to == eversion_t());
@@ -1193,14 +1353,15 @@ seastar::future<> PGLog::read_log_and_missing_crimson(
   std::set<std::string>* log_keys_debug,
   pg_missing_tracker_t &missing,
   ghobject_t pgmeta_oid,
-  const DoutPrefixProvider *dpp)
+  const DoutPrefixProvider *dpp,
+  bool *dup_blocks)
 {
   ldpp_dout(dpp, 20) << "read_log_and_missing coll "
                      << ch->get_cid()
                      << " " << pgmeta_oid << dendl;
   return seastar::do_with(FuturizedShardStoreLogReader{
       store, info, log, log_keys_debug,
-      missing, dpp},
+      missing, dpp, dup_blocks},
     [ch, pgmeta_oid](FuturizedShardStoreLogReader& reader) {
     return reader.read(ch, pgmeta_oid);
   });
@@ -655,6 +655,9 @@ protected:
   eversion_t dirty_from_dups;  ///< must clear/writeout all dups >= dirty_from_dups
   eversion_t write_from_dups;  ///< must write keys >= write_from_dups
   std::set<std::string> trimmed_dups;    ///< must clear keys in trimmed_dups
+  uint64_t trim_pending = 0;   ///< trimmed entries whose keys are still on disk
+  eversion_t trim_pending_to;  ///< newest trimmed log entry still on disk
+  bool dup_blocks = false;     ///< dups may be stored in blocks on disk
   CephContext *cct;
   bool pg_log_debug;
   /// Log is clean on [dirty_to, dirty_from)
@@ -1391,11 +1394,26 @@ public:
     eversion_t dirty_to_dups,
     eversion_t dirty_from_dups,
     eversion_t write_from_dups,
+    bool remove_trimmed,
+    eversion_t trimmed_to,
+    uint64_t dups_per_key,
+    bool dup_blocks,
     bool *may_include_deletes_in_missing_dirty,
     std::set<std::string> *log_keys_debug,
     const DoutPrefixProvider *dpp = nullptr
     );
 
+  static void _write_dup_blocks(
+    ObjectStore::Transaction& t,
+    std::map<std::string,ceph::buffer::list>* km,
+    pg_log_t &log,
+    const coll_t& coll, const ghobject_t &log_oid,
+    eversion_t dirty_to_dups,
+    eversion_t dirty_from_dups,
+    eversion_t write_from_dups,
+    uint64_t dups_per_key,
+    const DoutPrefixProvider *dpp);
+
   void read_log_and_missing(
     ObjectStore *store,
     ObjectStore::CollectionHandle& ch,
@@ -1412,7 +1430,8 @@ public:
       &clear_divergent_priors,
       this,
       (pg_log_debug ? &log_keys_debug : nullptr),
-      debug_verify_stored_missing);
+      debug_verify_stored_missing,
+      &dup_blocks);
   }
 
   template <typename missing_type>
@@ -1429,7 +1448,8 @@ public:
     bool *clear_divergent_priors = nullptr,
     const DoutPrefixProvider *dpp = nullptr,
     std::set<std::string> *log_keys_debug = nullptr,
-    bool debug_verify_stored_missing = false
+    bool debug_verify_stored_missing = false,
+    bool *dup_blocks = nullptr
     ) {
     ldpp_dout(dpp, 10) << "read_log_and_missing coll " << ch->cid
 		       << " " << pgmeta_oid << dendl;
@@ -1451,6 +1471,7 @@ public:
     missing.may_include_deletes = false;
     std::list<pg_log_entry_t> entries;
     std::list<pg_log_dup_t> dups;
+    std::list<pg_log_dup_t> block_dups;
     const auto NUM_DUPS_WARN_THRESHOLD = 2*cct->_conf->osd_pg_log_dups_tracked;
     if (p) {
       using ceph::decode;
@@ -1489,19 +1510,27 @@ public:
 	  if (!dups.empty()) {
 	    ceph_assert(dups.back().version < dup.version);
 	  }
-	  if (dups.size() == NUM_DUPS_WARN_THRESHOLD) {
-	    ldpp_dout(dpp, 0) << "read_log_and_missing WARN num of dups exceeded "
-			      << NUM_DUPS_WARN_THRESHOLD << "."
-			      << " You can be hit by THE DUPS BUG"
-			      << " https://tracker.ceph.com/issues/53729."
-			      << " Consider ceph-objectstore-tool --op trim-pg-log-dups"
-			      << dendl;
-	  }
 	  dups.push_back(dup);
+	} else if (p->key().substr(0, 5) == std::string("dupb_")) {
+	  uint32_t n;
+	  decode(n, bp);
+	  total_dups += n;
+	  while (n--) {
+	    pg_log_dup_t dup;
+	    decode(dup, bp);
+	    if (!block_dups.empty()) {
+	      ceph_assert(block_dups.back().version <= dup.version);
+	    }
+	    block_dups.push_back(dup);
+	  }
 	} else {
 	  pg_log_entry_t e;
 	  e.decode_with_checksum(bp);
 	  ldpp_dout(dpp, 20) << "read_log_and_missing " << e << dendl;
+	  if (e.version <= info.log_tail) {
+	    // trimmed, removal from disk is deferred
+	    continue;
+	  }
 	  if (!entries.empty()) {
 	    pg_log_entry_t last_e(entries.back());
 	    ceph_assert(last_e.version.version < e.version.version);
@@ -1513,6 +1542,21 @@ public:
 	}
       }
     }
+    if (dup_blocks) {
+      *dup_blocks = !block_dups.empty();
+    }
+    // keys of individual dups sort before the blocks but may be newer
+    dups.merge(block_dups, [](const pg_log_dup_t& a, const pg_log_dup_t& b) {
+      return a.version < b.version;
+    });
+    if (dups.size() >= NUM_DUPS_WARN_THRESHOLD) {
+      ldpp_dout(dpp, 0) << "read_log_and_missing WARN num of dups exceeded "
+			<< NUM_DUPS_WARN_THRESHOLD << "."
+			<< " You can be hit by THE DUPS BUG"
+			<< " https://tracker.ceph.com/issues/53729."
+			<< " Consider ceph-objectstore-tool --op trim-pg-log-dups"
+			<< dendl;
+    }
     if (info.pgid.is_no_shard()) {
       // replicated pool pg does not persist this key
       assert(on_disk_rollback_info_trimmed_to == eversion_t());
@@ -1691,7 +1735,7 @@ public:
     return read_log_and_missing_crimson(
       store, ch, info,
       log, (pg_log_debug ? &log_keys_debug : nullptr),
-      missing, pgmeta_oid, this);
+      missing, pgmeta_oid, this, &dup_blocks);
   }
 
   static seastar::future<> read_log_and_missing_crimson(
@@ -1702,7 +1746,8 @@ public:
     std::set<std::string>* log_keys_debug,
     pg_missing_tracker_t &missing,
     ghobject_t pgmeta_oid,
-    const DoutPrefixProvider *dpp = nullptr);
+    const DoutPrefixProvider *dpp = nullptr,
+    bool *dup_blocks = nullptr);
 
 #endif
 
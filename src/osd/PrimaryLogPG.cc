@@ -4403,6 +4403,26 @@ void PrimaryLogPG::log_op_stats(const OpRequest& op,
   osd->logger->tinc(l_osd_op_lat, latency);
   osd->logger->tinc(l_osd_op_process_lat, process_latency);
 
+  // stage histograms; queue wait is up to dequeue_op(), service time
+  // from there to now
+  if (op.stage_tracking) {
+    int hist = (op.may_read() && op.may_write()) ?
+      l_osd_op_rw_queue_service_hist :
+      op.may_read() ? l_osd_op_r_queue_service_hist :
+      l_osd_op_w_queue_service_hist;
+    osd->logger->hinc(hist,
+		      (op.get_dequeued_time() - m->get_recv_stamp()).to_nsec(),
+		      process_latency.to_nsec());
+    utime_t submitted = op.get_stage_stamp(OpRequest::STAGE_SUBMITTED);
+    utime_t local = op.get_stage_stamp(OpRequest::STAGE_LOCAL_COMMIT);
+    utime_t replica = op.get_stage_stamp(OpRequest::STAGE_REPLICA_COMMIT);
+    if (submitted != utime_t() && local != utime_t() && replica != utime_t()) {
+      osd->logger->hinc(l_osd_op_w_commit_hist,
+			(local - submitted).to_nsec(),
+			(replica - submitted).to_nsec());
+    }
+  }
+
   if (op.may_read() && op.may_write()) {
     osd->logger->inc(l_osd_op_rw);
     osd->logger->inc(l_osd_op_rw_inb, inb);
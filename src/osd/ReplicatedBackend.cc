@@ -511,6 +511,10 @@ void ReplicatedBackend::submit_transaction(
     parent->get_acting_recovery_backfill_shards().begin(),
     parent->get_acting_recovery_backfill_shards().end());
 
+  // before the repops go out, so that both commits are measured from here
+  if (op.op) {
+    op.op->mark_stage(OpRequest::STAGE_SUBMITTED);
+  }
   issue_op(
     soid,
     at_version,
@@ -563,6 +567,7 @@ void ReplicatedBackend::op_commit(const ceph::ref_t<InProgressOp>& op)
   if (op->op) {
     op->op->mark_event("op_commit");
     op->op->pg_trace.event("op commit");
+    op->op->mark_stage(OpRequest::STAGE_LOCAL_COMMIT);
   }
 
   op->waiting_for_commit.erase(get_parent()->whoami_shard());
@@ -612,6 +617,7 @@ void ReplicatedBackend::do_repop_reply(OpRequestRef op)
       if (ip_op.op) {
 	ip_op.op->mark_event("sub_op_commit_rec");
 	ip_op.op->pg_trace.event("sub_op_commit_rec");
+	ip_op.op->mark_stage(OpRequest::STAGE_REPLICA_COMMIT);
       }
     } else {
       // legacy peer; ignore
@@ -675,6 +681,7 @@ int ReplicatedBackend::be_deep_scrub(
       pos.data_hash << bl;
     }
     pos.data_pos += r;
+    pos.data_bytes_read += r;
     if (static_cast<uint64_t>(r) == stride) {
       dout(20) << __func__ << "  " << poid << " more data, digest so far 0x"
 	       << std::hex << pos.data_hash.digest() << std::dec << dendl;
@@ -1963,6 +1970,13 @@ void ReplicatedBackend::handle_push(
 
 void ReplicatedBackend::send_pushes(int prio, map<pg_shard_t, vector<PushOp> > &pushes)
 {
+  // batched small object recovery may carry more objects per message,
+  // osd_max_push_cost still bounds the size
+  uint64_t max_pushes = cct->_conf->osd_max_push_objects;
+  if (cct->_conf->osd_recovery_batch_bytes) {
+    max_pushes = std::max<uint64_t>(
+      max_pushes, cct->_conf->osd_recovery_batch_max_objects);
+  }
   for (map<pg_shard_t, vector<PushOp> >::iterator i = pushes.begin();
        i != pushes.end();
        ++i) {
@@ -1985,7 +1999,7 @@ void ReplicatedBackend::send_pushes(int prio, map<pg_shard_t, vector<PushOp> > &
       for (;
            (j != i->second.end() &&
 	    cost < cct->_conf->osd_max_push_cost &&
-	    pushes < cct->_conf->osd_max_push_objects) ;
+	    pushes < max_pushes) ;
 	   ++j) {
 	dout(20) << __func__ << ": sending push " << *j
 		 << " to osd." << i->first << dendl;
@@ -1994,6 +2008,7 @@ void ReplicatedBackend::send_pushes(int prio, map<pg_shard_t, vector<PushOp> > &
 	msg->pushes.push_back(*j);
       }
       msg->set_cost(cost);
+      get_parent()->get_logger()->inc(l_osd_push_batch_objects, pushes);
       get_parent()->send_message_osd_cluster(msg, con);
     }
   }
@@ -26,6 +26,35 @@ PerfCounters *build_osd_logger(CephContext *cct) {
     32,                              ///< Enough to cover requests larger than GB
   };
 
+  // Axes of the op stage histograms, values are in nanoseconds
+  PerfHistogramCommon::axis_config_d op_queue_axis_config{
+    "Queue wait (usec)",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,
+    10000,                           ///< Quantization unit is 10usec
+    32,
+  };
+  PerfHistogramCommon::axis_config_d op_service_axis_config{
+    "Service time (usec)",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,
+    10000,
+    32,
+  };
+  PerfHistogramCommon::axis_config_d op_local_commit_axis_config{
+    "Local commit (usec)",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,
+    10000,
+    32,
+  };
+  PerfHistogramCommon::axis_config_d op_replica_commit_axis_config{
+    "Replica commit (usec)",
+    PerfHistogramCommon::SCALE_LOG2,
+    0,
+    10000,
+    32,
+  };
 
   // All the basic OSD operation stats are to be considered useful
   osd_plb.set_prio_default(PerfCountersBuilder::PRIO_USEFUL);
@@ -123,6 +152,23 @@ PerfCounters *build_osd_logger(CephContext *cct) {
   osd_plb.add_time_avg(
     l_osd_op_rw_prepare_lat, "op_rw_prepare_latency",
     "Latency of read-modify-write operations (excluding queue time and wait for finished)");
+  osd_plb.add_u64_counter_histogram(
+    l_osd_op_r_queue_service_hist, "op_r_queue_service_histogram",
+    op_queue_axis_config, op_service_axis_config,
+    "Histogram of read operation queue wait (until dequeued) + service time");
+  osd_plb.add_u64_counter_histogram(
+    l_osd_op_w_queue_service_hist, "op_w_queue_service_histogram",
+    op_queue_axis_config, op_service_axis_config,
+    "Histogram of write operation queue wait (until dequeued) + service time");
+  osd_plb.add_u64_counter_histogram(
+    l_osd_op_rw_queue_service_hist, "op_rw_queue_service_histogram",
+    op_queue_axis_config, op_service_axis_config,
+    "Histogram of rw operation queue wait (until dequeued) + service time");
+  osd_plb.add_u64_counter_histogram(
+    l_osd_op_w_commit_hist, "op_w_commit_histogram",
+    op_local_commit_axis_config, op_replica_commit_axis_config,
+    "Histogram of write operation local commit + last replica commit, "
+    "from the transaction submission");
   osd_plb.add_time_avg(l_osd_op_before_queue_op_lat, "op_before_queue_op_lat",
     "Latency of IO before calling queue(before really queue into ShardedOpWq)"); // client io before queue op_wq latency
 
@@ -133,6 +179,16 @@ PerfCounters *build_osd_logger(CephContext *cct) {
   osd_plb.add_time_avg(l_osd_op_before_dequeue_op_lat, "op_before_dequeue_op_lat",
     "Latency of IO before calling dequeue_op(already dequeued and get PG lock)"); // client io before dequeue_op latency
 
+  osd_plb.add_u64_counter(
+    l_osd_op_wq_steal, "op_wq_steal",
+    "Work queue items run by a thread of another, idle, shard");
+  osd_plb.add_u64(
+    l_osd_op_wq_depth_max, "op_wq_depth_max",
+    "Items queued in the deepest op shard");
+  osd_plb.add_u64_avg(
+    l_osd_op_wq_depth_avg, "op_wq_depth_avg",
+    "Items queued per op shard, sampled on tick");
+
   osd_plb.add_u64_counter(
     l_osd_sop, "subop", "Suboperations");
   osd_plb.add_u64_counter(
@@ -158,6 +214,9 @@ PerfCounters *build_osd_logger(CephContext *cct) {
   osd_plb.add_u64_counter(l_osd_pull, "pull", "Pull requests sent");
   osd_plb.add_u64_counter(l_osd_push, "push", "Push messages sent");
   osd_plb.add_u64_counter(l_osd_push_outb, "push_out_bytes", "Pushed size", NULL, 0, unit_t(UNIT_BYTES));
+  osd_plb.add_u64_avg(
+    l_osd_push_batch_objects, "push_batch_objects",
+    "Objects per push message");
 
   osd_plb.add_u64_counter(
     l_osd_rop, "recovery_ops",
@@ -247,6 +306,12 @@ PerfCounters *build_osd_logger(CephContext *cct) {
   osd_plb.add_u64_avg(
     l_osd_map_cache_miss_low_avg, "osd_map_cache_miss_low_avg",
     "osdmap cache miss, avg distance below cache lower bound");
+  osd_plb.add_u64_counter(
+    l_osd_map_cache_load_wait, "osd_map_cache_load_wait",
+    "osdmap cache misses waiting for another thread to load the map");
+  osd_plb.add_u64(
+    l_osd_map_cache_pinned, "osd_map_cache_pinned",
+    "osdmaps pinned for pgs catching up");
   osd_plb.add_u64_counter(
     l_osd_map_bl_cache_hit, "osd_map_bl_cache_hit",
     "OSDMap buffer cache hits");
@@ -401,6 +466,8 @@ PerfCounters *build_scrub_labeled_perf(CephContext *cct, std::string label)
   scrub_perf.add_u64_counter(scrbcnt_chunks_busy, "chunk_busy", "chunk busy during scrubs");
   scrub_perf.add_u64_counter(scrbcnt_blocked, "locked_object", "waiting on locked object events");
   scrub_perf.add_u64_counter(scrbcnt_write_blocked, "write_blocked_by_scrub", "write blocked by scrub");
+  scrub_perf.add_u64_counter(scrbcnt_read_bytes, "read_bytes", "object data read by deep scrubs", NULL, 0, unit_t(UNIT_BYTES));
+  scrub_perf.add_u64_counter(scrbcnt_read_throttled, "read_throttled", "deep scrub chunks paused by the bandwidth limit");
 
   // the replica reservation process
   scrub_perf.add_u64_counter(scrbcnt_resrv_success, "scrub_reservations_completed", "successfully completed reservation processes");
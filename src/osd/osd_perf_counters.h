@@ -36,6 +36,10 @@ enum {
   l_osd_op_rw_lat_outb_hist,
   l_osd_op_rw_process_lat,
   l_osd_op_rw_prepare_lat,
+  l_osd_op_r_queue_service_hist,
+  l_osd_op_w_queue_service_hist,
+  l_osd_op_rw_queue_service_hist,
+  l_osd_op_w_commit_hist,
 
   l_osd_op_delayed_unreadable,
   l_osd_op_delayed_degraded,
@@ -43,6 +47,10 @@ enum {
   l_osd_op_before_queue_op_lat,
   l_osd_op_before_dequeue_op_lat,
 
+  l_osd_op_wq_steal,
+  l_osd_op_wq_depth_max,
+  l_osd_op_wq_depth_avg,
+
   l_osd_sop,
   l_osd_sop_inb,
   l_osd_sop_lat,
@@ -58,6 +66,7 @@ enum {
   l_osd_pull,
   l_osd_push,
   l_osd_push_outb,
+  l_osd_push_batch_objects,
 
   l_osd_rop,
   l_osd_rbytes,
@@ -93,6 +102,8 @@ enum {
   l_osd_map_cache_miss,
   l_osd_map_cache_miss_low,
   l_osd_map_cache_miss_low_avg,
+  l_osd_map_cache_load_wait,
+  l_osd_map_cache_pinned,
   l_osd_map_bl_cache_hit,
   l_osd_map_bl_cache_miss,
 
@@ -210,6 +221,10 @@ enum {
   scrbcnt_blocked,
   /// # write blocked by the scrub
   scrbcnt_write_blocked,
+  /// object data bytes read by deep scrubs
+  scrbcnt_read_bytes,
+  /// # deep scrub chunks paused by the bandwidth limit
+  scrbcnt_read_throttled,
 
   // -- replicas reservation
   /// # successfully completed reservation steps
@@ -5080,6 +5080,16 @@ std::string pg_log_dup_t::get_key_name() const
   return key;
 }
 
+std::string pg_log_dup_t::get_block_key_name(const eversion_t& last)
+{
+  static const char prefix[] = "dupb_";
+  std::string key(37, ' ');
+  memcpy(&key[0], prefix, 5);
+  last.get_key_name(&key[5]);
+  key.resize(36); // remove the null terminator
+  return key;
+}
+
 void pg_log_dup_t::encode(ceph::buffer::list &bl) const
 {
   ENCODE_START(2, 1, bl);
@@ -1278,6 +1278,7 @@ struct pg_pool_t {
     // Pool features are restricted to those supported by crimson-osd.
     // Note, does not prohibit being created on classic osd.
     FLAG_CRIMSON = 1<<18,
+    FLAG_EC_OPTIMIZATIONS = 1<<19, // partial stripe reads and parity delta writes
   };
 
   static const char *get_flag_name(uint64_t f) {
@@ -1301,6 +1302,7 @@ struct pg_pool_t {
     case FLAG_EIO: return "eio";
     case FLAG_BULK: return "bulk";
     case FLAG_CRIMSON: return "crimson";
+    case FLAG_EC_OPTIMIZATIONS: return "ec_optimizations";
     default: return "???";
     }
   }
@@ -1357,6 +1359,8 @@ struct pg_pool_t {
       return FLAG_BULK;
     if (name == "crimson")
       return FLAG_CRIMSON;
+    if (name == "ec_optimizations")
+      return FLAG_EC_OPTIMIZATIONS;
     return 0;
   }
 
@@ -1759,6 +1763,10 @@ public:
     return has_flag(FLAG_EC_OVERWRITES);
   }
 
+  bool allows_ecoptimizations() const {
+    return has_flag(FLAG_EC_OPTIMIZATIONS);
+  }
+
   bool is_crimson() const {
     return has_flag(FLAG_CRIMSON);
   }
@@ -4491,6 +4499,8 @@ struct pg_log_dup_t {
   {}
 
   std::string get_key_name() const;
+  /// key of a block of dups whose newest entry is at @last
+  static std::string get_block_key_name(const eversion_t& last);
   void encode(ceph::buffer::list &bl) const;
   void decode(ceph::buffer::list::const_iterator &bl);
   void dump(ceph::Formatter *f) const;
@@ -6310,6 +6320,7 @@ struct ScrubMapBuilder {
   ceph::buffer::hash data_hash, omap_hash;  ///< accumulatinng hash value
   uint64_t omap_keys = 0;
   uint64_t omap_bytes = 0;
+  uint64_t data_bytes_read = 0;  ///< object data read so far, all objects
 
   bool empty() {
     return ls.empty();
@@ -38,6 +38,7 @@ OsdScrub::OsdScrub(
     , m_queue{cct, m_osd_svc}
     , m_log_prefix{fmt::format("osd.{} osd-scrub:", m_osd_svc.get_nodeid())}
     , m_load_tracker{cct, conf, m_osd_svc.get_nodeid()}
+    , m_deep_scrub_throttle{cct, conf, m_osd_svc.get_nodeid()}
 {
   create_scrub_perf_counters();
 }
@@ -325,6 +326,127 @@ std::optional<double> OsdScrub::update_load_average()
   return m_load_tracker.update_load_average();
 }
 
+
+// ////////////////////////////////////////////////////////////////////////// //
+// deep scrub bandwidth shaping
+
+OsdScrub::DeepScrubThrottle::DeepScrubThrottle(
+    CephContext* cct,
+    const ceph::common::ConfigProxy& config,
+    int node_id)
+    : cct{cct}
+    , conf{config}
+    , log_prefix{fmt::format("osd.{} deep-scrub-throttle::", node_id)}
+    , last_refill{ceph::coarse_mono_clock::now()}
+{}
+
+void OsdScrub::DeepScrubThrottle::refill(ceph::coarse_mono_time now)
+{
+  const uint64_t max_rate =
+      conf.get_val<Option::size_t>("osd_deep_scrub_bandwidth");
+  if (max_rate == 0) {
+    rate = 0;
+    tokens = 0;
+  } else {
+    if (rate == 0 || rate > max_rate) {
+      // just enabled, or the limit was lowered
+      rate = max_rate;
+    }
+    // allow for bursts of up to a second worth of reads
+    tokens = std::min<double>(
+	rate, tokens + rate * duration<double>(now - last_refill).count());
+  }
+  last_refill = now;
+}
+
+milliseconds OsdScrub::DeepScrubThrottle::read_delay(
+    ceph::coarse_mono_time now)
+{
+  std::lock_guard l{lock};
+  refill(now);
+  if (rate == 0 || tokens >= 0) {
+    return 0ms;
+  }
+  return milliseconds{int64_t(std::ceil(-tokens * 1000 / rate))};
+}
+
+void OsdScrub::DeepScrubThrottle::charge(
+    uint64_t bytes,
+    ceph::coarse_mono_time now)
+{
+  std::lock_guard l{lock};
+  // replicas only ever charge: follow the configured bandwidth here too
+  refill(now);
+  if (rate) {
+    tokens -= bytes;
+  }
+}
+
+uint64_t OsdScrub::DeepScrubThrottle::get_rate() const
+{
+  std::lock_guard l{lock};
+  return rate;
+}
+
+void OsdScrub::DeepScrubThrottle::update_rate(
+    std::pair<uint64_t, uint64_t> client_op_lat)
+{
+  std::lock_guard l{lock};
+  auto [sum, count] = client_op_lat;
+  auto [last_sum, last_count] = last_client_op_lat;
+  last_client_op_lat = client_op_lat;
+
+  const uint64_t max_rate =
+      conf.get_val<Option::size_t>("osd_deep_scrub_bandwidth");
+  const auto target = conf.get_val<milliseconds>(
+      "osd_deep_scrub_client_latency_target");
+  if (rate == 0 || max_rate == 0 || target == 0ms || count <= last_count ||
+      sum < last_sum) {
+    return;
+  }
+  const nanoseconds lat{(sum - last_sum) / (count - last_count)};
+  // never throttle below 1/16 of the configured bandwidth, so that deep
+  // scrubs do make progress on a loaded OSD
+  const uint64_t min_rate = std::max<uint64_t>(max_rate / 16, 1);
+  const uint64_t old_rate = rate;
+  if (lat > target) {
+    rate = std::max(rate / 2, min_rate);
+  } else {
+    rate = std::min(rate + std::max<uint64_t>(max_rate / 10, 1), max_rate);
+  }
+  if (rate != old_rate) {
+    dout(15) << fmt::format(
+		    "client op latency {}us (target {}), deep scrub bandwidth "
+		    "{} -> {} B/s",
+		    duration_cast<microseconds>(lat).count(), target, old_rate,
+		    rate)
+	     << dendl;
+  }
+}
+
+std::ostream& OsdScrub::DeepScrubThrottle::gen_prefix(
+    std::ostream& out,
+    std::string_view fn) const
+{
+  return out << log_prefix << fn << ": ";
+}
+
+milliseconds OsdScrub::deep_scrub_read_delay()
+{
+  return m_deep_scrub_throttle.read_delay(ceph::coarse_mono_clock::now());
+}
+
+void OsdScrub::deep_scrub_data_read(uint64_t bytes)
+{
+  m_deep_scrub_throttle.charge(bytes, ceph::coarse_mono_clock::now());
+}
+
+void OsdScrub::update_deep_scrub_bandwidth(
+    std::pair<uint64_t, uint64_t> client_op_lat)
+{
+  m_deep_scrub_throttle.update_rate(client_op_lat);
+}
+
 // ////////////////////////////////////////////////////////////////////////// //
 
 // checks for half-closed ranges. Modify the (p<till)to '<=' to check for
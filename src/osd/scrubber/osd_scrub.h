@@ -161,6 +161,26 @@ class OsdScrub {
    */
   std::optional<double> update_load_average();
 
+  /**
+   * deep scrub read bandwidth shaping (osd_deep_scrub_bandwidth): a token
+   * bucket shared by all the PGs scrubbing on this OSD.
+   *
+   * \returns how long the caller should wait before reading more object
+   *          data, zero if it may go on now.
+   */
+  std::chrono::milliseconds deep_scrub_read_delay();
+
+  /// charge deep scrub data reads to the token bucket
+  void deep_scrub_data_read(uint64_t bytes);
+
+  /**
+   * Called by the OSD tick with the client op latency counter (sum, count).
+   * Halves the deep scrub bandwidth while the client op latency since the
+   * previous call is above osd_deep_scrub_client_latency_target, and grows
+   * it back slowly otherwise.
+   */
+  void update_deep_scrub_bandwidth(std::pair<uint64_t, uint64_t> client_op_lat);
+
    // the scrub performance counters collections
    // ---------------------------------------------------------------
   PerfCounters* get_perf_counters(int pool_type, scrub_level_t level);
@@ -242,6 +262,44 @@ class OsdScrub {
   };
   LoadTracker m_load_tracker;
 
+ public:
+  /**
+   * the deep scrub read token bucket. Tokens are bytes, and the balance may
+   * go negative, as reads are charged once done. The caller provides the
+   * current time, so that the unit tests can set it.
+   */
+  class DeepScrubThrottle {
+    CephContext* cct;
+    const ceph::common::ConfigProxy& conf;
+    const std::string log_prefix;
+
+    mutable ceph::mutex lock =
+	ceph::make_mutex("OsdScrub::DeepScrubThrottle::lock");
+    double tokens{0};
+    ceph::coarse_mono_time last_refill;
+    /// the current rate, at most osd_deep_scrub_bandwidth. 0 - not shaping.
+    uint64_t rate{0};
+    std::pair<uint64_t, uint64_t> last_client_op_lat{0, 0};
+
+    void refill(ceph::coarse_mono_time now);
+
+   public:
+    DeepScrubThrottle(
+	CephContext* cct,
+	const ceph::common::ConfigProxy& config,
+	int node_id);
+
+    std::chrono::milliseconds read_delay(ceph::coarse_mono_time now);
+    void charge(uint64_t bytes, ceph::coarse_mono_time now);
+    void update_rate(std::pair<uint64_t, uint64_t> client_op_lat);
+    uint64_t get_rate() const;
+
+    std::ostream& gen_prefix(std::ostream& out, std::string_view fn) const;
+  };
+
+ private:
+  DeepScrubThrottle m_deep_scrub_throttle;
+
   // the scrub performance counters collections
   // ---------------------------------------------------------------
 
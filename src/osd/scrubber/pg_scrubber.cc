@@ -1355,6 +1355,11 @@ int PgScrubber::build_scrub_map_chunk(ScrubMap& map,
       break;
     }
     m_pg->_scan_rollback_obs(rollback_obs);
+    if (deep && m_pg->get_cct()->_conf.get_val<bool>(
+		  "osd_deep_scrub_sort_by_location")) {
+      // turn the object data reads into a (mostly) forward sweep of the disk
+      m_pg->get_pgbackend()->be_sort_scan_list(pos);
+    }
     pos.pos = 0;
     return -EINPROGRESS;
   }
@@ -1362,8 +1367,15 @@ int PgScrubber::build_scrub_map_chunk(ScrubMap& map,
   // scan objects
   while (!pos.done()) {
 
+    const uint64_t data_bytes_read = pos.data_bytes_read;
     int r = m_pg->get_pgbackend()->be_scan_list(map, pos);
     dout(30) << __func__ << " BE returned " << r << dendl;
+    if (pos.deep && pos.data_bytes_read > data_bytes_read) {
+      m_osds->get_scrub_services().deep_scrub_data_read(
+	pos.data_bytes_read - data_bytes_read);
+      get_counters_set().inc(scrbcnt_read_bytes,
+			     pos.data_bytes_read - data_bytes_read);
+    }
     if (r == -EINPROGRESS) {
       dout(20) << __func__ << " in progress" << dendl;
       return r;
@@ -2407,8 +2419,20 @@ void PgScrubber::replica_handling_done()
 
 std::chrono::milliseconds PgScrubber::get_scrub_sleep_time() const
 {
-  return m_osds->get_scrub_services().scrub_sleep_time(
+  auto sleep_time = m_osds->get_scrub_services().scrub_sleep_time(
     ceph_clock_now(), m_flags.required);
+  if (m_is_deep) {
+    // wait for the deep scrub bandwidth before the next chunk is selected,
+    // and its range blocked for writes
+    auto read_delay = m_osds->get_scrub_services().deep_scrub_read_delay();
+    if (read_delay > sleep_time) {
+      dout(20) << __func__ << " deep scrub bandwidth used up, resuming in "
+	       << read_delay << dendl;
+      get_counters_set().inc(scrbcnt_read_throttled);
+      sleep_time = read_delay;
+    }
+  }
+  return sleep_time;
 }
 
 void PgScrubber::queue_for_scrub_resched(Scrub::scrub_prio_t prio)
@@ -319,6 +319,59 @@ TEST_F(IsaErasureCodeTest, chunk_size)
   }
 }
 
+TEST_F(IsaErasureCodeTest, encode_scatter_gather)
+{
+  for (const char *m : { "1", "3" }) {
+    ErasureCodeIsaDefault Isa(tcache);
+    ErasureCodeProfile profile;
+    profile["k"] = "4";
+    profile["m"] = m;
+    Isa.init(profile, &cerr);
+    set<int> want_to_encode;
+    for (unsigned i = 0; i < Isa.get_chunk_count(); i++) {
+      want_to_encode.insert(i);
+    }
+
+    const unsigned object_size = 4 * 64 * 1024 - 100;
+    bufferlist contiguous;
+    for (unsigned i = 0; i < object_size; i++) {
+      contiguous.append((char)(i * 13));
+    }
+    contiguous.rebuild_aligned(ErasureCode::SIMD_ALIGN);
+    map<int, bufferlist> expected;
+    EXPECT_EQ(0, Isa.encode(want_to_encode, contiguous, &expected));
+
+    // off unless the OSD turns it on
+    bufferlist split;
+    split.push_back(buffer::copy(contiguous.c_str(), 4096));
+    split.push_back(buffer::copy(contiguous.c_str() + 4096,
+                                 object_size - 4096));
+    ASSERT_FALSE(Isa.wants_encode_sg(split));
+    Isa.set_encode_sg(true);
+    ASSERT_TRUE(Isa.wants_encode_sg(split));
+
+    // page sized segments are encoded in place, odd sized ones
+    // go through the bounce buffer
+    for (unsigned segment : { 4096u, 1000u, 4099u }) {
+      bufferlist fragmented;
+      for (unsigned off = 0; off < object_size; off += segment) {
+	unsigned len = std::min(segment, object_size - off);
+	bufferptr bp(buffer::create(len));
+	contiguous.begin(off).copy(len, bp.c_str());
+	fragmented.push_back(std::move(bp));
+      }
+      ASSERT_TRUE(Isa.wants_encode_sg(fragmented));
+      map<int, bufferlist> encoded;
+      EXPECT_EQ(0, Isa.encode(want_to_encode, fragmented, &encoded));
+      ASSERT_EQ(expected.size(), encoded.size());
+      for (auto &&[i, bl] : expected) {
+	EXPECT_TRUE(bl.contents_equal(encoded[i])) << "chunk " << i
+						   << " segment " << segment;
+      }
+    }
+  }
+}
+
 TEST_F(IsaErasureCodeTest, encode)
 {
   ErasureCodeIsaDefault Isa(tcache);
@@ -278,6 +278,119 @@ TEST(ErasureCodeTest, encode)
   }
 }
 
+TEST(ErasureCodeTest, parity_delta)
+{
+  ErasureCodeJerasureReedSolomonVandermonde jerasure;
+  ErasureCodeProfile profile;
+  profile["k"] = "3";
+  profile["m"] = "2";
+  profile["w"] = "8";
+  jerasure.init(profile, &cerr);
+  EXPECT_TRUE(jerasure.get_supported_optimizations() &
+	      ErasureCodeInterface::FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION);
+
+  unsigned object_size = jerasure.get_alignment() * 3;
+  set<int> want_to_encode = { 0, 1, 2, 3, 4 };
+  bufferlist in;
+  for (unsigned i = 0; i < object_size; i++) {
+    in.append((char)(i * 7));
+  }
+  map<int,bufferlist> encoded;
+  EXPECT_EQ(0, jerasure.encode(want_to_encode, in, &encoded));
+  unsigned chunk_size = encoded[0].length();
+
+  // overwrite part of the second data chunk
+  const unsigned off = 16, len = 32;
+  bufferlist updated;
+  updated.append(in.c_str(), object_size);
+  for (unsigned i = 0; i < len; i++) {
+    updated.c_str()[chunk_size + off + i] = 'U';
+  }
+  map<int,bufferlist> reencoded;
+  EXPECT_EQ(0, jerasure.encode(want_to_encode, updated, &reencoded));
+
+  bufferptr old_data(encoded[1].front(), off, len);
+  bufferptr new_data(reencoded[1].front(), off, len);
+  map<int,bufferptr> deltas;
+  jerasure.encode_delta(old_data, new_data, &deltas[1]);
+  map<int,bufferptr> parity;
+  for (int i = 3; i < 5; i++) {
+    parity[i] = bufferptr(encoded[i].front(), off, len);
+  }
+  jerasure.apply_delta(deltas, parity);
+  for (int i = 3; i < 5; i++) {
+    EXPECT_TRUE(encoded[i].contents_equal(reencoded[i]));
+  }
+}
+
+// encoding fragmented input in place must give the same chunks as
+// encoding it contiguous
+template <typename T>
+void encode_scatter_gather(const char *m, const char *w)
+{
+  T jerasure;
+  ErasureCodeProfile profile;
+  profile["k"] = "4";
+  profile["m"] = m;
+  profile["w"] = w;
+  ASSERT_EQ(0, jerasure.init(profile, &cerr));
+  set<int> want_to_encode;
+  for (unsigned i = 0; i < jerasure.get_chunk_count(); i++) {
+    want_to_encode.insert(i);
+  }
+
+  const unsigned object_size = 4 * 64 * 1024 - 100;
+  bufferlist contiguous;
+  for (unsigned i = 0; i < object_size; i++) {
+    contiguous.append((char)(i * 13));
+  }
+  contiguous.rebuild_aligned(ErasureCode::SIMD_ALIGN);
+  ASSERT_FALSE(jerasure.wants_encode_sg(contiguous));
+  map<int, bufferlist> expected;
+  EXPECT_EQ(0, jerasure.encode(want_to_encode, contiguous, &expected));
+
+  // off unless the OSD turns it on
+  bufferlist split;
+  split.push_back(buffer::copy(contiguous.c_str(), 4096));
+  split.push_back(buffer::copy(contiguous.c_str() + 4096,
+                               object_size - 4096));
+  ASSERT_FALSE(jerasure.wants_encode_sg(split));
+  jerasure.set_encode_sg(true);
+  ASSERT_TRUE(jerasure.wants_encode_sg(split));
+
+  // page sized segments are encoded in place, odd sized ones
+  // go through the bounce buffer
+  for (unsigned segment : { 4096u, 1000u, 4099u }) {
+    bufferlist fragmented;
+    for (unsigned off = 0; off < object_size; off += segment) {
+      unsigned len = std::min(segment, object_size - off);
+      bufferptr bp(buffer::create(len));
+      contiguous.begin(off).copy(len, bp.c_str());
+      fragmented.push_back(std::move(bp));
+    }
+    ASSERT_TRUE(jerasure.wants_encode_sg(fragmented));
+    map<int, bufferlist> encoded;
+    EXPECT_EQ(0, jerasure.encode(want_to_encode, fragmented, &encoded));
+    ASSERT_EQ(expected.size(), encoded.size());
+    for (auto &&[i, bl] : expected) {
+      EXPECT_TRUE(bl.contents_equal(encoded[i])) << "w " << w
+						 << " chunk " << i
+						 << " segment " << segment;
+    }
+  }
+}
+
+TEST(ErasureCodeTest, encode_scatter_gather)
+{
+  for (const char *w : { "8", "16", "32" }) {
+    ASSERT_NO_FATAL_FAILURE(
+      encode_scatter_gather<ErasureCodeJerasureReedSolomonVandermonde>(
+	"3", w));
+    ASSERT_NO_FATAL_FAILURE(
+      encode_scatter_gather<ErasureCodeJerasureReedSolomonRAID6>("2", w));
+  }
+}
+
 TEST(ErasureCodeTest, create_rule)
 {
   std::unique_ptr<CrushWrapper> c = std::make_unique<CrushWrapper>();
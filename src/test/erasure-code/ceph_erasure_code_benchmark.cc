@@ -59,7 +59,16 @@ int ErasureCodeBench::setup(int argc, char** argv) {
     ("plugin,p", po::value<string>()->default_value("jerasure"),
      "erasure code plugin name")
     ("workload,w", po::value<string>()->default_value("encode"),
-     "run either encode or decode")
+     "run either encode, decode or delta")
+    ("update-size,u", po::value<int>()->default_value(4096),
+     "size of the data chunk range overwritten by the delta workload")
+    ("segment-size", po::value<int>()->default_value(0),
+     "split the buffer to be encoded in segments of this size, "
+     "as received from the network (0 for a single buffer)")
+    ("encode-sg", "encode segmented input without making it contiguous "
+     "first, as osd_ec_encode_scatter_gather does")
+    ("stats", "also report the bytes copied per byte encoded or decoded "
+     "and the throughput per core")
     ("erasures,e", po::value<int>()->default_value(1),
      "number of erasures when decoding")
     ("erased", po::value<vector<int> >(),
@@ -119,6 +128,10 @@ int ErasureCodeBench::setup(int argc, char** argv) {
   }
 
   in_size = vm["size"].as<int>();
+  update_size = vm["update-size"].as<int>();
+  segment_size = vm["segment-size"].as<int>();
+  encode_sg = vm.count("encode-sg") > 0;
+  stats = vm.count("stats") > 0;
   max_iterations = vm["iterations"].as<int>();
   plugin = vm["plugin"].as<string>();
   workload = vm["workload"].as<string>();
@@ -158,10 +171,56 @@ int ErasureCodeBench::run() {
 
   if (workload == "encode")
     return encode();
+  else if (workload == "delta")
+    return delta();
   else
     return decode();
 }
 
+bufferlist ErasureCodeBench::make_input() const
+{
+  bufferlist in;
+  if (segment_size <= 0) {
+    in.append(string(in_size, 'X'));
+    in.rebuild_aligned(ErasureCode::SIMD_ALIGN);
+    return in;
+  }
+  for (int off = 0; off < in_size; off += segment_size) {
+    int len = std::min(segment_size, in_size - off);
+    bufferptr segment = buffer::create_aligned(len, ErasureCode::SIMD_ALIGN);
+    memset(segment.c_str(), 'X', len);
+    in.push_back(std::move(segment));
+  }
+  return in;
+}
+
+// turns the count on if the stats are wanted, returns the count so far
+static uint64_t count_bytes_copied(
+  const ErasureCodeInterfaceRef &erasure_code,
+  bool stats)
+{
+  auto ec = dynamic_cast<ErasureCode*>(erasure_code.get());
+  if (!ec) {
+    return 0;
+  }
+  ec->set_count_copies(stats);
+  return ec->get_bytes_copied();
+}
+
+void ErasureCodeBench::report(utime_t elapsed,
+			      uint64_t bytes,
+			      uint64_t copied) const
+{
+  cout << elapsed << "\t" << (bytes / 1024) << endl;
+  if (stats) {
+    // single threaded, the throughput is per core
+    cout << "copied/byte " << (bytes ? (double)copied / bytes : 0)
+	 << "\tGB/s/core " << (elapsed > utime_t() ?
+				bytes / (double)elapsed / 1e9 : 0)
+	 << endl;
+  }
+}
+
 int ErasureCodeBench::encode()
 {
   ErasureCodePluginRegistry &instance = ErasureCodePluginRegistry::instance();
@@ -175,13 +234,13 @@ int ErasureCodeBench::encode()
     return code;
   }
 
-  bufferlist in;
-  in.append(string(in_size, 'X'));
-  in.rebuild_aligned(ErasureCode::SIMD_ALIGN);
+  bufferlist in = make_input();
   set<int> want_to_encode;
   for (int i = 0; i < k + m; i++) {
     want_to_encode.insert(i);
   }
+  erasure_code->set_encode_sg(encode_sg);
+  uint64_t copied = count_bytes_copied(erasure_code, stats);
   utime_t begin_time = ceph_clock_now();
   for (int i = 0; i < max_iterations; i++) {
     std::map<int,bufferlist> encoded;
@@ -190,7 +249,62 @@ int ErasureCodeBench::encode()
       return code;
   }
   utime_t end_time = ceph_clock_now();
-  cout << (end_time - begin_time) << "\t" << (max_iterations * (in_size / 1024)) << endl;
+  report(end_time - begin_time, (uint64_t)max_iterations * in_size,
+	 count_bytes_copied(erasure_code, stats) - copied);
+  return 0;
+}
+
+int ErasureCodeBench::delta()
+{
+  ErasureCodePluginRegistry &instance = ErasureCodePluginRegistry::instance();
+  ErasureCodeInterfaceRef erasure_code;
+  stringstream messages;
+  int code = instance.factory(plugin,
+			      g_conf().get_val<std::string>("erasure_code_dir"),
+			      profile, &erasure_code, &messages);
+  if (code) {
+    cerr << messages.str() << endl;
+    return code;
+  }
+  if (!(erasure_code->get_supported_optimizations() &
+	ErasureCodeInterface::FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION)) {
+    cerr << "plugin " << plugin << " does not support parity delta" << endl;
+    return -EOPNOTSUPP;
+  }
+
+  bufferlist in;
+  in.append(string(in_size, 'X'));
+  in.rebuild_aligned(ErasureCode::SIMD_ALIGN);
+  set<int> want_to_encode;
+  for (int i = 0; i < k + m; i++) {
+    want_to_encode.insert(i);
+  }
+  map<int,bufferlist> encoded;
+  code = erasure_code->encode(want_to_encode, in, &encoded);
+  if (code)
+    return code;
+
+  // overwrite the beginning of the first data chunk
+  const vector<int> &mapping = erasure_code->get_chunk_mapping();
+  int shard = mapping.empty() ? 0 : mapping[0];
+  int len = std::min<int>(update_size, encoded[shard].length());
+  bufferptr old_data(encoded[shard].front(), 0, len);
+  bufferptr new_data = buffer::create_aligned(len, ErasureCode::SIMD_ALIGN);
+  memset(new_data.c_str(), 'Y', len);
+  map<int,bufferptr> parity;
+  for (int i = k; i < k + m; i++) {
+    int p = mapping.empty() ? i : mapping[i];
+    parity[p] = bufferptr(encoded[p].front(), 0, len);
+  }
+  utime_t begin_time = ceph_clock_now();
+  for (int i = 0; i < max_iterations; i++) {
+    map<int,bufferptr> deltas;
+    erasure_code->encode_delta(old_data, new_data, &deltas[shard]);
+    erasure_code->apply_delta(deltas, parity);
+    std::swap(old_data, new_data);
+  }
+  utime_t end_time = ceph_clock_now();
+  report(end_time - begin_time, (uint64_t)max_iterations * len, 0);
   return 0;
 }
 
@@ -270,9 +384,7 @@ int ErasureCodeBench::decode()
     return code;
   }
 
-  bufferlist in;
-  in.append(string(in_size, 'X'));
-  in.rebuild_aligned(ErasureCode::SIMD_ALIGN);
+  bufferlist in = make_input();
 
   set<int> want_to_encode;
   for (int i = 0; i < k + m; i++) {
@@ -294,6 +406,7 @@ int ErasureCodeBench::decode()
     display_chunks(encoded, erasure_code->get_chunk_count());
   }
 
+  uint64_t copied = count_bytes_copied(erasure_code, stats);
   utime_t begin_time = ceph_clock_now();
   for (int i = 0; i < max_iterations; i++) {
     if (exhaustive_erasures) {
@@ -321,7 +434,8 @@ int ErasureCodeBench::decode()
     }
   }
   utime_t end_time = ceph_clock_now();
-  cout << (end_time - begin_time) << "\t" << (max_iterations * (in_size / 1024)) << endl;
+  report(end_time - begin_time, (uint64_t)max_iterations * in_size,
+	 count_bytes_copied(erasure_code, stats) - copied);
   return 0;
 }
 
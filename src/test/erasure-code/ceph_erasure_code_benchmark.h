@@ -27,11 +27,16 @@
 #include "include/buffer.h"
 
 #include "common/ceph_context.h"
+#include "include/utime.h"
 
 #include "erasure-code/ErasureCodeInterface.h"
 
 class ErasureCodeBench {
   int in_size;
+  int update_size;
+  int segment_size;
+  bool encode_sg;
+  bool stats;
   int max_iterations;
   int erasures;
   int k;
@@ -57,6 +62,9 @@ public:
 		      ErasureCodeInterfaceRef erasure_code);
   int decode();
   int encode();
+  int delta();
+  ceph::buffer::list make_input() const;
+  void report(utime_t elapsed, uint64_t bytes, uint64_t copied) const;
 };
 
 #endif
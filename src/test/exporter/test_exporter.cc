@@ -1260,7 +1260,8 @@ void setup_test_data(std::map<std::string, AdminSocketClient> clients, std::stri
       ]
     })";
   }
-  collector.dump_asok_metrics(true, 5, false, expectedCounterDump, expectedCounterSchema, false);
+  std::string histogramDump = "";
+  collector.dump_asok_metrics(true, 5, false, expectedCounterDump, expectedCounterSchema, histogramDump, false);
 }
 
 TEST(Exporter, dump_asok_metrics) {
@@ -1419,6 +1420,114 @@ ceph_rbd_mirror_snapshot_image_sync_time_sum{ceph_daemon="rbd-mirror.a",image="i
   ASSERT_TRUE(collector.metrics.find(expectedMetrics) != std::string::npos);
 }
 
+TEST(Exporter, promethize_axis) {
+  ASSERT_EQ(promethize_axis("Latency (usec)"), "latency_usec");
+  ASSERT_EQ(promethize_axis("Request size (bytes)"), "request_size_bytes");
+  ASSERT_EQ(promethize_axis("  Queue-wait / usec "), "queue_wait_usec");
+  ASSERT_EQ(promethize_axis("()"), "");
+}
+
+TEST(Exporter, parse_asok_histograms) {
+  std::map<std::string, AdminSocketClient> clients;
+  std::string daemon = "ceph-osd.0";
+  clients.insert({daemon, AdminSocketClient("/tmp/" + daemon + ".asok")});
+  DaemonMetricCollector &collector = collector_instance();
+  collector.clients = clients;
+  collector.metrics = "";
+
+  std::string counterDump = R"(
+    {
+      "osd": [
+          {
+              "labels": {},
+              "counters": {
+                  "op_wip": 0
+              }
+          }
+      ]
+    })";
+  std::string counterSchema = R"(
+    {
+      "osd": [
+          {
+              "labels": {},
+              "counters": {
+                  "op_wip": {
+                      "type": 2,
+                      "metric_type": "gauge",
+                      "value_type": "integer",
+                      "description": "Replication operations currently being processed (primary)",
+                      "nick": "",
+                      "priority": 5,
+                      "units": "none"
+                  }
+              }
+          }
+      ]
+    })";
+  // a 3x3 'perf histogram dump': latency by rows, request size by columns
+  std::string histogramDump = R"(
+    {
+      "osd": {
+          "op_r_latency_out_bytes_histogram": {
+              "axes": [
+                  {
+                      "name": "Latency (usec)",
+                      "min": 0,
+                      "quant_size": 100000,
+                      "buckets": 3,
+                      "scale_type": "log2",
+                      "ranges": [
+                          { "max": -1 },
+                          { "min": 0, "max": 99999 },
+                          { "min": 100000 }
+                      ]
+                  },
+                  {
+                      "name": "Request size (bytes)",
+                      "min": 0,
+                      "quant_size": 512,
+                      "buckets": 3,
+                      "scale_type": "log2",
+                      "ranges": [
+                          { "max": -1 },
+                          { "min": 0, "max": 511 },
+                          { "min": 512 }
+                      ]
+                  }
+              ],
+              "values": [
+                  [ 0, 0, 0 ],
+                  [ 1, 2, 3 ],
+                  [ 0, 4, 5 ]
+              ]
+          }
+      }
+    })";
+  g_conf().set_val("exporter_histograms", "true");
+  collector.dump_asok_metrics(true, 5, false, counterDump, counterSchema,
+                              histogramDump, false);
+  g_conf().set_val("exporter_histograms", "false");
+
+  // each axis gets the cumulative counts of the other one collapsed
+  std::string expectedMetrics = R"(
+# HELP ceph_osd_op_r_latency_out_bytes_histogram_count Number of samples in ceph_osd_op_r_latency_out_bytes_histogram
+# TYPE ceph_osd_op_r_latency_out_bytes_histogram_count counter
+ceph_osd_op_r_latency_out_bytes_histogram_count{ceph_daemon="osd.0"} 15
+# HELP ceph_osd_op_r_latency_out_bytes_histogram_latency_usec_bucket ceph_osd_op_r_latency_out_bytes_histogram by Latency (usec)
+# TYPE ceph_osd_op_r_latency_out_bytes_histogram_latency_usec_bucket counter
+ceph_osd_op_r_latency_out_bytes_histogram_latency_usec_bucket{ceph_daemon="osd.0",le="-1"} 0
+ceph_osd_op_r_latency_out_bytes_histogram_latency_usec_bucket{ceph_daemon="osd.0",le="99999"} 6
+ceph_osd_op_r_latency_out_bytes_histogram_latency_usec_bucket{ceph_daemon="osd.0",le="+Inf"} 15
+# HELP ceph_osd_op_r_latency_out_bytes_histogram_request_size_bytes_bucket ceph_osd_op_r_latency_out_bytes_histogram by Request size (bytes)
+# TYPE ceph_osd_op_r_latency_out_bytes_histogram_request_size_bytes_bucket counter
+ceph_osd_op_r_latency_out_bytes_histogram_request_size_bytes_bucket{ceph_daemon="osd.0",le="-1"} 1
+ceph_osd_op_r_latency_out_bytes_histogram_request_size_bytes_bucket{ceph_daemon="osd.0",le="511"} 7
+ceph_osd_op_r_latency_out_bytes_histogram_request_size_bytes_bucket{ceph_daemon="osd.0",le="+Inf"} 15
+)";
+  ASSERT_TRUE(collector.metrics.find(expectedMetrics) != std::string::npos);
+}
+
 TEST(Exporter, add_fixed_name_metrics) {
     std::vector<std::string> metrics = {
       "ceph_data_sync_from_zone2-zg1-realm1_fetch_bytes",
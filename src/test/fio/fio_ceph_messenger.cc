@@ -29,10 +29,12 @@ enum ceph_msgr_type {
   CEPH_MSGR_TYPE_POSIX,
   CEPH_MSGR_TYPE_DPDK,
   CEPH_MSGR_TYPE_RDMA,
+  CEPH_MSGR_TYPE_IO_URING,
 };
 
 const char *ceph_msgr_types[] = { "undef", "async+posix",
-				  "async+dpdk", "async+rdma" };
+				  "async+dpdk", "async+rdma",
+				  "async+io_uring" };
 
 struct ceph_msgr_options {
   struct thread_data *td__;
@@ -640,7 +642,7 @@ static std::vector<fio_option> options {
   }),
   make_option([] (fio_option& o) {
     o.name  = "ms_type";
-    o.lname = "CEPH messenger transport type: async+posix, async+dpdk, async+rdma";
+    o.lname = "CEPH messenger transport type: async+posix, async+dpdk, async+rdma, async+io_uring";
     o.type  = FIO_OPT_STR;
     o.off1  = offsetof(struct ceph_msgr_options, ms_type);
     o.help  = "Transport type for CEPH messenger, see 'ms async transport type' corresponding CEPH documentation page";
@@ -660,6 +662,10 @@ static std::vector<fio_option> options {
     o.posval[3].ival = "async+rdma";
     o.posval[3].oval = CEPH_MSGR_TYPE_RDMA;
     o.posval[3].help = "RDMA";
+
+    o.posval[4].ival = "async+io_uring";
+    o.posval[4].oval = CEPH_MSGR_TYPE_IO_URING;
+    o.posval[4].help = "TCP over io_uring";
   }),
   make_option([] (fio_option& o) {
     o.name  = "ceph_conf_file";
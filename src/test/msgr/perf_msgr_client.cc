@@ -27,6 +27,9 @@ using namespace std;
 #include "common/Cycles.h"
 #include "global/global_init.h"
 #include "msg/Messenger.h"
+#ifdef HAVE_URING_STACK
+#include "msg/async/UringStack.h"
+#endif
 #include "messages/MOSDOp.h"
 #include "auth/DummyAuth.h"
 
@@ -173,6 +176,7 @@ void usage(const string &name) {
   cout << "       [ios]: how much messages sent for each client" << std::endl;
   cout << "       [thinktime]: sleep time when do fast dispatching(match client logic)" << std::endl;
   cout << "       [msg length]: message data bytes" << std::endl;
+  cout << "       --ms_type async+posix|async+io_uring selects the stack" << std::endl;
 }
 
 int main(int argc, char **argv)
@@ -197,6 +201,13 @@ int main(int argc, char **argv)
   int len = atoi(args[5]);
 
   std::string public_msgr_type = g_ceph_context->_conf->ms_public_type.empty() ? g_ceph_context->_conf.get_val<std::string>("ms_type") : g_ceph_context->_conf->ms_public_type;
+#ifdef HAVE_URING_STACK
+  if (public_msgr_type == "async+io_uring" &&
+      !UringNetworkStack::is_supported()) {
+    cerr << "io_uring stack not supported by this kernel" << std::endl;
+    return 1;
+  }
+#endif
 
   cout << " using ms-public-type " << public_msgr_type << std::endl;
   cout << "       server ip:port " << args[0] << std::endl;
@@ -214,6 +225,7 @@ int main(int argc, char **argv)
   client.start();
   uint64_t stop = Cycles::rdtsc();
   cout << " Total op " << (ios * numjobs) << " run time " << Cycles::to_microseconds(stop - start) << "us." << std::endl;
+  cout << " " << (ios * numjobs) * 1000000.0 / Cycles::to_microseconds(stop - start) << " msgs/s." << std::endl;
 
   return 0;
 }
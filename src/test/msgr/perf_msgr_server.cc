@@ -27,12 +27,16 @@ using namespace std;
 #include "common/WorkQueue.h"
 #include "global/global_init.h"
 #include "msg/Messenger.h"
+#ifdef HAVE_URING_STACK
+#include "msg/async/UringStack.h"
+#endif
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
 #include "auth/DummyAuth.h"
 
 class ServerDispatcher : public Dispatcher {
   uint64_t think_time;
+  bool fast_dispatch;
   ThreadPool op_tp;
   class OpWQ : public ThreadPool::WorkQueue<Message> {
     list<Message*> messages;
@@ -71,7 +75,8 @@ class ServerDispatcher : public Dispatcher {
   } op_wq;
 
  public:
-  ServerDispatcher(int threads, uint64_t delay): Dispatcher(g_ceph_context), think_time(delay),
+  ServerDispatcher(int threads, uint64_t delay, bool fast):
+    Dispatcher(g_ceph_context), think_time(delay), fast_dispatch(fast),
     op_tp(g_ceph_context, "ServerDispatcher::op_tp", "tp_serv_disp", threads, "serverdispatcher_op_threads"),
     op_wq(ceph::make_timespan(30), ceph::make_timespan(30), &op_tp) {
     op_tp.start();
@@ -83,7 +88,7 @@ class ServerDispatcher : public Dispatcher {
   bool ms_can_fast_dispatch(const Message *m) const override {
     switch (m->get_type()) {
     case CEPH_MSG_OSD_OP:
-      return true;
+      return fast_dispatch;
     default:
       return false;
     }
@@ -91,7 +96,13 @@ class ServerDispatcher : public Dispatcher {
 
   void ms_handle_fast_connect(Connection *con) override {}
   void ms_handle_fast_accept(Connection *con) override {}
-  bool ms_dispatch(Message *m) override { return true; }
+  bool ms_dispatch(Message *m) override {
+    if (m->get_type() != CEPH_MSG_OSD_OP)
+      return false;
+    usleep(think_time);
+    op_wq.queue(m);
+    return true;
+  }
   bool ms_handle_reset(Connection *con) override { return true; }
   void ms_handle_remote_reset(Connection *con) override {}
   bool ms_handle_refused(Connection *con) override { return false; }
@@ -113,11 +124,13 @@ class MessengerServer {
   DummyAuthClientServer dummy_auth;
 
  public:
-  MessengerServer(const string &t, const string &addr, int threads, int delay):
-      msgr(NULL), type(t), bindaddr(addr), dispatcher(threads, delay),
+  MessengerServer(const string &t, const string &addr, int threads, int delay,
+                  bool fast_dispatch):
+      msgr(NULL), type(t), bindaddr(addr), dispatcher(threads, delay, fast_dispatch),
       dummy_auth(g_ceph_context) {
     msgr = Messenger::create(g_ceph_context, type, entity_name_t::OSD(0), "server", 0);
     msgr->set_default_policy(Messenger::Policy::stateless_server(0));
+    msgr->set_concurrent_dispatch();
     dummy_auth.auth_registry.refresh_config();
       msgr->set_auth_server(&dummy_auth);
   }
@@ -136,10 +149,12 @@ class MessengerServer {
 };
 
 void usage(const string &name) {
-  cerr << "Usage: " << name << " [bind ip:port] [server worker threads] [thinktime us]" << std::endl;
+  cerr << "Usage: " << name << " [bind ip:port] [server worker threads] [thinktime us] [fast dispatch]" << std::endl;
   cerr << "       [bind ip:port]: The ip:port pair to bind, client need to specify this pair to connect" << std::endl;
   cerr << "       [server worker threads]: threads will process incoming messages and reply(matching pg threads)" << std::endl;
   cerr << "       [thinktime]: sleep time when do dispatching(match fast dispatch logic in OSD.cc)" << std::endl;
+  cerr << "       [fast dispatch]: 0 to go through the dispatch queue(like mon and mds), default 1" << std::endl;
+  cerr << "       --ms_type async+posix|async+io_uring selects the stack" << std::endl;
 }
 
 int main(int argc, char **argv)
@@ -159,7 +174,15 @@ int main(int argc, char **argv)
 
   int worker_threads = atoi(args[1]);
   int think_time = atoi(args[2]);
+  bool fast_dispatch = args.size() < 4 || atoi(args[3]);
   std::string public_msgr_type = g_ceph_context->_conf->ms_public_type.empty() ? g_ceph_context->_conf.get_val<std::string>("ms_type") : g_ceph_context->_conf->ms_public_type;
+#ifdef HAVE_URING_STACK
+  if (public_msgr_type == "async+io_uring" &&
+      !UringNetworkStack::is_supported()) {
+    cerr << "io_uring stack not supported by this kernel" << std::endl;
+    return 1;
+  }
+#endif
 
   cerr << " This tool won't handle connection error alike things, " << std::endl;
   cerr << "please ensure the proper network environment to test." << std::endl;
@@ -168,8 +191,13 @@ int main(int argc, char **argv)
   cerr << "       bind ip:port " << args[0] << std::endl;
   cerr << "       worker threads " << worker_threads << std::endl;
   cerr << "       thinktime(us) " << think_time << std::endl;
+  cerr << "       fast dispatch " << fast_dispatch << std::endl;
+  if (!fast_dispatch)
+    cerr << "       dispatch threads "
+         << g_ceph_context->_conf.get_val<uint64_t>("ms_dispatch_threads") << std::endl;
 
-  MessengerServer server(public_msgr_type, args[0], worker_threads, think_time);
+  MessengerServer server(public_msgr_type, args[0], worker_threads, think_time,
+                         fast_dispatch);
   server.start();
 
   return 0;
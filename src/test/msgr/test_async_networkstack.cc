@@ -28,6 +28,7 @@
 #include "common/config_obs.h"
 #include "include/Context.h"
 #include "msg/async/Event.h"
+#include "msg/async/PosixStack.h"
 #include "msg/async/Stack.h"
 
 using namespace std;
@@ -575,6 +576,188 @@ TEST_P(NetworkWorkerTest, ComplexTest) {
   });
 }
 
+TEST(ZeroCopySendTracker, Wraparound) {
+  // the kernel's 32 bit id counter wraps in the middle of the first send
+  ZeroCopySendTracker tracker(0xfffffffeull);
+  bufferptr first(buffer::create(4096)), second(buffer::create(4096));
+  {
+    bufferlist bl;
+    bl.append(first);
+    tracker.hold(bl, 3);
+  }
+  {
+    bufferlist bl;
+    bl.append(second);
+    tracker.hold(bl, 2);
+  }
+  ASSERT_EQ(2, first.raw_nref());
+  ASSERT_EQ(2, second.raw_nref());
+
+  // a send is only released once all of its sendmsg() calls are done
+  tracker.complete(0xfffffffe, 0xffffffff);
+  ASSERT_EQ(2, first.raw_nref());
+  tracker.complete(0, 1);
+  ASSERT_EQ(1, first.raw_nref());
+  ASSERT_EQ(2, second.raw_nref());
+  tracker.complete(2, 2);
+  ASSERT_EQ(1, second.raw_nref());
+  ASSERT_TRUE(tracker.empty());
+}
+
+TEST(ZeroCopySendTracker, OutOfOrder) {
+  ZeroCopySendTracker tracker(0xfffffff0ull);
+  std::vector<bufferptr> ptrs;
+  for (unsigned i = 0; i < 4; ++i) {
+    ptrs.emplace_back(buffer::create(4096));
+    bufferlist bl;
+    bl.append(ptrs.back());
+    tracker.hold(bl, 8);
+  }
+  // one notification may cover the end of a send and the start of the
+  // next, and ranges may complete out of order
+  tracker.complete(0x4, 0xf);
+  tracker.complete(0xfffffff4, 0x3);
+  for (auto& p : ptrs) {
+    ASSERT_EQ(2, p.raw_nref());
+  }
+  tracker.complete(0xfffffff0, 0xfffffff3);
+  for (auto& p : ptrs) {
+    ASSERT_EQ(1, p.raw_nref());
+  }
+  ASSERT_TRUE(tracker.empty());
+}
+
+TEST_P(NetworkWorkerTest, ZeroCopySendTest) {
+  if (strcmp(GetParam(), "posix")) {
+    GTEST_SKIP() << "only the posix stack sends with MSG_ZEROCOPY";
+  }
+  entity_addr_t bind_addr;
+  ASSERT_TRUE(bind_addr.parse(get_addr().c_str()));
+  g_ceph_context->_conf.set_val("ms_tcp_zerocopy_min_size", "65536");
+  std::atomic_bool zerocopy_used(false);
+  std::atomic_bool *zerocopy_used_p = &zerocopy_used;
+
+  exec_events([bind_addr, zerocopy_used_p](Worker *worker) mutable {
+    if (worker->id != 0)
+      return;
+    EventCenter *center = &worker->center;
+    PerfCounters *logger = worker->perf_logger;
+    SocketOptions options;
+    ServerSocket bind_socket;
+    ASSERT_EQ(0, worker->listen(bind_addr, 0, options, &bind_socket));
+
+    auto connect_pair = [&](ConnectedSocket *cli, ConnectedSocket *srv) {
+      entity_addr_t cli_addr;
+      ASSERT_EQ(0, worker->connect(bind_addr, options, cli));
+      C_poll cb(center);
+      center->create_file_event(bind_socket.fd(), EVENT_READABLE, &cb);
+      ASSERT_TRUE(cb.poll(500));
+      center->delete_file_event(bind_socket.fd(), EVENT_READABLE);
+      ASSERT_EQ(0, bind_socket.accept(srv, options, &cli_addr, worker));
+      cb.reset();
+      center->create_file_event(cli->fd(), EVENT_READABLE, &cb);
+      int r = cli->is_connected();
+      if (r == 0) {
+        ASSERT_TRUE(cb.poll(500));
+        r = cli->is_connected();
+      }
+      ASSERT_EQ(1, r);
+      center->delete_file_event(cli->fd(), EVENT_READABLE);
+    };
+    auto drain = [&](ConnectedSocket *srv, size_t len) {
+      char buf[65536];
+      C_poll cb(center);
+      center->create_file_event(srv->fd(), EVENT_READABLE, &cb);
+      while (len) {
+        ssize_t r = srv->read(buf, std::min(len, sizeof(buf)));
+        if (r == -EAGAIN) {
+          ASSERT_TRUE(cb.poll(500));
+          cb.reset();
+          continue;
+        }
+        ASSERT_GT(r, 0);
+        len -= r;
+      }
+      center->delete_file_event(srv->fd(), EVENT_READABLE);
+    };
+
+    ConnectedSocket cli_socket, srv_socket;
+    ASSERT_NO_FATAL_FAILURE(connect_pair(&cli_socket, &srv_socket));
+
+    // more than the socket buffers take, so that it goes out in parts
+    bufferptr data(buffer::create_page_aligned(16 << 20));
+    data.zero();
+    bufferlist bl;
+    bl.append(data);
+    uint64_t zerocopy_bytes = logger->get(l_msgr_send_zerocopy_bytes);
+    uint64_t copied = logger->get(l_msgr_send_zerocopy_copied);
+    size_t sent = 0;
+    while (bl.length()) {
+      ssize_t r = cli_socket.send(bl, false);
+      ASSERT_GE(r, 0);
+      if (!sent && logger->get(l_msgr_send_zerocopy_bytes) == zerocopy_bytes) {
+	// SO_ZEROCOPY is not supported by this kernel
+	return;
+      }
+      if (!sent) {
+	// the sent part is held until the kernel is done with it
+	ASSERT_EQ(bl.length() ? 3 : 2, data.raw_nref());
+      }
+      ASSERT_NO_FATAL_FAILURE(drain(&srv_socket, r));
+      sent += r;
+    }
+    *zerocopy_used_p = true;
+    ASSERT_EQ(data.length(), sent);
+
+    // loopback copies, the notifications say so and release the data
+    bufferlist empty;
+    for (int i = 0; i < 1000 && data.raw_nref() > 1; ++i) {
+      usleep(1000);
+      ASSERT_EQ(0, cli_socket.send(empty, false));
+    }
+    ASSERT_EQ(1, data.raw_nref());
+    ASSERT_LT(copied, logger->get(l_msgr_send_zerocopy_copied));
+
+    // which turns zero copy off for the connection
+    zerocopy_bytes = logger->get(l_msgr_send_zerocopy_bytes);
+    bufferptr more(buffer::create_page_aligned(1 << 20));
+    more.zero();
+    bl.append(more);
+    sent = 0;
+    while (bl.length()) {
+      ssize_t r = cli_socket.send(bl, false);
+      ASSERT_GE(r, 0);
+      ASSERT_NO_FATAL_FAILURE(drain(&srv_socket, r));
+      sent += r;
+    }
+    ASSERT_EQ(more.length(), sent);
+    ASSERT_EQ(zerocopy_bytes, logger->get(l_msgr_send_zerocopy_bytes));
+    ASSERT_EQ(1, more.raw_nref());
+
+    // a socket closed with sends in flight lets go of their data
+    ConnectedSocket cli_socket2, srv_socket2;
+    ASSERT_NO_FATAL_FAILURE(connect_pair(&cli_socket2, &srv_socket2));
+    bufferptr unread(buffer::create_page_aligned(16 << 20));
+    unread.zero();
+    bl.append(unread);
+    ASSERT_LT(0, cli_socket2.send(bl, false));
+    bl.clear();
+    cli_socket2.close();
+    ASSERT_EQ(1, unread.raw_nref());
+    srv_socket2.close();
+
+    cli_socket.close();
+    srv_socket.close();
+    bind_socket.abort_accept();
+  });
+
+  g_ceph_context->_conf.set_val("ms_tcp_zerocopy_min_size", "0");
+  if (!zerocopy_used) {
+    GTEST_SKIP() << "SO_ZEROCOPY is not supported";
+  }
+}
+
+
 class StressFactory {
   struct Client;
   struct Server;
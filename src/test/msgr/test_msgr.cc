@@ -40,6 +40,9 @@
 #include "msg/Message.h"
 #include "msg/Messenger.h"
 #include "msg/msg_types.h"
+#ifdef HAVE_URING_STACK
+#include "msg/async/UringStack.h"
+#endif
 
 typedef boost::mt11213b gen_type;
 
@@ -76,6 +79,12 @@ class MessengerTest : public ::testing::TestWithParam<const char*> {
   }
   void SetUp() override {
     lderr(g_ceph_context) << __func__ << " start set up " << GetParam() << dendl;
+#ifdef HAVE_URING_STACK
+    if (string(GetParam()) == "async+io_uring" &&
+	!UringNetworkStack::is_supported()) {
+      GTEST_SKIP() << "io_uring stack not supported by this kernel";
+    }
+#endif
     server_msgr = Messenger::create(g_ceph_context, string(GetParam()), entity_name_t::OSD(0), "server", getpid());
     client_msgr = Messenger::create(g_ceph_context, string(GetParam()), entity_name_t::CLIENT(-1), "client", getpid());
     server_msgr->set_default_policy(Messenger::Policy::stateless_server(0));
@@ -87,6 +96,10 @@ class MessengerTest : public ::testing::TestWithParam<const char*> {
     server_msgr->set_require_authorizer(false);
   }
   void TearDown() override {
+    if (!server_msgr) {
+      // skipped
+      return;
+    }
     ASSERT_EQ(server_msgr->get_dispatch_queue_len(), 0);
     ASSERT_EQ(client_msgr->get_dispatch_queue_len(), 0);
     delete server_msgr;
@@ -2389,12 +2402,17 @@ TEST_P(MessengerTest, MarkdownTest) {
   delete server_msgr2;
 }
 
+static const char* const messenger_types[] = {
+  "async+posix",
+#ifdef HAVE_URING_STACK
+  "async+io_uring",
+#endif
+};
+
 INSTANTIATE_TEST_SUITE_P(
   Messenger,
   MessengerTest,
-  ::testing::Values(
-    "async+posix"
-  )
+  ::testing::ValuesIn(messenger_types)
 );
 
 int main(int argc, char **argv) {
@@ -13,6 +13,7 @@
 #include "include/stringify.h"
 #include "include/Context.h"
 #include "os/bluestore/Allocator.h"
+#include "os/bluestore/FrontCacheAllocator.h"
 
 using namespace std;
 
@@ -656,3 +657,133 @@ INSTANTIATE_TEST_SUITE_P(
   Allocator,
   AllocTest,
   ::testing::Values("stupid", "bitmap", "avl", "hybrid", "btree"));
+
+class FrontCacheTest : public ::testing::TestWithParam<const char*> {
+public:
+  std::unique_ptr<FrontCacheAllocator> alloc;
+  Allocator* backend = nullptr;
+
+  void init_alloc(int64_t size, uint64_t min_alloc_size,
+		  uint64_t batch_bytes) {
+    backend = Allocator::create(g_ceph_context, GetParam(), size,
+				min_alloc_size, "front-cache-backend");
+    alloc.reset(new FrontCacheAllocator(g_ceph_context, backend,
+      { min_alloc_size, 0x10000, 0x400000 }, batch_bytes, "front-cache"));
+  }
+};
+
+TEST_P(FrontCacheTest, test_hits_and_accounting)
+{
+  uint64_t capacity = 256 * 1024 * 1024;
+  uint64_t alloc_unit = 0x1000;
+  init_alloc(capacity, alloc_unit, 0x10000);
+  alloc->init_add_free(0, capacity);
+
+  PExtentVector extents;
+  for (int i = 0; i < 64; ++i) {
+    EXPECT_EQ((int64_t)alloc_unit,
+	      alloc->allocate(alloc_unit, alloc_unit, 0, (int64_t)0, &extents));
+  }
+  ASSERT_EQ(64u, extents.size());
+  auto stats = alloc->get_stats();
+  EXPECT_EQ(64u, stats.hits);
+  EXPECT_EQ(0u, stats.misses);
+  // 16 extents per batch
+  EXPECT_EQ(4u, stats.refills);
+  EXPECT_EQ(0u, stats.cached);
+  EXPECT_EQ(capacity - 64 * alloc_unit, alloc->get_free());
+
+  // not a size class
+  EXPECT_EQ(3 * (int64_t)alloc_unit,
+	    alloc->allocate(3 * alloc_unit, alloc_unit, 0, (int64_t)0, &extents));
+  EXPECT_EQ(1u, alloc->get_stats().misses);
+
+  interval_set<uint64_t> all;
+  for (auto& e : extents) {
+    all.insert(e.offset, e.length);
+  }
+  EXPECT_EQ(64 * alloc_unit + 3 * alloc_unit, all.size());
+
+  // frees of a class size stay in the cache, up to twice the batch
+  for (auto& e : extents) {
+    interval_set<uint64_t> r;
+    r.insert(e.offset, e.length);
+    alloc->release(r);
+  }
+  stats = alloc->get_stats();
+  EXPECT_LE(stats.cached, 2 * 0x10000u);
+  EXPECT_GT(stats.drains, 0u);
+  EXPECT_EQ(capacity, alloc->get_free());
+
+  // cached extents are reported as free
+  uint64_t total = 0;
+  alloc->foreach([&](uint64_t off, uint64_t len) {
+    total += len;
+  });
+  EXPECT_EQ(capacity, total);
+  EXPECT_LT(backend->get_free(), capacity);
+
+  alloc->drain();
+  EXPECT_EQ(0u, alloc->get_stats().cached);
+  EXPECT_EQ(capacity, backend->get_free());
+  EXPECT_EQ(0, alloc->get_fragmentation_score());
+}
+
+TEST_P(FrontCacheTest, test_alignment)
+{
+  uint64_t capacity = 64 * 1024 * 1024;
+  uint64_t alloc_unit = 0x1000;
+  init_alloc(capacity, alloc_unit, 0x100000);
+  alloc->init_add_free(0, capacity);
+
+  // park a misaligned 64K extent in the cache
+  alloc->init_rm_free(alloc_unit, 0x10000);
+  interval_set<uint64_t> r;
+  r.insert(alloc_unit, 0x10000);
+  alloc->release(r);
+  EXPECT_EQ(0x10000u, alloc->get_stats().cached);
+
+  PExtentVector extents;
+  EXPECT_EQ(0x10000,
+	    alloc->allocate(0x10000, 0x10000, 0, (int64_t)0, &extents));
+  ASSERT_EQ(1u, extents.size());
+  EXPECT_EQ(0u, p2phase<uint64_t>(extents[0].offset, 0x10000));
+
+  // block unit accepts it
+  extents.clear();
+  EXPECT_EQ(0x10000,
+	    alloc->allocate(0x10000, alloc_unit, 0, (int64_t)0, &extents));
+  ASSERT_EQ(1u, extents.size());
+  EXPECT_EQ(0u, p2phase<uint64_t>(extents[0].offset, alloc_unit));
+}
+
+TEST_P(FrontCacheTest, test_init_rm_free_and_enospc)
+{
+  uint64_t capacity = 16 * 1024 * 1024;
+  uint64_t alloc_unit = 0x1000;
+  init_alloc(capacity, alloc_unit, 0x100000);
+  alloc->init_add_free(0, capacity);
+
+  PExtentVector extents;
+  EXPECT_EQ(0x10000,
+	    alloc->allocate(0x10000, alloc_unit, 0, (int64_t)0, &extents));
+  EXPECT_GT(alloc->get_stats().cached, 0u);
+
+  // removing free space drains the cache first
+  alloc->init_rm_free(0x800000, 0x800000);
+  EXPECT_EQ(0u, alloc->get_stats().cached);
+  EXPECT_EQ(capacity - 0x800000 - 0x10000, alloc->get_free());
+
+  // refill the 4K magazine, the rest must still be allocatable
+  EXPECT_EQ((int64_t)alloc_unit,
+	    alloc->allocate(alloc_unit, alloc_unit, 0, (int64_t)0, &extents));
+  uint64_t want = alloc->get_free();
+  uint64_t got = alloc->allocate(want, alloc_unit, 0, (int64_t)0, &extents);
+  EXPECT_EQ(want, got);
+  EXPECT_EQ(0u, alloc->get_free());
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  Allocator,
+  FrontCacheTest,
+  ::testing::Values("stupid", "bitmap", "avl", "hybrid", "btree"));
@@ -16,6 +16,8 @@
 #include "include/denc.h"
 #include "global/global_init.h"
 #include "os/bluestore/Allocator.h"
+#include "os/bluestore/bitmap_scan.h"
+#include "os/bluestore/simple_bitmap.h"
 
 using namespace std;
 
@@ -28,7 +30,8 @@ void usage(const string &name) {
           "try_alloc <count> <want> <alloc_unit>|"
           "replay_alloc <alloc_list_file|"
           "export_binary <out_file>|"
-          "free_histogram [<alloc_unit>] [<num_buckets>]"
+          "free_histogram [<alloc_unit>] [<num_buckets>]|"
+          "bench_scan <want> <alloc_unit> [<iterations>]"
        << std::endl;
 }
 
@@ -467,6 +470,88 @@ int export_as_binary(char* fname, char* target_fname)
   return r;
 }
 
+/*
+* Replays a free-dump into the bitmap allocator and a SimpleBitmap and
+* times the free space search with every bitmap scan implementation
+* supported by the CPU.
+*/
+int bench_scan(char* fname, uint64_t want, uint64_t alloc_unit,
+               uint64_t iterations)
+{
+  std::vector<std::pair<uint64_t, uint64_t>> free_extents;
+  uint64_t capacity = 0;
+  uint64_t dump_unit = 0;
+  auto create_fn = [&](std::string_view,
+                       int64_t _capacity,
+                       int64_t _alloc_unit,
+                       std::string_view) {
+    capacity = _capacity;
+    dump_unit = _alloc_unit;
+  };
+  auto add_fn = [&](uint64_t offset,
+                    uint64_t len) {
+    free_extents.emplace_back(offset, len);
+  };
+  int r = replay_free_dump_and_apply_raw(
+    fname,
+    create_fn,
+    add_fn);
+  if (r < 0) {
+    return r;
+  }
+  std::cout << "Free extents: " << free_extents.size()
+            << ", default scan: " << bitmap_scan_get_impl() << std::endl;
+
+  for (auto impl : { "scalar", "neon", "avx2", "avx512" }) {
+    if (!bitmap_scan_set_impl(impl)) {
+      continue;
+    }
+    unique_ptr<Allocator> alloc(
+      Allocator::create(g_ceph_context, "bitmap", capacity, dump_unit,
+                        "bench_scan"));
+    for (auto& e : free_extents) {
+      alloc->init_add_free(e.first, e.second);
+    }
+    uint64_t allocs = 0;
+    auto start = ceph::mono_clock::now();
+    PExtentVector extents;
+    for (uint64_t i = 0; i < iterations; i++) {
+      extents.clear();
+      if (alloc->allocate(want, alloc_unit, 0, &extents) <= 0) {
+        break;
+      }
+      ++allocs;
+      alloc->release(extents);
+    }
+    auto alloc_lat = ceph::mono_clock::now() - start;
+
+    SimpleBitmap sbmap(g_ceph_context, capacity / dump_unit);
+    sbmap.set_all();
+    for (auto& e : free_extents) {
+      sbmap.clr(e.first / dump_unit, e.second / dump_unit);
+    }
+    uint64_t walked = 0;
+    start = ceph::mono_clock::now();
+    for (uint64_t i = 0; i < iterations; i++) {
+      for (auto ext = sbmap.get_next_clr_extent(0);
+           ext.length;
+           ext = sbmap.get_next_clr_extent(ext.offset + ext.length)) {
+        ++walked;
+      }
+    }
+    auto walk_lat = ceph::mono_clock::now() - start;
+
+    std::cout << impl << ": "
+              << allocs << " allocate/release of " << want << " in "
+              << alloc_lat << " ("
+              << (allocs ? ceph::to_seconds<double>(alloc_lat) * 1e6 / allocs : 0)
+              << " us/op), "
+              << walked << " simple bitmap extents walked in "
+              << walk_lat << std::endl;
+  }
+  return 0;
+}
+
 int check_duplicates(char* fname)
 {
   interval_set<uint64_t> free_extents;
@@ -780,5 +865,19 @@ int main(int argc, char **argv)
     return export_as_binary(argv[1], argv[3]);
   } else if (strcmp(argv[2], "duplicates") == 0) {
     return check_duplicates(argv[1]);
+  } else if (strcmp(argv[2], "bench_scan") == 0) {
+    if (argc < 5) {
+      std::cerr << "Error: insufficient arguments for \"bench_scan\" operation."
+                << std::endl;
+      usage(argv[0]);
+      return 1;
+    }
+    auto want = strtoul(argv[3], nullptr, 10);
+    auto alloc_unit = strtoul(argv[4], nullptr, 10);
+    uint64_t iterations = 1000;
+    if (argc >= 6) {
+      iterations = strtoul(argv[5], nullptr, 10);
+    }
+    return bench_scan(argv[1], want, alloc_unit, iterations);
   }
 }
@@ -0,0 +1,155 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * BlueFS log compaction stress benchmark.
+ *
+ * A WAL-like writer appends and syncs a file through BlueRocksEnv while
+ * other threads churn BlueFS metadata and compact its log over and over.
+ * WAL fsync latency percentiles are reported separately for the syncs
+ * which overlapped a compaction and for the ones which didn't.
+ *
+ * Runs once per compaction mode: "mirror" (background compaction),
+ * "jump" (legacy async compaction) and "sync".
+ */
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <gtest/gtest.h>
+
+#include "common/ceph_time.h"
+#include "global/global_context.h"
+#include "include/stringify.h"
+#include "os/bluestore/BlueFS.h"
+#include "os/bluestore/BlueRocksEnv.h"
+
+using namespace std;
+
+class BlueFSCompactionBench : public ::testing::TestWithParam<const char*> {
+public:
+  static constexpr uint64_t bdev_size = 1ull << 30;
+  static constexpr uint64_t wal_block = 4096;
+  static constexpr uint64_t wal_roll_size = 16ull << 20;
+  static constexpr unsigned seconds = 10;
+
+  string path;
+
+  void SetUp() override {
+    path = "ceph_test_bluefs_bench.tmp.block." + stringify(getpid());
+    int fd = ::open(path.c_str(), O_CREAT|O_RDWR|O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(0, ::ftruncate(fd, bdev_size));
+    ::close(fd);
+    string mode(GetParam());
+    g_ceph_context->_conf.set_val("bluefs_compact_log_sync",
+      mode == "sync" ? "true" : "false");
+    g_ceph_context->_conf.set_val("bluefs_compact_log_mirror",
+      mode == "mirror" ? "true" : "false");
+    g_ceph_context->_conf.apply_changes(nullptr);
+  }
+  void TearDown() override {
+    ::unlink(path.c_str());
+  }
+
+  static void report(const char* what, vector<ceph::timespan>& lat) {
+    if (lat.empty()) {
+      cout << "  " << what << ": no samples" << std::endl;
+      return;
+    }
+    std::sort(lat.begin(), lat.end());
+    auto pct = [&](double p) {
+      size_t i = std::min(lat.size() - 1, size_t(p * lat.size()));
+      return std::chrono::duration_cast<std::chrono::microseconds>(lat[i]).count();
+    };
+    cout << "  " << what << ": " << lat.size() << " syncs"
+	 << ", p50 " << pct(0.5) << "us"
+	 << ", p99 " << pct(0.99) << "us"
+	 << ", p99.9 " << pct(0.999) << "us"
+	 << ", max " << pct(1.0) << "us" << std::endl;
+  }
+};
+
+TEST_P(BlueFSCompactionBench, wal_fsync_latency) {
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, path, false));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+  BlueRocksEnv env(&fs);
+  ASSERT_TRUE(env.CreateDirIfMissing("db.wal").ok());
+  ASSERT_TRUE(env.CreateDirIfMissing("db").ok());
+
+  std::atomic_bool stop{false};
+  std::atomic<unsigned> compacting{0};
+  vector<ceph::timespan> lat_idle, lat_compacting;
+
+  std::thread wal([&] {
+    string data(wal_block, 'w');
+    unsigned n = 0;
+    while (!stop) {
+      string fname = "db.wal/" + stringify(++n) + ".log";
+      std::unique_ptr<rocksdb::WritableFile> f;
+      ASSERT_TRUE(env.NewWritableFile(fname, &f, rocksdb::EnvOptions()).ok());
+      for (uint64_t pos = 0; pos < wal_roll_size && !stop; pos += wal_block) {
+	ASSERT_TRUE(f->Append(rocksdb::Slice(data)).ok());
+	bool c = compacting > 0;
+	auto t0 = ceph::mono_clock::now();
+	ASSERT_TRUE(f->Sync().ok());
+	auto lat = ceph::mono_clock::now() - t0;
+	if (c || compacting > 0) {
+	  lat_compacting.push_back(lat);
+	} else {
+	  lat_idle.push_back(lat);
+	}
+      }
+      f->Close();
+      env.DeleteFile(fname);
+    }
+  });
+  // grow the log with lots of small metadata updates
+  std::thread churn([&] {
+    string data(512, 'c');
+    for (unsigned n = 0; !stop; ++n) {
+      string fname = "db/" + stringify(n % 1000) + ".sst";
+      std::unique_ptr<rocksdb::WritableFile> f;
+      ASSERT_TRUE(env.NewWritableFile(fname, &f, rocksdb::EnvOptions()).ok());
+      ASSERT_TRUE(f->Append(rocksdb::Slice(data)).ok());
+      ASSERT_TRUE(f->Sync().ok());
+      f->Close();
+      if (n % 2) {
+	env.DeleteFile(fname);
+      }
+    }
+  });
+  std::thread compactor([&] {
+    while (!stop) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      ++compacting;
+      fs.compact_log();
+      --compacting;
+    }
+  });
+
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  stop = true;
+  wal.join();
+  churn.join();
+  compactor.join();
+
+  auto logger = fs.get_perf_counters();
+  cout << GetParam() << " compaction: "
+       << logger->get(l_bluefs_log_compactions) << " compactions, "
+       << logger->get(l_bluefs_compaction_aborts) << " aborted, "
+       << byte_u_t(logger->get(l_bluefs_compaction_mirror_bytes))
+       << " mirrored" << std::endl;
+  report("idle", lat_idle);
+  report("compacting", lat_compacting);
+  fs.umount();
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  BlueFS,
+  BlueFSCompactionBench,
+  ::testing::Values("mirror", "jump", "sync"));
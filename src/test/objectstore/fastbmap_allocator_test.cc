@@ -1143,3 +1143,31 @@ TEST(TestAllocatorLevel01, test_claim_free_l2)
   ASSERT_EQ(0x15000,
     al2.debug_get_free());
 }
+
+TEST(TestAllocatorLevel01, test_bitmap_scan_impls)
+{
+  std::vector<uint64_t> words(37, all_slot_set);
+  for (auto impl : { "scalar", "neon", "avx2", "avx512" }) {
+    if (!bitmap_scan_set_impl(impl)) {
+      continue;
+    }
+    std::cout << "checking " << impl << std::endl;
+    for (auto pattern : { all_slot_set, all_slot_clear }) {
+      std::fill(words.begin(), words.end(), pattern);
+      for (size_t pos = 0; pos <= words.size(); ++pos) {
+	ASSERT_EQ(words.size(),
+	  bitmap_scan_skip(words.data(), pos, words.size(), pattern));
+      }
+      for (size_t diff = 0; diff < words.size(); ++diff) {
+	words[diff] = pattern ^ 0x100;
+	for (size_t pos = 0; pos <= words.size(); ++pos) {
+	  size_t end = words.size() - (pos % 3);
+	  size_t expected = bitmap_scan_skip_scalar(words.data(), pos, end,
+	    pattern);
+	  ASSERT_EQ(expected, bitmap_scan_skip(words.data(), pos, end, pattern));
+	}
+	words[diff] = pattern;
+      }
+    }
+  }
+}
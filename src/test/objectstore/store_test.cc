@@ -17,6 +17,7 @@
 #include <string.h>
 #include <iostream>
 #include <memory>
+#include <thread>
 #include <time.h>
 #include <sys/mount.h>
 #include <boost/random/mersenne_twister.hpp>
@@ -7567,6 +7568,192 @@ TEST_P(StoreTestSpecificAUSize, OnodeSizeTracking) {
   }
 }
 
+TEST_P(StoreTestSpecificAUSize, OnodeCacheSharedLookup) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf(), "bluestore_onode_cache_type", "lru_shared");
+  // keep the onode cache small so that lookups race with trimming
+  SetVal(g_conf(), "bluestore_cache_autotune", "false");
+  SetVal(g_conf(), "bluestore_cache_size", "8388608");
+  SetVal(g_conf(), "bluestore_cache_meta_ratio", "0.01");
+  StartDeferred(4096);
+
+  int r;
+  coll_t cid;
+  const size_t num_objects = 256;
+  const PerfCounters* logger = store->get_perf_counters();
+
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto make_oid = [](size_t i) {
+    return ghobject_t(hobject_t(sobject_t("Object " + stringify(i), CEPH_NOSNAP)));
+  };
+  for (size_t i = 0; i < num_objects; ++i) {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(4096, 'a' + i % 26));
+    t.write(cid, make_oid(i), 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  uint64_t hits = logger->get(l_bluestore_onode_hits);
+  std::atomic<bool> stop = false;
+  std::vector<std::thread> readers;
+  for (size_t n = 0; n < 4; ++n) {
+    readers.emplace_back([&, n] {
+      while (!stop) {
+	for (size_t i = n; i < num_objects; i += 4) {
+	  bufferlist bl;
+	  int r = store->read(ch, make_oid(i), 0, 4096, bl);
+	  // renamed objects may be briefly absent
+	  if (r >= 0) {
+	    EXPECT_EQ(bl.length(), 4096u);
+	    EXPECT_EQ(bl[0], char('a' + i % 26));
+	  } else {
+	    EXPECT_EQ(r, -ENOENT);
+	  }
+	}
+      }
+    });
+  }
+  // mutate the onode map underneath the readers
+  for (size_t i = 0; i < num_objects; i += 8) {
+    ghobject_t tmp(hobject_t(sobject_t("Temp " + stringify(i), CEPH_NOSNAP)));
+    ObjectStore::Transaction t;
+    t.collection_move_rename(cid, make_oid(i), cid, tmp);
+    t.collection_move_rename(cid, tmp, cid, make_oid(i));
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  stop = true;
+  for (auto& th : readers) {
+    th.join();
+  }
+  ASSERT_GT(logger->get(l_bluestore_onode_hits), hits);
+
+  for (size_t i = 0; i < num_objects; ++i) {
+    bufferlist bl;
+    r = store->read(ch, make_oid(i), 0, 4096, bl);
+    ASSERT_EQ(r, 4096);
+    ASSERT_EQ(bl[0], char('a' + i % 26));
+  }
+  {
+    ObjectStore::Transaction t;
+    for (size_t i = 0; i < num_objects; ++i) {
+      t.remove(cid, make_oid(i));
+    }
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, AllocationJournal) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf(), "bluestore_allocation_journal", "true");
+  // checkpoints are triggered by the test
+  SetVal(g_conf(), "bluestore_allocation_journal_checkpoint_records", "1000000");
+  SetVal(g_conf(), "bluestore_debug_inject_allocation_from_file_failure", "0");
+  StartDeferred(4096);
+
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+  int r;
+  coll_t cid;
+  const size_t num_objects = 300;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  auto make_oid = [](size_t i) {
+    return ghobject_t(hobject_t(sobject_t("Object " + stringify(i), CEPH_NOSNAP)));
+  };
+  auto do_writes = [&](size_t from, size_t to) {
+    for (size_t i = from; i < to; ++i) {
+      ObjectStore::Transaction t;
+      bufferlist bl;
+      bl.append(std::string(4096 * (1 + i % 4), 'a' + i % 26));
+      t.write(cid, make_oid(i), 0, bl.length(), bl);
+      if (i % 3 == 2) {
+	t.remove(cid, make_oid(i - 1));
+      }
+      r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  };
+  // umount as a crash would leave the store, then check that fsck agrees
+  // with the replayed allocations and that statfs is restored
+  auto crash_and_remount = [&]() {
+    store_statfs_t statfs0, statfs;
+    ASSERT_EQ(store->statfs(&statfs0), 0);
+    ch.reset();
+    bstore->inject_unclean_umount();
+    store->umount();
+    ASSERT_EQ(store->fsck(false), 0);
+    ASSERT_EQ(store->mount(), 0);
+    ch = store->open_collection(cid);
+    ASSERT_EQ(store->statfs(&statfs), 0);
+    statfs0.available = statfs.available;
+    statfs0.internal_metadata = statfs.internal_metadata;
+    ASSERT_EQ(statfs0, statfs);
+  };
+
+  // records on top of the allocation file written at mount
+  ASSERT_NO_FATAL_FAILURE(do_writes(0, num_objects));
+  ASSERT_NO_FATAL_FAILURE(crash_and_remount());
+
+  // records folded by a checkpoint, plus more records on top of it
+  ASSERT_NO_FATAL_FAILURE(do_writes(num_objects, 2 * num_objects));
+  ASSERT_EQ(bstore->debug_alloc_journal_checkpoint(), 0);
+  ASSERT_NO_FATAL_FAILURE(do_writes(2 * num_objects, 3 * num_objects));
+  ASSERT_NO_FATAL_FAILURE(crash_and_remount());
+
+  // a checkpoint right before the crash
+  ASSERT_NO_FATAL_FAILURE(do_writes(3 * num_objects, 4 * num_objects));
+  ASSERT_EQ(bstore->debug_alloc_journal_checkpoint(), 0);
+  ASSERT_NO_FATAL_FAILURE(crash_and_remount());
+
+  // a clean umount still stores the allocation file
+  {
+    store_statfs_t statfs0, statfs;
+    ASSERT_EQ(store->statfs(&statfs0), 0);
+    ch.reset();
+    store->umount();
+    ASSERT_EQ(store->fsck(false), 0);
+    ASSERT_EQ(store->mount(), 0);
+    ch = store->open_collection(cid);
+    ASSERT_EQ(store->statfs(&statfs), 0);
+    statfs0.available = statfs.available;
+    statfs0.internal_metadata = statfs.internal_metadata;
+    ASSERT_EQ(statfs0, statfs);
+  }
+
+  {
+    ObjectStore::Transaction t;
+    for (size_t i = 0; i < 4 * num_objects; ++i) {
+      if (i % 3 != 1) {
+	t.remove(cid, make_oid(i));
+      }
+    }
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTestSpecificAUSize, BlobReuseOnOverwrite) {
 
   if (string(GetParam()) != "bluestore")
@@ -8831,6 +9018,258 @@ TEST_P(StoreTestSpecificAUSize, DeferredDifferentChunks) {
   }
 }
 
+TEST_P(StoreTestSpecificAUSize, DeferredBatchCoalescing) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  size_t alloc_size = 65536;
+  size_t block_size = 4096;
+  // keep deferred ops pending until we submit them explicitly
+  SetVal(g_conf(), "bluestore_deferred_batch_ops", "1000");
+  SetVal(g_conf(), "bluestore_max_defer_interval", "0");
+  SetVal(g_conf(), "bluestore_prefer_deferred_size", "16384");
+  StartDeferred(alloc_size);
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t("test", "", CEPH_NOSNAP, 0, -1, ""));
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+  const PerfCounters* logger = store->get_perf_counters();
+  ObjectStore::CollectionHandle ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    bufferlist bl;
+    bl.append(std::string(alloc_size, 'a'));
+    t.write(cid, hoid, 0, bl.length(), bl, CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  bstore->deferred_try_submit();
+  auto submitted = logger->get(l_bluestore_submitted_deferred_writes);
+  auto batches = logger->get(l_bluestore_submitted_deferred_batches);
+  auto extents = logger->get(l_bluestore_deferred_batch_extents);
+  auto ios = logger->get(l_bluestore_deferred_batch_ios);
+
+  // four adjacent blocks in separate transactions plus a distant one,
+  // all overwrite the same allocation unit so they go deferred
+  for (auto off : {0, 1, 2, 3, 8}) {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(block_size, 'b'));
+    t.write(cid, hoid, off * block_size, bl.length(), bl,
+	    CEPH_OSD_OP_FLAG_FADVISE_NOCACHE);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(submitted, logger->get(l_bluestore_submitted_deferred_writes));
+
+  bstore->deferred_try_submit();
+  ASSERT_EQ(batches + 1, logger->get(l_bluestore_submitted_deferred_batches));
+  ASSERT_EQ(extents + 5, logger->get(l_bluestore_deferred_batch_extents));
+  ASSERT_EQ(ios + 2, logger->get(l_bluestore_deferred_batch_ios));
+  ASSERT_EQ(submitted + 2, logger->get(l_bluestore_submitted_deferred_writes));
+
+  ch.reset(nullptr);
+  CloseAndReopen();
+  ch = store->open_collection(cid);
+  {
+    bufferlist bl, expected;
+    expected.append(std::string(block_size * 4, 'b'));
+    expected.append(std::string(block_size * 4, 'a'));
+    expected.append(std::string(block_size, 'b'));
+    expected.append(std::string(alloc_size - block_size * 9, 'a'));
+    r = store->read(ch, hoid, 0, alloc_size, bl);
+    ASSERT_EQ(r, (int)alloc_size);
+    ASSERT_TRUE(bl_eq(expected, bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, ExtentMapShardPrefetch) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  size_t block_size = 4096;
+  // tiny shards so that every read spans a few of them
+  SetVal(g_conf(), "bluestore_extent_map_shard_max_size", "200");
+  SetVal(g_conf(), "bluestore_extent_map_shard_target_size", "100");
+  SetVal(g_conf(), "bluestore_extent_map_prefetch_shards", "4");
+  StartDeferred(block_size);
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t("test", "", CEPH_NOSNAP, 0, -1, ""));
+  ObjectStore::CollectionHandle ch = store->create_new_collection(cid);
+  const size_t extents = 256;
+  bufferlist expected;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // every other block, so that the extents can't be merged
+  for (size_t i = 0; i < extents; ++i) {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(block_size, 'a' + i % 26));
+    t.write(cid, hoid, i * 2 * block_size, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    expected.append(bl);
+    if (i + 1 < extents) {
+      expected.append_zero(block_size);
+    }
+  }
+
+  ch.reset(nullptr);
+  CloseAndReopen();
+  ch = store->open_collection(cid);
+  const PerfCounters* logger = store->get_perf_counters();
+  auto prefetch = logger->get(l_bluestore_onode_shard_prefetch);
+  auto hits = logger->get(l_bluestore_onode_shard_prefetch_hits);
+  auto wasted = logger->get(l_bluestore_onode_shard_prefetch_wasted);
+  {
+    bufferlist got;
+    const size_t chunk = 16 * block_size;
+    for (size_t off = 0; off < expected.length(); off += chunk) {
+      bufferlist bl;
+      r = store->read(ch, hoid, off, chunk, bl);
+      ASSERT_GT(r, 0);
+      got.claim_append(bl);
+    }
+    ASSERT_TRUE(bl_eq(expected, got));
+  }
+  ASSERT_GT(logger->get(l_bluestore_onode_shard_prefetch), prefetch);
+  ASSERT_GT(logger->get(l_bluestore_onode_shard_prefetch_hits), hits);
+  ASSERT_EQ(logger->get(l_bluestore_onode_shard_prefetch_wasted), wasted);
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTestSpecificAUSize, LargeReadBypassCache) {
+
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  // a small data cache, which the scan below is well over
+  SetVal(g_conf(), "bluestore_cache_autotune", "false");
+  SetVal(g_conf(), "bluestore_cache_size", "33554432");
+  SetVal(g_conf(), "bluestore_cache_meta_ratio", "0.1");
+  SetVal(g_conf(), "bluestore_cache_kv_ratio", "0.1");
+  SetVal(g_conf(), "bluestore_default_buffered_read", "true");
+  StartDeferred(4096);
+
+  int r;
+  coll_t cid;
+  const size_t num_hot = 64;
+  const size_t hot_size = 65536;
+  const size_t scan_chunk = 4 << 20;
+  const size_t scan_size = 64 << 20;
+  ghobject_t scan_oid(hobject_t(sobject_t("Scan", CEPH_NOSNAP)));
+  auto make_oid = [](size_t i) {
+    return ghobject_t(hobject_t(sobject_t("Hot " + stringify(i), CEPH_NOSNAP)));
+  };
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  for (size_t i = 0; i < num_hot; ++i) {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(hot_size, 'a' + i % 26));
+    t.write(cid, make_oid(i), 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  for (size_t off = 0; off < scan_size; off += scan_chunk) {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(scan_chunk, 'A' + off / scan_chunk % 26));
+    t.write(cid, scan_oid, off, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  const PerfCounters* logger = store->get_perf_counters();
+  auto read_hot = [&]() {
+    for (size_t i = 0; i < num_hot; ++i) {
+      bufferlist bl;
+      int r = store->read(ch, make_oid(i), 0, hot_size, bl);
+      ASSERT_EQ(r, (int)hot_size);
+      ASSERT_EQ(bl[0], char('a' + i % 26));
+    }
+  };
+  // warm up the hot set, scan the large object and measure how much of
+  // the hot set is still served by the cache
+  auto run = [&](const char* bypass, double* hit_rate) {
+    SetVal(g_conf(), "bluestore_read_bypass_cache_size", bypass);
+    g_conf().apply_changes(nullptr);
+    ch.reset();
+    CloseAndReopen();
+    ch = store->open_collection(cid);
+    read_hot();
+    store->refresh_perf_counters();
+    auto buffer_bytes = logger->get(l_bluestore_buffer_bytes);
+    auto bypassed = logger->get(l_bluestore_read_bypass_cache_bytes);
+    for (size_t off = 0; off < scan_size; off += scan_chunk) {
+      bufferlist bl;
+      int r = store->read(ch, scan_oid, off, scan_chunk, bl);
+      ASSERT_EQ(r, (int)scan_chunk);
+      ASSERT_EQ(bl[0], char('A' + off / scan_chunk % 26));
+    }
+    // let the cache trim
+    sleep(1);
+    store->refresh_perf_counters();
+    if (string(bypass) != "0") {
+      ASSERT_EQ(logger->get(l_bluestore_read_bypass_cache_bytes),
+		bypassed + scan_size);
+      ASSERT_LE(logger->get(l_bluestore_buffer_bytes), buffer_bytes);
+    }
+    auto hit = logger->get(l_bluestore_buffer_hit_bytes);
+    auto miss = logger->get(l_bluestore_buffer_miss_bytes);
+    read_hot();
+    hit = logger->get(l_bluestore_buffer_hit_bytes) - hit;
+    miss = logger->get(l_bluestore_buffer_miss_bytes) - miss;
+    *hit_rate = (double)hit / (hit + miss);
+    cout << "bypass " << bypass << ": hot set hit rate after scan "
+	 << *hit_rate << " (" << hit << " hit, " << miss << " missed bytes)"
+	 << std::endl;
+  };
+  double cached_rate, bypassed_rate;
+  run("0", &cached_rate);
+  run("1048576", &bypassed_rate);
+  ASSERT_EQ(bypassed_rate, 1.0);
+  ASSERT_GT(bypassed_rate, cached_rate);
+  {
+    ObjectStore::Transaction t;
+    for (size_t i = 0; i < num_hot; ++i) {
+      t.remove(cid, make_oid(i));
+    }
+    t.remove(cid, scan_oid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTestSpecificAUSize, BlobReuseOnOverwriteReverse) {
 
   if (string(GetParam()) != "bluestore")
@@ -9500,6 +9939,108 @@ TEST_P(StoreTestSpecificAUSize, garbageCollection) {
   }
 }
 
+TEST_P(StoreTestSpecificAUSize, CompressedBlobBackgroundGC) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  size_t blob_size = 128 * 1024;
+  StartDeferred(4096);
+  SetVal(g_conf(), "bluestore_compression_mode", "force");
+  SetVal(g_conf(), "bluestore_compression_min_blob_size", stringify(blob_size).c_str());
+  SetVal(g_conf(), "bluestore_max_blob_size", stringify(blob_size).c_str());
+  // keep inline GC out of the way
+  SetVal(g_conf(), "bluestore_gc_enable_blob_threshold", "1000");
+  SetVal(g_conf(), "bluestore_gc_enable_total_threshold", "1000");
+  SetVal(g_conf(), "bluestore_compressed_gc_max_bytes_per_sec", "0");
+  g_conf().apply_changes(nullptr);
+
+  int r;
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // compresses to about a half: random first half of each 4K, zeros after
+  std::string data(blob_size, 0);
+  uint32_t seed = 1;
+  for (size_t i = 0; i < blob_size; i += 4096) {
+    for (size_t j = 0; j < 2048; j++) {
+      seed = seed * 1103515245 + 12345;
+      data[i + j] = seed >> 24;
+    }
+  }
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(data);
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // leave a quarter of the blob referenced
+  size_t overwrite = blob_size * 3 / 4;
+  {
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append_zero(overwrite);
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  struct store_statfs_t before;
+  ASSERT_EQ(store->statfs(&before), 0);
+  {
+    BlueStore::compressed_gc_stats_t stats;
+    bstore->compressed_gc(false, &stats);
+    ASSERT_GE(stats.objects, 1u);
+    ASSERT_EQ(stats.candidates, 1u);
+    ASSERT_EQ(stats.referenced, blob_size - overwrite);
+    ASSERT_GT(stats.reclaimable, 0u);
+    ASSERT_EQ(stats.rewritten, 0u);
+  }
+  {
+    BlueStore::compressed_gc_stats_t stats;
+    bstore->compressed_gc(true, &stats);
+    ASSERT_EQ(stats.candidates, 1u);
+    ASSERT_EQ(stats.rewritten, blob_size - overwrite);
+  }
+  struct store_statfs_t after;
+  ASSERT_EQ(store->statfs(&after), 0);
+  ASSERT_EQ(after.data_stored, before.data_stored);
+  ASSERT_LT(after.data_compressed_allocated, before.data_compressed_allocated);
+  {
+    BlueStore::compressed_gc_stats_t stats;
+    bstore->compressed_gc(false, &stats);
+    ASSERT_EQ(stats.candidates, 0u);
+  }
+
+  ch.reset();
+  CloseAndReopen();
+  ch = store->open_collection(cid);
+  {
+    bufferlist bl, expected;
+    expected.append_zero(overwrite);
+    expected.append(data.substr(overwrite));
+    r = store->read(ch, hoid, 0, blob_size, bl);
+    ASSERT_EQ(r, (int)blob_size);
+    ASSERT_TRUE(bl_eq(expected, bl));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 TEST_P(StoreTestSpecificAUSize, fsckOnUnalignedDevice) {
   if (string(GetParam()) != "bluestore")
     return;
@@ -9741,6 +10282,77 @@ TEST_P(StoreTestSpecificAUSize, BluestoreRepairTest) {
   cerr << "Completing" << std::endl;
 }
 
+TEST_P(StoreTestSpecificAUSize, BluestoreParallelFsckTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+  SetVal(g_conf(), "bluestore_fsck_on_mount", "false");
+  SetVal(g_conf(), "bluestore_fsck_on_umount", "false");
+  SetVal(g_conf(), "bluestore_max_blob_size", "65536");
+  SetVal(g_conf(), "bluestore_extent_map_shard_max_size", "12000");
+
+  StartDeferred(0x10000);
+
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+
+  // several pools and PGs so that the keyspaces get split
+  bufferlist bl;
+  bl.append(std::string(0x8000, 'a'));
+  for (int64_t pool = 1; pool <= 3; ++pool) {
+    for (uint32_t ps = 0; ps < 4; ++ps) {
+      coll_t cid(spg_t(pg_t(ps, pool), shard_id_t::NO_SHARD));
+      auto ch = store->create_new_collection(cid);
+      ObjectStore::Transaction t;
+      t.create_collection(cid, 2);
+      for (int i = 0; i < 16; ++i) {
+	ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(i),
+					    CEPH_NOSNAP),
+				  "", ps | (i << 2), pool, ""));
+	for (uint64_t off = 0; off < 0x40000; off += 0x10000) {
+	  t.write(cid, hoid, off, bl.length(), bl);
+	}
+	map<string, bufferlist> km;
+	km["key" + stringify(i)] = bl;
+	t.omap_setkeys(cid, hoid, km);
+	if (i % 4 == 0) {
+	  ghobject_t clone = hoid;
+	  clone.hobj.snap = 1;
+	  t.clone(cid, hoid, clone);
+	}
+      }
+      int r = queue_transaction(store, ch, std::move(t));
+      ASSERT_EQ(r, 0);
+    }
+  }
+  bstore->umount();
+
+  ASSERT_EQ(bstore->fsck(false), 0);
+  ASSERT_EQ(bstore->fsck(true), 0);
+  SetVal(g_conf(), "bluestore_fsck_threads", "4");
+  ASSERT_EQ(bstore->fsck(false), 0);
+  ASSERT_EQ(bstore->fsck(true), 0);
+  ASSERT_FALSE(bstore->get_fsck_phase_timings().empty());
+
+  // errors are found the same way regardless of the amount of threads
+  bstore->mount();
+  bool leaked_injected = false;
+  if (!bstore->has_null_manager()) {
+    bstore->inject_leaked(0x30000);
+    leaked_injected = true;
+  }
+  bstore->inject_broken_shared_blob_key("undec1", bufferlist());
+  bstore->inject_broken_shared_blob_key("undecodable key 2", bufferlist());
+  bstore->umount();
+  int expected = leaked_injected ? 3 : 2;
+  ASSERT_EQ(bstore->fsck(false), expected);
+  SetVal(g_conf(), "bluestore_fsck_threads", "1");
+  ASSERT_EQ(bstore->fsck(false), expected);
+  SetVal(g_conf(), "bluestore_fsck_threads", "4");
+  ASSERT_EQ(bstore->repair(false), 0);
+  ASSERT_EQ(bstore->fsck(false), 0);
+  SetVal(g_conf(), "bluestore_fsck_threads", "1");
+  ASSERT_EQ(bstore->fsck(true), 0);
+}
+
 TEST_P(StoreTestSpecificAUSize, BluestoreBrokenZombieRepairTest) {
   if (string(GetParam()) != "bluestore")
     return;
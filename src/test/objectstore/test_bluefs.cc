@@ -1419,6 +1419,63 @@ TEST(BlueFS, test_concurrent_dir_link_and_compact_log_56210) {
   }
 }
 
+TEST(BlueFS, test_compaction_mirror_concurrent_writes) {
+  uint64_t size = 1048576 * 128;
+  TempBdev bdev{size};
+  ConfSaver conf(g_ceph_context->_conf);
+  conf.SetVal("bluefs_alloc_size", "65536");
+  conf.SetVal("bluefs_compact_log_sync", "false");
+  conf.SetVal("bluefs_compact_log_mirror", "true");
+  // short runway so that the log expands while being compacted
+  conf.SetVal("bluefs_min_log_runway", "65536");
+  conf.SetVal("bluefs_max_log_runway", "131072");
+  conf.ApplyChanges();
+
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, bdev.path, false));
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid, { BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mount());
+  ASSERT_EQ(0, fs.maybe_verify_layout({ BlueFS::BDEV_DB, false, false }));
+  ASSERT_EQ(0, fs.mkdir("dir"));
+
+  const unsigned num_files = 2000;
+  std::atomic<unsigned> written{0};
+  std::thread writer([&] {
+    std::string data(4096, 'x');
+    for (unsigned i = 0; i < num_files; ++i) {
+      BlueFS::FileWriter *h;
+      ASSERT_EQ(0, fs.open_for_write("dir", "file." + stringify(i), &h, false));
+      h->append(data.c_str(), data.length());
+      ASSERT_EQ(0, fs.fsync(h));
+      fs.close_writer(h);
+      ++written;
+    }
+  });
+  while (written < num_files) {
+    fs.compact_log();
+  }
+  do_join(writer);
+  fs.compact_log();
+  auto logger = fs.get_perf_counters();
+  ASSERT_GT(logger->get(l_bluefs_log_compactions), 0u);
+  ASSERT_EQ(logger->get(l_bluefs_compaction_aborts), 0u);
+
+  fs.umount(true); //do not compact on exit!
+  ASSERT_EQ(0, fs.mount());
+  std::vector<std::string> ls;
+  ASSERT_EQ(0, fs.readdir("dir", &ls));
+  // readdir adds "." and ".."
+  ASSERT_EQ(num_files + 2, ls.size());
+  for (unsigned i = 0; i < num_files; ++i) {
+    uint64_t file_size = 0;
+    utime_t mtime;
+    ASSERT_EQ(0, fs.stat("dir", "file." + stringify(i), &file_size, &mtime));
+    ASSERT_EQ(4096u, file_size);
+  }
+  fs.umount();
+}
+
 TEST(BlueFS, test_log_runway) {
   uint64_t max_log_runway = 65536;
   ConfSaver conf(g_ceph_context->_conf);
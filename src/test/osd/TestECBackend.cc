@@ -16,11 +16,66 @@
 #include <sstream>
 #include <errno.h>
 #include <signal.h>
+#include "erasure-code/ErasureCode.h"
+#include "erasure-code/ErasureCodePlugin.h"
+#include "include/stringify.h"
 #include "osd/ECBackend.h"
+#include "osd/ECTransaction.h"
 #include "gtest/gtest.h"
 
+#include "test/unit.cc"
+
 using namespace std;
 
+struct mydpp : public DoutPrefixProvider {
+  std::ostream& gen_prefix(std::ostream& out) const override { return out << "foo"; }
+  CephContext *get_cct() const override { return g_ceph_context; }
+  unsigned get_subsys() const override { return ceph_subsys_osd; }
+} dpp;
+
+// k=2, m=1 with the coding chunk the xor of the data chunks
+class ErasureCodeXor final : public ceph::ErasureCode {
+public:
+  unsigned int get_chunk_count() const override {
+    return 3;
+  }
+  unsigned int get_data_chunk_count() const override {
+    return 2;
+  }
+  unsigned int get_chunk_size(unsigned int stripe_width) const override {
+    return stripe_width / 2;
+  }
+  uint64_t get_supported_optimizations() const override {
+    return FLAG_EC_PLUGIN_PARTIAL_READ_OPTIMIZATION |
+      FLAG_EC_PLUGIN_PARITY_DELTA_OPTIMIZATION;
+  }
+  int encode_chunks(const set<int> &want_to_encode,
+		    map<int, bufferlist> *encoded) override {
+    const char *a = (*encoded)[0].c_str();
+    const char *b = (*encoded)[1].c_str();
+    char *p = (*encoded)[2].c_str();
+    for (unsigned i = 0; i < (*encoded)[0].length(); ++i) {
+      p[i] = a[i] ^ b[i];
+    }
+    return 0;
+  }
+  int decode_chunks(const set<int> &want_to_read,
+		    const map<int, bufferlist> &chunks,
+		    map<int, bufferlist> *decoded) override {
+    return -EOPNOTSUPP;
+  }
+  void apply_delta(const map<int, bufferptr> &in,
+		   map<int, bufferptr> &out) override {
+    for (auto &&[shard, delta] : in) {
+      for (auto &&[pshard, parity] : out) {
+	for (unsigned i = 0; i < delta.length(); ++i) {
+	  parity.c_str()[i] ^= delta.c_str()[i];
+	}
+      }
+    }
+  }
+};
+
 TEST(ECUtil, stripe_info_t)
 {
   const uint64_t swidth = 4096;
@@ -60,3 +115,827 @@ TEST(ECUtil, stripe_info_t)
             make_pair((uint64_t)0, 2*swidth));
 }
 
+
+TEST(ECUtil, chunk_ranges)
+{
+  const uint64_t csize = 1024;
+  const uint64_t k = 4;
+  const uint64_t swidth = csize * k;
+  ECUtil::stripe_info_t s(k, swidth);
+  ASSERT_EQ(s.get_data_chunk_count(), k);
+
+  // within a single chunk
+  auto ranges = s.offset_len_to_chunk_ranges(make_pair(csize + 10, (uint64_t)20));
+  ASSERT_EQ(ranges.size(), 1u);
+  ASSERT_EQ(ranges[1], make_pair((uint64_t)10, (uint64_t)20));
+
+  // across a stripe boundary
+  ranges = s.offset_len_to_chunk_ranges(make_pair(swidth - 10, (uint64_t)20));
+  ASSERT_EQ(ranges.size(), 2u);
+  ASSERT_EQ(ranges[3], make_pair(csize - 10, (uint64_t)10));
+  ASSERT_EQ(ranges[0], make_pair(csize, (uint64_t)10));
+
+  // whole stripes
+  ranges = s.offset_len_to_chunk_ranges(make_pair(swidth, 2 * swidth));
+  ASSERT_EQ(ranges.size(), k);
+  for (auto &&[i, r] : ranges) {
+    ASSERT_EQ(r, make_pair(csize, 2 * csize));
+  }
+
+  // gather the logical range back from the chunks
+  bufferlist logical;
+  for (uint64_t i = 0; i < 2 * swidth; ++i) {
+    logical.append((char)(i % 251));
+  }
+  uint64_t off = csize / 2;
+  uint64_t len = swidth + csize;
+  map<int, pair<uint64_t, bufferlist>> chunks;
+  for (auto &&[i, r] : s.offset_len_to_chunk_ranges(make_pair(off, len))) {
+    auto &c = chunks[i];
+    c.first = r.first;
+    for (uint64_t o = r.first; o < r.first + r.second; ++o) {
+      uint64_t l = (o / csize) * swidth + i * csize + o % csize;
+      c.second.append(logical[l]);
+    }
+  }
+  bufferlist out;
+  ECUtil::gather_range(s, off, len, chunks, &out);
+  bufferlist expected;
+  expected.substr_of(logical, off, len);
+  ASSERT_TRUE(out.contents_equal(expected));
+
+  // stops where the chunks end
+  chunks.erase(2);
+  out.clear();
+  ECUtil::gather_range(s, off, len, chunks, &out);
+  ASSERT_EQ(out.length(), 2 * csize - off);
+}
+
+TEST(ECUtil, gather_partial_read)
+{
+  const uint64_t csize = 1024;
+  const uint64_t k = 2;
+  const uint64_t swidth = csize * k;
+  ECUtil::stripe_info_t s(k, swidth);
+  ceph::ErasureCodeInterfaceRef ec_impl(new ErasureCodeXor);
+
+  bufferlist logical;
+  for (uint64_t i = 0; i < 2 * swidth; ++i) {
+    logical.append((char)(i % 251));
+  }
+  // the shards hold the chunk ranges read, in pieces
+  map<int, extent_map> shards;
+  for (uint64_t c = 0; c < k; ++c) {
+    for (uint64_t o = 0; o < 2 * csize; o += csize / 2) {
+      bufferlist bl;
+      for (uint64_t j = o; j < o + csize / 2; ++j) {
+	bl.append(logical[(j / csize) * swidth + c * csize + j % csize]);
+      }
+      shards[c].insert(o, bl.length(), bl);
+    }
+  }
+  map<int, const extent_map*> by_shard;
+  for (auto &&[shard, em] : shards) {
+    by_shard[shard] = &em;
+  }
+
+  for (auto &&[off, len] : {make_pair<uint64_t, uint64_t>(0, 2 * swidth),
+			    make_pair<uint64_t, uint64_t>(10, 20),
+			    make_pair<uint64_t, uint64_t>(csize - 10, 20),
+			    make_pair<uint64_t, uint64_t>(swidth - 1, csize + 2)}) {
+    bufferlist out;
+    ECCommon::gather_partial_read(s, ec_impl, by_shard, off, len, &out);
+    bufferlist expected;
+    expected.substr_of(logical, off, len);
+    ASSERT_TRUE(out.contents_equal(expected)) << off << "~" << len;
+  }
+
+  // the object ends where the second chunk of the second stripe wasn't read
+  shards[1].erase(csize, csize);
+  bufferlist out;
+  ECCommon::gather_partial_read(s, ec_impl, by_shard, 0, 2 * swidth, &out);
+  ASSERT_EQ(out.length(), swidth + csize);
+
+  // a shard which wasn't read at all
+  by_shard.erase(0);
+  out.clear();
+  ECCommon::gather_partial_read(s, ec_impl, by_shard, 0, swidth, &out);
+  ASSERT_EQ(out.length(), 0u);
+}
+
+TEST(ECTransaction, get_delta_write)
+{
+  const uint64_t csize = 2 * CEPH_PAGE_SIZE;
+  const uint64_t swidth = 2 * csize;
+  const uint64_t size = 4 * swidth;
+  ECUtil::stripe_info_t s(2, swidth);
+  auto delta_write = [&](uint64_t off, uint64_t len, uint64_t size,
+			 ECTransaction::DeltaWrite *dw) {
+    extent_set raw;
+    if (len) {
+      raw.insert(off, len);
+    }
+    return ECTransaction::get_delta_write(s, raw, size, dw);
+  };
+
+  // rounded to pages of the chunk
+  {
+    ECTransaction::DeltaWrite dw;
+    ASSERT_TRUE(delta_write(csize + CEPH_PAGE_SIZE + 10, 100, size, &dw));
+    ASSERT_EQ(dw.data.size(), 1u);
+    extent_set expected;
+    expected.insert(CEPH_PAGE_SIZE, CEPH_PAGE_SIZE);
+    ASSERT_EQ(dw.data[1], expected);
+    ASSERT_EQ(dw.parity, expected);
+  }
+  // in the second stripe, across a page boundary
+  {
+    ECTransaction::DeltaWrite dw;
+    ASSERT_TRUE(delta_write(swidth + CEPH_PAGE_SIZE - 10, 20, size, &dw));
+    ASSERT_EQ(dw.data.size(), 1u);
+    extent_set expected;
+    expected.insert(csize, csize);
+    ASSERT_EQ(dw.data[0], expected);
+    ASSERT_EQ(dw.parity, expected);
+  }
+  // whole chunks if they aren't made of pages
+  {
+    const uint64_t odd_csize = 1536;
+    ECUtil::stripe_info_t odd(2, 2 * odd_csize);
+    extent_set raw;
+    raw.insert(odd_csize + 100, 10);
+    ECTransaction::DeltaWrite dw;
+    ASSERT_TRUE(ECTransaction::get_delta_write(odd, raw, 4 * odd_csize, &dw));
+    extent_set expected;
+    expected.insert(0, odd_csize);
+    ASSERT_EQ(dw.data[1], expected);
+    ASSERT_EQ(dw.parity, expected);
+  }
+  // every data chunk is written
+  {
+    ECTransaction::DeltaWrite dw;
+    ASSERT_FALSE(delta_write(csize - 10, 20, size, &dw));
+  }
+  // across stripes
+  {
+    ECTransaction::DeltaWrite dw;
+    ASSERT_FALSE(delta_write(2 * swidth - 10, 20, size, &dw));
+  }
+  // beyond the end of the object
+  {
+    ECTransaction::DeltaWrite dw;
+    ASSERT_FALSE(delta_write(size - 10, 20, size + swidth, &dw));
+    ASSERT_FALSE(delta_write(size - 10, 20, size - 5, &dw));
+  }
+  // nothing written
+  {
+    ECTransaction::DeltaWrite dw;
+    ASSERT_FALSE(delta_write(0, 0, size, &dw));
+  }
+}
+
+namespace {
+
+struct RollbackVisitor : public ObjectModDesc::Visitor {
+  vector<pair<uint64_t, uint64_t>> extents;
+  void rollback_extents(
+    version_t gen,
+    const vector<pair<uint64_t, uint64_t>> &e) override {
+    extents.insert(extents.end(), e.begin(), e.end());
+  }
+};
+
+// the writes to the object itself, by offset
+map<uint64_t, bufferlist> get_writes(ObjectStore::Transaction &t)
+{
+  map<uint64_t, bufferlist> writes;
+  for (auto i = t.begin(); i.have_op(); ) {
+    auto op = i.decode_op();
+    switch (op->op) {
+    case ObjectStore::Transaction::OP_WRITE: {
+      bufferlist bl;
+      i.decode_bl(bl);
+      if (i.get_oid(op->oid).generation == ghobject_t::NO_GEN) {
+	writes[op->off] = bl;
+      }
+      break;
+    }
+    case ObjectStore::Transaction::OP_SETATTR:
+      i.decode_string();
+      {
+	bufferlist bl;
+	i.decode_bl(bl);
+      }
+      break;
+    case ObjectStore::Transaction::OP_TOUCH:
+    case ObjectStore::Transaction::OP_CLONERANGE2:
+      break;
+    default:
+      ADD_FAILURE() << "unexpected op " << op->op;
+    }
+  }
+  return writes;
+}
+
+bufferlist make_chunk(uint64_t len, char seed)
+{
+  bufferlist bl;
+  for (uint64_t i = 0; i < len; ++i) {
+    bl.append((char)(seed + i * 7));
+  }
+  return bl;
+}
+
+// overwrite 100 bytes of the second data chunk of a two stripe object
+// with parity deltas, with the shards in @shards, of which those in
+// @read_shards had their old content read
+void delta_write_object(
+  const set<int> &shards,
+  map<shard_id_t, ObjectStore::Transaction> *transactions,
+  pg_log_entry_t *entry,
+  bufferlist *old_chunks,
+  bufferlist *written,
+  const set<int> &read_shards = {0, 1, 2})
+{
+  const uint64_t csize = CEPH_PAGE_SIZE;
+  const uint64_t swidth = 2 * csize;
+  ECUtil::stripe_info_t sinfo(2, swidth);
+  ceph::ErasureCodeInterfaceRef ec_impl(new ErasureCodeXor);
+
+  hobject_t h(object_t("foo"), "", CEPH_NOSNAP, 0, 1, "");
+  ECUtil::HashInfoRef hinfo(new ECUtil::HashInfo(3));
+  hinfo->set_total_chunk_size_clear_hash(2 * csize);
+  hinfo->set_projected_total_logical_size(sinfo, 2 * swidth);
+
+  PGTransactionUPtr t(new PGTransaction);
+  t->obc_map[h] = std::make_shared<ObjectContext>();
+  *written = make_chunk(100, 'x');
+  bufferlist bl = *written;
+  t->write(h, csize + 10, bl.length(), bl, 0);
+
+  auto plan = ECTransaction::get_write_plan(
+    sinfo,
+    *t,
+    [&](const hobject_t &i) { return hinfo; },
+    &dpp,
+    true);
+  ASSERT_EQ(plan.delta_writes.count(h), 1u);
+  ASSERT_EQ(plan.to_read.count(h), 0u);
+  // the rmw plan is kept to fall back to
+  extent_set stripe;
+  stripe.insert(0, swidth);
+  ASSERT_EQ(plan.delta_writes[h].rmw_to_read, stripe);
+  ASSERT_EQ(plan.delta_writes[h].rmw_will_write, stripe);
+
+  // the first stripe as the shards hold it
+  map<int, extent_map> old_extents;
+  old_chunks[0] = make_chunk(csize, 'a');
+  old_chunks[1] = make_chunk(csize, 'b');
+  old_chunks[2].append_zero(csize);
+  for (uint64_t i = 0; i < csize; ++i) {
+    old_chunks[2].c_str()[i] = old_chunks[0][i] ^ old_chunks[1][i];
+  }
+  for (auto &&i : read_shards) {
+    old_extents[i].insert(0, csize, old_chunks[i]);
+  }
+  map<hobject_t, map<int, extent_map>> delta_extents;
+  delta_extents[h] = old_extents;
+
+  for (auto &&shard : shards) {
+    (*transactions)[shard_id_t(shard)];
+  }
+  vector<pg_log_entry_t> entries;
+  entries.push_back(
+    pg_log_entry_t(pg_log_entry_t::MODIFY, h, eversion_t(1, 2),
+		   eversion_t(1, 1), 2, osd_reqid_t(), utime_t(), 0));
+  map<hobject_t, extent_map> written_map;
+  set<hobject_t> temp_added, temp_removed;
+  ECTransaction::generate_transactions(
+    t.get(),
+    plan,
+    ec_impl,
+    pg_t(0, 1),
+    sinfo,
+    map<hobject_t, extent_map>(),
+    delta_extents,
+    entries,
+    &written_map,
+    transactions,
+    &temp_added,
+    &temp_removed,
+    &dpp);
+  *entry = entries.front();
+  ASSERT_EQ(written_map[h].get_interval_set(), plan.will_write[h]);
+}
+
+} // anonymous namespace
+
+TEST(ECTransaction, delta_and_write)
+{
+  const uint64_t csize = CEPH_PAGE_SIZE;
+  map<shard_id_t, ObjectStore::Transaction> transactions;
+  pg_log_entry_t entry;
+  bufferlist old_chunks[3];
+  bufferlist written;
+  ASSERT_NO_FATAL_FAILURE(
+    delta_write_object({0, 1, 2}, &transactions, &entry, old_chunks,
+		       &written));
+
+  // the parity range can be rolled back
+  RollbackVisitor visitor;
+  entry.mod_desc.visit(&visitor);
+  ASSERT_EQ(visitor.extents,
+	    (vector<pair<uint64_t, uint64_t>>{{0, csize}}));
+
+  // the untouched data chunk isn't written
+  ASSERT_TRUE(get_writes(transactions[shard_id_t(0)]).empty());
+
+  // the page of the written chunk and the parity, which is the xor of
+  // the new data chunks
+  auto data = get_writes(transactions[shard_id_t(1)]);
+  ASSERT_EQ(data.size(), 1u);
+  ASSERT_EQ(data.begin()->first, 0u);
+  bufferlist expected;
+  expected.substr_of(old_chunks[1], 0, 10);
+  expected.append(written);
+  bufferlist tail;
+  tail.substr_of(old_chunks[1], 110, csize - 110);
+  expected.append(tail);
+  ASSERT_TRUE(data.begin()->second.contents_equal(expected));
+
+  auto parity = get_writes(transactions[shard_id_t(2)]);
+  ASSERT_EQ(parity.size(), 1u);
+  ASSERT_EQ(parity.begin()->first, 0u);
+  ASSERT_EQ(parity.begin()->second.length(), csize);
+  for (uint64_t i = 0; i < csize; ++i) {
+    ASSERT_EQ(parity.begin()->second[i],
+	      (char)(old_chunks[0][i] ^ expected[i])) << i;
+  }
+}
+
+TEST(ECTransaction, delta_and_write_missing_parity)
+{
+  // the parity shard isn't written, e.g. because it is down, the data
+  // still is
+  map<shard_id_t, ObjectStore::Transaction> transactions;
+  pg_log_entry_t entry;
+  bufferlist old_chunks[3];
+  bufferlist written;
+  ASSERT_NO_FATAL_FAILURE(
+    delta_write_object({0, 1}, &transactions, &entry, old_chunks, &written));
+  ASSERT_EQ(transactions.count(shard_id_t(2)), 0u);
+  ASSERT_TRUE(get_writes(transactions[shard_id_t(0)]).empty());
+  auto data = get_writes(transactions[shard_id_t(1)]);
+  ASSERT_EQ(data.size(), 1u);
+  bufferlist got;
+  got.substr_of(data.begin()->second, 10, written.length());
+  ASSERT_TRUE(got.contents_equal(written));
+}
+
+TEST(ECTransaction, delta_and_write_backfill_parity)
+{
+  // the parity shard is a backfill target which doesn't have the object
+  // yet: it wasn't read and its transaction won't be sent
+  map<shard_id_t, ObjectStore::Transaction> transactions;
+  pg_log_entry_t entry;
+  bufferlist old_chunks[3];
+  bufferlist written;
+  ASSERT_NO_FATAL_FAILURE(
+    delta_write_object({0, 1, 2}, &transactions, &entry, old_chunks, &written,
+		       {0, 1}));
+  ASSERT_TRUE(get_writes(transactions[shard_id_t(0)]).empty());
+  ASSERT_TRUE(get_writes(transactions[shard_id_t(2)]).empty());
+  auto data = get_writes(transactions[shard_id_t(1)]);
+  ASSERT_EQ(data.size(), 1u);
+  bufferlist got;
+  got.substr_of(data.begin()->second, 10, written.length());
+  ASSERT_TRUE(got.contents_equal(written));
+}
+
+namespace {
+
+// just enough of a PG for the ops to go through the state and read stages,
+// and for the read pipeline to pick the shards to read
+struct PipelineListener : public ECListener {
+  OSDMapRef osdmap = std::make_shared<OSDMap>();
+  pg_pool_t pool;
+  set<pg_shard_t> acting_recovery_backfill;
+  /// backfill targets which don't have the objects yet
+  set<shard_id_t> backfill_behind;
+  set<pg_shard_t> acting, backfill;
+  map<hobject_t, set<pg_shard_t>> missing_loc;
+  map<pg_shard_t, pg_missing_t> shard_missing;
+  pg_missing_t no_missing;
+
+  PipelineListener() {
+    pool.type = pg_pool_t::TYPE_ERASURE;
+    pool.set_flag(pg_pool_t::FLAG_EC_OVERWRITES);
+  }
+
+  const OSDMapRef& pgb_get_osdmap() const override { return osdmap; }
+  epoch_t pgb_get_osdmap_epoch() const override { return 1; }
+  const pg_info_t &get_info() const override { ceph_abort(); }
+  void cancel_pull(const hobject_t &soid) override { ceph_abort(); }
+  pg_shard_t primary_shard() const override { ceph_abort(); }
+  bool pgb_is_primary() const override { return true; }
+  void on_failed_pull(const set<pg_shard_t> &from, const hobject_t &soid,
+		      const eversion_t &v) override { ceph_abort(); }
+  void on_local_recover(const hobject_t &oid,
+			const ObjectRecoveryInfo &recovery_info,
+			ObjectContextRef obc, bool is_delete,
+			ObjectStore::Transaction *t) override { ceph_abort(); }
+  void on_global_recover(const hobject_t &oid,
+			 const object_stat_sum_t &stat_diff,
+			 bool is_delete) override { ceph_abort(); }
+  void on_peer_recover(pg_shard_t peer, const hobject_t &oid,
+		       const ObjectRecoveryInfo &recovery_info) override {
+    ceph_abort();
+  }
+  void begin_peer_recover(pg_shard_t peer, const hobject_t oid) override {
+    ceph_abort();
+  }
+  bool pg_is_repair() const override { return false; }
+  ObjectContextRef get_obc(
+    const hobject_t &hoid,
+    const map<string, bufferlist, less<>> &attrs) override { ceph_abort(); }
+  bool check_failsafe_full() override { return false; }
+  hobject_t get_temp_recovery_object(const hobject_t &target,
+				     eversion_t version) override {
+    ceph_abort();
+  }
+  bool pg_is_remote_backfilling() override { return false; }
+  void pg_add_local_num_bytes(int64_t num_bytes) override {}
+  void pg_add_num_bytes(int64_t num_bytes) override {}
+  void inc_osd_stat_repaired() override {}
+  void add_temp_obj(const hobject_t &oid) override {}
+  void clear_temp_obj(const hobject_t &oid) override {}
+  epoch_t get_last_peering_reset_epoch() const override { return 1; }
+  GenContext<ThreadPool::TPHandle&> *bless_unlocked_gencontext(
+    GenContext<ThreadPool::TPHandle&> *c) override { ceph_abort(); }
+  void schedule_recovery_work(GenContext<ThreadPool::TPHandle&> *c,
+			      uint64_t cost) override { ceph_abort(); }
+  epoch_t get_interval_start_epoch() const override { return 1; }
+  const set<pg_shard_t> &get_acting_shards() const override { return acting; }
+  const set<pg_shard_t> &get_backfill_shards() const override {
+    return backfill;
+  }
+  const map<hobject_t, set<pg_shard_t>> &get_missing_loc_shards()
+    const override { return missing_loc; }
+  const map<pg_shard_t, pg_missing_t> &get_shard_missing() const override {
+    return shard_missing;
+  }
+  const pg_missing_const_i &get_shard_missing(pg_shard_t peer)
+    const override {
+    auto m = maybe_get_shard_missing(peer);
+    return m ? *m : no_missing;
+  }
+  const pg_missing_const_i *maybe_get_shard_missing(pg_shard_t peer)
+    const override {
+    auto p = shard_missing.find(peer);
+    return p == shard_missing.end() ? nullptr : &p->second;
+  }
+  const pg_info_t &get_shard_info(pg_shard_t peer) const override {
+    ceph_abort();
+  }
+  ceph_tid_t get_tid() override { ceph_abort(); }
+  pg_shard_t whoami_shard() const override { ceph_abort(); }
+  void send_message_osd_cluster(vector<pair<int, Message*>> &messages,
+				epoch_t from_epoch) override { ceph_abort(); }
+  std::ostream& gen_dbg_prefix(std::ostream& out) const override {
+    return out << "pipeline ";
+  }
+  const pg_pool_t &get_pool() const override { return pool; }
+  const set<pg_shard_t> &get_acting_recovery_backfill_shards()
+    const override { return acting_recovery_backfill; }
+  bool should_send_op(pg_shard_t peer, const hobject_t &hoid) override {
+    return !backfill_behind.count(peer.shard);
+  }
+  const map<pg_shard_t, pg_info_t> &get_shard_info() const override {
+    ceph_abort();
+  }
+  spg_t primary_spg_t() const override { ceph_abort(); }
+  const PGLog &get_log() const override { ceph_abort(); }
+  DoutPrefixProvider *get_dpp() override { return &dpp; }
+  void apply_stats(const hobject_t &soid,
+		   const object_stat_sum_t &delta_stats) override {
+    ceph_abort();
+  }
+  bool is_missing_object(const hobject_t &oid) const override {
+    return false;
+  }
+  void add_local_next_event(const pg_log_entry_t &e) override { ceph_abort(); }
+  void log_operation(
+    vector<pg_log_entry_t> &&logv,
+    const std::optional<pg_hit_set_history_t> &hset_history,
+    const eversion_t &trim_to,
+    const eversion_t &roll_forward_to,
+    const eversion_t &min_last_complete_ondisk,
+    bool transaction_applied,
+    ObjectStore::Transaction &t,
+    bool async) override { ceph_abort(); }
+  void op_applied(const eversion_t &applied_version) override {
+    ceph_abort();
+  }
+};
+
+// records the objects the rmw ops read, the reads never complete. The
+// last shard read, of parity delta writes, is kept for the test to complete.
+struct PipelineBackend : public ECCommon {
+  vector<hobject_t> reads;
+  GenContextURef<map<hobject_t, map<int, extent_map>> &&> shard_read;
+
+  void handle_sub_write(pg_shard_t from, OpRequestRef msg, ECSubWrite &op,
+			const ZTracer::Trace &trace,
+			ECListener &eclistener) override { ceph_abort(); }
+  void objects_read_and_reconstruct(
+    const map<hobject_t, list<boost::tuple<uint64_t, uint64_t, uint32_t>>>
+      &to_read,
+    bool fast_read,
+    GenContextURef<map<hobject_t, pair<int, extent_map>> &&> &&func) override {
+    for (auto &&[hoid, extents] : to_read) {
+      reads.push_back(hoid);
+    }
+  }
+  void objects_read_shards(
+    const map<hobject_t, map<int, extent_set>> &to_read,
+    GenContextURef<map<hobject_t, map<int, extent_map>> &&> &&func) override {
+    shard_read = std::move(func);
+  }
+};
+
+struct PipelineOp : public ECCommon::RMWPipeline::Op {
+  void generate_transactions(
+    ceph::ErasureCodeInterfaceRef &ecimpl,
+    pg_t pgid,
+    const ECUtil::stripe_info_t &sinfo,
+    map<hobject_t, extent_map> *written,
+    map<shard_id_t, ObjectStore::Transaction> *transactions,
+    DoutPrefixProvider *dpp,
+    const ceph_release_t require_osd_release) override { ceph_abort(); }
+};
+
+} // anonymous namespace
+
+TEST(ECCommon, rmw_pipeline_invalidates_per_object)
+{
+  const uint64_t swidth = 8192;
+  ECUtil::stripe_info_t sinfo(2, swidth);
+  ceph::ErasureCodeInterfaceRef ec_impl(new ErasureCodeXor);
+  PipelineListener listener;
+  PipelineBackend backend;
+  ECCommon::RMWPipeline pipeline(g_ceph_context, ec_impl, sinfo, &listener,
+				 backend);
+
+  auto obj = [](const char *name) {
+    return hobject_t(object_t(name), "", CEPH_NOSNAP, 0, 1, "");
+  };
+  const hobject_t a = obj("a"), a_clone = obj("a_clone");
+  const hobject_t b = obj("b"), c = obj("c");
+  ceph_tid_t tid = 0;
+  auto queue = [&](ECTransaction::WritePlan &&plan) {
+    auto op = std::make_unique<PipelineOp>();
+    op->tid = ++tid;
+    op->version = eversion_t(1, tid);
+    op->hoid = plan.hash_infos.begin()->first;
+    op->plan = std::move(plan);
+    auto ret = op.get();
+    pipeline.waiting_state.push_back(*op);
+    pipeline.tid_to_op_map[op->tid] = std::move(op);
+    return ret;
+  };
+  auto hinfo = [] {
+    return ECUtil::HashInfoRef(new ECUtil::HashInfo(3));
+  };
+  // a partial stripe overwrite of the first stripe
+  auto rmw = [&](const hobject_t &hoid) {
+    ECTransaction::WritePlan plan;
+    plan.to_read[hoid].insert(0, swidth);
+    plan.will_write[hoid].insert(0, swidth);
+    plan.hash_infos[hoid] = hinfo();
+    return queue(std::move(plan));
+  };
+  // stands in for the commit on the shards of the oldest op being read
+  auto commit_front = [&] {
+    auto &op = pipeline.waiting_reads.front();
+    pipeline.waiting_reads.pop_front();
+    pipeline.waiting_commit.push_back(op);
+    ASSERT_TRUE(pipeline.try_finish_rmw());
+  };
+
+  // clone a to a_clone
+  {
+    ECTransaction::WritePlan plan;
+    plan.invalidates_cache = true;
+    plan.hash_infos[a] = hinfo();
+    plan.hash_infos[a_clone] = hinfo();
+    queue(std::move(plan));
+  }
+  ASSERT_TRUE(pipeline.try_state_to_reads());
+  ASSERT_TRUE(pipeline.pipeline_state.cache_invalid(a));
+  ASSERT_TRUE(pipeline.pipeline_state.cache_invalid(a_clone));
+
+  // an rmw of another object goes on, through the cache
+  auto op_b = rmw(b);
+  ASSERT_TRUE(pipeline.try_state_to_reads());
+  ASSERT_TRUE(op_b->using_cache);
+  ASSERT_EQ(backend.reads, vector<hobject_t>{b});
+
+  // an append to the cloned object goes on without the cache
+  {
+    ECTransaction::WritePlan plan;
+    plan.will_write[a].insert(swidth, swidth);
+    plan.hash_infos[a] = hinfo();
+    auto op = queue(std::move(plan));
+    ASSERT_TRUE(pipeline.try_state_to_reads());
+    ASSERT_FALSE(op->using_cache);
+  }
+
+  // an rmw of the cloned object waits for the clone and the append
+  auto op_a = rmw(a);
+  ASSERT_FALSE(pipeline.try_state_to_reads());
+  // and, as the ops leave the state stage in order, so does every later
+  // op, whatever object it writes
+  auto op_c = rmw(c);
+  ASSERT_FALSE(pipeline.try_state_to_reads());
+  ASSERT_EQ(&pipeline.waiting_state.front(), op_a);
+
+  // the clone is done, the append still bypasses the cache
+  ASSERT_NO_FATAL_FAILURE(commit_front());
+  ASSERT_FALSE(pipeline.pipeline_state.cache_invalid(a_clone));
+  ASSERT_TRUE(pipeline.pipeline_state.cache_invalid(a));
+  ASSERT_FALSE(pipeline.try_state_to_reads());
+
+  // the rmw of b is done, and then the append
+  ASSERT_NO_FATAL_FAILURE(commit_front());
+  ASSERT_FALSE(pipeline.try_state_to_reads());
+  ASSERT_NO_FATAL_FAILURE(commit_front());
+  ASSERT_TRUE(pipeline.pipeline_state.empty());
+
+  // both rmw ops go on now, through the cache
+  ASSERT_TRUE(pipeline.try_state_to_reads());
+  ASSERT_TRUE(pipeline.try_state_to_reads());
+  ASSERT_TRUE(pipeline.waiting_state.empty());
+  ASSERT_TRUE(op_a->using_cache);
+  ASSERT_TRUE(op_c->using_cache);
+  ASSERT_EQ(backend.reads, (vector<hobject_t>{b, a, c}));
+
+  pipeline.on_change();
+}
+
+TEST(ECCommon, rmw_pipeline_delta_backfill_parity)
+{
+  const uint64_t csize = CEPH_PAGE_SIZE;
+  const uint64_t swidth = 2 * csize;
+  ECUtil::stripe_info_t sinfo(2, swidth);
+  ceph::ErasureCodeInterfaceRef ec_impl(new ErasureCodeXor);
+  PipelineListener listener;
+  PipelineBackend backend;
+  ECCommon::RMWPipeline pipeline(g_ceph_context, ec_impl, sinfo, &listener,
+				 backend);
+  for (int i = 0; i < 3; ++i) {
+    listener.acting_recovery_backfill.insert(pg_shard_t(i, shard_id_t(i)));
+  }
+
+  auto obj = [](const char *name) {
+    return hobject_t(object_t(name), "", CEPH_NOSNAP, 0, 1, "");
+  };
+  ceph_tid_t tid = 0;
+  auto queue = [&](ECTransaction::WritePlan &&plan) {
+    auto op = std::make_unique<PipelineOp>();
+    op->tid = ++tid;
+    op->version = eversion_t(1, tid);
+    op->hoid = plan.hash_infos.begin()->first;
+    op->plan = std::move(plan);
+    auto ret = op.get();
+    pipeline.waiting_state.push_back(*op);
+    pipeline.tid_to_op_map[op->tid] = std::move(op);
+    return ret;
+  };
+  extent_set stripe;
+  stripe.insert(0, swidth);
+  // 100 bytes into the second data chunk, on shard 1, shard 2 is parity
+  auto delta = [&](const hobject_t &hoid) {
+    ECTransaction::WritePlan plan;
+    auto &dw = plan.delta_writes[hoid];
+    dw.data[1].insert(0, csize);
+    dw.parity.insert(0, csize);
+    dw.rmw_to_read = stripe;
+    dw.rmw_will_write = stripe;
+    plan.will_write[hoid].insert(csize + 10, 100);
+    plan.hash_infos[hoid] = ECUtil::HashInfoRef(new ECUtil::HashInfo(3));
+    return queue(std::move(plan));
+  };
+  // the reads are served by the acting shards, the backfill target has none
+  auto complete_shard_read = [&](const hobject_t &hoid) {
+    ASSERT_TRUE(backend.shard_read != nullptr);
+    map<hobject_t, map<int, extent_map>> results;
+    bufferlist bl;
+    bl.append_zero(csize);
+    results[hoid][1].insert(0, csize, bl);
+    backend.shard_read.release()->complete(std::move(results));
+  };
+
+  // an rmw in front, whose read never completes, holds the delta writes
+  // in the read stage
+  const hobject_t a = obj("a"), b = obj("b"), c = obj("c");
+  {
+    ECTransaction::WritePlan plan;
+    plan.to_read[a] = stripe;
+    plan.will_write[a] = stripe;
+    plan.hash_infos[a] = ECUtil::HashInfoRef(new ECUtil::HashInfo(3));
+    queue(std::move(plan));
+  }
+  ASSERT_TRUE(pipeline.try_state_to_reads());
+
+  // b is past the last_backfill of the parity shard, which doesn't get
+  // the op: the delta goes on without it
+  listener.backfill_behind.insert(shard_id_t(2));
+  auto op_b = delta(b);
+  ASSERT_TRUE(pipeline.try_state_to_reads());
+  ASSERT_TRUE(op_b->delta_read_pending);
+  ASSERT_NO_FATAL_FAILURE(complete_shard_read(b));
+  ASSERT_FALSE(op_b->read_in_progress());
+  ASSERT_TRUE(op_b->is_delta());
+  ASSERT_EQ(op_b->delta_read_result[b].count(1), 1u);
+  ASSERT_EQ(op_b->delta_read_result[b].count(2), 0u);
+
+  // the parity shard has c already, and has to be written, but isn't read
+  // as it isn't acting: c is written with a stripe rmw
+  listener.backfill_behind.clear();
+  auto op_c = delta(c);
+  ASSERT_TRUE(pipeline.try_state_to_reads());
+  ASSERT_NO_FATAL_FAILURE(complete_shard_read(c));
+  ASSERT_FALSE(op_c->is_delta());
+  ASSERT_EQ(op_c->plan.to_read[c], stripe);
+  ASSERT_EQ(op_c->plan.will_write[c], stripe);
+  ASSERT_TRUE(op_c->read_in_progress());
+  ASSERT_EQ(backend.reads, (vector<hobject_t>{a, c}));
+
+  pipeline.on_change();
+}
+
+// CLAY repairs a shard from sub-chunks of d helpers, which only decode
+// together: a helper error restarts the read from whole chunks
+TEST(ECCommon, read_pipeline_clay_recovery)
+{
+  const int k = 4, m = 2, d = 5;
+  ceph::ErasureCodeProfile profile;
+  profile["k"] = stringify(k);
+  profile["m"] = stringify(m);
+  profile["d"] = stringify(d);
+  ceph::ErasureCodeInterfaceRef ec_impl;
+  ASSERT_EQ(0, ceph::ErasureCodePluginRegistry::instance().factory(
+	      "clay", g_conf().get_val<std::string>("erasure_code_dir"),
+	      profile, &ec_impl, &cerr));
+  const int sub_chunks = ec_impl->get_sub_chunk_count();
+  ASSERT_GT(sub_chunks, 1);
+  const vector<pair<int, int>> whole_chunk{make_pair(0, sub_chunks)};
+  ECUtil::stripe_info_t sinfo(k, k * ec_impl->get_chunk_size(1));
+  PipelineListener listener;
+  ECCommon::ReadPipeline pipeline(g_ceph_context, ec_impl, sinfo, &listener);
+
+  const hobject_t hoid(object_t("obj"), "", CEPH_NOSNAP, 0, 1, "");
+  for (int i = 0; i < k + m; ++i) {
+    listener.acting.insert(pg_shard_t(i, shard_id_t(i)));
+  }
+  // shard 0 is recovered
+  listener.shard_missing[pg_shard_t(0, shard_id_t(0))].add(
+    hoid, eversion_t(1, 1), eversion_t(), false);
+
+  map<pg_shard_t, vector<pair<int, int>>> to_read;
+  ASSERT_EQ(0, pipeline.get_min_avail_to_read_shards(
+	      hoid, {0}, true, false, &to_read));
+  ASSERT_EQ(to_read.size(), (size_t)d);
+  map<int, vector<pair<int, int>>> repair;
+  for (auto &&[shard, subchunks] : to_read) {
+    int count = 0;
+    for (auto &&[first, len] : subchunks) {
+      count += len;
+    }
+    ASSERT_EQ(count, sub_chunks / (d - k + 1)) << shard;
+    repair[shard.shard] = subchunks;
+  }
+  const ECCommon::read_request_t req({}, to_read, false);
+  ASSERT_TRUE(pipeline.read_subchunks_match(req, repair));
+
+  // shard 5 fails, the sub-chunks of the 4 others aren't enough to repair
+  // shard 0, nor are they whole chunks
+  ECCommon::read_result_t result;
+  result.errors[pg_shard_t(5, shard_id_t(5))] = -EIO;
+  const set<int> answered{1, 2, 3, 4};
+  map<int, vector<pair<int, int>>> minimum;
+  ASSERT_EQ(0, ec_impl->minimum_to_decode({0}, answered, &minimum));
+  ASSERT_FALSE(pipeline.read_subchunks_match(req, minimum));
+
+  // the shards that answered are read again, in full
+  map<pg_shard_t, vector<pair<int, int>>> remaining;
+  ASSERT_EQ(0, pipeline.get_remaining_shards(
+	      hoid, answered, {0}, result, &remaining, true));
+  ASSERT_EQ(remaining.size(), answered.size());
+  for (auto &&[shard, subchunks] : remaining) {
+    ASSERT_TRUE(answered.count(shard.shard)) << shard;
+    ASSERT_EQ(subchunks, whole_chunk) << shard;
+  }
+  ASSERT_TRUE(pipeline.read_subchunks_match(
+		ECCommon::read_request_t({}, remaining, false), minimum));
+}
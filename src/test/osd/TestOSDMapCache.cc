@@ -0,0 +1,210 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include "global/global_context.h"
+#include "osd/OSDMap.h"
+#include "osd/osd_perf_counters.h"
+#include "test/osd/map_cache_osd.h"
+
+using namespace std;
+
+class OSDMapCacheTest : public ::testing::Test {
+protected:
+  static constexpr epoch_t last = 10;
+
+  ceph::async::io_context_pool icp{1};
+  MonClient mc{g_ceph_context, icp};
+  std::unique_ptr<Messenger> ms;
+  std::unique_ptr<MapCacheOSD> osd;
+
+  void SetUp() override {
+    ms.reset(Messenger::create(g_ceph_context,
+			       g_conf().get_val<std::string>("ms_type"),
+			       entity_name_t::OSD(0), "map_cache",
+			       getpid()));
+    osd = std::make_unique<MapCacheOSD>(
+      g_ceph_context, "map_cache_osd." + std::to_string(getpid()),
+      ms.get(), &mc, icp);
+    ASSERT_EQ(0, osd->mount());
+
+    OSDMap m;
+    uuid_d fsid;
+    fsid.generate_random();
+    m.build_simple(g_ceph_context, 0, fsid, 3);
+    for (epoch_t e = 1; e <= last; ++e) {
+      m.set_epoch(e);
+      bufferlist bl;
+      m.encode(bl, CEPH_FEATURES_SUPPORTED_DEFAULT | CEPH_FEATURE_RESERVED);
+      ASSERT_EQ(0, osd->write_map(e, bl));
+    }
+  }
+
+  void TearDown() override {
+    osd->drop_maps(last);
+    osd->umount();
+    osd.reset();
+  }
+
+  uint64_t loads() {
+    return osd->get_counter(l_osd_map_bl_cache_hit) +
+      osd->get_counter(l_osd_map_bl_cache_miss);
+  }
+
+  uint64_t load_waits() {
+    return osd->get_counter(l_osd_map_cache_load_wait);
+  }
+
+  // until n threads wait on map_loaded_cond
+  void wait_for_waiters(uint64_t n) {
+    while (load_waits() < n) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // a waiter counts itself under map_cache_lock and only lets go of
+    // it once waiting
+    std::lock_guard l(osd->get_service().map_cache_lock);
+  }
+};
+
+TEST_F(OSDMapCacheTest, concurrent_try_get_map)
+{
+  constexpr unsigned n = 16;
+  OSDService& service = osd->get_service();
+  const uint64_t loads0 = loads();
+  const uint64_t waits0 = load_waits();
+
+  std::atomic<bool> go{false};
+  vector<OSDMapRef> maps(n);
+  vector<std::thread> threads;
+  for (unsigned i = 0; i < n; ++i) {
+    threads.emplace_back([&, i] {
+      while (!go) {
+	std::this_thread::yield();
+      }
+      maps[i] = service.try_get_map(5);
+    });
+  }
+  go = true;
+  for (auto& t : threads) {
+    t.join();
+  }
+  // read and decoded once, whoever got there first
+  ASSERT_EQ(1u, loads() - loads0);
+  ASSERT_LE(load_waits() - waits0, n - 1);
+  for (auto& m : maps) {
+    ASSERT_TRUE(m);
+    ASSERT_EQ(maps[0].get(), m.get());
+    ASSERT_EQ(5u, m->get_epoch());
+  }
+}
+
+TEST_F(OSDMapCacheTest, waiters_woken_by_loader)
+{
+  constexpr unsigned n = 8;
+  OSDService& service = osd->get_service();
+  const uint64_t loads0 = loads();
+  const uint64_t waits0 = load_waits();
+
+  // stand for a thread in the middle of loading epoch 5
+  {
+    std::lock_guard l(service.map_cache_lock);
+    service.map_loading.insert(5);
+  }
+  vector<OSDMapRef> maps(n);
+  vector<std::thread> threads;
+  for (unsigned i = 0; i < n; ++i) {
+    threads.emplace_back([&, i] {
+      maps[i] = service.try_get_map(5);
+    });
+  }
+  wait_for_waiters(waits0 + n);
+
+  OSDMapRef loaded;
+  {
+    bufferlist bl;
+    ASSERT_TRUE(service.get_map_bl(5, bl));
+    auto m = new OSDMap;
+    m->decode(bl);
+    std::lock_guard l(service.map_cache_lock);
+    loaded = service._add_map(m);
+    service.map_loading.erase(5);
+    service.map_loaded_cond.notify_all();
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  // only the read above, none of the waiters loaded it again
+  ASSERT_EQ(1u, loads() - loads0);
+  ASSERT_EQ(n, load_waits() - waits0);
+  for (auto& m : maps) {
+    ASSERT_EQ(loaded.get(), m.get());
+  }
+}
+
+TEST_F(OSDMapCacheTest, waiters_load_after_failed_load)
+{
+  constexpr unsigned n = 8;
+  OSDService& service = osd->get_service();
+  const uint64_t loads0 = loads();
+  const uint64_t waits0 = load_waits();
+
+  {
+    std::lock_guard l(service.map_cache_lock);
+    service.map_loading.insert(5);
+  }
+  vector<OSDMapRef> maps(n);
+  vector<std::thread> threads;
+  for (unsigned i = 0; i < n; ++i) {
+    threads.emplace_back([&, i] {
+      maps[i] = service.try_get_map(5);
+    });
+  }
+  wait_for_waiters(waits0 + n);
+
+  // the load failed: one of the waiters takes over, the others wait
+  // for it in turn
+  {
+    std::lock_guard l(service.map_cache_lock);
+    service.map_loading.erase(5);
+    service.map_loaded_cond.notify_all();
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  ASSERT_EQ(1u, loads() - loads0);
+  for (auto& m : maps) {
+    ASSERT_TRUE(m);
+    ASSERT_EQ(maps[0].get(), m.get());
+  }
+}
+
+TEST_F(OSDMapCacheTest, pinned_maps_outlive_lru)
+{
+  OSDService& service = osd->get_service();
+  g_conf().set_val("osd_peering_map_pin_max", "100");
+  service.map_cache.set_size(2);
+  service.pin_peering_maps(1, last);
+
+  const uint64_t loads0 = loads();
+  for (epoch_t e = 2; e <= last; ++e) {
+    ASSERT_TRUE(service.try_get_map(e));
+  }
+  ASSERT_EQ(last - 1, loads() - loads0);
+  ASSERT_EQ(last - 1, osd->get_counter(l_osd_map_cache_pinned));
+  // out of the lru, but still pinned
+  for (epoch_t e = 2; e <= last; ++e) {
+    ASSERT_TRUE(service.try_get_map(e));
+  }
+  ASSERT_EQ(last - 1, loads() - loads0);
+
+  // every pg advanced past them
+  service.pin_peering_maps(last, last);
+  ASSERT_EQ(0u, osd->get_counter(l_osd_map_cache_pinned));
+  ASSERT_TRUE(service.try_get_map(2));
+  ASSERT_EQ(last, loads() - loads0);
+  g_conf().rm_val("osd_peering_map_pin_max");
+}
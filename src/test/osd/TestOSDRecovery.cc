@@ -0,0 +1,340 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include "messages/MOSDPGPush.h"
+#include "osd/OSD.h"
+#include "osd/ReplicatedBackend.h"
+#include "osd/osd_perf_counters.h"
+#include "include/stringify.h"
+#include "../objectstore/store_test_fixture.h"
+
+using namespace std;
+
+TEST(OSDService, recovery_batch_objects)
+{
+  const uint64_t budget = 1 << 20;
+  const uint64_t max_objects = 32;
+
+  // objects as large as the budget or larger are recovered one by one
+  ASSERT_EQ(1u, OSDService::get_recovery_batch_objects(
+	      budget, budget, max_objects));
+  ASSERT_EQ(1u, OSDService::get_recovery_batch_objects(
+	      4 * budget, budget, max_objects));
+  ASSERT_EQ(1u, OSDService::get_recovery_batch_objects(
+	      budget - 1, budget, max_objects));
+
+  // as many objects as fit in the budget
+  ASSERT_EQ(2u, OSDService::get_recovery_batch_objects(
+	      budget / 2, budget, max_objects));
+  ASSERT_EQ(16u, OSDService::get_recovery_batch_objects(
+	      64 << 10, budget, max_objects));
+  ASSERT_EQ(12u, OSDService::get_recovery_batch_objects(
+	      80 << 10, budget, max_objects));
+
+  // up to the maximum
+  ASSERT_EQ(max_objects, OSDService::get_recovery_batch_objects(
+	      4 << 10, budget, max_objects));
+  ASSERT_EQ(max_objects, OSDService::get_recovery_batch_objects(
+	      0, budget, max_objects));
+
+  // disabled
+  ASSERT_EQ(1u, OSDService::get_recovery_batch_objects(4 << 10, 0, 32));
+  ASSERT_EQ(1u, OSDService::get_recovery_batch_objects(4 << 10, budget, 1));
+  ASSERT_EQ(1u, OSDService::get_recovery_batch_objects(4 << 10, budget, 0));
+}
+
+namespace {
+
+// the peer end of the cluster connection, never written to: the listener
+// keeps the messages
+struct NullConnection : public Connection {
+  explicit NullConnection(CephContext *cct) : Connection(cct, nullptr) {}
+  bool is_connected() override { return true; }
+  int send_message(Message *m) override { ceph_abort(); }
+  void send_keepalive() override {}
+  void mark_down() override {}
+  void mark_disposable() override {}
+  entity_addr_t get_peer_socket_addr() const override { return {}; }
+};
+
+// just enough of a primary PG to push objects to a peer missing them
+struct RecoveryListener : public PGBackend::Listener,
+			  public DoutPrefixProvider {
+  const pg_shard_t primary{0, shard_id_t::NO_SHARD};
+  const pg_shard_t peer{1, shard_id_t::NO_SHARD};
+  OSDMapRef osdmap;
+  pg_pool_t pool;
+  pg_info_t info;
+  set<pg_shard_t> acting{primary, peer}, backfill;
+  map<hobject_t, set<pg_shard_t>> missing_loc;
+  pg_missing_tracker_t local_missing;
+  map<pg_shard_t, pg_missing_t> shard_missing;
+  map<pg_shard_t, pg_info_t> shard_info;
+  std::unique_ptr<PerfCounters> logger{build_osd_logger(g_ceph_context)};
+  ConnectionRef con = ceph::make_ref<NullConnection>(g_ceph_context);
+  /// the push messages sent to the peer
+  vector<ceph::ref_t<MOSDPGPush>> pushes;
+  ceph_tid_t tid = 0;
+
+  explicit RecoveryListener(spg_t pgid) {
+    pool.type = pg_pool_t::TYPE_REPLICATED;
+    info.pgid = pgid;
+    info.last_backfill = hobject_t::get_max();
+    shard_info[peer] = info;
+    shard_missing[peer];
+  }
+
+  CephContext *get_cct() const override { return g_ceph_context; }
+  unsigned get_subsys() const override { return ceph_subsys_osd; }
+  std::ostream& gen_prefix(std::ostream& out) const override {
+    return gen_dbg_prefix(out);
+  }
+  DoutPrefixProvider *get_dpp() override { return this; }
+  void on_local_recover(const hobject_t &oid,
+			const ObjectRecoveryInfo &recovery_info,
+			ObjectContextRef obc, bool is_delete,
+			ObjectStore::Transaction *t) override { ceph_abort(); }
+  void on_global_recover(const hobject_t &oid,
+			 const object_stat_sum_t &stat_diff,
+			 bool is_delete) override { ceph_abort(); }
+  void on_peer_recover(pg_shard_t peer, const hobject_t &oid,
+		       const ObjectRecoveryInfo &recovery_info) override {
+    ceph_abort();
+  }
+  void begin_peer_recover(pg_shard_t peer, const hobject_t oid) override {}
+  void apply_stats(const hobject_t &soid,
+		   const object_stat_sum_t &delta_stats) override {
+    ceph_abort();
+  }
+  void on_failed_pull(const set<pg_shard_t> &from, const hobject_t &soid,
+		      const eversion_t &v) override { ceph_abort(); }
+  void cancel_pull(const hobject_t &soid) override { ceph_abort(); }
+  void remove_missing_object(const hobject_t &oid, eversion_t v,
+			     Context *on_complete) override { ceph_abort(); }
+  Context *bless_context(Context *c) override { ceph_abort(); }
+  GenContext<ThreadPool::TPHandle&> *bless_gencontext(
+    GenContext<ThreadPool::TPHandle&> *c) override { ceph_abort(); }
+  GenContext<ThreadPool::TPHandle&> *bless_unlocked_gencontext(
+    GenContext<ThreadPool::TPHandle&> *c) override { ceph_abort(); }
+  void send_message(int to_osd, Message *m) override { ceph_abort(); }
+  void queue_transaction(ObjectStore::Transaction&& t,
+			 OpRequestRef op) override { ceph_abort(); }
+  void queue_transactions(vector<ObjectStore::Transaction>& tls,
+			  OpRequestRef op) override { ceph_abort(); }
+  epoch_t get_interval_start_epoch() const override { return 1; }
+  epoch_t get_last_peering_reset_epoch() const override { return 1; }
+  const set<pg_shard_t> &get_acting_recovery_backfill_shards()
+    const override { return acting; }
+  const set<pg_shard_t> &get_acting_shards() const override { return acting; }
+  const set<pg_shard_t> &get_backfill_shards() const override {
+    return backfill;
+  }
+  std::ostream& gen_dbg_prefix(std::ostream& out) const override {
+    return out << "recovery ";
+  }
+  const map<hobject_t, set<pg_shard_t>> &get_missing_loc_shards()
+    const override { return missing_loc; }
+  const pg_missing_tracker_t &get_local_missing() const override {
+    return local_missing;
+  }
+  void add_local_next_event(const pg_log_entry_t& e) override { ceph_abort(); }
+  const map<pg_shard_t, pg_missing_t> &get_shard_missing() const override {
+    return shard_missing;
+  }
+  const pg_missing_const_i &get_shard_missing(pg_shard_t peer)
+    const override { return shard_missing.at(peer); }
+  const map<pg_shard_t, pg_info_t> &get_shard_info() const override {
+    return shard_info;
+  }
+  const PGLog &get_log() const override { ceph_abort(); }
+  bool pgb_is_primary() const override { return true; }
+  const OSDMapRef& pgb_get_osdmap() const override { return osdmap; }
+  epoch_t pgb_get_osdmap_epoch() const override { return 1; }
+  const pg_info_t &get_info() const override { return info; }
+  const pg_pool_t &get_pool() const override { return pool; }
+  ObjectContextRef get_obc(
+    const hobject_t &hoid,
+    const map<string, bufferlist, less<>> &attrs) override { ceph_abort(); }
+  bool try_lock_for_read(const hobject_t &hoid,
+			 ObcLockManager &manager) override { return false; }
+  void release_locks(ObcLockManager &manager) override {}
+  void op_applied(const eversion_t &applied_version) override {
+    ceph_abort();
+  }
+  bool should_send_op(pg_shard_t peer, const hobject_t &hoid) override {
+    return true;
+  }
+  bool pg_is_undersized() const override { return false; }
+  bool pg_is_repair() const override { return false; }
+  void log_operation(
+    vector<pg_log_entry_t>&& logv,
+    const std::optional<pg_hit_set_history_t> &hset_history,
+    const eversion_t &trim_to,
+    const eversion_t &roll_forward_to,
+    const eversion_t &min_last_complete_ondisk,
+    bool transaction_applied,
+    ObjectStore::Transaction &t,
+    bool async) override { ceph_abort(); }
+  void pgb_set_object_snap_mapping(
+    const hobject_t &soid, const set<snapid_t> &snaps,
+    ObjectStore::Transaction *t) override { ceph_abort(); }
+  void pgb_clear_object_snap_mapping(
+    const hobject_t &soid, ObjectStore::Transaction *t) override {
+    ceph_abort();
+  }
+  void update_peer_last_complete_ondisk(pg_shard_t fromosd,
+					eversion_t lcod) override {
+    ceph_abort();
+  }
+  void update_last_complete_ondisk(eversion_t lcod) override { ceph_abort(); }
+  void update_stats(const pg_stat_t &stat) override { ceph_abort(); }
+  void schedule_recovery_work(GenContext<ThreadPool::TPHandle&> *c,
+			      uint64_t cost) override { ceph_abort(); }
+  pg_shard_t whoami_shard() const override { return primary; }
+  spg_t primary_spg_t() const override { return info.pgid; }
+  pg_shard_t primary_shard() const override { return primary; }
+  uint64_t min_peer_features() const override { return CEPH_FEATURES_ALL; }
+  uint64_t min_upacting_features() const override {
+    return CEPH_FEATURES_ALL;
+  }
+  hobject_t get_temp_recovery_object(const hobject_t& target,
+				     eversion_t version) override {
+    ceph_abort();
+  }
+  void send_message_osd_cluster(int peer, Message *m,
+				epoch_t from_epoch) override { ceph_abort(); }
+  void send_message_osd_cluster(vector<pair<int, Message*>>& messages,
+				epoch_t from_epoch) override { ceph_abort(); }
+  void send_message_osd_cluster(MessageRef m, Connection *con) override {
+    ceph_abort();
+  }
+  void send_message_osd_cluster(Message *m,
+				const ConnectionRef& con) override {
+    ASSERT_EQ(m->get_type(), MSG_OSD_PG_PUSH);
+    pushes.emplace_back(static_cast<MOSDPGPush*>(m), false);
+  }
+  ConnectionRef get_con_osd_cluster(int peer, epoch_t from_epoch) override {
+    return con;
+  }
+  entity_name_t get_cluster_msgr_name() override {
+    return entity_name_t::OSD(primary.osd);
+  }
+  PerfCounters *get_logger() override { return logger.get(); }
+  ceph_tid_t get_tid() override { return ++tid; }
+  OstreamTemp clog_error() override { ceph_abort(); }
+  OstreamTemp clog_warn() override { ceph_abort(); }
+  bool check_failsafe_full() override { return false; }
+  void inc_osd_stat_repaired() override {}
+  bool pg_is_remote_backfilling() override { return false; }
+  void pg_add_local_num_bytes(int64_t num_bytes) override {}
+  void pg_sub_local_num_bytes(int64_t num_bytes) override {}
+  void pg_add_num_bytes(int64_t num_bytes) override {}
+  void pg_sub_num_bytes(int64_t num_bytes) override {}
+  bool maybe_preempt_replica_scrub(const hobject_t& oid) override {
+    return false;
+  }
+  struct ECListener *get_eclistener() override { return nullptr; }
+};
+
+} // anonymous namespace
+
+// a batch of small objects the peer misses, recovered through one recovery
+// handle as PrimaryLogPG::recover_replicas does
+class ReplicatedBackendRecovery : public StoreTestFixture {
+public:
+  static constexpr unsigned num_objects = 32;
+  static constexpr uint64_t object_size = 4 << 10;
+
+  const spg_t pgid{pg_t(0, 1)};
+  const coll_t cid{pgid};
+  std::unique_ptr<RecoveryListener> listener;
+  std::unique_ptr<ReplicatedBackend> backend;
+  map<hobject_t, ObjectContextRef> objects;
+  vector<std::unique_ptr<SnapSetContext>> snapsets;
+
+  ReplicatedBackendRecovery() : StoreTestFixture("memstore") {}
+
+  void SetUp() override {
+    StoreTestFixture::SetUp();
+    ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    listener = std::make_unique<RecoveryListener>(pgid);
+    for (unsigned i = 0; i < num_objects; ++i) {
+      hobject_t hoid(object_t("obj" + stringify(i)), "", CEPH_NOSNAP, i, 1, "");
+      auto obc = std::make_shared<ObjectContext>();
+      obc->obs.oi = object_info_t(hoid);
+      obc->obs.oi.version = eversion_t(1, i + 1);
+      obc->obs.oi.size = object_size;
+      obc->obs.exists = true;
+      snapsets.emplace_back(std::make_unique<SnapSetContext>(hoid));
+      obc->ssc = snapsets.back().get();
+
+      bufferlist data, oi;
+      data.append(std::string(object_size, 'a' + i % 26));
+      encode(obc->obs.oi, oi, CEPH_FEATURES_ALL);
+      t.write(cid, ghobject_t(hoid), 0, object_size, data);
+      t.setattr(cid, ghobject_t(hoid), OI_ATTR, oi);
+      listener->shard_missing[listener->peer].add(
+	hoid, obc->obs.oi.version, eversion_t(), false);
+      objects[hoid] = obc;
+    }
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+    backend = std::make_unique<ReplicatedBackend>(
+      listener.get(), cid, ch, store.get(), g_ceph_context);
+  }
+
+  void TearDown() override {
+    backend.reset();
+    objects.clear();
+    snapsets.clear();
+    listener.reset();
+    ch.reset();
+    StoreTestFixture::TearDown();
+  }
+
+  /// the objects of each push message sent to the peer
+  vector<size_t> recover() {
+    auto h = backend->open_recovery_op();
+    for (auto &&[hoid, obc] : objects) {
+      EXPECT_EQ(0, backend->recover_object(
+		  hoid, obc->obs.oi.version, ObjectContextRef(), obc, h));
+    }
+    backend->run_recovery_op(h, CEPH_MSG_PRIO_DEFAULT);
+    vector<size_t> objects_per_push;
+    for (auto &&m : listener->pushes) {
+      objects_per_push.push_back(m->pushes.size());
+    }
+    return objects_per_push;
+  }
+};
+
+TEST_F(ReplicatedBackendRecovery, batch)
+{
+  ASSERT_EQ(num_objects, OSDService::get_recovery_batch_objects(
+	      object_size,
+	      g_conf()->osd_recovery_batch_bytes,
+	      g_conf()->osd_recovery_batch_max_objects));
+  ASSERT_GT(num_objects, g_conf()->osd_max_push_objects);
+  // the whole batch goes in one message
+  ASSERT_EQ(recover(), vector<size_t>{num_objects});
+}
+
+TEST_F(ReplicatedBackendRecovery, no_batch)
+{
+  SetVal(g_conf(), "osd_recovery_batch_bytes", "0");
+  SetVal(g_conf(), "osd_max_push_objects", "10");
+  g_conf().apply_changes(nullptr);
+  // messages are split at osd_max_push_objects
+  ASSERT_EQ(recover(), (vector<size_t>{10, 10, 10, 2}));
+}
@@ -27,6 +27,7 @@
 #include "os/ObjectStore.h"
 #include "mon/MonClient.h"
 #include "common/ceph_argparse.h"
+#include "common/stringify.h"
 #include "msg/Messenger.h"
 
 class TestOSDScrub: public OSD {
@@ -199,6 +200,81 @@ TEST(TestOSDScrub, scrub_time_permit) {
   mc.shutdown();
 }
 
+TEST(TestOSDScrub, deep_scrub_throttle) {
+  using namespace std::chrono_literals;
+  constexpr uint64_t bw = 1 << 20;
+  auto& conf = g_ceph_context->_conf;
+  conf.set_val("osd_deep_scrub_bandwidth", "0");
+  conf.set_val("osd_deep_scrub_client_latency_target", "10");
+  conf.apply_changes(nullptr);
+  OsdScrub::DeepScrubThrottle throttle{g_ceph_context, conf, 0};
+  auto now = ceph::coarse_mono_clock::now();
+
+  // no limit
+  throttle.charge(100 * bw, now);
+  ASSERT_EQ(0ms, throttle.read_delay(now));
+  ASSERT_EQ(0u, throttle.get_rate());
+
+  // reads charged before the first read_delay() count, as they do on an
+  // OSD where only replica reads happen
+  conf.set_val("osd_deep_scrub_bandwidth", stringify(bw));
+  conf.apply_changes(nullptr);
+  now += 2s;
+  throttle.charge(bw + bw / 2, now);
+  ASSERT_EQ(bw, throttle.get_rate());
+  ASSERT_EQ(500ms, throttle.read_delay(now));
+
+  // the debt is paid back at the configured rate
+  now += 250ms;
+  ASSERT_EQ(250ms, throttle.read_delay(now));
+  now += 250ms;
+  ASSERT_EQ(0ms, throttle.read_delay(now));
+
+  // idle time refills up to a second worth of reads
+  now += 10s;
+  ASSERT_EQ(0ms, throttle.read_delay(now));
+  throttle.charge(2 * bw, now);
+  ASSERT_EQ(1000ms, throttle.read_delay(now));
+  now += 1s;
+  ASSERT_EQ(0ms, throttle.read_delay(now));
+
+  // client op latency above the target halves the rate, down to 1/16
+  // (latency sums are in ns)
+  uint64_t sum = 0, count = 0;
+  throttle.update_rate({sum, count});
+  ASSERT_EQ(bw, throttle.get_rate());
+  for (uint64_t expected : {bw / 2, bw / 4, bw / 8, bw / 16, bw / 16}) {
+    sum += 100 * 20'000'000;
+    count += 100;
+    throttle.update_rate({sum, count});
+    ASSERT_EQ(expected, throttle.get_rate());
+  }
+  // no new ops, no change
+  throttle.update_rate({sum, count});
+  ASSERT_EQ(bw / 16, throttle.get_rate());
+  // below the target it grows back by 1/10 per call, up to the limit
+  for (int i = 0; i < 9; i++) {
+    sum += 100 * 1'000'000;
+    count += 100;
+    throttle.update_rate({sum, count});
+    ASSERT_EQ(bw / 16 + (i + 1) * (bw / 10), throttle.get_rate());
+  }
+  sum += 100 * 1'000'000;
+  count += 100;
+  throttle.update_rate({sum, count});
+  ASSERT_EQ(bw, throttle.get_rate());
+
+  // lowering the limit takes effect at the next refill
+  conf.set_val("osd_deep_scrub_bandwidth", stringify(bw / 2));
+  conf.apply_changes(nullptr);
+  throttle.charge(0, now);
+  ASSERT_EQ(bw / 2, throttle.get_rate());
+
+  conf.set_val("osd_deep_scrub_bandwidth", "0");
+  conf.set_val("osd_deep_scrub_client_latency_target", "0");
+  conf.apply_changes(nullptr);
+}
+
 // Local Variables:
 // compile-command: "cd ../.. ; make unittest_osdscrub ; ./unittest_osdscrub --log-to-stderr=true  --debug-osd=20 # --gtest_filter=*.* "
 // End:
@@ -2674,6 +2674,177 @@ TEST_F(PGLogMergeDupsTest, Superset) {
 }
 
 
+class PGLogDeferredTrimTest : protected PGLog, public PGLogTestBase,
+			      public StoreTestFixture {
+public:
+  PGLogDeferredTrimTest()
+    : PGLog(g_ceph_context), StoreTestFixture("memstore") {}
+
+  void SetUp() override {
+    StoreTestFixture::SetUp();
+    test_coll = coll_t(spg_t(pg_t(1, 1)));
+    info.pgid = spg_t(pg_t(1, 1));
+    hobject_t hoid;
+    hoid.pool = 1;
+    hoid.oid = "log";
+    log_oid = ghobject_t(hoid);
+    ch = store->create_new_collection(test_coll);
+    ObjectStore::Transaction t;
+    t.create_collection(test_coll, 0);
+    store->queue_transaction(ch, std::move(t));
+  }
+
+  void TearDown() override {
+    clear();
+    StoreTestFixture::TearDown();
+  }
+
+  // append n entries, trim down to keep of them and persist
+  void append_and_trim(unsigned n, unsigned keep) {
+    for (unsigned i = 0; i < n; ++i) {
+      ++last;
+      eversion_t v = mk_evt(1, last);
+      add(mk_ple_mod(mk_obj(last), v, eversion_t(),
+		     osd_reqid_t(entity_name_t::CLIENT(777), 8, last)));
+      info.last_update = info.last_complete = v;
+    }
+    skip_rollforward();
+    if (last > keep) {
+      trim(mk_evt(1, last - keep), info);
+    }
+    ObjectStore::Transaction t;
+    map<string, bufferlist> km;
+    write_log_and_missing(t, &km, test_coll, log_oid, false);
+    if (!km.empty()) {
+      t.omap_setkeys(test_coll, log_oid, km);
+    }
+    for (auto i = t.begin(); i.have_op(); ) {
+      if (i.decode_op()->op == ObjectStore::Transaction::OP_OMAP_RMKEYRANGE) {
+	++range_deletes;
+      }
+    }
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  }
+
+  unsigned count_log_keys() {
+    unsigned n = 0;
+    auto p = store->get_omap_iterator(ch, log_oid);
+    for (p->seek_to_first(); p->valid(); p->next()) {
+      if (p->key().substr(0, 3) != "dup") {
+	++n;
+      }
+    }
+    return n;
+  }
+
+  unsigned count_dup_blocks() {
+    unsigned n = 0;
+    auto p = store->get_omap_iterator(ch, log_oid);
+    for (p->seek_to_first(); p->valid(); p->next()) {
+      if (p->key().substr(0, 5) == "dupb_") {
+	++n;
+      }
+    }
+    return n;
+  }
+
+  // the reloaded log has to match, the dups may carry a few trimmed ones
+  // which are still on disk
+  void verify_reload() {
+    PGLog reloaded(g_ceph_context);
+    ostringstream err;
+    reloaded.read_log_and_missing(store.get(), ch, log_oid, info, err, false);
+    auto& rlog = reloaded.get_log();
+    ASSERT_EQ(log.log.size(), rlog.log.size());
+    auto p = rlog.log.begin();
+    for (auto& e : log.log) {
+      ASSERT_EQ(e.version, p->version);
+      ++p;
+    }
+    ASSERT_LE(log.dups.size(), rlog.dups.size());
+    auto q = rlog.dups.rbegin();
+    for (auto d = log.dups.rbegin(); d != log.dups.rend(); ++d, ++q) {
+      ASSERT_EQ(*d, *q);
+    }
+    reloaded.clear();
+  }
+
+  coll_t test_coll;
+  ghobject_t log_oid;
+  pg_info_t info;
+  unsigned last = 0;
+  unsigned range_deletes = 0;
+};
+
+TEST_F(PGLogDeferredTrimTest, DeferredRemoval) {
+  SetVal(g_conf(), "osd_pg_log_trim_defer_entries", "50");
+  SetVal(g_conf(), "osd_pg_log_dups_per_key", "4");
+  SetVal(g_conf(), "osd_pg_log_dups_tracked", "1000");
+
+  bool saw_deferred = false;
+  for (unsigned i = 0; i < 20; ++i) {
+    append_and_trim(10, 15);
+    unsigned on_disk = count_log_keys();
+    EXPECT_LE(log.log.size(), on_disk);
+    // pending trimmed entries and their dups count against the budget
+    EXPECT_LT(on_disk, log.log.size() + 50);
+    saw_deferred = saw_deferred || on_disk > log.log.size();
+    verify_reload();
+  }
+  EXPECT_TRUE(saw_deferred);
+  EXPECT_EQ(185u, log.dups.size());
+}
+
+TEST_F(PGLogDeferredTrimTest, DupTrim) {
+  SetVal(g_conf(), "osd_pg_log_trim_defer_entries", "20");
+  SetVal(g_conf(), "osd_pg_log_dups_per_key", "3");
+  SetVal(g_conf(), "osd_pg_log_dups_tracked", "30");
+
+  for (unsigned i = 0; i < 30; ++i) {
+    append_and_trim(7, 5);
+    verify_reload();
+  }
+}
+
+TEST_F(PGLogDeferredTrimTest, PerKeyDups) {
+  SetVal(g_conf(), "osd_pg_log_trim_defer_entries", "0");
+  SetVal(g_conf(), "osd_pg_log_dups_per_key", "0");
+  SetVal(g_conf(), "osd_pg_log_dups_tracked", "30");
+
+  for (unsigned i = 0; i < 10; ++i) {
+    append_and_trim(7, 5);
+    EXPECT_EQ(log.log.size(), count_log_keys());
+    verify_reload();
+  }
+  // trimmed keys go one by one, no range deletes
+  EXPECT_EQ(0u, range_deletes);
+  EXPECT_EQ(0u, count_dup_blocks());
+
+  // switching to blocks keeps the per-key dups readable
+  SetVal(g_conf(), "osd_pg_log_dups_per_key", "4");
+  for (unsigned i = 0; i < 10; ++i) {
+    append_and_trim(7, 5);
+    verify_reload();
+  }
+  EXPECT_LT(0u, count_dup_blocks());
+
+  // and switching back still trims the blocks until the log is rewritten
+  SetVal(g_conf(), "osd_pg_log_dups_per_key", "0");
+  for (unsigned i = 0; i < 10; ++i) {
+    append_and_trim(7, 5);
+    EXPECT_EQ(log.log.size(), count_log_keys());
+    verify_reload();
+  }
+  mark_log_for_rewrite();
+  append_and_trim(7, 5);
+  verify_reload();
+  EXPECT_EQ(0u, count_dup_blocks());
+  range_deletes = 0;
+  append_and_trim(7, 5);
+  EXPECT_EQ(0u, range_deletes);
+}
+
+
 struct PGLogTrimTest :
   public ::testing::Test,
   public PGLogTestBase,
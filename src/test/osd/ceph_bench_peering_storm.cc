@@ -0,0 +1,344 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Peering storm benchmark.
+ *
+ * Replays an OSDMap history the way the PGs of an OSD catch up with it
+ * after a large map change: each PG walks the epochs one by one, maps
+ * itself and updates its PastIntervals, as advance_pg does. PGs are spread
+ * over worker threads standing for the OSD shards. The maps are written
+ * to the memstore of an OSD which is never booted, and the workers get
+ * them from its OSDService, in one of two modes:
+ *
+ *   "unpinned"  osd_peering_map_pin_max is 0: only the osd_map_cache_size
+ *               most recent maps stay decoded
+ *   "pinned"    maps stay pinned until every PG has advanced past them,
+ *               up to osd_peering_map_pin_max
+ *
+ * The history is either a list of full map files, in epoch order, e.g.
+ *
+ *   osdmaptool --createsimple 120 --with-default-pool --pg-bits 8 om.0
+ *   for i in $(seq 1 40); do
+ *     cp om.$((i-1)) om.$i
+ *     osdmaptool om.$i --adjust-crush-weight $((i-1)):0 --save
+ *   done
+ *   ceph_bench_peering_storm om.*
+ *
+ * or, without any, one built in process in which the osds of a "rack"
+ * go down one epoch after another and come back.
+ */
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include "common/ceph_argparse.h"
+#include "common/ceph_time.h"
+#include "common/common_init.h"
+#include "common/errno.h"
+#include "global/global_context.h"
+#include "global/global_init.h"
+#include "osd/OSDMap.h"
+#include "osd/osd_perf_counters.h"
+#include "test/osd/map_cache_osd.h"
+
+using namespace std;
+
+namespace {
+
+struct AnyShardPredicate : public IsPGRecoverablePredicate {
+  bool operator()(const set<pg_shard_t> &have) const override {
+    return !have.empty();
+  }
+};
+
+struct PGState {
+  pg_t pgid;
+  epoch_t epoch;
+  vector<int> up, acting;
+  int up_primary = -1, acting_primary = -1;
+  epoch_t same_interval_since;
+  PastIntervals past_intervals;
+};
+
+void build_history(unsigned num_osds, unsigned rack_size,
+		   map<epoch_t, bufferlist>* bls)
+{
+  OSDMap m;
+  uuid_d fsid;
+  fsid.generate_random();
+  m.build_simple_with_pool(g_ceph_context, 0, fsid, num_osds, 8, 8);
+  OSDMap::Incremental inc(m.get_epoch() + 1);
+  inc.fsid = fsid;
+  entity_addrvec_t addrs;
+  addrs.v.push_back(entity_addr_t());
+  for (unsigned i = 0; i < num_osds; ++i) {
+    addrs.v[0].nonce = i;
+    inc.new_state[i] = CEPH_OSD_EXISTS | CEPH_OSD_NEW | CEPH_OSD_UP;
+    inc.new_up_client[i] = addrs;
+    inc.new_up_cluster[i] = addrs;
+    inc.new_hb_back_up[i] = addrs;
+    inc.new_hb_front_up[i] = addrs;
+    inc.new_weight[i] = CEPH_OSD_IN;
+  }
+  m.apply_incremental(inc);
+  auto save = [&] {
+    m.encode((*bls)[m.get_epoch()],
+	     CEPH_FEATURES_SUPPORTED_DEFAULT | CEPH_FEATURE_RESERVED);
+  };
+  save();
+  // the rack goes down, gets marked out, and comes back
+  for (unsigned i = 0; i < rack_size * 3; ++i) {
+    OSDMap::Incremental inc(m.get_epoch() + 1);
+    inc.fsid = fsid;
+    int osd = i % rack_size;
+    if (i < rack_size) {
+      inc.new_state[osd] = CEPH_OSD_UP;
+    } else if (i < rack_size * 2) {
+      inc.new_weight[osd] = CEPH_OSD_OUT;
+    } else {
+      addrs.v[0].nonce = num_osds + i;
+      inc.new_state[osd] = CEPH_OSD_UP;
+      inc.new_up_client[osd] = addrs;
+      inc.new_up_cluster[osd] = addrs;
+      inc.new_hb_back_up[osd] = addrs;
+      inc.new_hb_front_up[osd] = addrs;
+      inc.new_weight[osd] = CEPH_OSD_IN;
+    }
+    m.apply_incremental(inc);
+    save();
+  }
+}
+
+int load_history(const vector<const char*>& files,
+		 map<epoch_t, bufferlist>* bls)
+{
+  epoch_t last = 0;
+  for (auto f : files) {
+    bufferlist bl;
+    string err;
+    int r = bl.read_file(f, &err);
+    if (r < 0) {
+      cerr << "error reading " << f << ": " << err << std::endl;
+      return r;
+    }
+    OSDMap m;
+    m.decode(bl);
+    if (m.get_epoch() <= last) {
+      // osdmaptool doesn't bump the epoch for every change
+      m.set_epoch(last + 1);
+      bl.clear();
+      m.encode(bl, CEPH_FEATURES_SUPPORTED_DEFAULT | CEPH_FEATURE_RESERVED);
+    }
+    last = m.get_epoch();
+    (*bls)[last] = bl;
+  }
+  return 0;
+}
+
+void run(const char* mode, MapCacheOSD& osd,
+	 const map<epoch_t, bufferlist>& bls,
+	 unsigned threads, unsigned pgs_per_thread, uint64_t pin_max)
+{
+  auto& conf = g_ceph_context->_conf;
+  conf.set_val("osd_peering_map_pin_max",
+	       string(mode) == "pinned" ? std::to_string(pin_max) : "0");
+  conf.apply_changes(nullptr);
+  OSDService& service = osd.get_service();
+  const epoch_t first = bls.begin()->first;
+  const epoch_t last = bls.rbegin()->first;
+  osd.drop_maps(last);
+  // what handle_osd_map does once the maps are stored
+  service.pin_peering_maps(first, last);
+  auto loads = [&osd] {
+    return osd.get_counter(l_osd_map_bl_cache_hit) +
+      osd.get_counter(l_osd_map_bl_cache_miss);
+  };
+  const uint64_t loads0 = loads();
+  const uint64_t waits0 = osd.get_counter(l_osd_map_cache_load_wait);
+
+  // PGs as of the first map, round robin over the shards
+  vector<vector<PGState>> shards(threads);
+  {
+    OSDMapRef m = service.get_map(first);
+    unsigned n = 0;
+    for (auto& [poolid, pool] : m->get_pools()) {
+      for (ps_t ps = 0; ps < pool.get_pg_num(); ++ps) {
+	if (n == threads * pgs_per_thread) {
+	  break;
+	}
+	auto& s = shards[n++ % threads];
+	s.emplace_back();
+	auto& pg = s.back();
+	pg.pgid = pg_t(ps, poolid);
+	pg.epoch = first;
+	pg.same_interval_since = first;
+	m->pg_to_up_acting_osds(pg.pgid, &pg.up, &pg.up_primary,
+				&pg.acting, &pg.acting_primary);
+      }
+    }
+  }
+
+  std::atomic<uint64_t> intervals{0};
+  vector<std::atomic<epoch_t>> shard_min(threads);
+  for (auto& e : shard_min) {
+    e = first;
+  }
+  auto t0 = ceph::mono_clock::now();
+  vector<std::thread> workers;
+  for (unsigned t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      AnyShardPredicate recoverable;
+      for (auto& pg : shards[t]) {
+	OSDMapRef lastmap = service.get_map(pg.epoch);
+	for (epoch_t e = pg.epoch + 1; e <= last; ++e) {
+	  OSDMapRef osdmap = service.get_map(e);
+	  vector<int> up, acting;
+	  int up_primary, acting_primary;
+	  osdmap->pg_to_up_acting_osds(pg.pgid, &up, &up_primary,
+				       &acting, &acting_primary);
+	  if (PastIntervals::check_new_interval(
+		pg.acting_primary, acting_primary, pg.acting, acting,
+		pg.up_primary, up_primary, pg.up, up,
+		pg.same_interval_since, first, osdmap, lastmap,
+		pg.pgid, recoverable, &pg.past_intervals)) {
+	    pg.same_interval_since = e;
+	    ++intervals;
+	  }
+	  pg.up.swap(up);
+	  pg.acting.swap(acting);
+	  pg.up_primary = up_primary;
+	  pg.acting_primary = acting_primary;
+	  pg.epoch = e;
+	  lastmap = osdmap;
+	}
+      }
+      // all of this shard's pgs are done
+      shard_min[t] = last;
+      epoch_t osd_min = last;
+      for (auto& e : shard_min) {
+	osd_min = std::min<epoch_t>(osd_min, e);
+      }
+      service.pin_peering_maps(osd_min, last);
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  auto elapsed = ceph::mono_clock::now() - t0;
+
+  unsigned pgs = 0;
+  for (auto& s : shards) {
+    pgs += s.size();
+  }
+  cout << mode << ": " << pgs << " pgs over " << threads << " shards, epochs "
+       << first << ".." << last << ", "
+       << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+       << " ms, " << loads() - loads0 << " map loads, "
+       << osd.get_counter(l_osd_map_cache_load_wait) - waits0
+       << " load waits, "
+       << intervals << " new intervals" << std::endl;
+}
+
+void usage(const char* name)
+{
+  cout << "usage: " << name << " [options] [osdmap file ...]\n"
+       << "  --threads <n>       shards catching up in parallel (default 8)\n"
+       << "  --pgs <n>           pgs per shard (default 128)\n"
+       << "  --osds <n>          osds in the built-in history (default 120)\n"
+       << "  --rack-size <n>     osds failing in the built-in history (default 20)\n"
+       << "  --mode <mode>       unpinned or pinned (default: both)\n"
+       << "  --data-dir <dir>    memstore of the osd (default peering_storm.<pid>)\n"
+       << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, const char **argv)
+{
+  map<string,string> defaults = {
+    // the built-in map is flat
+    { "osd_crush_chooseleaf_type", "0" },
+  };
+  auto args = argv_to_vec(argc, argv);
+  auto cct = global_init(&defaults, args, CEPH_ENTITY_TYPE_OSD,
+			 CODE_ENVIRONMENT_UTILITY,
+			 CINIT_FLAG_NO_DEFAULT_CONFIG_FILE);
+  common_init_finish(g_ceph_context);
+
+  int threads = 8, pgs = 128, osds = 120, rack_size = 20;
+  string mode;
+  string data_dir = "peering_storm." + std::to_string(getpid());
+  vector<const char*> files;
+  std::ostringstream err;
+  for (auto i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+    } else if (ceph_argparse_witharg(args, i, &threads, err, "--threads", (char*)NULL)) {
+    } else if (ceph_argparse_witharg(args, i, &pgs, err, "--pgs", (char*)NULL)) {
+    } else if (ceph_argparse_witharg(args, i, &osds, err, "--osds", (char*)NULL)) {
+    } else if (ceph_argparse_witharg(args, i, &rack_size, err, "--rack-size", (char*)NULL)) {
+    } else if (ceph_argparse_witharg(args, i, &mode, "--mode", (char*)NULL)) {
+    } else if (ceph_argparse_witharg(args, i, &data_dir, "--data-dir", (char*)NULL)) {
+    } else {
+      files.push_back(*i);
+      i = args.erase(i);
+    }
+  }
+  if (!err.str().empty()) {
+    cerr << err.str() << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (threads <= 0 || pgs <= 0 || osds <= 0 ||
+      rack_size <= 0 || rack_size > osds) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  map<epoch_t, bufferlist> bls;
+  if (files.empty()) {
+    build_history(osds, rack_size, &bls);
+  } else if (load_history(files, &bls) < 0) {
+    return EXIT_FAILURE;
+  }
+  if (bls.size() < 2) {
+    cerr << "need at least two maps" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  ceph::async::io_context_pool icp(1);
+  MonClient mc(g_ceph_context, icp);
+  std::unique_ptr<Messenger> ms(
+    Messenger::create(g_ceph_context,
+		      g_conf().get_val<std::string>("ms_type"),
+		      entity_name_t::OSD(0), "peering_storm", getpid()));
+  auto osd = std::make_unique<MapCacheOSD>(g_ceph_context, data_dir,
+					   ms.get(), &mc, icp);
+  int r = osd->mount();
+  if (r < 0) {
+    cerr << "unable to set up a memstore in " << data_dir << ": "
+	 << cpp_strerror(r) << std::endl;
+    return EXIT_FAILURE;
+  }
+  for (auto& [e, bl] : bls) {
+    r = osd->write_map(e, bl);
+    ceph_assert(r == 0);
+  }
+
+  const uint64_t pin_max =
+    g_conf().get_val<uint64_t>("osd_peering_map_pin_max");
+  for (auto m : {"unpinned", "pinned"}) {
+    if (mode.empty() || mode == m) {
+      run(m, *osd, bls, threads, pgs, pin_max);
+    }
+  }
+  osd->drop_maps(bls.rbegin()->first);
+  osd->umount();
+  osd.reset();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#pragma once
+
+#include <sys/stat.h>
+#include <iostream>
+#include <string>
+
+#include "common/async/context_pool.h"
+#include "mon/MonClient.h"
+#include "msg/Messenger.h"
+#include "os/ObjectStore.h"
+#include "osd/OSD.h"
+
+/**
+ * An OSD which is never booted, on a memstore of its own, to drive the
+ * map cache of its OSDService the way the shard threads do: full maps
+ * are written to the meta collection as handle_osd_map does, and read
+ * back with try_get_map.
+ */
+class MapCacheOSD : public OSD {
+  const std::string data_dir;
+
+public:
+  MapCacheOSD(CephContext *cct,
+	      const std::string &data_dir,
+	      Messenger *ms,
+	      MonClient *mc,
+	      ceph::async::io_context_pool& icp)
+    : OSD(cct, ObjectStore::create(cct, "memstore", data_dir),
+	  0, ms, ms, ms, ms, ms, ms, ms, mc, "", "", icp),
+      data_dir(data_dir)
+  {}
+
+  int mount() {
+    if (::mkdir(data_dir.c_str(), 0777) < 0) {
+      return -errno;
+    }
+    int r = store->mkfs();
+    if (r < 0) {
+      return r;
+    }
+    r = store->mount();
+    if (r < 0) {
+      return r;
+    }
+    auto ch = store->create_new_collection(coll_t::meta());
+    ObjectStore::Transaction t;
+    t.create_collection(coll_t::meta(), 0);
+    r = store->queue_transaction(ch, std::move(t));
+    if (r < 0) {
+      return r;
+    }
+    service.meta_ch = ch;
+    return 0;
+  }
+
+  void umount() {
+    service.meta_ch.reset();
+    store->umount();
+    std::string cmd = "rm -r " + data_dir;
+    if (::system(cmd.c_str()) != 0) {
+      std::cerr << "failed to remove " << data_dir << std::endl;
+    }
+  }
+
+  int write_map(epoch_t e, ceph::buffer::list bl) {
+    ObjectStore::Transaction t;
+    t.write(coll_t::meta(), OSD::get_osdmap_pobject_name(e), 0,
+	    bl.length(), bl);
+    return store->queue_transaction(service.meta_ch, std::move(t));
+  }
+
+  /// forget every decoded and encoded map up to epoch last
+  void drop_maps(epoch_t last) {
+    service.pin_peering_maps(0, 0);
+    for (epoch_t e = 0; e <= last; ++e) {
+      service.map_cache.clear(e);
+      service.map_bl_cache.clear(e);
+    }
+  }
+
+  OSDService& get_service() {
+    return service;
+  }
+
+  uint64_t get_counter(int idx) {
+    return logger->get(idx);
+  }
+};
@@ -0,0 +1,125 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * PG log write amplification benchmark.
+ *
+ * Appends client log entries to a PGLog the way a PG does, trimming it
+ * in batches of osd_pg_log_trim_min, and reports the size of the pgmeta
+ * updates per op and the omap keys left on disk.
+ *
+ * Runs once per layout: "per-key" (one key per dup, trimmed keys removed
+ * with every trim) and "block" (the defaults: dups packed into blocks,
+ * trimmed keys removed in deferred range deletes).
+ */
+#include <chrono>
+#include <iostream>
+#include <gtest/gtest.h>
+
+#include "common/ceph_time.h"
+#include "global/global_context.h"
+#include "include/stringify.h"
+#include "os/ObjectStore.h"
+#include "osd/PGLog.h"
+#include "../objectstore/store_test_fixture.h"
+
+using namespace std;
+
+class PGLogBench : public StoreTestFixture,
+		   public ::testing::WithParamInterface<const char*> {
+public:
+  static constexpr unsigned ops = 50000;
+  static constexpr unsigned log_entries = 500;
+  static constexpr unsigned trim_min = 100;
+
+  coll_t cid;
+  ghobject_t log_oid;
+
+  PGLogBench() : StoreTestFixture("memstore") {}
+
+  void SetUp() override {
+    StoreTestFixture::SetUp();
+    string mode(GetParam());
+    if (mode == "per-key") {
+      SetVal(g_conf(), "osd_pg_log_trim_defer_entries", "0");
+      SetVal(g_conf(), "osd_pg_log_dups_per_key", "0");
+    } else {
+      SetVal(g_conf(), "osd_pg_log_trim_defer_entries", "1000");
+      SetVal(g_conf(), "osd_pg_log_dups_per_key", "128");
+    }
+    cid = coll_t(spg_t(pg_t(1, 1)));
+    hobject_t hoid;
+    hoid.pool = 1;
+    hoid.oid = "pgmeta";
+    log_oid = ghobject_t(hoid);
+    ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    store->queue_transaction(ch, std::move(t));
+  }
+};
+
+TEST_P(PGLogBench, omap_bytes_per_op) {
+  PGLog pglog(g_ceph_context);
+  pg_info_t info;
+  info.pgid = spg_t(pg_t(1, 1));
+  uint64_t txn_bytes = 0, key_bytes = 0, keys = 0;
+  ceph::timespan elapsed = ceph::timespan::zero();
+
+  for (unsigned i = 1; i <= ops; ++i) {
+    pg_log_entry_t e;
+    e.mark_unrollbackable();
+    e.op = pg_log_entry_t::MODIFY;
+    e.soid.pool = 1;
+    e.soid.oid = "obj_" + stringify(i % 1000);
+    e.soid.set_hash(i % 1000);
+    e.version = eversion_t(1, i);
+    e.prior_version = eversion_t(1, i > 1000 ? i - 1000 : 0);
+    e.reqid = osd_reqid_t(entity_name_t::CLIENT(4100), 0, i);
+    info.last_update = info.last_complete = e.version;
+
+    auto t0 = ceph::mono_clock::now();
+    pglog.add(e);
+    pglog.skip_rollforward();
+    if (i > log_entries + trim_min) {
+      pglog.trim(eversion_t(1, i - log_entries), info);
+    }
+    ObjectStore::Transaction t;
+    map<string, bufferlist> km;
+    pglog.write_log_and_missing(t, &km, cid, log_oid, false);
+    if (!km.empty()) {
+      t.omap_setkeys(cid, log_oid, km);
+    }
+    elapsed += ceph::mono_clock::now() - t0;
+    for (auto& [k, v] : km) {
+      key_bytes += k.size() + v.length();
+    }
+    keys += km.size();
+    txn_bytes += t.get_encoded_bytes();
+    ASSERT_EQ(0, store->queue_transaction(ch, std::move(t)));
+  }
+
+  unsigned log_keys = 0, dup_keys = 0;
+  auto p = store->get_omap_iterator(ch, log_oid);
+  for (p->seek_to_first(); p->valid(); p->next()) {
+    if (p->key().substr(0, 3) == "dup") {
+      ++dup_keys;
+    } else {
+      ++log_keys;
+    }
+  }
+  cout << GetParam() << ": " << ops << " ops, "
+       << (double)txn_bytes / ops << " txn bytes/op, "
+       << (double)key_bytes / ops << " omap bytes set/op, "
+       << (double)keys / ops << " keys set/op, "
+       << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / ops
+       << " ns/op" << std::endl;
+  cout << "  on disk: " << log_keys << " log keys, " << dup_keys
+       << " dup keys for " << pglog.get_log().dups.size() << " dups"
+       << std::endl;
+  pglog.clear();
+}
+
+INSTANTIATE_TEST_SUITE_P(
+  PGLog,
+  PGLogBench,
+  ::testing::Values("per-key", "block"));
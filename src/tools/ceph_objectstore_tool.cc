@@ -682,6 +682,8 @@ int do_trim_pg_log(ObjectStore *store, const coll_t &coll,
 	continue;
       if (p->key().substr(0, 4) == string("dup_"))
 	continue;
+      if (p->key().substr(0, 5) == string("dupb_"))
+	continue;
 
       bufferlist bl = p->value();
       auto bp = bl.cbegin();
@@ -760,7 +762,10 @@ int do_trim_pg_log_dups(ObjectStore *store, const coll_t &coll,
 	 << " the trimming will never stop!" << std::endl;
   }
 
-  set<string> keys_to_keep;
+  // dup keys to keep, oldest first, with the number of dups each holds:
+  // a block of dups (osd_pg_log_dups_per_key) holds several
+  map<string, uint32_t> keys_to_keep;
+  size_t dups_kept = 0;
   size_t num_removed = 0;
   do {
     set<string> keys_to_trim;
@@ -781,12 +786,20 @@ int do_trim_pg_log_dups(ObjectStore *store, const coll_t &coll,
 	continue;
       if (p->key().substr(0, 7) == string("missing"))
 	continue;
-      if (p->key().substr(0, 4) != string("dup_"))
+      uint32_t n = 1;
+      if (p->key().substr(0, 5) == string("dupb_")) {
+	auto bp = p->value().cbegin();
+	decode(n, bp);
+      } else if (p->key().substr(0, 4) != string("dup_")) {
 	continue;
-      keys_to_keep.insert(p->key());
-      if (keys_to_keep.size() > max_dup_entries) {
+      }
+      if (keys_to_keep.emplace(p->key(), n).second) {
+	dups_kept += n;
+      }
+      while (dups_kept - keys_to_keep.begin()->second >= max_dup_entries) {
 	auto oldest_to_keep = keys_to_keep.begin();
-      	keys_to_trim.emplace(*oldest_to_keep);
+	dups_kept -= oldest_to_keep->second;
+	keys_to_trim.emplace(oldest_to_keep->first);
 	keys_to_keep.erase(oldest_to_keep);
       }
       if (keys_to_trim.size() >= max_chunk_size) {
@@ -805,6 +818,42 @@ int do_trim_pg_log_dups(ObjectStore *store, const coll_t &coll,
     }
   } while (num_removed == max_chunk_size);
 
+  // the oldest block may still hold dups beyond max_dup_entries, keep
+  // its newest ones only; it is named after the newest, which stays
+  if (dups_kept > max_dup_entries &&
+      keys_to_keep.begin()->first.substr(0, 5) == string("dupb_")) {
+    const string &key = keys_to_keep.begin()->first;
+    set<string> keys = {key};
+    map<string, bufferlist> values;
+    r = store->omap_get_values(ch, oid, keys, &values);
+    ceph_assert(r == 0);
+    auto bp = values[key].cbegin();
+    uint32_t n;
+    decode(n, bp);
+    uint32_t excess = dups_kept - max_dup_entries;
+    ceph_assert(excess < n);
+    bufferlist entries;
+    for (uint32_t i = 0; i < n; ++i) {
+      pg_log_dup_t dup;
+      decode(dup, bp);
+      if (i >= excess) {
+	encode(dup, entries);
+      }
+    }
+    cout << "Trimming " << excess << " dups of " << key << std::endl;
+    if (!dry_run) {
+      bufferlist bl;
+      encode(n - excess, bl);
+      bl.claim_append(entries);
+      map<string, bufferlist> to_set;
+      to_set[key] = std::move(bl);
+      ObjectStore::Transaction t;
+      t.omap_setkeys(coll, oid, to_set);
+      store->queue_transaction(ch, std::move(t));
+      ch->flush();
+    }
+  }
+
   // compact the db since we just removed a bunch of data
   cerr << "Finished trimming, now compacting..." << std::endl;
   if (!dry_run)